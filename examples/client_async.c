@@ -0,0 +1,89 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+/*
+ * Reads the server status from one or more servers with a single thread. Up to
+ * WINDOW requests are kept in flight per server.
+ *
+ * exampleClientAsync [requests per server] [endpointUrl]...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_client.h"
+#include "ua_nodeids.h"
+
+#include "networklayer_tcp_client.h"
+
+#define WINDOW 32
+
+static UA_UInt32 responses = 0;
+static UA_UInt32 failures = 0;
+
+static void readCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+                         UA_ReadResponse *response, const UA_DataType *responseType) {
+    if(response->responseHeader.serviceResult == UA_STATUSCODE_GOOD && response->resultsSize == 1)
+        responses++;
+    else
+        failures++;
+}
+
+int main(int argc, char **argv) {
+    UA_UInt32 requests = argc > 1 ? (UA_UInt32)atoi(argv[1]) : 10000;
+    int clientsSize = argc > 2 ? argc - 2 : 1;
+    UA_Client **clients = malloc(sizeof(UA_Client*) * clientsSize);
+    UA_UInt32 *sent = calloc(clientsSize, sizeof(UA_UInt32));
+    for(int i = 0; i < clientsSize; i++) {
+        const char *endpointUrl = argc > 2 ? argv[i + 2] : "opc.tcp://localhost:16664";
+        clients[i] = UA_Client_new(UA_ClientConfig_standard, ClientNetworkLayerTCP_new(UA_ConnectionConfig_standard));
+        UA_StatusCode retval = UA_Client_connect(clients[i], endpointUrl);
+        if(retval != UA_STATUSCODE_GOOD) {
+            printf("Could not connect to %s: 0x%08x\n", endpointUrl, retval);
+            return EXIT_FAILURE;
+        }
+    }
+
+    UA_ReadValueId item;
+    UA_ReadValueId_init(&item);
+    item.nodeId = UA_NODEID_STATIC(0, UA_NS0ID_SERVER_SERVERSTATUS);
+    item.attributeId = 13; // value
+    UA_ReadRequest request;
+    UA_ReadRequest_init(&request);
+    request.nodesToRead = &item;
+    request.nodesToReadSize = 1;
+
+    UA_UInt32 total = requests * clientsSize;
+    UA_DateTime start = UA_DateTime_now();
+    while(responses + failures < total) {
+        UA_UInt32 done = responses + failures;
+        for(int i = 0; i < clientsSize; i++) {
+            // keep the window full
+            while(sent[i] < requests && UA_Client_getRequestsInFlight(clients[i]) < WINDOW) {
+                if(UA_Client_read_async(clients[i], &request, (UA_ClientAsyncServiceCallback)readCallback,
+                                        NULL, NULL) != UA_STATUSCODE_GOOD)
+                    break;
+                sent[i]++;
+            }
+            if(UA_Client_processResponses(clients[i], clientsSize > 1 ? 0 : 100000) != UA_STATUSCODE_GOOD &&
+               sent[i] < requests) {
+                failures += requests - sent[i]; // disconnected
+                sent[i] = requests;
+            }
+        }
+        if(done == responses + failures && clientsSize > 1) {
+            // nothing arrived. wait on the first client for a moment.
+            UA_Client_processResponses(clients[0], 1000);
+        }
+    }
+    UA_Double duration = (UA_Double)(UA_DateTime_now() - start) / 1e7;
+    printf("%u responses, %u failures in %f s: %f requests/s\n", responses, failures, duration,
+           responses / duration);
+
+    for(int i = 0; i < clientsSize; i++)
+        UA_Client_delete(clients[i]);
+    free(clients);
+    free(sent);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,422 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+/*
+ * Generates load on a server and measures the throughput and the latency of
+ * the responses. A single thread drives all sessions.
+ *
+ * benchmarkClient [options] [endpointUrl]
+ *   -c <n>        concurrent sessions (default 4)
+ *   -d <s>        measured duration in seconds (default 5)
+ *   -w <s>        warmup in seconds that is not measured (default 1)
+ *   -mix <r:w:b>  weights of read, write and browse requests (default 1:0:0)
+ *   -batch <n>    nodes per request (default 1)
+ *   -window <n>   requests in flight per session (default 8)
+ *   -rate <n>     requests per second over all sessions. 0 for no limit (default 0)
+ *   -pid <pid>    pid of the server to report its cpu usage
+ *
+ * Reads and writes go to the variable "the answer" of the example server. If
+ * it is not found, the server status is read and written instead. Browse
+ * requests browse the objects folder.
+ *
+ * With a rate limit, the latency is measured from the time the request was due
+ * to be sent. So a server that falls behind shows up in the latency and not
+ * only in the throughput.
+ */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L // clock_gettime, nanosleep
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "ua_client.h"
+#include "ua_nodeids.h"
+
+#include "networklayer_tcp_client.h"
+
+#define MAXRESPONSESIZE (16 * 1024 * 1024)
+
+enum { SERVICE_READ, SERVICE_WRITE, SERVICE_BROWSE, SERVICES };
+static const char *serviceNames[SERVICES] = {"read", "write", "browse"};
+
+typedef struct {
+    UA_UInt32 count;
+    UA_UInt32 size;
+    UA_DateTime *latencies;
+} LatencySamples;
+
+typedef struct Session Session;
+
+/* A request in flight */
+typedef struct {
+    Session *session;
+    UA_Int32 service;
+    UA_DateTime start;
+} Slot;
+
+struct Session {
+    UA_Client *client;
+    Slot *slots;
+    Slot **freeSlots;
+    UA_UInt32 freeSlotsSize;
+    UA_UInt32 sent;
+    UA_Boolean connected;
+};
+
+static UA_Boolean measuring = UA_FALSE;
+static LatencySamples samples[SERVICES];
+static UA_UInt32 failures[SERVICES];
+
+static void addSample(LatencySamples *s, UA_DateTime latency) {
+    if(s->count == s->size) {
+        s->size = s->size > 0 ? s->size * 2 : 65536;
+        s->latencies = realloc(s->latencies, s->size * sizeof(UA_DateTime));
+    }
+    s->latencies[s->count++] = latency;
+}
+
+static void responseCallback(UA_Client *client, Slot *slot, UA_UInt32 requestId,
+                             void *response, const UA_DataType *responseType) {
+    if(measuring) {
+        if(((UA_ResponseHeader*)response)->serviceResult == UA_STATUSCODE_GOOD)
+            addSample(&samples[slot->service], UA_DateTime_now() - slot->start);
+        else
+            failures[slot->service]++;
+    }
+    Session *session = slot->session;
+    session->freeSlots[session->freeSlotsSize++] = slot;
+}
+
+static int compareDateTime(const void *a, const void *b) {
+    UA_DateTime x = *(const UA_DateTime*)a;
+    UA_DateTime y = *(const UA_DateTime*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* in usec */
+static UA_Double percentile(const LatencySamples *s, UA_Double p) {
+    if(s->count == 0)
+        return 0;
+    UA_UInt32 i = (UA_UInt32)(p * (s->count - 1) + 0.5);
+    return s->latencies[i] / 10.0;
+}
+
+/* in seconds. Returns a negative value if the process is not found. */
+static UA_Double processCpuTime(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if(!f)
+        return -1;
+    unsigned long utime, stime;
+    // skip pid, comm (without spaces for our server), state and ten more fields
+    int n = fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    fclose(f);
+    if(n != 2)
+        return -1;
+    return (UA_Double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static UA_Double ownCpuTime(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* Looks up "the answer" in the objects folder */
+static UA_NodeId findTarget(UA_Client *client) {
+    UA_BrowseDescription bd;
+    UA_BrowseDescription_init(&bd);
+    bd.nodeId = UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER);
+    bd.browseDirection = UA_BROWSEDIRECTION_FORWARD;
+    bd.referenceTypeId = UA_NODEID_STATIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+    bd.includeSubtypes = UA_TRUE;
+    bd.resultMask = UA_BROWSERESULTMASK_BROWSENAME;
+    UA_BrowseRequest request;
+    UA_BrowseRequest_init(&request);
+    request.nodesToBrowse = &bd;
+    request.nodesToBrowseSize = 1;
+    UA_BrowseResponse response = UA_Client_browse(client, &request);
+
+    UA_NodeId target = UA_NODEID_STATIC(0, UA_NS0ID_SERVER_SERVERSTATUS);
+    if(response.responseHeader.serviceResult == UA_STATUSCODE_GOOD && response.resultsSize == 1) {
+        UA_BrowseResult *br = &response.results[0];
+        for(UA_Int32 i = 0; i < br->referencesSize; i++) {
+            UA_String *name = &br->references[i].browseName.name;
+            if(name->length == 10 && memcmp(name->data, "the answer", 10) == 0) {
+                UA_NodeId_copy(&br->references[i].nodeId.nodeId, &target);
+                break;
+            }
+        }
+    }
+    UA_BrowseResponse_deleteMembers(&response);
+    return target;
+}
+
+static void usage(void) {
+    printf("benchmarkClient [-c sessions] [-d seconds] [-w seconds] [-mix r:w:b] [-batch n] "
+           "[-window n] [-rate n] [-pid pid] [endpointUrl]\n");
+}
+
+int main(int argc, char **argv) {
+    UA_UInt32 sessionsSize = 4;
+    UA_Double duration = 5;
+    UA_Double warmup = 1;
+    UA_UInt32 weights[SERVICES] = {1, 0, 0};
+    UA_Int32 batch = 1;
+    UA_UInt32 window = 8;
+    UA_Double rate = 0;
+    int pid = 0;
+    const char *endpointUrl = "opc.tcp://localhost:16664";
+
+    for(int i = 1; i < argc; i++) {
+        if(argv[i][0] != '-') {
+            endpointUrl = argv[i];
+            continue;
+        }
+        if(i + 1 >= argc) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        const char *val = argv[++i];
+        if(strcmp(argv[i-1], "-c") == 0)
+            sessionsSize = (UA_UInt32)atoi(val);
+        else if(strcmp(argv[i-1], "-d") == 0)
+            duration = atof(val);
+        else if(strcmp(argv[i-1], "-w") == 0)
+            warmup = atof(val);
+        else if(strcmp(argv[i-1], "-mix") == 0) {
+            if(sscanf(val, "%u:%u:%u", &weights[0], &weights[1], &weights[2]) != 3) {
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if(strcmp(argv[i-1], "-batch") == 0)
+            batch = atoi(val);
+        else if(strcmp(argv[i-1], "-window") == 0)
+            window = (UA_UInt32)atoi(val);
+        else if(strcmp(argv[i-1], "-rate") == 0)
+            rate = atof(val);
+        else if(strcmp(argv[i-1], "-pid") == 0)
+            pid = atoi(val);
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    UA_UInt32 weightsSum = weights[0] + weights[1] + weights[2];
+    if(sessionsSize == 0 || batch <= 0 || window == 0 || weightsSum == 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    /* Open the sessions */
+    UA_ClientConfig config = UA_ClientConfig_standard;
+    config.maxRequestsInFlight = window;
+    // the responses to batched browse requests outgrow the standard 64 KiB.
+    // the networklayer still receives in pieces of the standard size.
+    config.localConnectionConfig.recvBufferSize = MAXRESPONSESIZE;
+    config.localConnectionConfig.maxMessageSize = MAXRESPONSESIZE;
+    Session *sessions = calloc(sessionsSize, sizeof(Session));
+    for(UA_UInt32 i = 0; i < sessionsSize; i++) {
+        Session *s = &sessions[i];
+        s->client = UA_Client_new(config, ClientNetworkLayerTCP_new(UA_ConnectionConfig_standard));
+        UA_StatusCode retval = UA_Client_connect(s->client, endpointUrl);
+        if(retval != UA_STATUSCODE_GOOD) {
+            printf("Could not connect to %s: 0x%08x\n", endpointUrl, retval);
+            return EXIT_FAILURE;
+        }
+        s->connected = UA_TRUE;
+        s->slots = malloc(window * sizeof(Slot));
+        s->freeSlots = malloc(window * sizeof(Slot*));
+        for(UA_UInt32 j = 0; j < window; j++) {
+            s->slots[j].session = s;
+            s->freeSlots[j] = &s->slots[j];
+        }
+        s->freeSlotsSize = window;
+    }
+
+    /* Prepare one request per service. They are reused for every call. */
+    UA_NodeId target = findTarget(sessions[0].client);
+    UA_Int32 answer = 42;
+
+    UA_ReadValueId *readItems = malloc(batch * sizeof(UA_ReadValueId));
+    UA_WriteValue *writeItems = malloc(batch * sizeof(UA_WriteValue));
+    UA_BrowseDescription *browseItems = malloc(batch * sizeof(UA_BrowseDescription));
+    for(UA_Int32 i = 0; i < batch; i++) {
+        UA_ReadValueId_init(&readItems[i]);
+        readItems[i].nodeId = target;
+        readItems[i].attributeId = 13; // value
+
+        UA_WriteValue_init(&writeItems[i]);
+        writeItems[i].nodeId = target;
+        writeItems[i].attributeId = 13;
+        writeItems[i].value.hasVariant = UA_TRUE;
+        UA_Variant_setValue(&writeItems[i].value.value, &answer, &UA_TYPES[UA_TYPES_INT32]);
+        writeItems[i].value.value.storageType = UA_VARIANT_DATA_NODELETE;
+
+        UA_BrowseDescription_init(&browseItems[i]);
+        browseItems[i].nodeId = UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER);
+        browseItems[i].browseDirection = UA_BROWSEDIRECTION_FORWARD;
+        browseItems[i].referenceTypeId = UA_NODEID_STATIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+        browseItems[i].includeSubtypes = UA_TRUE;
+        browseItems[i].resultMask = UA_BROWSERESULTMASK_ALL;
+    }
+
+    UA_ReadRequest readRequest;
+    UA_ReadRequest_init(&readRequest);
+    readRequest.nodesToRead = readItems;
+    readRequest.nodesToReadSize = batch;
+    UA_WriteRequest writeRequest;
+    UA_WriteRequest_init(&writeRequest);
+    writeRequest.nodesToWrite = writeItems;
+    writeRequest.nodesToWriteSize = batch;
+    UA_BrowseRequest browseRequest;
+    UA_BrowseRequest_init(&browseRequest);
+    browseRequest.nodesToBrowse = browseItems;
+    browseRequest.nodesToBrowseSize = batch;
+
+    const void *requests[SERVICES] = {&readRequest, &writeRequest, &browseRequest};
+    const UA_DataType *requestTypes[SERVICES] =
+        {&UA_TYPES[UA_TYPES_READREQUEST], &UA_TYPES[UA_TYPES_WRITEREQUEST], &UA_TYPES[UA_TYPES_BROWSEREQUEST]};
+    const UA_DataType *responseTypes[SERVICES] =
+        {&UA_TYPES[UA_TYPES_READRESPONSE], &UA_TYPES[UA_TYPES_WRITERESPONSE], &UA_TYPES[UA_TYPES_BROWSERESPONSE]};
+
+    /* With a rate limit, every session sends at a fixed interval */
+    UA_DateTime interval = rate > 0 ? (UA_DateTime)(1e7 * sessionsSize / rate) : 0;
+    UA_DateTime begin = UA_DateTime_now();
+    UA_DateTime measureStart = begin + (UA_DateTime)(warmup * 1e7);
+    UA_DateTime end = measureStart + (UA_DateTime)(duration * 1e7);
+    UA_Double serverCpuStart = 0, ownCpuStart = 0;
+    UA_UInt32 waitSession = 0;
+
+    /* Send until the end. Then wait for the responses in flight. */
+    while(1) {
+        UA_DateTime now = UA_DateTime_now();
+        UA_Boolean sending = now < end;
+        if(!measuring && now >= measureStart && sending) {
+            measuring = UA_TRUE;
+            serverCpuStart = pid > 0 ? processCpuTime(pid) : 0;
+            ownCpuStart = ownCpuTime();
+        } else if(measuring && !sending)
+            measuring = UA_FALSE;
+
+        UA_UInt32 inFlight = 0, active = 0;
+        UA_DateTime nextDue = end;
+        for(UA_UInt32 i = 0; i < sessionsSize; i++) {
+            Session *s = &sessions[i];
+            if(!s->connected)
+                continue;
+            while(sending && s->freeSlotsSize > 0) {
+                UA_DateTime due = now;
+                if(interval > 0) {
+                    // the sessions are staggered over the interval
+                    due = begin + (UA_DateTime)s->sent * interval + interval * i / sessionsSize;
+                    if(due > now) {
+                        if(due < nextDue)
+                            nextDue = due;
+                        break;
+                    }
+                }
+                // weighted round-robin over the services
+                UA_UInt32 pick = s->sent % weightsSum;
+                UA_Int32 service = 0;
+                while(pick >= weights[service])
+                    pick -= weights[service++];
+                Slot *slot = s->freeSlots[--s->freeSlotsSize];
+                slot->service = service;
+                slot->start = due;
+                if(UA_Client_sendAsyncRequest(s->client, requests[service], requestTypes[service],
+                                              (UA_ClientAsyncServiceCallback)responseCallback,
+                                              responseTypes[service], slot, NULL) != UA_STATUSCODE_GOOD) {
+                    s->freeSlots[s->freeSlotsSize++] = slot;
+                    break;
+                }
+                s->sent++;
+            }
+            // the requests in flight fail when the connection is lost
+            UA_StatusCode retval = UA_Client_processResponses(s->client, 0);
+            if(retval != UA_STATUSCODE_GOOD) {
+                printf("Session %u lost the connection: 0x%08x\n", i, retval);
+                s->connected = UA_FALSE;
+                continue;
+            }
+            inFlight += UA_Client_getRequestsInFlight(s->client);
+            active++;
+        }
+        if(active == 0 || (!sending && inFlight == 0))
+            break;
+
+        /* Wait for a response on one of the sessions (in turn) or until the
+           next request is due */
+        UA_UInt32 wait = 1000;
+        now = UA_DateTime_now();
+        if(sending && nextDue < end)
+            wait = nextDue > now ? (UA_UInt32)((nextDue - now) / 10) : 0;
+        if(wait == 0)
+            continue;
+        if(inFlight == 0) {
+            struct timespec ts = {.tv_sec = wait / 1000000, .tv_nsec = (wait % 1000000) * 1000};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        for(UA_UInt32 i = 0; i < sessionsSize; i++) {
+            waitSession = (waitSession + 1) % sessionsSize;
+            Session *s = &sessions[waitSession];
+            if(s->connected && UA_Client_getRequestsInFlight(s->client) > 0) {
+                UA_Client_processResponses(s->client, wait);
+                break;
+            }
+        }
+    }
+    UA_Double measured = (UA_Double)(end - measureStart) / 1e7;
+    UA_Double ownCpu = ownCpuTime() - ownCpuStart;
+    UA_Double serverCpu = pid > 0 ? processCpuTime(pid) - serverCpuStart : -1;
+
+    /* Report */
+    printf("%u sessions, window %u, batch %d, %.1f s measured\n", sessionsSize, window, batch, measured);
+    printf("%-8s %10s %10s %12s %10s %10s %10s %10s\n", "service", "requests", "failures", "requests/s",
+           "nodes/s", "p50 [us]", "p99 [us]", "p999 [us]");
+    UA_UInt32 totalRequests = 0;
+    for(UA_Int32 i = 0; i < SERVICES; i++) {
+        LatencySamples *s = &samples[i];
+        if(s->count == 0 && failures[i] == 0)
+            continue;
+        qsort(s->latencies, s->count, sizeof(UA_DateTime), compareDateTime);
+        printf("%-8s %10u %10u %12.0f %10.0f %10.1f %10.1f %10.1f\n", serviceNames[i], s->count,
+               failures[i], s->count / measured, s->count * batch / measured, percentile(s, 0.5),
+               percentile(s, 0.99), percentile(s, 0.999));
+        totalRequests += s->count;
+    }
+    printf("total: %.0f requests/s\n", totalRequests / measured);
+    printf("client cpu: %.1f%%\n", 100 * ownCpu / measured);
+    if(pid > 0) {
+        if(serverCpu >= 0)
+            printf("server cpu: %.1f%%, %.1f us per request\n", 100 * serverCpu / measured,
+                   totalRequests > 0 ? 1e6 * serverCpu / totalRequests : 0);
+        else
+            printf("server cpu: process %d not found\n", pid);
+    }
+
+    UA_UInt32 totalFailures = failures[0] + failures[1] + failures[2];
+    for(UA_UInt32 i = 0; i < sessionsSize; i++) {
+        UA_Client_delete(sessions[i].client);
+        free(sessions[i].slots);
+        free(sessions[i].freeSlots);
+    }
+    for(UA_Int32 i = 0; i < SERVICES; i++)
+        free(samples[i].latencies);
+    free(sessions);
+    free(readItems);
+    free(writeItems);
+    free(browseItems);
+    UA_NodeId_deleteMembers(&target);
+    return totalFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -7,11 +7,43 @@
 #include <arpa/inet.h>	//inet_addr
 #include <unistd.h> // for close
 #include <stdlib.h> // pulls in declaration of malloc, free
+#include <sys/time.h> // timeval
 
 #include "ua_transport_generated.h"
 #include "ua_util.h"
 #include "ua_types_encoding_binary.h"
 
+#ifdef EXTENSION_UDP
+#define WINDOW 32 // requests in flight during the benchmark
+
+/* Sends the request count times with up to WINDOW requests in flight and
+   reports the datagrams per second. The example server runs a single thread,
+   so this is the throughput of one core. */
+static void benchmark(int sock, const UA_Byte *request, size_t requestLength, int count) {
+	UA_Byte reply[2000];
+	struct timeval timeout = {1, 0};
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	int sent = 0, received = 0, lost = 0;
+	UA_DateTime start = UA_DateTime_now();
+	while(received + lost < count) {
+		while(sent < count && sent - received - lost < WINDOW) {
+			if(send(sock, request, requestLength, 0) < 0) {
+				perror("send failed");
+				return;
+			}
+			sent++;
+		}
+		if(recv(sock, reply, sizeof(reply), 0) < 0)
+			lost = sent - received; // timeout. the outstanding requests are lost
+		else
+			received++;
+	}
+	double seconds = (UA_DateTime_now() - start) / 10000000.0;
+	printf("%i requests, %i responses, %i lost in %f s: %f datagrams/s\n",
+	       count, received, lost, seconds, received / seconds);
+}
+#endif
+
 
 int main(int argc , char *argv[])
 {
@@ -22,7 +54,7 @@ int main(int argc , char *argv[])
 	message.length = 1000;
 	UA_UInt32 messageEncodedLength = 0;
 	UA_Byte server_reply[2000];
-	unsigned int messagepos = 0;
+	size_t messagepos = 0;
 
 	//Create socket
 #ifdef EXTENSION_UDP
@@ -124,6 +156,12 @@ int main(int argc , char *argv[])
 			  printf("%c",server_reply[i]);
 	}
 	printf("\n");
+
+#ifdef EXTENSION_UDP
+	// statelessClient <count> benchmarks the server with count read requests
+	if(argc > 1)
+		benchmark(sock, message.data, messagepos, atoi(argv[1]));
+#endif
 	close(sock);
 	return 0;
 }
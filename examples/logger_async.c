@@ -0,0 +1,551 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#define _GNU_SOURCE // nanosleep
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logger_async.h"
+
+#define RINGSIZE 1024 // entries per thread. must be a power of two
+#define ARGSSIZE 232 // the copied arguments of a message
+#define CATEGORIES (UA_LOGGINGCATEGORY_SERVER + 1)
+#define IDLESLEEP 1000000 // ns the background thread sleeps when all rings are empty
+#define DATETIME_SEC 10000000 // UA_DateTime counts in 100ns
+
+enum { LEVEL_TRACE, LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARNING, LEVEL_ERROR, LEVEL_FATAL };
+static const char *levelNames[] = {"trace", "debug", "info", "warning", "error", "fatal"};
+static const char *categoryNames[CATEGORIES] = {"connection", "session", "subscription", "server"};
+
+typedef struct {
+    const char *msg; // the format string. not copied.
+    UA_DateTime time;
+    UA_Byte level;
+    UA_Byte category;
+    UA_UInt16 argsSize;
+    UA_Byte args[ARGSSIZE];
+} LogEntry;
+
+/** Single producer (the owning thread), single consumer (the background
+    thread). The counters only increase and wrap around. */
+typedef struct LogRing {
+    struct LogRing *next;
+    UA_UInt32 orphaned; // the owning thread has exited. the ring can be taken over.
+    UA_UInt32 dropped; // messages that did not fit
+    UA_UInt32 head; // written by the producer
+    UA_UInt32 tail __attribute__((aligned(64))); // written by the consumer
+    LogEntry entries[RINGSIZE] __attribute__((aligned(64)));
+} LogRing;
+
+static struct {
+    FILE *out;
+    UA_Boolean running;
+    pthread_t thread;
+    pthread_key_t ringKey; // to notice when a thread exits
+    LogRing *rings;
+    UA_UInt32 maxPerSecond;
+    struct {
+        UA_Int64 second;
+        UA_UInt32 count;
+        UA_UInt32 suppressed;
+    } limits[CATEGORIES];
+} asyncLogger;
+
+// the rings are freed when the logger stops. a ring of an earlier start is not used.
+static UA_UInt32 generation = 0;
+static __thread LogRing *localRing = NULL;
+static __thread UA_UInt32 localGeneration = 0;
+
+/*********************/
+/* Format Specifiers */
+/*********************/
+
+enum { LENGTH_NONE, LENGTH_HH, LENGTH_H, LENGTH_L, LENGTH_LL, LENGTH_J, LENGTH_Z, LENGTH_T, LENGTH_LD };
+
+typedef struct {
+    const char *flags;
+    size_t flagsLength;
+    UA_Boolean widthStar;
+    const char *width;
+    size_t widthLength;
+    UA_Boolean hasPrecision;
+    UA_Boolean precisionStar;
+    const char *precision;
+    size_t precisionLength;
+    int length;
+    char conversion;
+} FormatSpec;
+
+/** Parses the specifier after the '%'. Returns the position after it. */
+static const char * parseSpec(const char *p, FormatSpec *spec) {
+    memset(spec, 0, sizeof(FormatSpec));
+    spec->flags = p;
+    while(*p && strchr("-+ #0", *p))
+        p++;
+    spec->flagsLength = (size_t)(p - spec->flags);
+    if(*p == '*') {
+        spec->widthStar = UA_TRUE;
+        p++;
+    } else {
+        spec->width = p;
+        while(*p >= '0' && *p <= '9')
+            p++;
+        spec->widthLength = (size_t)(p - spec->width);
+    }
+    if(*p == '.') {
+        spec->hasPrecision = UA_TRUE;
+        p++;
+        if(*p == '*') {
+            spec->precisionStar = UA_TRUE;
+            p++;
+        } else {
+            spec->precision = p;
+            while(*p >= '0' && *p <= '9')
+                p++;
+            spec->precisionLength = (size_t)(p - spec->precision);
+        }
+    }
+    switch(*p) {
+    case 'h':
+        p++;
+        spec->length = LENGTH_H;
+        if(*p == 'h') {
+            p++;
+            spec->length = LENGTH_HH;
+        }
+        break;
+    case 'l':
+        p++;
+        spec->length = LENGTH_L;
+        if(*p == 'l') {
+            p++;
+            spec->length = LENGTH_LL;
+        }
+        break;
+    case 'j': p++; spec->length = LENGTH_J; break;
+    case 'z': p++; spec->length = LENGTH_Z; break;
+    case 't': p++; spec->length = LENGTH_T; break;
+    case 'L': p++; spec->length = LENGTH_LD; break;
+    default: break;
+    }
+    spec->conversion = *p;
+    if(*p)
+        p++;
+    return p;
+}
+
+/***********/
+/* Logging */
+/***********/
+
+typedef struct {
+    UA_Byte *data;
+    size_t size;
+    UA_Boolean full;
+} ArgsWriter;
+
+static void writeArg(ArgsWriter *w, const void *value, size_t size) {
+    if(w->full || w->size + size > ARGSSIZE) {
+        w->full = UA_TRUE;
+        return;
+    }
+    memcpy(&w->data[w->size], value, size);
+    w->size += size;
+}
+
+static void writeString(ArgsWriter *w, const char *str, UA_Boolean hasPrecision, int precision) {
+    if(!str)
+        str = "(null)";
+    size_t length = 0;
+    while((!hasPrecision || (int)length < precision) && str[length])
+        length++;
+    if(w->full || w->size + sizeof(UA_UInt16) > ARGSSIZE) {
+        w->full = UA_TRUE;
+        return;
+    }
+    if(length > ARGSSIZE - w->size - sizeof(UA_UInt16))
+        length = ARGSSIZE - w->size - sizeof(UA_UInt16); // truncate
+    UA_UInt16 l = (UA_UInt16)length;
+    writeArg(w, &l, sizeof(UA_UInt16));
+    writeArg(w, str, length);
+}
+
+/** Copies the arguments as the format string describes them. Integers are
+    widened to long long and floats to long double. */
+static void copyArgs(const char *msg, va_list args, ArgsWriter *w) {
+    for(const char *p = msg; *p;) {
+        if(*p++ != '%')
+            continue;
+        FormatSpec spec;
+        p = parseSpec(p, &spec);
+        int precision = 0;
+        if(spec.widthStar) {
+            int width = va_arg(args, int);
+            writeArg(w, &width, sizeof(int));
+        }
+        if(spec.precisionStar) {
+            precision = va_arg(args, int);
+            writeArg(w, &precision, sizeof(int));
+        } else if(spec.hasPrecision)
+            precision = atoi(spec.precision);
+
+        switch(spec.conversion) {
+        case 'd': case 'i': {
+            long long v;
+            switch(spec.length) {
+            case LENGTH_HH: v = (signed char)va_arg(args, int); break;
+            case LENGTH_H: v = (short)va_arg(args, int); break;
+            case LENGTH_L: v = va_arg(args, long); break;
+            case LENGTH_LL: v = va_arg(args, long long); break;
+            case LENGTH_J: v = va_arg(args, intmax_t); break;
+            case LENGTH_Z: v = (long long)va_arg(args, size_t); break;
+            case LENGTH_T: v = va_arg(args, ptrdiff_t); break;
+            default: v = va_arg(args, int); break;
+            }
+            writeArg(w, &v, sizeof(long long));
+            break; }
+        case 'u': case 'o': case 'x': case 'X': {
+            unsigned long long v;
+            switch(spec.length) {
+            case LENGTH_HH: v = (unsigned char)va_arg(args, unsigned int); break;
+            case LENGTH_H: v = (unsigned short)va_arg(args, unsigned int); break;
+            case LENGTH_L: v = va_arg(args, unsigned long); break;
+            case LENGTH_LL: v = va_arg(args, unsigned long long); break;
+            case LENGTH_J: v = va_arg(args, uintmax_t); break;
+            case LENGTH_Z: v = va_arg(args, size_t); break;
+            case LENGTH_T: v = (unsigned long long)va_arg(args, ptrdiff_t); break;
+            default: v = va_arg(args, unsigned int); break;
+            }
+            writeArg(w, &v, sizeof(unsigned long long));
+            break; }
+        case 'c': {
+            int v = va_arg(args, int);
+            writeArg(w, &v, sizeof(int));
+            break; }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            long double v;
+            if(spec.length == LENGTH_LD)
+                v = va_arg(args, long double);
+            else
+                v = va_arg(args, double);
+            writeArg(w, &v, sizeof(long double));
+            break; }
+        case 'p': {
+            void *v = va_arg(args, void*);
+            writeArg(w, &v, sizeof(void*));
+            break; }
+        case 's':
+            writeString(w, va_arg(args, const char*), spec.hasPrecision, precision);
+            break;
+        case 'n':
+            (void)va_arg(args, int*); // not supported
+            break;
+        default:
+            break; // %% and unknown conversions take no argument
+        }
+    }
+}
+
+/** Takes over the ring of an exited thread or allocates a new one */
+static LogRing * registerThread(void) {
+    LogRing *ring;
+    for(ring = __atomic_load_n(&asyncLogger.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        UA_UInt32 orphaned = 1;
+        if(__atomic_compare_exchange_n(&ring->orphaned, &orphaned, 0, UA_FALSE,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            goto found;
+    }
+    if(posix_memalign((void**)&ring, 64, sizeof(LogRing)) != 0)
+        return NULL;
+    memset(ring, 0, sizeof(LogRing));
+    ring->next = __atomic_load_n(&asyncLogger.rings, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(&asyncLogger.rings, &ring->next, ring, UA_TRUE,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+ found:
+    pthread_setspecific(asyncLogger.ringKey, ring);
+    localRing = ring;
+    localGeneration = generation;
+    return ring;
+}
+
+static void threadExited(void *ring) {
+    __atomic_store_n(&((LogRing*)ring)->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static void enqueue(LogRing *ring, int level, UA_LoggerCategory category, UA_DateTime time,
+                    const char *msg, va_list args) {
+    UA_UInt32 head = ring->head;
+    if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= RINGSIZE) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    LogEntry *entry = &ring->entries[head & (RINGSIZE - 1)];
+    entry->msg = msg;
+    entry->time = time;
+    entry->level = (UA_Byte)level;
+    entry->category = (UA_Byte)category;
+    ArgsWriter w = {.data = entry->args, .size = 0, .full = UA_FALSE};
+    copyArgs(msg, args, &w);
+    entry->argsSize = (UA_UInt16)w.size;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void enqueueArgs(LogRing *ring, int level, UA_LoggerCategory category, UA_DateTime time,
+                        const char *msg, ...) {
+    va_list args;
+    va_start(args, msg);
+    enqueue(ring, level, category, time, msg, args);
+    va_end(args);
+}
+
+/** Counts the messages of the category in the current second. Returns false if
+    the message is suppressed. */
+static UA_Boolean checkRate(LogRing *ring, UA_LoggerCategory category, UA_DateTime now) {
+    if(asyncLogger.maxPerSecond == 0)
+        return UA_TRUE;
+    UA_Int64 second = now / DATETIME_SEC;
+    UA_Int64 current = __atomic_load_n(&asyncLogger.limits[category].second, __ATOMIC_RELAXED);
+    if(current != second &&
+       __atomic_compare_exchange_n(&asyncLogger.limits[category].second, &current, second, UA_FALSE,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // the first message of a new second reports the suppressed messages
+        __atomic_store_n(&asyncLogger.limits[category].count, 0, __ATOMIC_RELAXED);
+        UA_UInt32 suppressed = __atomic_exchange_n(&asyncLogger.limits[category].suppressed, 0,
+                                                   __ATOMIC_RELAXED);
+        if(suppressed > 0)
+            enqueueArgs(ring, LEVEL_WARNING, category, now, "%u messages were suppressed", suppressed);
+    }
+    if(__atomic_add_fetch(&asyncLogger.limits[category].count, 1, __ATOMIC_RELAXED) <= asyncLogger.maxPerSecond)
+        return UA_TRUE;
+    __atomic_fetch_add(&asyncLogger.limits[category].suppressed, 1, __ATOMIC_RELAXED);
+    return UA_FALSE;
+}
+
+static void logAsync(int level, UA_LoggerCategory category, const char *msg, va_list args) {
+    if(!__atomic_load_n(&asyncLogger.running, __ATOMIC_ACQUIRE) || (unsigned)category >= CATEGORIES)
+        return;
+    LogRing *ring = localRing;
+    if((!ring || localGeneration != generation) && !(ring = registerThread()))
+        return;
+    UA_DateTime now = UA_DateTime_now();
+    if(!checkRate(ring, category, now))
+        return;
+    enqueue(ring, level, category, now, msg, args);
+}
+
+#define LOG_FUNCTION(LEVEL, NAME)                                       \
+    static void log_##NAME(UA_LoggerCategory category, const char *msg, ...) { \
+        va_list args;                                                   \
+        va_start(args, msg);                                            \
+        logAsync(LEVEL, category, msg, args);                           \
+        va_end(args);                                                   \
+    }
+
+LOG_FUNCTION(LEVEL_TRACE, trace)
+LOG_FUNCTION(LEVEL_DEBUG, debug)
+LOG_FUNCTION(LEVEL_INFO, info)
+LOG_FUNCTION(LEVEL_WARNING, warning)
+LOG_FUNCTION(LEVEL_ERROR, error)
+LOG_FUNCTION(LEVEL_FATAL, fatal)
+
+/**************/
+/* Formatting */
+/**************/
+
+typedef struct {
+    const UA_Byte *data;
+    size_t size;
+    size_t pos;
+} ArgsReader;
+
+static UA_Boolean readArg(ArgsReader *r, void *value, size_t size) {
+    if(r->pos + size > r->size)
+        return UA_FALSE;
+    memcpy(value, &r->data[r->pos], size);
+    r->pos += size;
+    return UA_TRUE;
+}
+
+/** Builds a specifier that takes exactly one argument of the widened type */
+static void makeSpec(const FormatSpec *spec, int width, int precision, const char *length,
+                     char *buf, size_t bufSize) {
+    int n = snprintf(buf, bufSize, "%%%.*s", (int)spec->flagsLength, spec->flags);
+    if(spec->widthStar)
+        n += snprintf(&buf[n], bufSize - (size_t)n, "%d", width);
+    else
+        n += snprintf(&buf[n], bufSize - (size_t)n, "%.*s", (int)spec->widthLength, spec->width);
+    if(spec->precisionStar)
+        n += snprintf(&buf[n], bufSize - (size_t)n, ".%d", precision);
+    else if(spec->hasPrecision)
+        n += snprintf(&buf[n], bufSize - (size_t)n, ".%.*s", (int)spec->precisionLength, spec->precision);
+    snprintf(&buf[n], bufSize - (size_t)n, "%s%c", length, spec->conversion);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+static void formatEntry(const LogEntry *entry, FILE *out) {
+    char line[1024];
+    size_t pos = 0;
+    ArgsReader r = {.data = entry->args, .size = entry->argsSize, .pos = 0};
+    for(const char *p = entry->msg; *p && pos < sizeof(line) - 1;) {
+        if(*p != '%') {
+            line[pos++] = *p++;
+            continue;
+        }
+        p++;
+        if(*p == '%') {
+            line[pos++] = *p++;
+            continue;
+        }
+        FormatSpec spec;
+        p = parseSpec(p, &spec);
+        int width = 0, precision = 0;
+        if((spec.widthStar && !readArg(&r, &width, sizeof(int))) ||
+           (spec.precisionStar && !readArg(&r, &precision, sizeof(int))))
+            break;
+        char fmt[64];
+        size_t left = sizeof(line) - pos;
+        int n = 0;
+        switch(spec.conversion) {
+        case 'd': case 'i': {
+            long long v;
+            if(!readArg(&r, &v, sizeof(long long)))
+                goto truncated;
+            makeSpec(&spec, width, precision, "ll", fmt, sizeof(fmt));
+            n = snprintf(&line[pos], left, fmt, v);
+            break; }
+        case 'u': case 'o': case 'x': case 'X': {
+            unsigned long long v;
+            if(!readArg(&r, &v, sizeof(unsigned long long)))
+                goto truncated;
+            makeSpec(&spec, width, precision, "ll", fmt, sizeof(fmt));
+            n = snprintf(&line[pos], left, fmt, v);
+            break; }
+        case 'c': {
+            int v;
+            if(!readArg(&r, &v, sizeof(int)))
+                goto truncated;
+            makeSpec(&spec, width, precision, "", fmt, sizeof(fmt));
+            n = snprintf(&line[pos], left, fmt, v);
+            break; }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            long double v;
+            if(!readArg(&r, &v, sizeof(long double)))
+                goto truncated;
+            makeSpec(&spec, width, precision, "L", fmt, sizeof(fmt));
+            n = snprintf(&line[pos], left, fmt, v);
+            break; }
+        case 'p': {
+            void *v;
+            if(!readArg(&r, &v, sizeof(void*)))
+                goto truncated;
+            makeSpec(&spec, width, precision, "", fmt, sizeof(fmt));
+            n = snprintf(&line[pos], left, fmt, v);
+            break; }
+        case 's': {
+            UA_UInt16 length;
+            if(!readArg(&r, &length, sizeof(UA_UInt16)) || r.pos + length > r.size)
+                goto truncated;
+            // the copy is not null-terminated. so the precision is the length.
+            FormatSpec s = spec;
+            s.precisionStar = UA_TRUE;
+            makeSpec(&s, width, length, "", fmt, sizeof(fmt));
+            n = snprintf(&line[pos], left, fmt, (const char*)&r.data[r.pos]);
+            r.pos += length;
+            break; }
+        default:
+            break;
+        }
+        if(n > 0)
+            pos += (size_t)n < left ? (size_t)n : left - 1;
+        continue;
+    truncated:
+        n = snprintf(&line[pos], left, "...");
+        if(n > 0)
+            pos += (size_t)n < left ? (size_t)n : left - 1;
+        break;
+    }
+    line[pos] = 0;
+
+    UA_String timeString;
+    UA_DateTime_toString(entry->time, &timeString);
+    fprintf(out, "[%.*s] %s/%s: %s\n", timeString.length, timeString.data, levelNames[entry->level],
+            categoryNames[entry->category], line);
+    UA_String_deleteMembers(&timeString);
+}
+#pragma GCC diagnostic pop
+
+/** Writes the pending messages of all rings. Returns the number of messages. */
+static size_t drain(void) {
+    size_t count = 0;
+    for(LogRing *ring = __atomic_load_n(&asyncLogger.rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        UA_UInt32 tail = ring->tail;
+        UA_UInt32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for(; tail != head; tail++) {
+            formatEntry(&ring->entries[tail & (RINGSIZE - 1)], asyncLogger.out);
+            count++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        UA_UInt32 dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if(dropped > 0)
+            fprintf(asyncLogger.out, "%u log messages were dropped\n", dropped);
+    }
+    if(count > 0)
+        fflush(asyncLogger.out);
+    return count;
+}
+
+static void * loggerLoop(void *data) {
+    struct timespec idle = {.tv_sec = 0, .tv_nsec = IDLESLEEP};
+    while(__atomic_load_n(&asyncLogger.running, __ATOMIC_ACQUIRE)) {
+        if(drain() == 0)
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+UA_StatusCode Logger_Async_start(UA_Logger *logger, FILE *out, UA_UInt32 maxPerSecond) {
+    if(asyncLogger.running)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    memset(&asyncLogger, 0, sizeof(asyncLogger));
+    asyncLogger.out = out;
+    asyncLogger.maxPerSecond = maxPerSecond;
+    generation++;
+    if(pthread_key_create(&asyncLogger.ringKey, threadExited) != 0)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    asyncLogger.running = UA_TRUE;
+    if(pthread_create(&asyncLogger.thread, NULL, loggerLoop, NULL) != 0) {
+        asyncLogger.running = UA_FALSE;
+        pthread_key_delete(asyncLogger.ringKey);
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    *logger = (UA_Logger){
+        .log_trace = log_trace,
+        .log_debug = log_debug,
+        .log_info = log_info,
+        .log_warning = log_warning,
+        .log_error = log_error,
+        .log_fatal = log_fatal
+    };
+    return UA_STATUSCODE_GOOD;
+}
+
+void Logger_Async_stop(void) {
+    if(!asyncLogger.running)
+        return;
+    __atomic_store_n(&asyncLogger.running, UA_FALSE, __ATOMIC_RELEASE);
+    pthread_join(asyncLogger.thread, NULL);
+    drain();
+    pthread_key_delete(asyncLogger.ringKey);
+    while(asyncLogger.rings) {
+        LogRing *ring = asyncLogger.rings;
+        asyncLogger.rings = ring->next;
+        free(ring);
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#ifndef LOGGER_ASYNC_H_
+#define LOGGER_ASYNC_H_
+
+#include <stdio.h>
+#include "ua_log.h"
+#include "ua_types.h"
+
+/**
+ * The logging threads copy the message arguments into a lock-free ring buffer
+ * of their own. A background thread formats the messages and writes them to
+ * the stream. So a slow terminal or file does not hold up the server.
+ *
+ * Since the formatting is deferred, the message has to be a string literal.
+ * Strings in the arguments are copied (and possibly truncated). Messages are
+ * dropped when the ring of a thread is full.
+ *
+ * @param logger Is set to the log functions of the async logger
+ * @param out The stream for the log messages
+ * @param maxPerSecond Messages above this rate are suppressed per category.
+ *        The number of suppressed messages is logged. Zero disables the limit.
+ */
+UA_StatusCode Logger_Async_start(UA_Logger *logger, FILE *out, UA_UInt32 maxPerSecond);
+
+/** Writes the pending messages and stops the background thread. Call this when
+    no more messages are logged, e.g. after the server is deleted. */
+void Logger_Async_stop(void);
+
+#endif /* LOGGER_ASYNC_H_ */
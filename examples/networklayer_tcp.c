@@ -3,6 +3,7 @@
  * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
  */
 
+#define _GNU_SOURCE // SO_REUSEPORT
 #include <stdlib.h> // malloc, free
 #ifdef _WIN32
 #include <malloc.h>
@@ -23,25 +24,55 @@
 #endif
 
 #include <stdio.h>
+#include <string.h> // memcpy
 #include <errno.h> // errno, EINTR
 #include <fcntl.h> // fcntl
 
 #include "networklayer_tcp.h" // UA_MULTITHREADING is defined in here
 
 #ifdef UA_MULTITHREADING
+#include <pthread.h>
 #include <urcu/uatomic.h>
+#define LOCK_SENDQUEUE(c) pthread_mutex_lock(&(c)->sendMutex)
+#define UNLOCK_SENDQUEUE(c) pthread_mutex_unlock(&(c)->sendMutex)
+#else
+#define LOCK_SENDQUEUE(c)
+#define UNLOCK_SENDQUEUE(c)
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // the flag is not available on all platforms
 #endif
 
 #define MAXBACKLOG 100
+#define MAXSENDQUEUESIZE 1048576 // default limit for the queued bytes per connection
 
 struct Networklayer_TCP;
 
+/* A message that could not be written immediately. The data follows the
+   struct in the same allocation. */
+typedef struct QueuedMessage {
+    struct QueuedMessage *next;
+    size_t offset; // bytes already written
+    size_t length;
+    UA_Byte *data;
+} QueuedMessage;
+
 /* Forwarded to the server as a (UA_Connection) and used for callbacks back into
    the networklayer */
 typedef struct {
 	UA_Connection connection;
 	UA_Int32 sockfd;
 	struct NetworkLayerTCP *layer;
+    /* Messages are queued only when the socket would block. Once a message is
+       queued, all following messages are queued behind it to keep the order. */
+    QueuedMessage *sendQueueFirst;
+    QueuedMessage *sendQueueLast;
+    UA_Boolean readingPaused; // until the queue is empty (TCP_SENDQUEUE_STOPREADING)
+    TCPSendQueueStatistics stats;
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t sendMutex;
+#endif
 } TCPConnection;
 
 /* Internal mapping of sockets to connections */
@@ -57,6 +88,7 @@ typedef struct {
 typedef struct NetworkLayerTCP {
 	UA_ConnectionConfig conf;
 	fd_set fdset;
+	fd_set writefdset; // connections with queued messages
 #ifdef _WIN32
 	UA_UInt32 serversockfd;
 	UA_UInt32 highestfd;
@@ -67,6 +99,11 @@ typedef struct NetworkLayerTCP {
     UA_UInt16 conLinksSize;
     ConnectionLink *conLinks;
     UA_UInt32 port;
+    UA_Boolean reusePort;
+    UA_Byte *recvBuffer; // read into here and copied to a right-sized buffer from the pool
+    UA_BufferPool *bufferPool;
+    UA_UInt32 maxSendQueueSize;
+    TCPSendQueuePolicy sendQueuePolicy;
     /* We remove the connection links only in the main thread. Attach
        to-be-deleted links with atomic operations */
     struct deleteLink {
@@ -92,17 +129,36 @@ static UA_StatusCode setNonBlocking(int sockid) {
 	return UA_STATUSCODE_GOOD;
 }
 
-static void freeConnectionCallback(UA_Server *server, TCPConnection *connection) {
+static void freeConnection(TCPConnection *connection) {
+    while(connection->sendQueueFirst) {
+        QueuedMessage *m = connection->sendQueueFirst;
+        connection->sendQueueFirst = m->next;
+        free(m);
+    }
+#ifdef UA_MULTITHREADING
+    pthread_mutex_destroy(&connection->sendMutex);
+#endif
     free(connection);
 }
 
+static void freeConnectionCallback(UA_Server *server, TCPConnection *connection) {
+    freeConnection(connection);
+}
+
 // after every select, reset the set of sockets we want to listen on
 static void setFDSet(NetworkLayerTCP *layer) {
 	FD_ZERO(&layer->fdset);
+	FD_ZERO(&layer->writefdset);
 	FD_SET(layer->serversockfd, &layer->fdset);
 	layer->highestfd = layer->serversockfd;
 	for(UA_Int32 i=0;i<layer->conLinksSize;i++) {
-		FD_SET(layer->conLinks[i].sockfd, &layer->fdset);
+        TCPConnection *c = layer->conLinks[i].connection;
+        LOCK_SENDQUEUE(c);
+        if(!c->readingPaused)
+            FD_SET(layer->conLinks[i].sockfd, &layer->fdset);
+        if(c->sendQueueFirst)
+            FD_SET(layer->conLinks[i].sockfd, &layer->writefdset);
+        UNLOCK_SENDQUEUE(c);
 		if(layer->conLinks[i].sockfd > layer->highestfd)
 			layer->highestfd = layer->conLinks[i].sockfd;
 	}
@@ -119,6 +175,13 @@ static UA_StatusCode NetworkLayerTCP_add(NetworkLayerTCP *layer, UA_Int32 newsoc
 		return UA_STATUSCODE_BADINTERNALERROR;
 	c->sockfd = newsockfd;
     c->layer = layer;
+    c->sendQueueFirst = (void*)0;
+    c->sendQueueLast = (void*)0;
+    c->readingPaused = UA_FALSE;
+    c->stats = (TCPSendQueueStatistics){0, 0, 0, 0, 0};
+#ifdef UA_MULTITHREADING
+    pthread_mutex_init(&c->sendMutex, (void*)0);
+#endif
     c->connection.state = UA_CONNECTION_OPENING;
     c->connection.localConf = layer->conf;
     c->connection.channel = (void*)0;
@@ -127,7 +190,7 @@ static UA_StatusCode NetworkLayerTCP_add(NetworkLayerTCP *layer, UA_Int32 newsoc
 
     layer->conLinks = realloc(layer->conLinks, sizeof(ConnectionLink)*(layer->conLinksSize+1));
 	if(!layer->conLinks) {
-		free(c);
+		freeConnection(c);
 		return UA_STATUSCODE_BADINTERNALERROR;
 	}
     layer->conLinks[layer->conLinksSize].connection = c;
@@ -194,12 +257,11 @@ void closeConnection(TCPConnection *handle) {
 }
 #else
 void closeConnection(TCPConnection *handle) {
+    if(handle->connection.state == UA_CONNECTION_CLOSING)
+        return;
 	struct deleteLink *d = malloc(sizeof(struct deleteLink));
 	if(!d)
 		return;
-
-    if(handle->connection.state == UA_CONNECTION_CLOSING)
-        return;
     handle->connection.state = UA_CONNECTION_CLOSING;
 
     UA_Connection_detachSecureChannel(&handle->connection);
@@ -213,47 +275,169 @@ void closeConnection(TCPConnection *handle) {
 }
 #endif
 
-/** Accesses only the sockfd in the handle. Can be run from parallel threads. */
-void writeCallback(TCPConnection *handle, UA_ByteStringArray gather_buf) {
-	UA_UInt32 total_len = 0, nWritten = 0;
+/* Writes as much as possible without blocking. The first offset bytes are
+   skipped. Returns the number of bytes written (zero if the socket would block)
+   or -1 if the connection is broken. */
+static UA_Int32 sendNonBlocking(UA_Int32 sockfd, const UA_ByteString *bufs, UA_UInt32 bufsSize,
+                                size_t offset) {
+    UA_UInt32 count = 0;
 #ifdef _WIN32
-	LPWSABUF buf = _alloca(gather_buf.stringsSize * sizeof(WSABUF));
-	int result = 0;
-	for(UA_UInt32 i = 0; i<gather_buf.stringsSize; i++) {
-		buf[i].buf = (char*)gather_buf.strings[i].data;
-		buf[i].len = gather_buf.strings[i].length;
-		total_len += gather_buf.strings[i].length;
-	}
-	while(nWritten < total_len) {
-		UA_UInt32 n = 0;
-		do {
-			result = WSASend(handle->sockfd, buf, gather_buf.stringsSize ,
-                             (LPDWORD)&n, 0, NULL, NULL);
-			if(result != 0)
-				printf("Error WSASend, code: %d \n", WSAGetLastError());
-		} while(errno == EINTR);
-		nWritten += n;
+	LPWSABUF buf = _alloca(bufsSize * sizeof(WSABUF));
+	for(UA_UInt32 i = 0; i<bufsSize; i++) {
+        if(bufs[i].length <= 0)
+            continue;
+        if(offset >= (size_t)bufs[i].length) {
+            offset -= bufs[i].length;
+            continue;
+        }
+		buf[count].buf = (char*)bufs[i].data + offset;
+		buf[count].len = bufs[i].length - offset;
+        offset = 0;
+        count++;
 	}
+    if(count == 0)
+        return 0;
+    DWORD n = 0;
+    if(WSASend(sockfd, buf, count, &n, 0, NULL, NULL) != 0) {
+        if(WSAGetLastError() == WSAEWOULDBLOCK)
+            return 0;
+        printf("Error WSASend, code: %d \n", WSAGetLastError());
+        return -1;
+    }
+    return n;
 #else
-	struct iovec iov[gather_buf.stringsSize];
-	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
-		iov[i] = (struct iovec) {.iov_base = gather_buf.strings[i].data,
-                                 .iov_len = gather_buf.strings[i].length};
-		total_len += gather_buf.strings[i].length;
-	}
-	struct msghdr message = {.msg_name = NULL, .msg_namelen = 0, .msg_iov = iov,
-							 .msg_iovlen = gather_buf.stringsSize, .msg_control = NULL,
-							 .msg_controllen = 0, .msg_flags = 0};
-	while (nWritten < total_len) {
-		UA_Int32 n = 0;
-		do {
-            n = sendmsg(handle->sockfd, &message, 0);
-        } while (n == -1L && errno == EINTR);
-        nWritten += n;
-	}
+    struct iovec iov[bufsSize];
+    for(UA_UInt32 i=0;i<bufsSize;i++) {
+        if(bufs[i].length <= 0)
+            continue;
+        if(offset >= (size_t)bufs[i].length) {
+            offset -= bufs[i].length;
+            continue;
+        }
+        iov[count] = (struct iovec) {.iov_base = bufs[i].data + offset,
+                                     .iov_len = bufs[i].length - offset};
+        offset = 0;
+        count++;
+    }
+    if(count == 0)
+        return 0;
+    struct msghdr message = {.msg_name = NULL, .msg_namelen = 0, .msg_iov = iov,
+                             .msg_iovlen = count, .msg_control = NULL,
+                             .msg_controllen = 0, .msg_flags = 0};
+    ssize_t n;
+    do {
+        n = sendmsg(sockfd, &message, MSG_NOSIGNAL);
+    } while(n == -1 && errno == EINTR);
+    if(n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    return n;
 #endif
 }
 
+/* Writes queued messages until the socket would block. Call with the send
+   mutex held. Returns UA_FALSE if the connection is broken. */
+static UA_Boolean flushSendQueue(TCPConnection *c) {
+    while(c->sendQueueFirst) {
+        QueuedMessage *m = c->sendQueueFirst;
+        UA_ByteString rest = {.length = m->length - m->offset, .data = m->data + m->offset};
+        UA_Int32 n = sendNonBlocking(c->sockfd, &rest, 1, 0);
+        if(n < 0)
+            return UA_FALSE;
+        c->stats.bytesSent += n;
+        c->stats.bytesQueued -= n;
+        m->offset += n;
+        if(m->offset < m->length)
+            break; // the socket would block
+        c->sendQueueFirst = m->next;
+        if(!c->sendQueueFirst)
+            c->sendQueueLast = (void*)0;
+        free(m);
+    }
+    if(!c->sendQueueFirst)
+        c->readingPaused = UA_FALSE;
+    return UA_TRUE;
+}
+
+/** Writes directly if nothing is queued. The rest of the message is queued if
+    the socket would block. Can be run from parallel threads. */
+void writeCallback(TCPConnection *handle, UA_ByteStringArray gather_buf) {
+    size_t total_len = 0, nWritten = 0;
+	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
+        if(gather_buf.strings[i].length > 0)
+            total_len += gather_buf.strings[i].length;
+    }
+
+    UA_Boolean broken = UA_FALSE;
+    LOCK_SENDQUEUE(handle);
+    if(handle->connection.state == UA_CONNECTION_CLOSING) {
+        UNLOCK_SENDQUEUE(handle);
+        return;
+    }
+
+    if(!handle->sendQueueFirst) {
+        UA_Int32 n = sendNonBlocking(handle->sockfd, gather_buf.strings, gather_buf.stringsSize, 0);
+        if(n < 0) {
+            UNLOCK_SENDQUEUE(handle);
+            closeConnection(handle);
+            return;
+        }
+        handle->stats.bytesSent += n;
+        nWritten = n;
+        if(nWritten >= total_len) {
+            UNLOCK_SENDQUEUE(handle);
+            return;
+        }
+    } else if(handle->stats.bytesQueued + total_len > handle->layer->maxSendQueueSize) {
+        // only messages behind others count against the limit. a partially
+        // written message is always queued, so that the stream stays intact.
+        handle->stats.overflows++;
+        switch(handle->layer->sendQueuePolicy) {
+        case TCP_SENDQUEUE_DROP:
+            handle->stats.messagesDropped++;
+            UNLOCK_SENDQUEUE(handle);
+            return;
+        case TCP_SENDQUEUE_CLOSE:
+            broken = UA_TRUE;
+            break;
+        default:
+            handle->readingPaused = UA_TRUE;
+            break;
+        }
+    }
+
+    QueuedMessage *m = (void*)0;
+    if(!broken)
+        m = malloc(sizeof(QueuedMessage) + total_len - nWritten);
+    if(m) {
+        m->next = (void*)0;
+        m->offset = 0;
+        m->length = total_len - nWritten;
+        m->data = (UA_Byte*)&m[1];
+        size_t pos = 0;
+        for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
+            if(gather_buf.strings[i].length <= 0)
+                continue;
+            size_t len = gather_buf.strings[i].length;
+            size_t skip = nWritten > len ? len : nWritten;
+            nWritten -= skip;
+            memcpy(&m->data[pos], gather_buf.strings[i].data + skip, len - skip);
+            pos += len - skip;
+        }
+        if(handle->sendQueueLast)
+            handle->sendQueueLast->next = m;
+        else
+            handle->sendQueueFirst = m;
+        handle->sendQueueLast = m;
+        handle->stats.messagesQueued++;
+        handle->stats.bytesQueued += m->length;
+    } else
+        broken = UA_TRUE;
+    UNLOCK_SENDQUEUE(handle);
+
+    if(broken)
+        closeConnection(handle);
+}
+
 static UA_StatusCode NetworkLayerTCP_start(NetworkLayerTCP *layer) {
 #ifdef _WIN32
 	WORD wVersionRequested;
@@ -283,6 +467,21 @@ static UA_StatusCode NetworkLayerTCP_start(NetworkLayerTCP *layer) {
 		CLOSESOCKET(layer->serversockfd);
 		return UA_STATUSCODE_BADINTERNALERROR;
 	}
+
+	if(layer->reusePort) {
+#ifdef SO_REUSEPORT
+		if(setsockopt(layer->serversockfd, SOL_SOCKET, SO_REUSEPORT,
+                      (const char *)&optval, sizeof(optval)) == -1) {
+			perror("setsockopt");
+			CLOSESOCKET(layer->serversockfd);
+			return UA_STATUSCODE_BADINTERNALERROR;
+		}
+#else
+		printf("ERROR: SO_REUSEPORT is not supported\n");
+		CLOSESOCKET(layer->serversockfd);
+		return UA_STATUSCODE_BADINTERNALERROR;
+#endif
+	}
 		
 	if(bind(layer->serversockfd, (const struct sockaddr *)&serv_addr,
             sizeof(serv_addr)) < 0) {
@@ -305,20 +504,33 @@ static UA_Int32 NetworkLayerTCP_getWork(NetworkLayerTCP *layer, UA_WorkItem **wo
     UA_Int32 itemsCount = batchDeleteLinks(layer, &items);
     setFDSet(layer);
     struct timeval tmptv = {0, timeout};
-    UA_Int32 resultsize = select(layer->highestfd+1, &layer->fdset, NULL, NULL, &tmptv);
+    UA_Int32 resultsize = select(layer->highestfd+1, &layer->fdset, &layer->writefdset, NULL, &tmptv);
 
     if(resultsize < 0) {
         *workItems = items;
         return itemsCount;
     }
 
+    // write queued messages
+	for(UA_Int32 i=0;i<layer->conLinksSize;i++) {
+		if(!(FD_ISSET(layer->conLinks[i].sockfd, &layer->writefdset)))
+            continue;
+        resultsize--;
+        TCPConnection *c = layer->conLinks[i].connection;
+        LOCK_SENDQUEUE(c);
+        UA_Boolean flushed = flushSendQueue(c);
+        UNLOCK_SENDQUEUE(c);
+        if(!flushed)
+            closeConnection(c);
+    }
+
 	// accept new connections (can only be a single one)
 	if(FD_ISSET(layer->serversockfd,&layer->fdset)) {
 		resultsize--;
 		struct sockaddr_in cli_addr;
 		socklen_t cli_len = sizeof(cli_addr);
 		int newsockfd = accept(layer->serversockfd, (struct sockaddr *) &cli_addr, &cli_len);
-		int i = 1;
+		int i = 1;
 		setsockopt(newsockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&i, sizeof(i));
 		if (newsockfd >= 0)
 			NetworkLayerTCP_add(layer, newsockfd);
@@ -328,36 +540,33 @@ static UA_Int32 NetworkLayerTCP_getWork(NetworkLayerTCP *layer, UA_WorkItem **wo
 
 	// read from established sockets
     UA_Int32 j = itemsCount;
-	UA_ByteString buf = { -1, NULL};
 	for(UA_Int32 i=0;i<layer->conLinksSize && j<itemsCount+resultsize;i++) {
 		if(!(FD_ISSET(layer->conLinks[i].sockfd, &layer->fdset)))
             continue;
 
-		if(!buf.data) {
-			buf.data = malloc(sizeof(UA_Byte) * layer->conf.recvBufferSize);
-			if(!buf.data)
-				break;
-		}
-        
 #ifdef _WIN32
-        buf.length = recv(layer->conLinks[i].sockfd, (char *)buf.data,
+        int length = recv(layer->conLinks[i].sockfd, (char *)layer->recvBuffer,
                           layer->conf.recvBufferSize, 0);
 #else
-        buf.length = read(layer->conLinks[i].sockfd, buf.data, layer->conf.recvBufferSize);
+        ssize_t length = read(layer->conLinks[i].sockfd, layer->recvBuffer, layer->conf.recvBufferSize);
 #endif
-        if (buf.length <= 0) {
+        if (length <= 0) {
             closeConnection(layer->conLinks[i].connection); // work is returned in the next iteration
-        } else {
-            items[j].type = UA_WORKITEMTYPE_BINARYNETWORKMESSAGE;
-            items[j].work.binaryNetworkMessage.message = buf;
-            items[j].work.binaryNetworkMessage.connection = &layer->conLinks[i].connection->connection;
-            buf.data = NULL;
-            j++;
+            continue;
         }
-    }
 
-    if(buf.data)
-        free(buf.data);
+        UA_ByteString buf;
+        if(UA_BufferPool_take(layer->bufferPool, &buf, length) != UA_STATUSCODE_GOOD) {
+            // the data is already read. without it, the stream is out of sync
+            closeConnection(layer->conLinks[i].connection);
+            continue;
+        }
+        memcpy(buf.data, layer->recvBuffer, length);
+        items[j].type = UA_WORKITEMTYPE_POOLEDBINARYNETWORKMESSAGE;
+        items[j].work.binaryNetworkMessage.message = buf;
+        items[j].work.binaryNetworkMessage.connection = &layer->conLinks[i].connection->connection;
+        j++;
+    }
 
     if(j == 0) {
         free(items);
@@ -378,9 +587,11 @@ static UA_Int32 NetworkLayerTCP_stop(NetworkLayerTCP * layer, UA_WorkItem **work
 
 static void NetworkLayerTCP_delete(NetworkLayerTCP *layer) {
 	for(UA_Int32 i=0;i<layer->conLinksSize;++i){
-		free(layer->conLinks[i].connection);
+		freeConnection(layer->conLinks[i].connection);
 	}
 	free(layer->conLinks);
+    free(layer->recvBuffer);
+    UA_BufferPool_delete(layer->bufferPool);
 	free(layer);
 }
 
@@ -390,6 +601,11 @@ UA_ServerNetworkLayer ServerNetworkLayerTCP_new(UA_ConnectionConfig conf, UA_UIn
 	tcplayer->conLinksSize = 0;
 	tcplayer->conLinks = NULL;
     tcplayer->port = port;
+    tcplayer->reusePort = UA_FALSE;
+    tcplayer->recvBuffer = malloc(conf.recvBufferSize);
+    tcplayer->bufferPool = UA_BufferPool_new();
+    tcplayer->maxSendQueueSize = MAXSENDQUEUESIZE;
+    tcplayer->sendQueuePolicy = TCP_SENDQUEUE_STOPREADING;
     tcplayer->deleteLinkList = (void*)0;
 
     UA_ServerNetworkLayer nl;
@@ -400,3 +616,22 @@ UA_ServerNetworkLayer ServerNetworkLayerTCP_new(UA_ConnectionConfig conf, UA_UIn
     nl.free = (void (*)(void*))NetworkLayerTCP_delete;
     return nl;
 }
+
+void ServerNetworkLayerTCP_setSendQueue(UA_ServerNetworkLayer *nl, UA_UInt32 maxQueueSize,
+                                        TCPSendQueuePolicy policy) {
+    NetworkLayerTCP *layer = nl->nlHandle;
+    layer->maxSendQueueSize = maxQueueSize;
+    layer->sendQueuePolicy = policy;
+}
+
+void ServerNetworkLayerTCP_setReusePort(UA_ServerNetworkLayer *nl, UA_Boolean reusePort) {
+    NetworkLayerTCP *layer = nl->nlHandle;
+    layer->reusePort = reusePort;
+}
+
+void TCPConnection_getSendQueueStatistics(UA_Connection *connection, TCPSendQueueStatistics *stats) {
+    TCPConnection *c = (TCPConnection*)connection;
+    LOCK_SENDQUEUE(c);
+    *stats = c->stats;
+    UNLOCK_SENDQUEUE(c);
+}
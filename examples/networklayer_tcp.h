@@ -15,6 +15,46 @@ extern "C" {
 /** @brief Create the TCP networklayer and listen to the specified port */
 UA_ServerNetworkLayer ServerNetworkLayerTCP_new(UA_ConnectionConfig conf, UA_UInt32 port);
 
+/**
+ * @brief Let several networklayers listen on the same port
+ *
+ * With SO_REUSEPORT, the kernel spreads the incoming connections over the
+ * listening sockets. Add the networklayers with
+ * UA_Server_addNetworkLayerWithLoop to get one event loop per networklayer.
+ * Must be set before the server is started.
+ */
+void ServerNetworkLayerTCP_setReusePort(UA_ServerNetworkLayer *nl, UA_Boolean reusePort);
+
+/** What happens to a response when the send queue of a connection is full */
+typedef enum {
+    TCP_SENDQUEUE_STOPREADING, ///< Queue the response, but read no more requests until the queue is empty
+    TCP_SENDQUEUE_DROP, ///< Drop the response
+    TCP_SENDQUEUE_CLOSE ///< Close the connection
+} TCPSendQueuePolicy;
+
+/**
+ * @brief Configure the send queues of the connections
+ *
+ * Responses that cannot be written immediately are queued and sent when the
+ * socket becomes writable. So slow clients do not stall the server.
+ *
+ * @param maxQueueSize The number of bytes that may be queued per connection
+ * before the policy applies.
+ */
+void ServerNetworkLayerTCP_setSendQueue(UA_ServerNetworkLayer *nl, UA_UInt32 maxQueueSize,
+                                        TCPSendQueuePolicy policy);
+
+typedef struct {
+    UA_UInt64 bytesSent;
+    UA_UInt32 bytesQueued; ///< Currently waiting in the queue
+    UA_UInt32 messagesQueued; ///< Messages that could not be sent immediately
+    UA_UInt32 messagesDropped;
+    UA_UInt32 overflows; ///< How often the queue ran full
+} TCPSendQueueStatistics;
+
+/** @brief Get the send counters of a connection of the TCP networklayer */
+void TCPConnection_getSendQueueStatistics(UA_Connection *connection, TCPSendQueueStatistics *stats);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
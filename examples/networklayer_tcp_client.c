@@ -0,0 +1,171 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L // getaddrinfo
+#endif
+
+#include <stdlib.h> // malloc, free
+#ifdef _WIN32
+#include <malloc.h>
+#include <winsock2.h>
+#include <sys/types.h>
+#include <windows.h>
+#include <ws2tcpip.h>
+#define CLOSESOCKET(S) closesocket(S)
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h> // read, close
+#include <netdb.h> // getaddrinfo
+#define CLOSESOCKET(S) close(S)
+#endif
+
+#include <string.h> // memcpy, strcspn
+#include <errno.h> // errno, EINTR
+
+#include "networklayer_tcp_client.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // the flag is not available on all platforms
+#endif
+
+typedef struct ClientNetworkLayerTCP {
+	UA_ConnectionConfig conf;
+#ifdef _WIN32
+	UA_UInt32 sockfd;
+#else
+	UA_Int32 sockfd;
+#endif
+    UA_Byte *recvBuffer;
+} ClientNetworkLayerTCP;
+
+/* Splits opc.tcp://host:port/path into host and port */
+static UA_StatusCode parseEndpointUrl(const char *endpointUrl, char *host, size_t hostSize, char *port) {
+    const char prefix[] = "opc.tcp://";
+    if(strncmp(endpointUrl, prefix, sizeof(prefix) - 1) != 0)
+        return UA_STATUSCODE_BADTCPENDPOINTURLINVALID;
+    const char *start = &endpointUrl[sizeof(prefix) - 1];
+    size_t hostLength = strcspn(start, ":/");
+    if(hostLength == 0 || hostLength >= hostSize)
+        return UA_STATUSCODE_BADTCPENDPOINTURLINVALID;
+    memcpy(host, start, hostLength);
+    host[hostLength] = 0;
+    strcpy(port, "4840");
+    if(start[hostLength] == ':') {
+        size_t portLength = strspn(&start[hostLength + 1], "0123456789");
+        if(portLength == 0 || portLength > 5)
+            return UA_STATUSCODE_BADTCPENDPOINTURLINVALID;
+        memcpy(port, &start[hostLength + 1], portLength);
+        port[portLength] = 0;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode ClientNetworkLayerTCP_connect(ClientNetworkLayerTCP *layer, const char *endpointUrl) {
+    char host[256];
+    char port[6];
+    UA_StatusCode retval = parseEndpointUrl(endpointUrl, host, sizeof(host), port);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &res) != 0)
+        return UA_STATUSCODE_BADTCPENDPOINTURLINVALID;
+    layer->sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if(layer->sockfd < 0) {
+        freeaddrinfo(res);
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    if(connect(layer->sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+        freeaddrinfo(res);
+        CLOSESOCKET(layer->sockfd);
+        layer->sockfd = -1;
+        return UA_STATUSCODE_BADCONNECTIONREJECTED;
+    }
+    freeaddrinfo(res);
+    int i = 1;
+    setsockopt(layer->sockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&i, sizeof(i));
+    return UA_STATUSCODE_GOOD;
+}
+
+static void ClientNetworkLayerTCP_disconnect(ClientNetworkLayerTCP *layer) {
+    if(layer->sockfd < 0)
+        return;
+    CLOSESOCKET(layer->sockfd);
+    layer->sockfd = -1;
+}
+
+static UA_StatusCode ClientNetworkLayerTCP_send(ClientNetworkLayerTCP *layer, UA_ByteStringArray gather_buf) {
+	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
+        UA_Int32 nWritten = 0;
+        while(nWritten < gather_buf.strings[i].length) {
+#ifdef _WIN32
+            int n = send(layer->sockfd, (const char*)&gather_buf.strings[i].data[nWritten],
+                         gather_buf.strings[i].length - nWritten, 0);
+#else
+            ssize_t n = send(layer->sockfd, &gather_buf.strings[i].data[nWritten],
+                             gather_buf.strings[i].length - nWritten, MSG_NOSIGNAL);
+#endif
+            if(n < 0) {
+                if(errno == EINTR)
+                    continue;
+                return UA_STATUSCODE_BADCONNECTIONCLOSED;
+            }
+            nWritten += n;
+        }
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode ClientNetworkLayerTCP_receive(ClientNetworkLayerTCP *layer, UA_ByteString *buf,
+                                                   UA_UInt32 timeout) {
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(layer->sockfd, &fdset);
+    struct timeval tmptv = {.tv_sec = timeout / 1000000, .tv_usec = timeout % 1000000};
+    int ready = select(layer->sockfd + 1, &fdset, NULL, NULL, &tmptv);
+    if(ready == 0 || (ready < 0 && errno == EINTR))
+        return UA_STATUSCODE_BADTIMEOUT;
+    if(ready < 0)
+        return UA_STATUSCODE_BADCONNECTIONCLOSED;
+#ifdef _WIN32
+    int length = recv(layer->sockfd, (char *)layer->recvBuffer, layer->conf.recvBufferSize, 0);
+#else
+    ssize_t length = read(layer->sockfd, layer->recvBuffer, layer->conf.recvBufferSize);
+#endif
+    if(length <= 0)
+        return UA_STATUSCODE_BADCONNECTIONCLOSED;
+    buf->data = layer->recvBuffer;
+    buf->length = length;
+    return UA_STATUSCODE_GOOD;
+}
+
+static void ClientNetworkLayerTCP_delete(ClientNetworkLayerTCP *layer) {
+    ClientNetworkLayerTCP_disconnect(layer);
+    free(layer->recvBuffer);
+    free(layer);
+}
+
+UA_ClientNetworkLayer ClientNetworkLayerTCP_new(UA_ConnectionConfig conf) {
+    ClientNetworkLayerTCP *tcplayer = malloc(sizeof(ClientNetworkLayerTCP));
+    tcplayer->conf = conf;
+    tcplayer->sockfd = -1;
+    tcplayer->recvBuffer = malloc(conf.recvBufferSize);
+
+    UA_ClientNetworkLayer nl;
+    nl.nlHandle = tcplayer;
+    nl.connect = (UA_StatusCode (*)(void*, const char*))ClientNetworkLayerTCP_connect;
+    nl.disconnect = (void (*)(void*))ClientNetworkLayerTCP_disconnect;
+    nl.send = (UA_StatusCode (*)(void*, UA_ByteStringArray))ClientNetworkLayerTCP_send;
+    nl.receive = (UA_StatusCode (*)(void*, UA_ByteString*, UA_UInt32))ClientNetworkLayerTCP_receive;
+    nl.free = (void (*)(void*))ClientNetworkLayerTCP_delete;
+    return nl;
+}
@@ -0,0 +1,22 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#ifndef NETWORKLAYERTCPCLIENT_H_
+#define NETWORKLAYERTCPCLIENT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ua_client.h"
+
+/** @brief Create a client networklayer that connects to opc.tcp:// endpoints */
+UA_ClientNetworkLayer ClientNetworkLayerTCP_new(UA_ConnectionConfig conf);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* NETWORKLAYERTCPCLIENT_H_ */
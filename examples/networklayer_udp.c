@@ -3,7 +3,9 @@
  * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
  */
 
+#define _GNU_SOURCE // recvmmsg, sendmmsg
 #include <stdlib.h> // malloc, free
+#include <string.h> // memcpy
 #ifdef _WIN32
 #include <malloc.h>
 #include <winsock2.h>
@@ -33,8 +35,11 @@
 #endif
 
 #define MAXBACKLOG 100
+#define MAXBATCHSIZE 32 // datagrams that are received with a single call
+#define RESPONSEBUFFERSIZE 65536 // responses of a batch that are collected before sending
 
 struct ServerNetworklayerUDP;
+struct UDPBatch;
 
 /* Forwarded to the server as a (UA_Connection) and used for callbacks back into
    the networklayer */
@@ -43,8 +48,24 @@ typedef struct {
 	struct sockaddr from;
 	socklen_t fromlen;
 	struct ServerNetworkLayerUDP *layer;
+    struct UDPBatch *batch;
 } UDPConnection;
 
+/* The connections of the datagrams received with one call. The batch is
+   recycled when all datagrams are processed. Without multithreading, the
+   responses are collected and sent with one call at the end of the batch. */
+typedef struct UDPBatch {
+    struct UDPBatch *next; // in the list of free batches
+    UDPConnection connections[MAXBATCHSIZE];
+#ifndef UA_MULTITHREADING
+    UA_UInt32 responsesSize;
+    size_t responseBufferUsed;
+    UDPConnection *responseTo[MAXBATCHSIZE];
+    struct iovec responseIov[MAXBATCHSIZE];
+    UA_Byte responseBuffer[RESPONSEBUFFERSIZE];
+#endif
+} UDPBatch;
+
 typedef struct ServerNetworkLayerUDP {
 	UA_ConnectionConfig conf;
 	fd_set fdset;
@@ -54,6 +75,10 @@ typedef struct ServerNetworkLayerUDP {
 	UA_Int32 serversockfd;
 #endif
     UA_UInt32 port;
+    UA_Byte *recvBuffer; // MAXBATCHSIZE datagrams of recvBufferSize. reused for every batch
+    UA_BufferPool *bufferPool; // the datagrams are copied to right-sized buffers from the pool
+    UDPBatch *freeBatches; // only used in the main thread
+    UDPBatch *recycledBatches; // batches are returned here with atomic operations
 } ServerNetworkLayerUDP;
 
 static UA_StatusCode setNonBlocking(int sockid) {
@@ -76,14 +101,14 @@ static void setFDSet(ServerNetworkLayerUDP *layer) {
 
 // the callbacks are thread-safe if UA_MULTITHREADING is defined
 static void closeConnectionUDP(UDPConnection *handle) {
-	free(handle);
+    // the connection is recycled with its batch
+	handle->connection.state = UA_CONNECTION_CLOSING;
 }
 
 void writeCallbackUDP(UDPConnection *handle, UA_ByteStringArray gather_buf);
 
 /** Accesses only the sockfd in the handle. Can be run from parallel threads. */
-void writeCallbackUDP(UDPConnection *handle, UA_ByteStringArray gather_buf) {
-	UA_UInt32 total_len = 0, nWritten = 0;
+static void sendDatagram(UDPConnection *handle, UA_ByteStringArray gather_buf) {
 #ifdef _WIN32
 	/*
 	LPWSABUF buf = _alloca(gather_buf.stringsSize * sizeof(WSABUF));
@@ -113,11 +138,10 @@ void writeCallbackUDP(UDPConnection *handle, UA_ByteStringArray gather_buf) {
 	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
 		iov[i] = (struct iovec) {.iov_base = gather_buf.strings[i].data,
                                  .iov_len = gather_buf.strings[i].length};
-		total_len += gather_buf.strings[i].length;
 	}
 
 
-	struct sockaddr_in *sin = UA_NULL;
+	struct sockaddr_in *sin = NULL;
 	if (handle->from.sa_family == AF_INET) {
         
 #if defined(__GNUC__) || defined(__clang__)
@@ -137,17 +161,118 @@ void writeCallbackUDP(UDPConnection *handle, UA_ByteStringArray gather_buf) {
 	struct msghdr message = {.msg_name = sin, .msg_namelen = handle->fromlen, .msg_iov = iov,
 							 .msg_iovlen = gather_buf.stringsSize, .msg_control = NULL,
 							 .msg_controllen = 0, .msg_flags = 0};
-	while (nWritten < total_len) {
-		UA_Int32 n = 0;
-		do {
-            n = sendmsg(handle->layer->serversockfd, &message, 0);
-            if(n==-1L){
-            	printf("ERROR:%i\n", errno);
-            }
-        } while (n == -1L && errno == EINTR);
-        nWritten += n;
-	}
+    // a datagram is sent as a whole or not at all
+	UA_Int32 n = 0;
+	do {
+        n = sendmsg(handle->layer->serversockfd, &message, 0);
+    } while (n == -1L && errno == EINTR);
+    if(n == -1L)
+        printf("ERROR:%i\n", errno);
+#endif
+}
+
+#ifndef UA_MULTITHREADING
+/** Sends the collected responses of the batch */
+static void flushResponses(ServerNetworkLayerUDP *layer, UDPBatch *batch) {
+    struct mmsghdr msgs[MAXBATCHSIZE];
+    for(UA_UInt32 i = 0; i < batch->responsesSize; i++) {
+        UDPConnection *c = batch->responseTo[i];
+        msgs[i].msg_hdr = (struct msghdr){.msg_name = &c->from, .msg_namelen = c->fromlen,
+                                          .msg_iov = &batch->responseIov[i], .msg_iovlen = 1,
+                                          .msg_control = NULL, .msg_controllen = 0, .msg_flags = 0};
+        msgs[i].msg_len = 0;
+    }
+    UA_UInt32 sent = 0;
+    while(sent < batch->responsesSize) {
+        int n = sendmmsg(layer->serversockfd, &msgs[sent], batch->responsesSize - sent, 0);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            printf("ERROR:%i\n", errno);
+            break;
+        }
+        sent += n;
+    }
+    batch->responsesSize = 0;
+    batch->responseBufferUsed = 0;
+}
+#endif
+
+/** Without multithreading, the response is copied into the batch and sent
+    when the batch is done */
+void writeCallbackUDP(UDPConnection *handle, UA_ByteStringArray gather_buf) {
+#ifndef UA_MULTITHREADING
+    UDPBatch *batch = handle->batch;
+    size_t total_len = 0;
+	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++)
+		total_len += gather_buf.strings[i].length;
+    if(batch->responsesSize == MAXBATCHSIZE ||
+       batch->responseBufferUsed + total_len > RESPONSEBUFFERSIZE)
+        flushResponses(handle->layer, batch);
+    if(handle->from.sa_family == AF_INET && total_len <= RESPONSEBUFFERSIZE) {
+        UA_Byte *data = &batch->responseBuffer[batch->responseBufferUsed];
+        size_t pos = 0;
+        for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
+            memcpy(&data[pos], gather_buf.strings[i].data, gather_buf.strings[i].length);
+            pos += gather_buf.strings[i].length;
+        }
+        batch->responseTo[batch->responsesSize] = handle;
+        batch->responseIov[batch->responsesSize] = (struct iovec){.iov_base = data, .iov_len = total_len};
+        batch->responseBufferUsed += total_len;
+        batch->responsesSize++;
+        return;
+    }
 #endif
+    sendDatagram(handle, gather_buf);
+}
+
+/** Takes a batch from the list of free batches or allocates a new one. Call
+    from the main thread only. */
+static UDPBatch * getBatch(ServerNetworkLayerUDP *layer) {
+    if(!layer->freeBatches) {
+#ifdef UA_MULTITHREADING
+        layer->freeBatches = uatomic_xchg(&layer->recycledBatches, NULL);
+#else
+        layer->freeBatches = layer->recycledBatches;
+        layer->recycledBatches = NULL;
+#endif
+    }
+    UDPBatch *batch = layer->freeBatches;
+    if(batch) {
+        layer->freeBatches = batch->next;
+        return batch;
+    }
+    batch = malloc(sizeof(UDPBatch));
+#ifndef UA_MULTITHREADING
+    if(batch) {
+        batch->responsesSize = 0;
+        batch->responseBufferUsed = 0;
+    }
+#endif
+    return batch;
+}
+
+static void recycleBatch(ServerNetworkLayerUDP *layer, UDPBatch *batch) {
+#ifdef UA_MULTITHREADING
+    while(1) {
+        batch->next = layer->recycledBatches;
+        if(uatomic_cmpxchg(&layer->recycledBatches, batch->next, batch) == batch->next)
+            break;
+    }
+#else
+    batch->next = layer->recycledBatches;
+    layer->recycledBatches = batch;
+#endif
+}
+
+/* Dispatched as delayed work after the datagrams of the batch. So all
+   datagrams are processed when it runs. */
+static void batchDone(UA_Server *server, UDPBatch *batch) {
+    ServerNetworkLayerUDP *layer = batch->connections[0].layer;
+#ifndef UA_MULTITHREADING
+    flushResponses(layer, batch);
+#endif
+    recycleBatch(layer, batch);
 }
 
 static UA_StatusCode ServerNetworkLayerUDP_start(ServerNetworkLayerUDP *layer) {
@@ -195,9 +320,11 @@ static UA_StatusCode ServerNetworkLayerUDP_start(ServerNetworkLayerUDP *layer) {
     return UA_STATUSCODE_GOOD;
 }
 
+/** Receives up to MAXBATCHSIZE datagrams with a single call. The datagrams are
+    copied out of the shared receive buffer into buffers of their actual size. */
 static UA_Int32 ServerNetworkLayerUDP_getWork(ServerNetworkLayerUDP *layer, UA_WorkItem **workItems,
                                         UA_UInt16 timeout) {
-    UA_WorkItem *items = UA_NULL;
+    UA_WorkItem *items = NULL;
     setFDSet(layer);
     struct timeval tmptv = {0, timeout};
     UA_Int32 resultsize = select(layer->serversockfd+1, &layer->fdset, NULL, NULL, &tmptv);
@@ -207,63 +334,70 @@ static UA_Int32 ServerNetworkLayerUDP_getWork(ServerNetworkLayerUDP *layer, UA_W
         return 0;
     }
 
-    items = malloc(sizeof(UA_WorkItem)*(resultsize));
-
-	// read from established sockets
-    UA_Int32 j = 0;
-	UA_ByteString buf = { -1, NULL};
-		if(!buf.data) {
-			buf.data = malloc(sizeof(UA_Byte) * layer->conf.recvBufferSize);
-			if(!buf.data){
-				//TODO:
-				printf("malloc failed");
-			}
-		}
-
-		struct sockaddr sender;
-		socklen_t sendsize = sizeof(sender);
-		bzero(&sender, sizeof(sender));
-
-#ifdef _WIN32
-        buf.length = recvfrom(layer->conLinks[i].sockfd, (char *)buf.data,
-                          layer->conf.recvBufferSize, 0);
-        //todo: fixme
-#else
-        buf.length = recvfrom(layer->serversockfd, buf.data, layer->conf.recvBufferSize, 0, &sender, &sendsize);
-#endif
-
-        if (buf.length <= 0) {
-        } else {
-            UDPConnection *c = malloc(sizeof(UDPConnection));
-
-        	if(!c)
-        		return UA_STATUSCODE_BADINTERNALERROR;
-            c->layer = layer;
-            c->from = sender;
-            c->fromlen = sendsize;
-            c->connection.state = UA_CONNECTION_OPENING;
-            c->connection.localConf = layer->conf;
-            c->connection.channel = UA_NULL;
-            c->connection.close = (void (*)(void*))closeConnectionUDP;
-            c->connection.write = (void (*)(void*, UA_ByteStringArray))writeCallbackUDP;
-
-
-            items[j].type = UA_WORKITEMTYPE_BINARYNETWORKMESSAGE;
-            items[j].work.binaryNetworkMessage.message = buf;
-            items[j].work.binaryNetworkMessage.connection = (UA_Connection*)c;
-            buf.data = NULL;
-            j++;
-        }
+    UDPBatch *batch = NULL;
+    if(layer->recvBuffer)
+        batch = getBatch(layer);
+    if(!batch) {
+        *workItems = NULL;
+        return 0;
+    }
 
+    // read up to MAXBATCHSIZE datagrams
+    struct mmsghdr msgs[MAXBATCHSIZE];
+    struct iovec iov[MAXBATCHSIZE];
+    for(UA_Int32 i = 0; i < MAXBATCHSIZE; i++) {
+        iov[i] = (struct iovec){.iov_base = &layer->recvBuffer[i * layer->conf.recvBufferSize],
+                                .iov_len = layer->conf.recvBufferSize};
+        msgs[i].msg_hdr = (struct msghdr){.msg_name = &batch->connections[i].from,
+                                          .msg_namelen = sizeof(struct sockaddr), .msg_iov = &iov[i],
+                                          .msg_iovlen = 1, .msg_control = NULL, .msg_controllen = 0,
+                                          .msg_flags = 0};
+        msgs[i].msg_len = 0;
+    }
+    UA_Int32 received;
+    do {
+        received = recvmmsg(layer->serversockfd, msgs, MAXBATCHSIZE, MSG_DONTWAIT, NULL);
+    } while(received == -1 && errno == EINTR);
+
+    if(received > 0)
+        items = malloc(sizeof(UA_WorkItem) * (received + 1));
+    if(!items) {
+        recycleBatch(layer, batch);
+        *workItems = NULL;
+        return 0;
+    }
 
-    if(buf.data)
-        free(buf.data);
+    UA_Int32 j = 0;
+    for(UA_Int32 i = 0; i < received; i++) {
+        if(msgs[i].msg_len == 0 || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+            continue;
+        UA_ByteString buf;
+        if(UA_BufferPool_take(layer->bufferPool, &buf, msgs[i].msg_len) != UA_STATUSCODE_GOOD)
+            break;
+        memcpy(buf.data, iov[i].iov_base, buf.length);
+
+        UDPConnection *c = &batch->connections[i];
+        c->layer = layer;
+        c->batch = batch;
+        c->fromlen = msgs[i].msg_hdr.msg_namelen;
+        c->connection.state = UA_CONNECTION_OPENING;
+        c->connection.localConf = layer->conf;
+        c->connection.channel = NULL;
+        c->connection.close = (void (*)(void*))closeConnectionUDP;
+        c->connection.write = (void (*)(void*, UA_ByteStringArray))writeCallbackUDP;
+
+        items[j].type = UA_WORKITEMTYPE_POOLEDBINARYNETWORKMESSAGE;
+        items[j].work.binaryNetworkMessage.message = buf;
+        items[j].work.binaryNetworkMessage.connection = (UA_Connection*)c;
+        j++;
+    }
 
-    if(j == 0) {
-        free(items);
-        *workItems = NULL;
-    } else
-        *workItems = items;
+    // the batch is recycled after all its datagrams are processed
+    items[j] = (UA_WorkItem)
+        {.type = UA_WORKITEMTYPE_DELAYEDMETHODCALL,
+         .work.methodCall = {.data = batch, .method = (void (*)(UA_Server*, void*))batchDone}};
+    j++;
+    *workItems = items;
     return j;
 }
 
@@ -272,7 +406,19 @@ static UA_Int32 ServerNetworkLayerUDP_stop(ServerNetworkLayerUDP * layer, UA_Wor
 	return 0;
 }
 
+static void freeBatchList(UDPBatch *batch) {
+    while(batch) {
+        UDPBatch *next = batch->next;
+        free(batch);
+        batch = next;
+    }
+}
+
 static void ServerNetworkLayerUDP_delete(ServerNetworkLayerUDP *layer) {
+    freeBatchList(layer->freeBatches);
+    freeBatchList(layer->recycledBatches);
+    free(layer->recvBuffer);
+    UA_BufferPool_delete(layer->bufferPool);
 	free(layer);
 }
 
@@ -280,6 +426,10 @@ UA_ServerNetworkLayer ServerNetworkLayerUDP_new(UA_ConnectionConfig conf, UA_UIn
     ServerNetworkLayerUDP *udplayer = malloc(sizeof(ServerNetworkLayerUDP));
 	udplayer->conf = conf;
     udplayer->port = port;
+    udplayer->recvBuffer = malloc(MAXBATCHSIZE * conf.recvBufferSize);
+    udplayer->bufferPool = UA_BufferPool_new();
+    udplayer->freeBatches = NULL;
+    udplayer->recycledBatches = NULL;
 
     UA_ServerNetworkLayer nl;
     nl.nlHandle = udplayer;
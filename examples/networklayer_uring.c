@@ -0,0 +1,648 @@
+ /*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#define _GNU_SOURCE // syscall
+#include <stdlib.h> // malloc, free
+#include <stdint.h> // uintptr_t
+#include <string.h> // memset, memcpy
+#include <stdio.h>
+#include <errno.h> // errno, ETIME
+#include <unistd.h> // close, syscall
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "networklayer_uring.h" // UA_MULTITHREADING is defined in here
+#include "networklayer_tcp.h" // the fallback
+
+#ifdef UA_MULTITHREADING
+#include <pthread.h>
+#define LOCK_RING(l) pthread_mutex_lock(&(l)->ringMutex)
+#define UNLOCK_RING(l) pthread_mutex_unlock(&(l)->ringMutex)
+#else
+#define LOCK_RING(l)
+#define UNLOCK_RING(l)
+#endif
+
+#define MAXBACKLOG 100
+#define RINGENTRIES 256
+#define RECVBUFFERS 32 // provided buffers of recvBufferSize. must be a power of two
+#define RECVBUFFERGROUP 0
+#define MAXWRITEIOV 16 // queued responses that are gathered into one writev
+
+/* The operation is encoded in the lower bits of the user data of a submission.
+   The upper bits hold the pointer to the connection. */
+enum {
+    OP_ACCEPT = 1,
+    OP_RECV = 2,
+    OP_WRITE = 3
+};
+#define OP_MASK 3
+
+struct NetworkLayerURing;
+
+/* A response that waits to be written. The data follows the struct in the same
+   allocation. */
+typedef struct QueuedWrite {
+    struct QueuedWrite *next;
+    size_t length;
+    UA_Byte *data;
+} QueuedWrite;
+
+/* Forwarded to the server as a (UA_Connection) and used for callbacks back into
+   the networklayer */
+typedef struct {
+	UA_Connection connection;
+	UA_Int32 sockfd;
+	struct NetworkLayerURing *layer;
+    UA_UInt32 pendingOps; // submitted operations that have not completed
+    UA_Boolean closing; // freed when no operations are pending
+    /* Responses are written in order. Only one writev is in flight per
+       connection. It gathers the queued responses from the first one on. */
+    QueuedWrite *writeQueueFirst;
+    QueuedWrite *writeQueueLast;
+    size_t writeOffset; // bytes of the first queued response that are written
+    UA_Boolean writing;
+    struct iovec iov[MAXWRITEIOV];
+} URingConnection;
+
+typedef struct NetworkLayerURing {
+	UA_ConnectionConfig conf;
+    UA_UInt32 port;
+	UA_Int32 serversockfd;
+    UA_Boolean accepting; // the multishot accept is armed
+    UA_Boolean stopping;
+
+    // the ring. the submissions are prepared with the mutex held.
+    UA_Int32 ringfd;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned sqPending; // prepared submissions that are not yet handed to the kernel
+
+    // the provided receive buffers
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    UA_Byte *recvBuffers;
+    UA_BufferPool *bufferPool; // the messages are copied to right-sized buffers from the pool
+
+    UA_UInt16 conLinksSize;
+    URingConnection **conLinks;
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t ringMutex; // the workers write responses into the ring
+#endif
+} NetworkLayerURing;
+
+/********/
+/* Ring */
+/********/
+
+static int uringEnter(int ringfd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                      void *arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, ringfd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static void * mapRing(NetworkLayerURing *layer, size_t size, off_t offset) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, layer->ringfd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void deleteRing(NetworkLayerURing *layer) {
+    if(layer->bufRing)
+        munmap(layer->bufRing, layer->bufRingSize);
+    free(layer->recvBuffers);
+    if(layer->sqes)
+        munmap(layer->sqes, layer->sqesSize);
+    if(layer->cqRing && layer->cqRing != layer->sqRing)
+        munmap(layer->cqRing, layer->cqRingSize);
+    if(layer->sqRing)
+        munmap(layer->sqRing, layer->sqRingSize);
+    if(layer->ringfd >= 0)
+        close(layer->ringfd);
+}
+
+/* Hands the buffer back to the kernel for the next receive. Call from the main
+   thread only. */
+static void provideBuffer(NetworkLayerURing *layer, UA_UInt16 bid) {
+    UA_UInt16 tail = layer->bufRing->tail;
+    // assign the members one by one. the tail overlaps with the first entry.
+    struct io_uring_buf *buf = &layer->bufRing->bufs[tail & (RECVBUFFERS - 1)];
+    buf->addr = (UA_UInt64)(uintptr_t)&layer->recvBuffers[bid * layer->conf.recvBufferSize];
+    buf->len = layer->conf.recvBufferSize;
+    buf->bid = bid;
+    __atomic_store_n(&layer->bufRing->tail, (UA_UInt16)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/* Fails if the kernel does not support io_uring or the features we use */
+static UA_StatusCode initRing(NetworkLayerURing *layer) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    layer->ringfd = (UA_Int32)syscall(__NR_io_uring_setup, RINGENTRIES, &p);
+    if(layer->ringfd < 0 || !(p.features & IORING_FEAT_EXT_ARG))
+        return UA_STATUSCODE_BADINTERNALERROR;
+
+    layer->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    layer->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(layer->cqRingSize > layer->sqRingSize)
+            layer->sqRingSize = layer->cqRingSize;
+        layer->sqRing = mapRing(layer, layer->sqRingSize, IORING_OFF_SQ_RING);
+        layer->cqRing = layer->sqRing;
+    } else {
+        layer->sqRing = mapRing(layer, layer->sqRingSize, IORING_OFF_SQ_RING);
+        layer->cqRing = mapRing(layer, layer->cqRingSize, IORING_OFF_CQ_RING);
+    }
+    layer->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    layer->sqes = mapRing(layer, layer->sqesSize, IORING_OFF_SQES);
+    if(!layer->sqRing || !layer->cqRing || !layer->sqes)
+        return UA_STATUSCODE_BADINTERNALERROR;
+
+    UA_Byte *sq = layer->sqRing;
+    layer->sqHead = (unsigned*)(sq + p.sq_off.head);
+    layer->sqTail = (unsigned*)(sq + p.sq_off.tail);
+    layer->sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    layer->sqArray = (unsigned*)(sq + p.sq_off.array);
+    UA_Byte *cq = layer->cqRing;
+    layer->cqHead = (unsigned*)(cq + p.cq_off.head);
+    layer->cqTail = (unsigned*)(cq + p.cq_off.tail);
+    layer->cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    layer->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // register the provided buffers
+    layer->bufRingSize = RECVBUFFERS * sizeof(struct io_uring_buf);
+    void *bufRing = mmap(NULL, layer->bufRingSize, PROT_READ | PROT_WRITE,
+                         MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if(bufRing == MAP_FAILED)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    layer->bufRing = bufRing;
+    layer->recvBuffers = malloc(RECVBUFFERS * layer->conf.recvBufferSize);
+    if(!layer->recvBuffers)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (UA_UInt64)(uintptr_t)layer->bufRing;
+    reg.ring_entries = RECVBUFFERS;
+    reg.bgid = RECVBUFFERGROUP;
+    if(syscall(__NR_io_uring_register, layer->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    for(UA_UInt16 i = 0; i < RECVBUFFERS; i++)
+        provideBuffer(layer, i);
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Returns the next free submission entry. Call with the mutex held. */
+static struct io_uring_sqe * getSqe(NetworkLayerURing *layer) {
+    unsigned tail = *layer->sqTail;
+    if(tail - __atomic_load_n(layer->sqHead, __ATOMIC_ACQUIRE) > *layer->sqMask) {
+        // the queue is full. hand the prepared submissions to the kernel.
+        uringEnter(layer->ringfd, layer->sqPending, 0, 0, NULL, 0);
+        layer->sqPending = 0;
+        if(tail - __atomic_load_n(layer->sqHead, __ATOMIC_ACQUIRE) > *layer->sqMask)
+            return NULL;
+    }
+    unsigned index = tail & *layer->sqMask;
+    struct io_uring_sqe *sqe = &layer->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    layer->sqArray[index] = index;
+    // the kernel reads the entry only when it is submitted with the mutex held
+    __atomic_store_n(layer->sqTail, tail + 1, __ATOMIC_RELEASE);
+    layer->sqPending++;
+    return sqe;
+}
+
+static void armAccept(NetworkLayerURing *layer) {
+    struct io_uring_sqe *sqe = getSqe(layer);
+    if(!sqe)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = layer->serversockfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = OP_ACCEPT;
+    layer->accepting = UA_TRUE;
+}
+
+static void armRecv(NetworkLayerURing *layer, URingConnection *c) {
+    struct io_uring_sqe *sqe = getSqe(layer);
+    if(!sqe)
+        return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECVBUFFERGROUP;
+    sqe->user_data = (UA_UInt64)(uintptr_t)c | OP_RECV;
+    c->pendingOps++;
+}
+
+/* Writes the queued responses if no write is in flight */
+static void submitWrite(NetworkLayerURing *layer, URingConnection *c) {
+    if(c->writing || c->closing || !c->writeQueueFirst)
+        return;
+    struct io_uring_sqe *sqe = getSqe(layer);
+    if(!sqe)
+        return; // retried when the next write completes or is queued
+    UA_UInt32 count = 0;
+    size_t offset = c->writeOffset;
+    for(QueuedWrite *w = c->writeQueueFirst; w && count < MAXWRITEIOV; w = w->next) {
+        c->iov[count] = (struct iovec){.iov_base = w->data + offset, .iov_len = w->length - offset};
+        offset = 0;
+        count++;
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = c->sockfd;
+    sqe->addr = (UA_UInt64)(uintptr_t)c->iov;
+    sqe->len = count;
+    sqe->user_data = (UA_UInt64)(uintptr_t)c | OP_WRITE;
+    c->writing = UA_TRUE;
+    c->pendingOps++;
+}
+
+/***************/
+/* Connections */
+/***************/
+
+static void freeConnection(URingConnection *c) {
+    while(c->writeQueueFirst) {
+        QueuedWrite *w = c->writeQueueFirst;
+        c->writeQueueFirst = w->next;
+        free(w);
+    }
+    free(c);
+}
+
+static void freeConnectionCallback(UA_Server *server, URingConnection *c) {
+    freeConnection(c);
+}
+
+/* The pending operations complete with an error after the shutdown. The socket
+   is closed and the connection is freed when no operations are left. Call with
+   the mutex held. */
+static void closeConnectionLocked(URingConnection *c) {
+    if(c->closing)
+        return;
+    c->closing = UA_TRUE;
+    c->connection.state = UA_CONNECTION_CLOSING;
+    UA_Connection_detachSecureChannel(&c->connection);
+    shutdown(c->sockfd, SHUT_RDWR);
+}
+
+// the callbacks are thread-safe if UA_MULTITHREADING is defined
+static void closeConnectionURing(URingConnection *c) {
+    LOCK_RING(c->layer);
+    closeConnectionLocked(c);
+    UNLOCK_RING(c->layer);
+}
+
+/** The response is copied and queued. Without multithreading, it is handed to
+    the kernel in the next iteration of the main loop together with the other
+    responses. */
+static void writeCallbackURing(URingConnection *c, UA_ByteStringArray gather_buf) {
+    size_t total_len = 0;
+	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
+        if(gather_buf.strings[i].length > 0)
+            total_len += gather_buf.strings[i].length;
+    }
+    QueuedWrite *w = malloc(sizeof(QueuedWrite) + total_len);
+    if(!w) {
+        closeConnectionURing(c);
+        return;
+    }
+    w->next = NULL;
+    w->length = total_len;
+    w->data = (UA_Byte*)&w[1];
+    size_t pos = 0;
+	for(UA_UInt32 i=0;i<gather_buf.stringsSize;i++) {
+        if(gather_buf.strings[i].length <= 0)
+            continue;
+        memcpy(&w->data[pos], gather_buf.strings[i].data, gather_buf.strings[i].length);
+        pos += gather_buf.strings[i].length;
+    }
+
+    NetworkLayerURing *layer = c->layer;
+    LOCK_RING(layer);
+    if(c->closing) {
+        UNLOCK_RING(layer);
+        free(w);
+        return;
+    }
+    if(c->writeQueueLast)
+        c->writeQueueLast->next = w;
+    else
+        c->writeQueueFirst = w;
+    c->writeQueueLast = w;
+    submitWrite(layer, c);
+#ifdef UA_MULTITHREADING
+    // the main loop might wait for completions for a while
+    uringEnter(layer->ringfd, layer->sqPending, 0, 0, NULL, 0);
+    layer->sqPending = 0;
+#endif
+    UNLOCK_RING(layer);
+}
+
+/* Call with the mutex held */
+static void addConnection(NetworkLayerURing *layer, UA_Int32 sockfd) {
+    int i = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (void *)&i, sizeof(i));
+    URingConnection *c = malloc(sizeof(URingConnection));
+    URingConnection **links = realloc(layer->conLinks, sizeof(URingConnection*) * (layer->conLinksSize + 1));
+    if(!c || !links) {
+        free(c);
+        if(links)
+            layer->conLinks = links;
+        close(sockfd);
+        return;
+    }
+    memset(c, 0, sizeof(URingConnection));
+	c->sockfd = sockfd;
+    c->layer = layer;
+    c->connection.state = UA_CONNECTION_OPENING;
+    c->connection.localConf = layer->conf;
+    c->connection.channel = NULL;
+    c->connection.close = (void (*)(void*))closeConnectionURing;
+    c->connection.write = (void (*)(void*, UA_ByteStringArray))writeCallbackURing;
+    layer->conLinks = links;
+    layer->conLinks[layer->conLinksSize] = c;
+    layer->conLinksSize++;
+    armRecv(layer, c);
+}
+
+/***************/
+/* Completions */
+/***************/
+
+/* Returns the number of work items. Call with the mutex held. */
+static UA_Int32 processRecv(NetworkLayerURing *layer, URingConnection *c, const struct io_uring_cqe *cqe,
+                            UA_WorkItem *items) {
+    UA_Boolean more = cqe->flags & IORING_CQE_F_MORE;
+    if(!more)
+        c->pendingOps--; // the multishot receive has ended
+    if(cqe->res == -ENOBUFS) {
+        // all buffers were in use. they are provided again by now.
+        if(!more && !c->closing)
+            armRecv(layer, c);
+        return 0;
+    }
+    if(cqe->res <= 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+        // closed by the client or failed
+        if(!more)
+            closeConnectionLocked(c);
+        return 0;
+    }
+
+    UA_Int32 count = 0;
+    UA_UInt16 bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if(!c->closing) {
+        // copy out of the provided buffer into a right-sized buffer from the pool
+        UA_ByteString buf;
+        if(UA_BufferPool_take(layer->bufferPool, &buf, cqe->res) == UA_STATUSCODE_GOOD) {
+            memcpy(buf.data, &layer->recvBuffers[bid * layer->conf.recvBufferSize], buf.length);
+            items[0].type = UA_WORKITEMTYPE_POOLEDBINARYNETWORKMESSAGE;
+            items[0].work.binaryNetworkMessage.message = buf;
+            items[0].work.binaryNetworkMessage.connection = &c->connection;
+            count = 1;
+            if(!more)
+                armRecv(layer, c);
+        } else
+            closeConnectionLocked(c); // the data is lost, so the stream is out of sync
+    }
+    provideBuffer(layer, bid);
+    return count;
+}
+
+/* Call with the mutex held */
+static void processWrite(NetworkLayerURing *layer, URingConnection *c, const struct io_uring_cqe *cqe) {
+    c->pendingOps--;
+    c->writing = UA_FALSE;
+    if(cqe->res < 0) {
+        closeConnectionLocked(c);
+        return;
+    }
+    size_t written = cqe->res;
+    while(written > 0 && c->writeQueueFirst) {
+        QueuedWrite *w = c->writeQueueFirst;
+        size_t rest = w->length - c->writeOffset;
+        if(written < rest) {
+            c->writeOffset += written;
+            break;
+        }
+        written -= rest;
+        c->writeOffset = 0;
+        c->writeQueueFirst = w->next;
+        if(!c->writeQueueFirst)
+            c->writeQueueLast = NULL;
+        free(w);
+    }
+    submitWrite(layer, c);
+}
+
+/* Removes the closed connections without pending operations. Returns the
+   number of work items. Call with the mutex held. */
+static UA_Int32 removeClosedConnections(NetworkLayerURing *layer, UA_WorkItem *items) {
+    UA_Int32 count = 0;
+    for(UA_Int32 i = 0; i < layer->conLinksSize;) {
+        URingConnection *c = layer->conLinks[i];
+        if(!c->closing || c->pendingOps > 0) {
+            i++;
+            continue;
+        }
+        close(c->sockfd);
+        layer->conLinksSize--;
+        layer->conLinks[i] = layer->conLinks[layer->conLinksSize];
+        items[count] = (UA_WorkItem)
+            {.type = UA_WORKITEMTYPE_DELAYEDMETHODCALL,
+             .work.methodCall = {.data = c,
+                                 .method = (void (*)(UA_Server*,void*))freeConnectionCallback} };
+        count++;
+    }
+    return count;
+}
+
+/******************/
+/* Networklayer   */
+/******************/
+
+static UA_StatusCode NetworkLayerURing_start(NetworkLayerURing *layer) {
+    if((layer->serversockfd = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("ERROR opening socket");
+		return UA_STATUSCODE_BADINTERNALERROR;
+	}
+
+	const struct sockaddr_in serv_addr = {
+        .sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY,
+        .sin_port = htons(layer->port), .sin_zero = {0}};
+
+	int optval = 1;
+	if(setsockopt(layer->serversockfd, SOL_SOCKET, SO_REUSEADDR,
+                  (const char *)&optval, sizeof(optval)) == -1) {
+		perror("setsockopt");
+		close(layer->serversockfd);
+		return UA_STATUSCODE_BADINTERNALERROR;
+	}
+
+	if(bind(layer->serversockfd, (const struct sockaddr *)&serv_addr,
+            sizeof(serv_addr)) < 0) {
+		perror("binding");
+		close(layer->serversockfd);
+		return UA_STATUSCODE_BADINTERNALERROR;
+	}
+
+	listen(layer->serversockfd, MAXBACKLOG);
+    printf("Listening for TCP connections (io_uring) on %s:%d\n",
+           inet_ntoa(serv_addr.sin_addr),
+           ntohs(serv_addr.sin_port));
+    LOCK_RING(layer);
+    armAccept(layer);
+    UNLOCK_RING(layer);
+    return UA_STATUSCODE_GOOD;
+}
+
+/** Hands the prepared submissions to the kernel and waits for completions in
+    the same call */
+static UA_Int32 NetworkLayerURing_getWork(NetworkLayerURing *layer, UA_WorkItem **workItems,
+                                          UA_UInt16 timeout) {
+    LOCK_RING(layer);
+    if(!layer->accepting && !layer->stopping)
+        armAccept(layer);
+    unsigned toSubmit = layer->sqPending;
+    layer->sqPending = 0;
+    UNLOCK_RING(layer);
+
+    struct __kernel_timespec ts = {.tv_sec = 0, .tv_nsec = timeout * 1000};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (UA_UInt64)(uintptr_t)&ts;
+    uringEnter(layer->ringfd, toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+               &arg, sizeof(arg)); // fails with ETIME if nothing completed
+
+    LOCK_RING(layer);
+    unsigned head = *layer->cqHead;
+    unsigned tail = __atomic_load_n(layer->cqTail, __ATOMIC_ACQUIRE);
+    UA_WorkItem *items = malloc(sizeof(UA_WorkItem) * (tail - head + layer->conLinksSize + 1));
+    if(!items) {
+        UNLOCK_RING(layer);
+        *workItems = NULL;
+        return 0;
+    }
+    UA_Int32 j = 0;
+    for(;head != tail; head++) {
+        const struct io_uring_cqe *cqe = &layer->cqes[head & *layer->cqMask];
+        URingConnection *c = (URingConnection*)(uintptr_t)(cqe->user_data & ~(UA_UInt64)OP_MASK);
+        switch(cqe->user_data & OP_MASK) {
+        case OP_ACCEPT:
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+                layer->accepting = UA_FALSE; // rearmed in the next iteration
+            if(cqe->res >= 0) {
+                if(layer->stopping)
+                    close(cqe->res);
+                else
+                    addConnection(layer, cqe->res);
+            }
+            break;
+        case OP_RECV:
+            j += processRecv(layer, c, cqe, &items[j]);
+            break;
+        case OP_WRITE:
+            processWrite(layer, c, cqe);
+            break;
+        default:
+            break;
+        }
+    }
+    __atomic_store_n(layer->cqHead, head, __ATOMIC_RELEASE);
+
+    // new connections might have been added
+    UA_WorkItem *newItems = realloc(items, sizeof(UA_WorkItem) * (j + layer->conLinksSize + 1));
+    if(newItems) {
+        items = newItems;
+        j += removeClosedConnections(layer, &items[j]);
+    }
+    UNLOCK_RING(layer);
+
+    if(j == 0) {
+        free(items);
+        *workItems = NULL;
+    } else
+        *workItems = items;
+    return j;
+}
+
+/** Closes all connections and waits until their operations have completed */
+static UA_Int32 NetworkLayerURing_stop(NetworkLayerURing *layer, UA_WorkItem **workItems) {
+    LOCK_RING(layer);
+    layer->stopping = UA_TRUE;
+	for(UA_Int32 i = 0;i < layer->conLinksSize;i++)
+        closeConnectionLocked(layer->conLinks[i]);
+    UNLOCK_RING(layer);
+    close(layer->serversockfd);
+
+    UA_WorkItem *items = NULL;
+    UA_Int32 itemsSize = 0;
+    for(UA_Int32 round = 0; round < 100 && layer->conLinksSize > 0; round++) {
+        UA_WorkItem *work;
+        UA_Int32 workSize = NetworkLayerURing_getWork(layer, &work, 10000);
+        if(workSize <= 0)
+            continue;
+        UA_WorkItem *newItems = realloc(items, sizeof(UA_WorkItem) * (itemsSize + workSize));
+        if(newItems) {
+            items = newItems;
+            memcpy(&items[itemsSize], work, sizeof(UA_WorkItem) * workSize);
+            itemsSize += workSize;
+        }
+        free(work);
+    }
+    *workItems = items;
+    return itemsSize;
+}
+
+static void NetworkLayerURing_delete(NetworkLayerURing *layer) {
+	for(UA_Int32 i = 0;i < layer->conLinksSize;i++)
+		freeConnection(layer->conLinks[i]);
+	free(layer->conLinks);
+    deleteRing(layer); // cancels the remaining operations
+    UA_BufferPool_delete(layer->bufferPool);
+#ifdef UA_MULTITHREADING
+    pthread_mutex_destroy(&layer->ringMutex);
+#endif
+	free(layer);
+}
+
+UA_ServerNetworkLayer ServerNetworkLayerURing_new(UA_ConnectionConfig conf, UA_UInt32 port) {
+    NetworkLayerURing *layer = malloc(sizeof(NetworkLayerURing));
+    if(!layer)
+        return ServerNetworkLayerTCP_new(conf, port);
+    memset(layer, 0, sizeof(NetworkLayerURing));
+	layer->conf = conf;
+    layer->port = port;
+    layer->serversockfd = -1;
+    if(initRing(layer) != UA_STATUSCODE_GOOD) {
+        printf("io_uring is not available, falling back to select\n");
+        deleteRing(layer);
+        free(layer);
+        return ServerNetworkLayerTCP_new(conf, port);
+    }
+    layer->bufferPool = UA_BufferPool_new();
+#ifdef UA_MULTITHREADING
+    pthread_mutex_init(&layer->ringMutex, NULL);
+#endif
+
+    UA_ServerNetworkLayer nl;
+    nl.nlHandle = layer;
+    nl.start = (UA_StatusCode (*)(void*))NetworkLayerURing_start;
+    nl.getWork = (UA_Int32 (*)(void*, UA_WorkItem**, UA_UInt16)) NetworkLayerURing_getWork;
+    nl.stop = (UA_Int32 (*)(void*, UA_WorkItem**)) NetworkLayerURing_stop;
+    nl.free = (void (*)(void*))NetworkLayerURing_delete;
+    return nl;
+}
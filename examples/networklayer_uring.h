@@ -0,0 +1,31 @@
+/*
+ * This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information.
+ */
+
+#ifndef NETWORKLAYERURING_H_
+#define NETWORKLAYERURING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ua_server.h"
+
+/**
+ * @brief Create a TCP networklayer based on io_uring and listen to the
+ * specified port
+ *
+ * Connections are accepted with a multishot accept and read with multishot
+ * receives into a ring of provided buffers. Responses are written with writev
+ * submissions that are sent to the kernel in one call per main loop iteration.
+ * Requires Linux 6.0. If io_uring is not available, the select-based TCP
+ * networklayer is returned instead.
+ */
+UA_ServerNetworkLayer ServerNetworkLayerURing_new(UA_ConnectionConfig conf, UA_UInt32 port);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* NETWORKLAYERURING_H_ */
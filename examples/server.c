@@ -8,14 +8,18 @@
 #include <stdio.h>
 #include <stdlib.h> 
 #include <signal.h>
+#include <string.h> // strcmp
 #include <errno.h> // errno, EINTR
 
 // provided by the open62541 lib
 #include "ua_server.h"
 
 // provided by the user, implementations available in the /examples folder
-#include "logger_stdout.h"
+#include "logger_async.h"
 #include "networklayer_tcp.h"
+#ifdef UA_IOURING
+#include "networklayer_uring.h"
+#endif
 
 UA_Boolean running = 1;
 
@@ -58,7 +62,46 @@ int main(int argc, char** argv) {
 
 	UA_Server *server = UA_Server_new();
     UA_Server_setServerCertificate(server, loadCertificate());
-    UA_Server_addNetworkLayer(server, ServerNetworkLayerTCP_new(UA_ConnectionConfig_standard, 16664));
+    // log asynchronously to stdout, at most 100 messages per category and second
+    UA_Logger logger;
+    if(Logger_Async_start(&logger, stdout, 100) == UA_STATUSCODE_GOOD)
+        UA_Server_setLogger(server, logger);
+    // exampleServer -uring uses the io_uring networklayer where available
+    UA_Boolean uring = UA_FALSE;
+    int loops = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-uring") == 0)
+            uring = UA_TRUE;
+        else
+            loops = atoi(argv[i]);
+    }
+#ifndef UA_MULTITHREADING
+    if(loops > 0) {
+        printf("Networklayer loops require multithreading\n");
+        loops = 0;
+    }
+#endif
+#ifndef UA_IOURING
+    if(uring) {
+        printf("io_uring is not available, falling back to select\n");
+        uring = UA_FALSE;
+    }
+#endif
+    if(loops > 0) {
+#ifdef UA_MULTITHREADING
+        // exampleServer <n> runs n networklayers with their own event loop on the same port
+        for(int i = 0; i < loops; i++) {
+            UA_ServerNetworkLayer nl = ServerNetworkLayerTCP_new(UA_ConnectionConfig_standard, 16664);
+            ServerNetworkLayerTCP_setReusePort(&nl, UA_TRUE);
+            UA_Server_addNetworkLayerWithLoop(server, nl);
+        }
+#endif
+    } else if(uring) {
+#ifdef UA_IOURING
+        UA_Server_addNetworkLayer(server, ServerNetworkLayerURing_new(UA_ConnectionConfig_standard, 16664));
+#endif
+    } else
+        UA_Server_addNetworkLayer(server, ServerNetworkLayerTCP_new(UA_ConnectionConfig_standard, 16664));
 
     UA_WorkItem work = {.type = UA_WORKITEMTYPE_METHODCALL, .work.methodCall = {.method = testCallback, .data = NULL} };
     UA_Server_addRepeatedWorkItem(server, &work, 20000000, NULL); // call every 2 sec
@@ -93,6 +136,7 @@ int main(int argc, char** argv) {
 
     UA_StatusCode retval = UA_Server_run(server, 1, &running);
 	UA_Server_delete(server);
+    Logger_Async_stop();
 
 	return retval;
 }
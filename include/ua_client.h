@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2014 the contributors as stated in the AUTHORS file
+ *
+ * This file is part of open62541. open62541 is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU Lesser General
+ * Public License, version 3 (as published by the Free Software Foundation) with
+ * a static linking exception as stated in the LICENSE file provided with
+ * open62541.
+ *
+ * open62541 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef UA_CLIENT_H_
+#define UA_CLIENT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ua_types.h"
+#include "ua_types_generated.h"
+#include "ua_connection.h"
+
+/**
+ * @defgroup client Client
+ *
+ * @brief The client opens a SecureChannel and a Session to a server and
+ * keeps many requests in flight on it. The responses are matched to the
+ * requests by their requestId and handed to a callback.
+ *
+ * A client is not thread-safe. But since no call blocks except for
+ * UA_Client_connect and the synchronous services, a single thread can drive
+ * many clients.
+ *
+ * @{
+ */
+
+/**
+ * Interface to the transport. The client does not open sockets itself. An
+ * implementation for TCP is in the /examples folder.
+ */
+typedef struct {
+    void *nlHandle;
+
+    /** Connects to the endpoint, e.g. "opc.tcp://localhost:16664". */
+    UA_StatusCode (*connect)(void *nlHandle, const char *endpointUrl);
+
+    /** Closes the connection. The networklayer can connect again afterwards. */
+    void (*disconnect)(void *nlHandle);
+
+    /** Sends the buffers as one message. */
+    UA_StatusCode (*send)(void *nlHandle, UA_ByteStringArray gather_buf);
+
+    /**
+     * Waits until data arrives or the timeout (in usec) passes. The received
+     * bytes need not be a complete message. The buffer stays valid until the
+     * next call.
+     *
+     * @return UA_STATUSCODE_GOOD if data was received, UA_STATUSCODE_BADTIMEOUT
+     * if nothing arrived, or an error code if the connection was lost.
+     */
+    UA_StatusCode (*receive)(void *nlHandle, UA_ByteString *buf, UA_UInt32 timeout);
+
+    /** Deletes the networklayer. */
+    void (*free)(void *nlHandle);
+} UA_ClientNetworkLayer;
+
+typedef struct UA_ClientConfig {
+    UA_UInt32 timeout; ///< Timeout for requests in ms
+    UA_UInt32 secureChannelLifeTime; ///< Requested lifetime of the SecureChannel in ms
+    UA_UInt32 maxRequestsInFlight; ///< Further requests are rejected. 0 means no limit
+    UA_ConnectionConfig localConnectionConfig;
+} UA_ClientConfig;
+
+extern const UA_EXPORT UA_ClientConfig UA_ClientConfig_standard;
+
+struct UA_Client;
+typedef struct UA_Client UA_Client;
+
+/** The client takes ownership of the networklayer and frees it in UA_Client_delete. */
+UA_Client UA_EXPORT * UA_Client_new(UA_ClientConfig config, UA_ClientNetworkLayer networkLayer);
+
+/** Disconnects if necessary. Requests in flight are cancelled. */
+void UA_EXPORT UA_Client_delete(UA_Client *client);
+
+/** Opens a SecureChannel and a Session. Blocks until done or the timeout passes. */
+UA_StatusCode UA_EXPORT UA_Client_connect(UA_Client *client, const char *endpointUrl);
+
+/** Closes the Session and the SecureChannel. Requests in flight are cancelled. */
+UA_StatusCode UA_EXPORT UA_Client_disconnect(UA_Client *client);
+
+/**
+ * Called with the response to an asynchronous request. If the request failed
+ * without a response from the server (e.g. timeout or lost connection), the
+ * response is empty except for the serviceResult in the response header.
+ *
+ * The response is deleted when the callback returns. To keep it, copy the
+ * structure and initialize the original with UA_init.
+ */
+typedef void (*UA_ClientAsyncServiceCallback)(UA_Client *client, void *userdata, UA_UInt32 requestId,
+                                              void *response, const UA_DataType *responseType);
+
+/**
+ * Sends a request without waiting for the response. The authenticationToken,
+ * timestamp and requestHandle in the request header are set by the client.
+ *
+ * @param requestId If not null, the requestId is returned. The callback
+ * receives the same requestId.
+ * @return UA_STATUSCODE_BADTOOMANYOPERATIONS if maxRequestsInFlight is
+ * reached. The callback is not called unless the request was sent.
+ */
+UA_StatusCode UA_EXPORT
+UA_Client_sendAsyncRequest(UA_Client *client, const void *request, const UA_DataType *requestType,
+                           UA_ClientAsyncServiceCallback callback, const UA_DataType *responseType,
+                           void *userdata, UA_UInt32 *requestId);
+
+/**
+ * Processes the received responses and calls their callbacks. Waits up to
+ * timeout (in usec) if nothing was received so far. Requests that have been
+ * in flight for longer than the configured timeout fail with
+ * UA_STATUSCODE_BADTIMEOUT.
+ */
+UA_StatusCode UA_EXPORT UA_Client_processResponses(UA_Client *client, UA_UInt32 timeout);
+
+/**
+ * Processes received bytes without the receive method of the networklayer.
+ * For networklayers that are driven by an external event loop.
+ */
+UA_StatusCode UA_EXPORT UA_Client_processBinaryMessage(UA_Client *client, const UA_ByteString *msg);
+
+/** Returns the number of requests that wait for a response. */
+UA_UInt32 UA_EXPORT UA_Client_getRequestsInFlight(const UA_Client *client);
+
+/**
+ * Sends a request and waits for the response. Responses to other requests
+ * that arrive in the meantime are processed as well.
+ */
+UA_StatusCode UA_EXPORT
+UA_Client_service(UA_Client *client, const void *request, const UA_DataType *requestType,
+                  void *response, const UA_DataType *responseType);
+
+/* Typed shortcuts for the services */
+UA_ReadResponse UA_EXPORT UA_Client_read(UA_Client *client, const UA_ReadRequest *request);
+UA_StatusCode UA_EXPORT
+UA_Client_read_async(UA_Client *client, const UA_ReadRequest *request,
+                     UA_ClientAsyncServiceCallback callback, void *userdata, UA_UInt32 *requestId);
+UA_WriteResponse UA_EXPORT UA_Client_write(UA_Client *client, const UA_WriteRequest *request);
+UA_BrowseResponse UA_EXPORT UA_Client_browse(UA_Client *client, const UA_BrowseRequest *request);
+
+/** @} */
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* UA_CLIENT_H_ */
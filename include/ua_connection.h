@@ -55,6 +55,9 @@ extern const UA_EXPORT UA_ConnectionConfig UA_ConnectionConfig_standard;
 struct UA_SecureChannel;
 typedef struct UA_SecureChannel UA_SecureChannel;
 
+struct UA_Session;
+typedef struct UA_Session UA_Session;
+
 typedef struct UA_Connection {
     UA_ConnectionState  state;
     UA_ConnectionConfig localConf;
@@ -67,6 +70,31 @@ typedef struct UA_Connection {
 void UA_EXPORT UA_Connection_detachSecureChannel(UA_Connection *connection);
 // void UA_Connection_attachSecureChannel(UA_Connection *connection);
 
+/**
+ * A pool of receive buffers for the networklayers. The buffers are kept in
+ * size classes of powers of two up to UA_BUFFERPOOL_MAXSIZE. Larger buffers
+ * are allocated and freed on every use.
+ *
+ * Only the networklayer that owns the pool takes buffers from it. They are
+ * released by the server after the message is processed, possibly from a
+ * worker thread. The pool is deleted only after all buffers are released.
+ */
+typedef struct UA_BufferPool UA_BufferPool;
+
+#define UA_BUFFERPOOL_MAXSIZE 65536
+
+UA_BufferPool UA_EXPORT * UA_BufferPool_new(void);
+void UA_EXPORT UA_BufferPool_delete(UA_BufferPool *pool);
+
+/**
+ * Takes a buffer for a message of the given length. If the pool is NULL, the
+ * buffer is allocated but still released with UA_BufferPool_release.
+ */
+UA_StatusCode UA_EXPORT UA_BufferPool_take(UA_BufferPool *pool, UA_ByteString *buf, size_t length);
+
+/** Returns the buffer to its pool. Thread-safe if UA_MULTITHREADING is defined. */
+void UA_EXPORT UA_BufferPool_release(UA_ByteString *buf);
+
 /** @} */
 
 #ifdef __cplusplus
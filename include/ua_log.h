@@ -28,6 +28,10 @@ extern "C" {
  * @defgroup logging Logging
  *
  * @brief Custom logging solutions can be "plugged in" with this interface
+ *
+ * The macros take the logger as the first argument. Levels below UA_LOGLEVEL
+ * compile to nothing, and unset log functions are skipped. Loggers may format
+ * the message later, so the message has to be a string literal.
  */
 
 typedef enum UA_LoggerCategory {
@@ -47,39 +51,39 @@ typedef struct UA_Logger {
 } UA_Logger;
 
 #if UA_LOGLEVEL <= 100
-#define UA_LOG_TRACE(CATEGORY, MSG, ...) do { logger.log_trace(CATEGORY, MSG, __VA_ARGS__); } while(0)
+#define UA_LOG_TRACE(LOGGER, CATEGORY, ...) do { if((LOGGER).log_trace) (LOGGER).log_trace(CATEGORY, __VA_ARGS__); } while(0)
 #else
-#define UA_LOG_TRACE(CATEGORY, MSG, ...) do {} while(0)
+#define UA_LOG_TRACE(LOGGER, CATEGORY, ...) do {} while(0)
 #endif
 
 #if UA_LOGLEVEL <= 200
-#define UA_LOG_DEBUG(CATEGORY, MSG, ...) do { logger.log_debug(CATEGORY, MSG, __VA_ARGS__); } while(0)
+#define UA_LOG_DEBUG(LOGGER, CATEGORY, ...) do { if((LOGGER).log_debug) (LOGGER).log_debug(CATEGORY, __VA_ARGS__); } while(0)
 #else
-#define UA_LOG_DEBUG(CATEGORY, MSG, ...) do {} while(0)
+#define UA_LOG_DEBUG(LOGGER, CATEGORY, ...) do {} while(0)
 #endif
 
 #if UA_LOGLEVEL <= 300
-#define UA_LOG_INFO(CATEGORY, MSG, ...) do { logger.log_info(CATEGORY, MSG, __VA_ARGS__); } while(0)
+#define UA_LOG_INFO(LOGGER, CATEGORY, ...) do { if((LOGGER).log_info) (LOGGER).log_info(CATEGORY, __VA_ARGS__); } while(0)
 #else
-#define UA_LOG_INFO(CATEGORY, MSG, ...) do {} while(0)
+#define UA_LOG_INFO(LOGGER, CATEGORY, ...) do {} while(0)
 #endif
 
 #if UA_LOGLEVEL <= 400
-#define UA_LOG_WARNING(CATEGORY, MSG, ...) do { logger.log_warning(CATEGORY, MSG, __VA_ARGS__); } while(0)
+#define UA_LOG_WARNING(LOGGER, CATEGORY, ...) do { if((LOGGER).log_warning) (LOGGER).log_warning(CATEGORY, __VA_ARGS__); } while(0)
 #else
-#define UA_LOG_WARNING(CATEGORY, MSG, ...) do {} while(0)
+#define UA_LOG_WARNING(LOGGER, CATEGORY, ...) do {} while(0)
 #endif
 
 #if UA_LOGLEVEL <= 500
-#define UA_LOG_ERROR(CATEGORY, MSG, ...) do { logger.log_error(CATEGORY, MSG, __VA_ARGS__); } while(0)
+#define UA_LOG_ERROR(LOGGER, CATEGORY, ...) do { if((LOGGER).log_error) (LOGGER).log_error(CATEGORY, __VA_ARGS__); } while(0)
 #else
-#define UA_LOG_ERROR(CATEGORY, MSG, ...) do {} while(0)
+#define UA_LOG_ERROR(LOGGER, CATEGORY, ...) do {} while(0)
 #endif
 
 #if UA_LOGLEVEL <= 600
-#define UA_LOG_FATAL(CATEGORY, MSG, ...) do { logger.log_fatal(CATEGORY, MSG, __VA_ARGS__); } while(0)
+#define UA_LOG_FATAL(LOGGER, CATEGORY, ...) do { if((LOGGER).log_fatal) (LOGGER).log_fatal(CATEGORY, __VA_ARGS__); } while(0)
 #else
-#define UA_LOG_FATAL(CATEGORY, MSG, ...) do {} while(0)
+#define UA_LOG_FATAL(LOGGER, CATEGORY, ...) do {} while(0)
 #endif
 
 #ifdef __cplusplus
@@ -25,6 +25,7 @@ extern "C" {
 #include "ua_nodeids.h"
 #include "ua_connection.h"
 #include "ua_log.h"
+#include "ua_trace.h"
 
 /**
  * @defgroup server Server
@@ -37,6 +38,9 @@ typedef struct UA_Server UA_Server;
 
 UA_Server UA_EXPORT * UA_Server_new(void);
 void UA_EXPORT UA_Server_setServerCertificate(UA_Server *server, UA_ByteString certificate);
+
+/** Sets the logger of the server. Without a logger, no messages are logged. */
+void UA_EXPORT UA_Server_setLogger(UA_Server *server, UA_Logger logger);
 void UA_EXPORT UA_Server_delete(UA_Server *server);
 
 /**
@@ -65,12 +69,43 @@ UA_StatusCode UA_EXPORT UA_Server_run(UA_Server *server, UA_UInt16 nThreads, UA_
  *
  * It is expected that the read and release callbacks are implemented. The write
  * callback can be set to null.
+ *
+ * Datasources that wrap slow devices can additionally implement readAsync. The
+ * server then starts the read and continues with other work. The datasource
+ * completes the read by calling the callback with the readHandle exactly once.
+ * The value remains owned by the datasource. Concurrent reads of the same
+ * datasource are coalesced into a single readAsync call. Without
+ * multithreading, the callback must be called from within the server's main
+ * loop (e.g. from a work item). The synchronous read is still used where a
+ * response cannot be deferred.
+ *
+ * Datasources that can read many values at once (e.g. a block of registers)
+ * can implement readBatch. Then, all value reads of a request that target the
+ * datasource (with the same handle) are grouped into a single call. The
+ * indices point into readValueIds and values. The values are written directly
+ * into the response and are not released afterwards.
+ *
+ * If maxAge (in ms) is set, the values read from the datasource are cached in
+ * the node and reused by later reads. Cached values are returned if they are
+ * not older than the maxAge requested by the client (or the
+ * minimumSamplingInterval of the node, as the value does not change faster
+ * anyway). But never older than the maxAge of the datasource. A maxAge of zero
+ * in the request always reads from the datasource. A successful write through
+ * the datasource invalidates the cached value.
  **/
+typedef void (*UA_DataSourceReadCallback)(UA_Server *server, void *readHandle, UA_StatusCode status,
+                                          const UA_DataValue *value);
+
 typedef struct {
     const void *handle;
     UA_StatusCode (*read)(const void *handle, UA_DataValue *value);
     void (*release)(const void *handle, UA_DataValue *value);
     UA_StatusCode (*write)(const void *handle, const UA_Variant *data);
+    UA_StatusCode (*readAsync)(const void *handle, UA_Server *server, UA_DataSourceReadCallback callback,
+                               void *readHandle);
+    UA_StatusCode (*readBatch)(const void *handle, const UA_ReadValueId *readValueIds,
+                               const UA_UInt32 *indices, UA_UInt32 indicesSize, UA_DataValue *values);
+    UA_Double maxAge;
 } UA_DataSource;
 
 /** Add a reference to the server's address space */
@@ -93,11 +128,12 @@ typedef struct UA_WorkItem {
         UA_WORKITEMTYPE_BINARYNETWORKMESSAGE,
         UA_WORKITEMTYPE_METHODCALL,
         UA_WORKITEMTYPE_DELAYEDMETHODCALL,
+        UA_WORKITEMTYPE_POOLEDBINARYNETWORKMESSAGE, ///< The message is from a UA_BufferPool
     } type;
     union {
         struct {
             UA_Connection *connection;
-            UA_ByteString message;
+            UA_ByteString message; ///< Freed after processing, or released to its UA_BufferPool
         } binaryNetworkMessage;
         struct {
             void * data;
@@ -147,6 +183,76 @@ UA_StatusCode UA_EXPORT UA_Server_addRepeatedWorkItem(UA_Server *server, const U
 /** Remove timed or repeated work */
 UA_Boolean UA_EXPORT UA_Server_removeWorkItem(UA_Server *server, UA_Guid workId);
 
+/**
+ * Sets when the operations of a request (nodes to read, write or browse) are
+ * processed in parallel by the worker threads. Is ignored if MULTITHREADING is
+ * not activated.
+ *
+ * @param threshold Requests with fewer operations are processed sequentially
+ *        by a single worker.
+ *
+ * @param minRangeSize Larger requests are split into ranges with at least
+ *        that many operations.
+ */
+void UA_EXPORT UA_Server_setParallelThreshold(UA_Server *server, UA_UInt32 threshold,
+                                              UA_UInt32 minRangeSize);
+
+/**
+ * Limits the number of requests per SecureChannel that are in flight, i.e.
+ * being processed or waiting for asynchronous datasources. Requests beyond the
+ * limit are answered with Bad_TcpServerTooBusy. With multithreading, read-only
+ * requests of a channel are processed concurrently and their responses are
+ * sent in the order of completion.
+ *
+ * @param maxRequestsInFlight The maximum number of requests in flight per
+ *        channel. Zero disables the limit.
+ */
+void UA_EXPORT UA_Server_setMaxRequestsInFlight(UA_Server *server, UA_UInt32 maxRequestsInFlight);
+
+/**
+ * Sessions are created with the timeout requested by the client, but at most
+ * with this timeout (default 1h). Sessions without activity for longer than
+ * their timeout are removed. Applies to sessions that are created afterwards.
+ *
+ * @param maxSessionTimeout The maximum session timeout in ms
+ */
+void UA_EXPORT UA_Server_setMaxSessionTimeout(UA_Server *server, UA_UInt32 maxSessionTimeout);
+
+/**
+ * A service handler processes a decoded request and fills in the response. The
+ * response is initialized and its header already carries the request handle
+ * and a timestamp.
+ */
+typedef void (*UA_ServiceHandler)(UA_Server *server, UA_SecureChannel *channel, UA_Session *session,
+                                  const void *request, void *response);
+
+/** The service can be called without a session if EXTENSION_STATELESS is enabled */
+#define UA_SERVICEFLAG_STATELESS 0x01
+/** The service is rejected if the channel has no activated session */
+#define UA_SERVICEFLAG_SESSION 0x02
+/** The handler can run in several worker threads at once. Otherwise the calls
+    are serialized. */
+#define UA_SERVICEFLAG_CONCURRENT 0x04
+/** The handler keeps no references into the request. The strings of the
+    request then point into the received message instead of being copied. */
+#define UA_SERVICEFLAG_BORROWREQUEST 0x08
+/** The service does not change the server state. With multithreading, such
+    requests that arrive together on a channel with an activated session are
+    processed concurrently. All other requests are processed in order. */
+#define UA_SERVICEFLAG_READONLY 0x10
+
+/**
+ * Adds a service or replaces the handler of an existing one. The request and
+ * response types are structures that start with a request header and a
+ * response header. Types outside of namespace zero are registered for decoding
+ * as well. Services are added before the server is run.
+ *
+ * @param flags A combination of the UA_SERVICEFLAG values
+ */
+UA_StatusCode UA_EXPORT UA_Server_addService(UA_Server *server, const UA_DataType *requestType,
+                                             const UA_DataType *responseType, UA_ServiceHandler handler,
+                                             UA_UInt32 flags);
+
 /**
  * Interface to the binary network layers. This structure is returned from the
  * function that initializes the network layer. The layer is already bound to a
@@ -200,6 +306,17 @@ typedef struct {
  */
 void UA_EXPORT UA_Server_addNetworkLayer(UA_Server *server, UA_ServerNetworkLayer networkLayer);
 
+/**
+ * Adds a network layer that runs in its own event loop thread. The thread gets
+ * the work from the networklayer and processes the messages directly. So
+ * receiving, processing and sending do not go through the main loop. Several
+ * such networklayers can listen on the same port (e.g. with SO_REUSEPORT) to
+ * spread the connections over the cores. They share only the nodestore and
+ * the sessions. Without MULTITHREADING, the networklayer is polled by the main
+ * loop like the others.
+ */
+void UA_EXPORT UA_Server_addNetworkLayerWithLoop(UA_Server *server, UA_ServerNetworkLayer networkLayer);
+
 /** @} */
 
 /**
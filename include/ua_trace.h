@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014 the contributors as stated in the AUTHORS file
+ *
+ * This file is part of open62541. open62541 is free software: you can
+ * redistribute it and/or modify it under the terms of the GNU Lesser General
+ * Public License, version 3 (as published by the Free Software Foundation) with
+ * a static linking exception as stated in the LICENSE file provided with
+ * open62541.
+ *
+ * open62541 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef UA_TRACE_H_
+#define UA_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "ua_config.h"
+#include "ua_types.h"
+
+/**
+ * @ingroup server
+ *
+ * @defgroup tracing Tracing
+ *
+ * @brief Tracepoints at the stages of the request processing. Enabled with the
+ * cmake option ENABLE_TRACING. Otherwise the tracepoints compile to nothing.
+ *
+ * A tracer can be "plugged in" to timestamp the tracepoints. If sys/sdt.h is
+ * found at build time, the tracepoints are also USDT probes of the provider
+ * open62541 (e.g. for bpftrace or perf).
+ *
+ * Work items are followed from DISPATCH to PICKUP by the address of the queue
+ * entry. Requests are followed by the channel id and the request id.
+ */
+
+typedef enum UA_TracePoint {
+    UA_TRACEPOINT_RECEIVE,  ///< getWork returned. arg1: number of work items
+    UA_TRACEPOINT_DISPATCH, ///< work was enqueued for the workers. arg1: queue entry, arg2: number of work items
+    UA_TRACEPOINT_PICKUP,   ///< a worker dequeued work. arg1: queue entry, arg2: number of work items
+    UA_TRACEPOINT_REQUEST,  ///< processing of a message starts. arg1: channel id, arg2: request id
+    UA_TRACEPOINT_DECODED,  ///< the request is decoded. arg1: channel id, arg2: request id
+    UA_TRACEPOINT_SERVICED, ///< the service returned. arg1: channel id, arg2: request id
+    UA_TRACEPOINT_WRITE     ///< a message was handed to connection->write. arg1: request id, arg2: bytes
+} UA_TracePoint;
+
+typedef struct UA_Tracer {
+    void *handle;
+    void (*trace)(void *handle, UA_TracePoint point, UA_UInt64 arg1, UA_UInt64 arg2);
+} UA_Tracer;
+
+#ifdef UA_TRACING
+
+/** The tracer is global to the process. No tracer is set by default. */
+extern UA_EXPORT UA_Tracer UA_tracer;
+
+#ifdef UA_TRACING_USDT
+#include <sys/sdt.h>
+#define UA_TRACE_USDT(POINT, ARG1, ARG2) DTRACE_PROBE2(open62541, POINT, ARG1, ARG2);
+#else
+#define UA_TRACE_USDT(POINT, ARG1, ARG2)
+#endif
+
+#define UA_TRACE(POINT, ARG1, ARG2) do {                                \
+        if(UA_tracer.trace)                                             \
+            UA_tracer.trace(UA_tracer.handle, UA_TRACEPOINT_##POINT,    \
+                            (UA_UInt64)(ARG1), (UA_UInt64)(ARG2));      \
+        UA_TRACE_USDT(POINT, (UA_UInt64)(ARG1), (UA_UInt64)(ARG2))      \
+    } while(0)
+
+#else
+#define UA_TRACE(POINT, ARG1, ARG2) do {} while(0)
+#endif
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* UA_TRACE_H_ */
@@ -0,0 +1,668 @@
+#include "ua_client.h"
+#include "ua_types_encoding_binary.h"
+#include "ua_transport_generated.h"
+#include "ua_nodeids.h"
+#include "ua_statuscodes.h"
+#include "ua_util.h"
+#include "../deps/queue.h"
+
+#define MAX_STACK_MESSAGE 1024 // messages are encoded on the stack up to this size
+
+const UA_ClientConfig UA_ClientConfig_standard =
+    {.timeout = 5000, .secureChannelLifeTime = 600000, .maxRequestsInFlight = 64,
+     .localConnectionConfig = {.protocolVersion = 0, .sendBufferSize = 65536, .recvBufferSize  = 65536,
+                               .maxMessageSize = 65536, .maxChunkCount = 1}};
+
+typedef enum {
+    CLIENTSTATE_DISCONNECTED,
+    CLIENTSTATE_WAITACK, // HEL was sent
+    CLIENTSTATE_WAITOPN, // OPN was sent
+    CLIENTSTATE_CHANNELOPEN
+} ClientState;
+
+typedef struct AsyncRequest {
+    TAILQ_ENTRY(AsyncRequest) pointers;
+    UA_UInt32 requestId;
+    UA_DateTime timeout; // the request fails when no response has arrived until then
+    UA_ClientAsyncServiceCallback callback;
+    const UA_DataType *responseType;
+    void *userdata;
+} AsyncRequest;
+
+struct UA_Client {
+    UA_ClientConfig config;
+    UA_ClientNetworkLayer networkLayer;
+    ClientState state;
+    UA_ConnectionConfig remoteConf;
+    UA_String endpointUrl;
+
+    /* SecureChannel */
+    UA_UInt32 channelId;
+    UA_UInt32 tokenId;
+    UA_UInt32 sequenceNumber;
+    UA_UInt32 requestId;
+    UA_UInt32 requestHandle;
+
+    /* Session */
+    UA_NodeId authenticationToken;
+
+    /* The requests in flight are ordered by their timeout. Responses mostly
+       arrive in order, so the matching request is usually found at the
+       front. */
+    TAILQ_HEAD(AsyncRequestQueue, AsyncRequest) requests;
+    UA_UInt32 requestsInFlight;
+    TAILQ_HEAD(AsyncRequestFreeList, AsyncRequest) freeRequests; // reused for the next requests
+
+    /* The start of a message that was received only partially */
+    UA_Byte *incompleteData;
+    size_t incompleteLength;
+    size_t incompleteSize;
+};
+
+UA_Client * UA_Client_new(UA_ClientConfig config, UA_ClientNetworkLayer networkLayer) {
+    UA_Client *client = UA_malloc(sizeof(UA_Client));
+    if(!client)
+        return UA_NULL;
+    UA_memset(client, 0, sizeof(UA_Client));
+    client->config = config;
+    client->networkLayer = networkLayer;
+    client->state = CLIENTSTATE_DISCONNECTED;
+    UA_String_init(&client->endpointUrl);
+    UA_NodeId_init(&client->authenticationToken);
+    TAILQ_INIT(&client->requests);
+    TAILQ_INIT(&client->freeRequests);
+    return client;
+}
+
+void UA_Client_delete(UA_Client *client) {
+    UA_Client_disconnect(client);
+    AsyncRequest *ar;
+    while((ar = TAILQ_FIRST(&client->freeRequests))) {
+        TAILQ_REMOVE(&client->freeRequests, ar, pointers);
+        UA_free(ar);
+    }
+    client->networkLayer.free(client->networkLayer.nlHandle);
+    UA_free(client->incompleteData);
+    UA_free(client);
+}
+
+UA_UInt32 UA_Client_getRequestsInFlight(const UA_Client *client) {
+    return client->requestsInFlight;
+}
+
+/********************/
+/* Requests         */
+/********************/
+
+/* Removes the request and calls the callback with an empty response */
+static void failRequest(UA_Client *client, AsyncRequest *ar, UA_StatusCode status) {
+    TAILQ_REMOVE(&client->requests, ar, pointers);
+    client->requestsInFlight--;
+    void *response = UA_alloca(ar->responseType->memSize);
+    UA_init(response, ar->responseType);
+    UA_ResponseHeader *header = (UA_ResponseHeader*)response; // always the first member
+    header->timestamp = UA_DateTime_now();
+    header->serviceResult = status;
+    ar->callback(client, ar->userdata, ar->requestId, response, ar->responseType);
+    UA_deleteMembers(response, ar->responseType);
+    TAILQ_INSERT_HEAD(&client->freeRequests, ar, pointers);
+}
+
+static void cancelRequests(UA_Client *client, UA_StatusCode status) {
+    AsyncRequest *ar;
+    while((ar = TAILQ_FIRST(&client->requests)))
+        failRequest(client, ar, status);
+}
+
+static void timeoutRequests(UA_Client *client) {
+    UA_DateTime now = UA_DateTime_now();
+    AsyncRequest *ar;
+    while((ar = TAILQ_FIRST(&client->requests)) && ar->timeout < now)
+        failRequest(client, ar, UA_STATUSCODE_BADTIMEOUT);
+}
+
+/* The connection is gone. The requests in flight fail with the status. */
+static void closeClient(UA_Client *client, UA_StatusCode status) {
+    if(client->state == CLIENTSTATE_DISCONNECTED)
+        return;
+    client->networkLayer.disconnect(client->networkLayer.nlHandle);
+    client->state = CLIENTSTATE_DISCONNECTED;
+    client->incompleteLength = 0;
+    UA_NodeId_deleteMembers(&client->authenticationToken);
+    UA_NodeId_init(&client->authenticationToken);
+    UA_String_deleteMembers(&client->endpointUrl);
+    cancelRequests(client, status);
+}
+
+/********************/
+/* Sending          */
+/********************/
+
+static void patchMessageSize(UA_ByteString *message, size_t messageSize) {
+    UA_UInt32 size = (UA_UInt32)messageSize;
+    size_t sizePos = 4; // behind the message type
+    UA_UInt32_encodeBinary(&size, message, &sizePos);
+    message->length = (UA_Int32)messageSize;
+}
+
+static UA_StatusCode sendEncoded(UA_Client *client, UA_ByteString *message, size_t length) {
+    patchMessageSize(message, length);
+    return client->networkLayer.send(client->networkLayer.nlHandle,
+                                     (UA_ByteStringArray){ .stringsSize = 1, .strings = message });
+}
+
+static UA_StatusCode sendHEL(UA_Client *client) {
+    UA_TcpMessageHeader header;
+    header.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_HELF;
+    header.messageSize = 0; // back-patched when the message is encoded
+
+    UA_TcpHelloMessage hello;
+    const UA_ConnectionConfig *conf = &client->config.localConnectionConfig;
+    hello.protocolVersion = conf->protocolVersion;
+    hello.receiveBufferSize = conf->recvBufferSize;
+    hello.sendBufferSize = conf->sendBufferSize;
+    hello.maxMessageSize = conf->maxMessageSize;
+    hello.maxChunkCount = conf->maxChunkCount;
+    hello.endpointUrl = client->endpointUrl;
+
+    UA_Byte data[MAX_STACK_MESSAGE];
+    UA_ByteString message = { .length = MAX_STACK_MESSAGE, .data = data };
+    UA_Boolean onHeap = UA_FALSE;
+    size_t pos = 0;
+    UA_StatusCode retval = UA_TcpMessageHeader_encodeBinary(&header, &message, &pos);
+    retval |= UA_encodeBinaryGrowing(&hello, &UA_TRANSPORT[UA_TRANSPORT_TCPHELLOMESSAGE],
+                                     &message, &pos, &onHeap);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = sendEncoded(client, &message, pos);
+    if(onHeap)
+        UA_free(message.data);
+    return retval;
+}
+
+static UA_StatusCode sendOPN(UA_Client *client) {
+    UA_SecureConversationMessageHeader header;
+    header.messageHeader.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_OPNF;
+    header.messageHeader.messageSize = 0;
+    header.secureChannelId = 0;
+
+    static char securityPolicy[] = "http://opcfoundation.org/UA/SecurityPolicy#None";
+    UA_AsymmetricAlgorithmSecurityHeader asymHeader;
+    UA_AsymmetricAlgorithmSecurityHeader_init(&asymHeader);
+    asymHeader.securityPolicyUri.data = (UA_Byte*)securityPolicy;
+    asymHeader.securityPolicyUri.length = sizeof(securityPolicy) - 1;
+
+    UA_SequenceHeader seqHeader;
+    seqHeader.sequenceNumber = ++client->sequenceNumber;
+    seqHeader.requestId = ++client->requestId;
+
+    UA_NodeId requestType = UA_NODEID_STATIC(0, UA_NS0ID_OPENSECURECHANNELREQUEST);
+    requestType.identifier.numeric += UA_ENCODINGOFFSET_BINARY;
+
+    UA_OpenSecureChannelRequest request;
+    UA_OpenSecureChannelRequest_init(&request);
+    request.requestHeader.timestamp = UA_DateTime_now();
+    request.requestHeader.timeoutHint = client->config.timeout;
+    request.clientProtocolVersion = client->config.localConnectionConfig.protocolVersion;
+    request.requestType = UA_SECURITYTOKENREQUESTTYPE_ISSUE;
+    request.securityMode = UA_MESSAGESECURITYMODE_NONE;
+    request.requestedLifetime = client->config.secureChannelLifeTime;
+
+    UA_Byte data[MAX_STACK_MESSAGE];
+    UA_ByteString message = { .length = MAX_STACK_MESSAGE, .data = data };
+    UA_Boolean onHeap = UA_FALSE;
+    size_t pos = 0;
+    UA_StatusCode retval = UA_SecureConversationMessageHeader_encodeBinary(&header, &message, &pos);
+    retval |= UA_encodeBinaryGrowing(&asymHeader, &UA_TRANSPORT[UA_TRANSPORT_ASYMMETRICALGORITHMSECURITYHEADER],
+                                     &message, &pos, &onHeap);
+    retval |= UA_encodeBinaryGrowing(&seqHeader, &UA_TRANSPORT[UA_TRANSPORT_SEQUENCEHEADER],
+                                     &message, &pos, &onHeap);
+    retval |= UA_encodeBinaryGrowing(&requestType, &UA_TYPES[UA_TYPES_NODEID], &message, &pos, &onHeap);
+    retval |= UA_encodeBinaryGrowing(&request, &UA_TYPES[UA_TYPES_OPENSECURECHANNELREQUEST],
+                                     &message, &pos, &onHeap);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = sendEncoded(client, &message, pos);
+    if(onHeap)
+        UA_free(message.data);
+    return retval;
+}
+
+/* Sends a MSG or CLO message on the open SecureChannel */
+static UA_StatusCode sendSymmetric(UA_Client *client, UA_UInt32 messageType, UA_UInt32 requestId,
+                                   const void *request, const UA_DataType *requestType) {
+    UA_SecureConversationMessageHeader header;
+    header.messageHeader.messageTypeAndFinal = messageType;
+    header.messageHeader.messageSize = 0;
+    header.secureChannelId = client->channelId;
+
+    UA_SequenceHeader seqHeader;
+    seqHeader.sequenceNumber = ++client->sequenceNumber;
+    seqHeader.requestId = requestId;
+
+    UA_NodeId requestTypeId = requestType->typeId;
+    requestTypeId.identifier.numeric += UA_ENCODINGOFFSET_BINARY;
+
+    UA_Byte data[MAX_STACK_MESSAGE];
+    UA_ByteString message = { .length = MAX_STACK_MESSAGE, .data = data };
+    UA_Boolean onHeap = UA_FALSE;
+    size_t pos = 0;
+    // the headers always fit into the stack buffer
+    UA_StatusCode retval = UA_SecureConversationMessageHeader_encodeBinary(&header, &message, &pos);
+    retval |= UA_UInt32_encodeBinary(&client->tokenId, &message, &pos);
+    retval |= UA_SequenceHeader_encodeBinary(&seqHeader, &message, &pos);
+    retval |= UA_NodeId_encodeBinary(&requestTypeId, &message, &pos);
+    retval |= UA_encodeBinaryGrowing(request, requestType, &message, &pos, &onHeap);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = sendEncoded(client, &message, pos);
+    if(onHeap)
+        UA_free(message.data);
+    return retval;
+}
+
+UA_StatusCode
+UA_Client_sendAsyncRequest(UA_Client *client, const void *request, const UA_DataType *requestType,
+                           UA_ClientAsyncServiceCallback callback, const UA_DataType *responseType,
+                           void *userdata, UA_UInt32 *requestId) {
+    if(client->state != CLIENTSTATE_CHANNELOPEN)
+        return UA_STATUSCODE_BADSERVERNOTCONNECTED;
+    if(client->config.maxRequestsInFlight > 0 &&
+       client->requestsInFlight >= client->config.maxRequestsInFlight)
+        return UA_STATUSCODE_BADTOOMANYOPERATIONS;
+
+    AsyncRequest *ar = TAILQ_FIRST(&client->freeRequests);
+    if(ar)
+        TAILQ_REMOVE(&client->freeRequests, ar, pointers);
+    else if(!(ar = UA_malloc(sizeof(AsyncRequest))))
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+
+    /* The request header is the first member of every request. It is filled
+       in for the encoding and restored afterwards. The token is not copied. */
+    UA_RequestHeader *header = (UA_RequestHeader*)(uintptr_t)request;
+    UA_RequestHeader userHeader = *header;
+    header->authenticationToken = client->authenticationToken;
+    header->timestamp = UA_DateTime_now();
+    header->requestHandle = ++client->requestHandle;
+    if(header->timeoutHint == 0)
+        header->timeoutHint = client->config.timeout;
+    UA_UInt32 id = ++client->requestId;
+    UA_StatusCode retval = sendSymmetric(client, UA_MESSAGETYPEANDFINAL_MSGF, id, request, requestType);
+    *header = userHeader;
+    if(retval != UA_STATUSCODE_GOOD) {
+        TAILQ_INSERT_HEAD(&client->freeRequests, ar, pointers);
+        return retval;
+    }
+
+    ar->requestId = id;
+    ar->timeout = UA_DateTime_now() + (UA_DateTime)client->config.timeout * 10000;
+    ar->callback = callback;
+    ar->responseType = responseType;
+    ar->userdata = userdata;
+    TAILQ_INSERT_TAIL(&client->requests, ar, pointers);
+    client->requestsInFlight++;
+    if(requestId)
+        *requestId = id;
+    return UA_STATUSCODE_GOOD;
+}
+
+/********************/
+/* Receiving        */
+/********************/
+
+static UA_StatusCode processACK(UA_Client *client, const UA_ByteString *msg, size_t *pos) {
+    if(client->state != CLIENTSTATE_WAITACK)
+        return UA_STATUSCODE_BADUNKNOWNRESPONSE;
+    UA_TcpAcknowledgeMessage ack;
+    UA_StatusCode retval = UA_TcpAcknowledgeMessage_decodeBinary(msg, pos, &ack);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    client->remoteConf.protocolVersion = ack.protocolVersion;
+    client->remoteConf.recvBufferSize = ack.receiveBufferSize;
+    client->remoteConf.sendBufferSize = ack.sendBufferSize;
+    client->remoteConf.maxMessageSize = ack.maxMessageSize;
+    client->remoteConf.maxChunkCount = ack.maxChunkCount;
+    client->state = CLIENTSTATE_WAITOPN;
+    return sendOPN(client);
+}
+
+static UA_StatusCode processOPN(UA_Client *client, const UA_ByteString *msg, size_t *pos) {
+    if(client->state != CLIENTSTATE_WAITOPN)
+        return UA_STATUSCODE_BADUNKNOWNRESPONSE;
+    UA_UInt32 channelId;
+    UA_AsymmetricAlgorithmSecurityHeader asymHeader;
+    UA_SequenceHeader seqHeader;
+    UA_NodeId responseType;
+    UA_StatusCode retval = UA_UInt32_decodeBinary(msg, pos, &channelId);
+    retval |= UA_AsymmetricAlgorithmSecurityHeader_decodeBinary(msg, pos, &asymHeader);
+    UA_AsymmetricAlgorithmSecurityHeader_deleteMembers(&asymHeader);
+    retval |= UA_SequenceHeader_decodeBinary(msg, pos, &seqHeader);
+    retval |= UA_NodeId_decodeBinary(msg, pos, &responseType);
+    if(retval != UA_STATUSCODE_GOOD)
+        return UA_STATUSCODE_BADDECODINGERROR;
+    if(responseType.identifierType != UA_NODEIDTYPE_NUMERIC ||
+       responseType.identifier.numeric != UA_NS0ID_OPENSECURECHANNELRESPONSE + UA_ENCODINGOFFSET_BINARY) {
+        UA_NodeId_deleteMembers(&responseType);
+        return UA_STATUSCODE_BADUNKNOWNRESPONSE;
+    }
+
+    UA_OpenSecureChannelResponse response;
+    retval = UA_OpenSecureChannelResponse_decodeBinary(msg, pos, &response);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    retval = response.responseHeader.serviceResult;
+    if(retval == UA_STATUSCODE_GOOD) {
+        client->channelId = response.securityToken.channelId;
+        client->tokenId = response.securityToken.tokenId;
+        client->state = CLIENTSTATE_CHANNELOPEN;
+    }
+    UA_OpenSecureChannelResponse_deleteMembers(&response);
+    return retval;
+}
+
+static UA_StatusCode processMSG(UA_Client *client, const UA_ByteString *msg, size_t *pos) {
+    if(client->state != CLIENTSTATE_CHANNELOPEN)
+        return UA_STATUSCODE_BADUNKNOWNRESPONSE;
+    UA_UInt32 channelId;
+    UA_UInt32 tokenId;
+    UA_SequenceHeader seqHeader;
+    UA_NodeId responseTypeId;
+    UA_StatusCode retval = UA_UInt32_decodeBinary(msg, pos, &channelId);
+    retval |= UA_UInt32_decodeBinary(msg, pos, &tokenId);
+    retval |= UA_SequenceHeader_decodeBinary(msg, pos, &seqHeader);
+    retval |= UA_NodeId_decodeBinary(msg, pos, &responseTypeId);
+    if(retval != UA_STATUSCODE_GOOD)
+        return UA_STATUSCODE_BADDECODINGERROR;
+
+    AsyncRequest *ar;
+    TAILQ_FOREACH(ar, &client->requests, pointers) {
+        if(ar->requestId == seqHeader.requestId)
+            break;
+    }
+    if(!ar) {
+        // the request has timed out already
+        UA_NodeId_deleteMembers(&responseTypeId);
+        return UA_STATUSCODE_GOOD;
+    }
+    TAILQ_REMOVE(&client->requests, ar, pointers);
+    client->requestsInFlight--;
+
+    const UA_DataType *responseType = ar->responseType;
+    void *response = UA_alloca(responseType->memSize);
+    UA_init(response, responseType);
+    UA_ResponseHeader *header = (UA_ResponseHeader*)response;
+    if(responseTypeId.identifierType != UA_NODEIDTYPE_NUMERIC || responseTypeId.namespaceIndex != 0) {
+        header->serviceResult = UA_STATUSCODE_BADUNKNOWNRESPONSE;
+    } else if(responseTypeId.identifier.numeric ==
+              responseType->typeId.identifier.numeric + UA_ENCODINGOFFSET_BINARY) {
+        if(UA_decodeBinary(msg, pos, response, responseType) != UA_STATUSCODE_GOOD) {
+            UA_init(response, responseType);
+            header->serviceResult = UA_STATUSCODE_BADDECODINGERROR;
+        }
+    } else if(responseTypeId.identifier.numeric == UA_NS0ID_SERVICEFAULT + UA_ENCODINGOFFSET_BINARY) {
+        // the ServiceFault has only the response header
+        if(UA_ResponseHeader_decodeBinary(msg, pos, header) != UA_STATUSCODE_GOOD) {
+            UA_ResponseHeader_init(header);
+            header->serviceResult = UA_STATUSCODE_BADDECODINGERROR;
+        }
+    } else
+        header->serviceResult = UA_STATUSCODE_BADUNKNOWNRESPONSE;
+    UA_NodeId_deleteMembers(&responseTypeId);
+
+    ar->callback(client, ar->userdata, ar->requestId, response, responseType);
+    UA_deleteMembers(response, responseType);
+    TAILQ_INSERT_HEAD(&client->freeRequests, ar, pointers);
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_Boolean appendIncomplete(UA_Client *client, const UA_Byte *data, size_t length) {
+    if(client->incompleteLength + length > client->incompleteSize) {
+        size_t newSize = client->incompleteLength + length;
+        UA_Byte *newData = UA_realloc(client->incompleteData, newSize);
+        if(!newData)
+            return UA_FALSE;
+        client->incompleteData = newData;
+        client->incompleteSize = newSize;
+    }
+    UA_memcpy(&client->incompleteData[client->incompleteLength], data, length);
+    client->incompleteLength += length;
+    return UA_TRUE;
+}
+
+UA_StatusCode UA_Client_processBinaryMessage(UA_Client *client, const UA_ByteString *msg) {
+    if(msg->length <= 0)
+        return UA_STATUSCODE_GOOD;
+
+    // continue the message that was received only partially
+    const UA_Byte *data = msg->data;
+    size_t length = (size_t)msg->length;
+    if(client->incompleteLength > 0) {
+        if(!appendIncomplete(client, msg->data, length)) {
+            closeClient(client, UA_STATUSCODE_BADOUTOFMEMORY);
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        data = client->incompleteData;
+        length = client->incompleteLength;
+    }
+
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    size_t pos = 0;
+    while(length - pos >= 8 && client->state != CLIENTSTATE_DISCONNECTED) {
+        UA_TcpMessageHeader header;
+        size_t headerPos = 0;
+        const UA_ByteString headerBuf = { .length = 8, .data = (UA_Byte*)(uintptr_t)&data[pos] };
+        UA_TcpMessageHeader_decodeBinary(&headerBuf, &headerPos, &header);
+        if(header.messageSize < 8 || header.messageSize > client->config.localConnectionConfig.recvBufferSize) {
+            retval = UA_STATUSCODE_BADTCPMESSAGETOOLARGE;
+            break;
+        }
+        if(header.messageSize > length - pos)
+            break; // wait for the rest
+
+        // the message is decoded within its bounds
+        const UA_ByteString message = { .length = (UA_Int32)header.messageSize,
+                                        .data = (UA_Byte*)(uintptr_t)&data[pos] };
+        size_t messagePos = 8;
+        switch(header.messageTypeAndFinal) {
+        case UA_MESSAGETYPEANDFINAL_ACKF:
+            retval = processACK(client, &message, &messagePos);
+            break;
+        case UA_MESSAGETYPEANDFINAL_OPNF:
+            retval = processOPN(client, &message, &messagePos);
+            break;
+        case UA_MESSAGETYPEANDFINAL_MSGF:
+            retval = processMSG(client, &message, &messagePos);
+            break;
+        default:
+            retval = UA_STATUSCODE_BADUNKNOWNRESPONSE; // chunked and error messages are not supported
+            break;
+        }
+        if(retval != UA_STATUSCODE_GOOD)
+            break;
+        pos += header.messageSize;
+    }
+
+    if(retval != UA_STATUSCODE_GOOD) {
+        closeClient(client, retval);
+        return retval;
+    }
+    if(client->state == CLIENTSTATE_DISCONNECTED)
+        return UA_STATUSCODE_GOOD; // closed from a callback
+
+    // keep the rest for the next call
+    size_t rest = length - pos;
+    if(data == client->incompleteData) {
+        memmove(client->incompleteData, &data[pos], rest);
+        client->incompleteLength = rest;
+    } else if(rest > 0 && !appendIncomplete(client, &data[pos], rest)) {
+        closeClient(client, UA_STATUSCODE_BADOUTOFMEMORY);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+UA_StatusCode UA_Client_processResponses(UA_Client *client, UA_UInt32 timeout) {
+    if(client->state == CLIENTSTATE_DISCONNECTED)
+        return UA_STATUSCODE_BADSERVERNOTCONNECTED;
+    UA_ByteString buf;
+    UA_StatusCode retval = client->networkLayer.receive(client->networkLayer.nlHandle, &buf, timeout);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = UA_Client_processBinaryMessage(client, &buf);
+    else if(retval == UA_STATUSCODE_BADTIMEOUT)
+        retval = UA_STATUSCODE_GOOD;
+    else
+        closeClient(client, retval);
+    timeoutRequests(client);
+    return retval;
+}
+
+/*********************/
+/* Synchronous Calls */
+/*********************/
+
+struct SyncResponse {
+    void *response;
+    UA_Boolean received;
+};
+
+/* Moves the response to the caller */
+static void syncResponseCallback(UA_Client *client, struct SyncResponse *sr, UA_UInt32 requestId,
+                                 void *response, const UA_DataType *responseType) {
+    UA_memcpy(sr->response, response, responseType->memSize);
+    UA_init(response, responseType);
+    sr->received = UA_TRUE;
+}
+
+UA_StatusCode UA_Client_service(UA_Client *client, const void *request, const UA_DataType *requestType,
+                                void *response, const UA_DataType *responseType) {
+    UA_init(response, responseType);
+    UA_ResponseHeader *header = (UA_ResponseHeader*)response;
+    struct SyncResponse sr = { .response = response, .received = UA_FALSE };
+    UA_StatusCode retval =
+        UA_Client_sendAsyncRequest(client, request, requestType,
+                                   (UA_ClientAsyncServiceCallback)syncResponseCallback,
+                                   responseType, &sr, UA_NULL);
+    if(retval != UA_STATUSCODE_GOOD) {
+        header->serviceResult = retval;
+        return retval;
+    }
+    // the request is answered, times out or is cancelled when the connection closes
+    while(!sr.received)
+        UA_Client_processResponses(client, client->config.timeout * 1000);
+    return header->serviceResult;
+}
+
+/* Waits until the SecureChannel is open or the connection closes */
+static UA_StatusCode waitForChannel(UA_Client *client) {
+    UA_DateTime deadline = UA_DateTime_now() + (UA_DateTime)client->config.timeout * 10000;
+    while(client->state != CLIENTSTATE_CHANNELOPEN) {
+        UA_DateTime now = UA_DateTime_now();
+        if(now >= deadline)
+            return UA_STATUSCODE_BADTIMEOUT;
+        UA_StatusCode retval = UA_Client_processResponses(client, (UA_UInt32)((deadline - now) / 10));
+        if(retval != UA_STATUSCODE_GOOD)
+            return retval;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode createSession(UA_Client *client) {
+    UA_CreateSessionRequest request;
+    UA_CreateSessionRequest_init(&request);
+    request.endpointUrl = client->endpointUrl; // not copied
+    request.requestedSessionTimeout = 1200000;
+    request.maxResponseMessageSize = UA_INT32_MAX;
+    UA_CreateSessionResponse response;
+    UA_StatusCode retval = UA_Client_service(client, &request, &UA_TYPES[UA_TYPES_CREATESESSIONREQUEST],
+                                             &response, &UA_TYPES[UA_TYPES_CREATESESSIONRESPONSE]);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = UA_NodeId_copy(&response.authenticationToken, &client->authenticationToken);
+    UA_CreateSessionResponse_deleteMembers(&response);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    UA_ActivateSessionRequest activateRequest;
+    UA_ActivateSessionRequest_init(&activateRequest);
+    UA_ActivateSessionResponse activateResponse;
+    retval = UA_Client_service(client, &activateRequest, &UA_TYPES[UA_TYPES_ACTIVATESESSIONREQUEST],
+                               &activateResponse, &UA_TYPES[UA_TYPES_ACTIVATESESSIONRESPONSE]);
+    UA_ActivateSessionResponse_deleteMembers(&activateResponse);
+    return retval;
+}
+
+UA_StatusCode UA_Client_connect(UA_Client *client, const char *endpointUrl) {
+    if(client->state != CLIENTSTATE_DISCONNECTED)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    UA_StatusCode retval = client->networkLayer.connect(client->networkLayer.nlHandle, endpointUrl);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    client->state = CLIENTSTATE_WAITACK;
+    client->sequenceNumber = 0;
+    client->requestId = 0;
+    client->incompleteLength = 0;
+
+    retval = UA_String_copycstring(endpointUrl, &client->endpointUrl);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = sendHEL(client);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = waitForChannel(client); // the OPN is sent when the ACK arrives
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = createSession(client);
+    if(retval != UA_STATUSCODE_GOOD)
+        closeClient(client, retval);
+    return retval;
+}
+
+UA_StatusCode UA_Client_disconnect(UA_Client *client) {
+    if(client->state == CLIENTSTATE_DISCONNECTED)
+        return UA_STATUSCODE_GOOD;
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    if(client->state == CLIENTSTATE_CHANNELOPEN) {
+        if(!UA_NodeId_isNull(&client->authenticationToken)) {
+            UA_CloseSessionRequest request;
+            UA_CloseSessionRequest_init(&request);
+            request.deleteSubscriptions = UA_TRUE;
+            UA_CloseSessionResponse response;
+            retval = UA_Client_service(client, &request, &UA_TYPES[UA_TYPES_CLOSESESSIONREQUEST],
+                                       &response, &UA_TYPES[UA_TYPES_CLOSESESSIONRESPONSE]);
+            UA_CloseSessionResponse_deleteMembers(&response);
+        }
+        if(client->state == CLIENTSTATE_CHANNELOPEN) {
+            UA_CloseSecureChannelRequest request;
+            UA_CloseSecureChannelRequest_init(&request);
+            sendSymmetric(client, UA_MESSAGETYPEANDFINAL_CLOF, ++client->requestId, &request,
+                          &UA_TYPES[UA_TYPES_CLOSESECURECHANNELREQUEST]);
+        }
+    }
+    closeClient(client, UA_STATUSCODE_BADSHUTDOWN);
+    return retval;
+}
+
+/*******************/
+/* Typed Shortcuts */
+/*******************/
+
+UA_ReadResponse UA_Client_read(UA_Client *client, const UA_ReadRequest *request) {
+    UA_ReadResponse response;
+    UA_Client_service(client, request, &UA_TYPES[UA_TYPES_READREQUEST], &response,
+                      &UA_TYPES[UA_TYPES_READRESPONSE]);
+    return response;
+}
+
+UA_StatusCode
+UA_Client_read_async(UA_Client *client, const UA_ReadRequest *request,
+                     UA_ClientAsyncServiceCallback callback, void *userdata, UA_UInt32 *requestId) {
+    return UA_Client_sendAsyncRequest(client, request, &UA_TYPES[UA_TYPES_READREQUEST], callback,
+                                      &UA_TYPES[UA_TYPES_READRESPONSE], userdata, requestId);
+}
+
+UA_WriteResponse UA_Client_write(UA_Client *client, const UA_WriteRequest *request) {
+    UA_WriteResponse response;
+    UA_Client_service(client, request, &UA_TYPES[UA_TYPES_WRITEREQUEST], &response,
+                      &UA_TYPES[UA_TYPES_WRITERESPONSE]);
+    return response;
+}
+
+UA_BrowseResponse UA_Client_browse(UA_Client *client, const UA_BrowseRequest *request) {
+    UA_BrowseResponse response;
+    UA_Client_service(client, request, &UA_TYPES[UA_TYPES_BROWSEREQUEST], &response,
+                      &UA_TYPES[UA_TYPES_BROWSERESPONSE]);
+    return response;
+}
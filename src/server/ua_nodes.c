@@ -96,12 +96,34 @@ UA_StatusCode UA_ObjectTypeNode_copy(const UA_ObjectTypeNode *src, UA_ObjectType
 	return UA_Node_copy((const UA_Node*)src, (UA_Node*)dst);
 }
 
+/* UA_DataSourceCache */
+UA_DataSourceCache * UA_DataSourceCache_new(void) {
+    UA_DataSourceCache *cache = UA_malloc(sizeof(UA_DataSourceCache));
+    if(!cache)
+        return UA_NULL;
+    UA_DataValue_init(&cache->value);
+    cache->readTime = 0;
+#ifdef UA_MULTITHREADING
+    pthread_mutex_init(&cache->mutex, UA_NULL);
+#endif
+    return cache;
+}
+
+void UA_DataSourceCache_delete(UA_DataSourceCache *cache) {
+    UA_DataValue_deleteMembers(&cache->value);
+#ifdef UA_MULTITHREADING
+    pthread_mutex_destroy(&cache->mutex);
+#endif
+    UA_free(cache);
+}
+
 /* UA_VariableNode */
 void UA_VariableNode_init(UA_VariableNode *p) {
 	UA_Node_init((UA_Node*)p);
     p->nodeClass = UA_NODECLASS_VARIABLE;
     p->variableType = UA_VARIABLENODETYPE_VARIANT;
     UA_Variant_init(&p->variable.variant);
+    p->cache = UA_NULL;
     p->valueRank = -2; // scalar or array of any dimension
     p->accessLevel = 0;
     p->userAccessLevel = 0;
@@ -120,6 +142,10 @@ void UA_VariableNode_deleteMembers(UA_VariableNode *p) {
     UA_Node_deleteMembers((UA_Node*)p);
     if(p->variableType == UA_VARIABLENODETYPE_VARIANT)
         UA_Variant_deleteMembers(&p->variable.variant);
+    if(p->cache) {
+        UA_DataSourceCache_delete(p->cache);
+        p->cache = UA_NULL;
+    }
 }
 
 void UA_VariableNode_delete(UA_VariableNode *p) {
@@ -133,8 +159,11 @@ UA_StatusCode UA_VariableNode_copy(const UA_VariableNode *src, UA_VariableNode *
     dst->variableType = src->variableType;
     if(src->variableType == UA_VARIABLENODETYPE_VARIANT)
         retval = UA_Variant_copy(&src->variable.variant, &dst->variable.variant);
-    else
+    else {
         dst->variable.dataSource = src->variable.dataSource;
+        if(src->cache && !(dst->cache = UA_DataSourceCache_new()))
+            retval = UA_STATUSCODE_BADOUTOFMEMORY;
+    }
     if(retval) {
         UA_VariableNode_deleteMembers(dst);
         return retval;
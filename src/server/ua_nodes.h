@@ -5,6 +5,10 @@
 #include "ua_types_generated.h"
 #include "ua_types_encoding_binary.h"
 
+#ifdef UA_MULTITHREADING
+#include <pthread.h>
+#endif
+
 #define UA_STANDARD_NODEMEMBERS                 \
     UA_NodeId nodeId;                           \
     UA_NodeClass nodeClass;                     \
@@ -32,6 +36,19 @@ typedef struct {
 } UA_ObjectTypeNode;
 UA_TYPE_HANDLING_FUNCTIONS(UA_ObjectTypeNode)
 
+/** The last value read from a datasource. Only used for datasources with a
+    maxAge. Every node has its own cache, it is not shared between copies. */
+typedef struct {
+    UA_DataValue value;
+    UA_DateTime readTime; // 0 if the cache is empty
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t mutex;
+#endif
+} UA_DataSourceCache;
+
+UA_DataSourceCache * UA_DataSourceCache_new(void);
+void UA_DataSourceCache_delete(UA_DataSourceCache *cache);
+
 typedef struct {
     UA_STANDARD_NODEMEMBERS
     UA_Int32 valueRank; /**< n >= 1: the value is an array with the specified number of dimensions.
@@ -47,6 +64,7 @@ typedef struct {
         UA_Variant variant;
         UA_DataSource dataSource;
     } variable;
+    UA_DataSourceCache *cache; // for datasources with a maxAge
     UA_Byte accessLevel;
     UA_Byte userAccessLevel;
     UA_Double minimumSamplingInterval;
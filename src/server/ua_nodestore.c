@@ -1,6 +1,7 @@
 #include "ua_nodestore.h"
 #include "ua_util.h"
 #include "ua_statuscodes.h"
+#include "ua_server_diagnostics.h"
 
 /* It could happen that we want to delete a node even though a function higher
    in the call-chain still has a reference. So we count references and delete
@@ -318,8 +319,11 @@ UA_StatusCode UA_NodeStore_replace(UA_NodeStore *ns, const UA_Node *oldNode, UA_
 
 const UA_Node * UA_NodeStore_get(const UA_NodeStore *ns, const UA_NodeId *nodeid) {
     struct nodeEntry **slot;
-    if(!containsNodeId(ns, nodeid, &slot))
+    if(!containsNodeId(ns, nodeid, &slot)) {
+        UA_DIAGNOSTICS_NODESTOREGET(UA_FALSE);
         return UA_NULL;
+    }
+    UA_DIAGNOSTICS_NODESTOREGET(UA_TRUE);
     (*slot)->refcount++;
     return &(*slot)->node;
 }
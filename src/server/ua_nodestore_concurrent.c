@@ -6,6 +6,7 @@
 
 #include "ua_nodestore.h"
 #include "ua_util.h"
+#include "ua_server_diagnostics.h"
 
 #define ALIVE_BIT (1 << 15) /* Alive bit in the refcount */
 
@@ -312,8 +313,10 @@ const UA_Node * UA_NodeStore_get(const UA_NodeStore *ns, const UA_NodeId *nodeid
 
     if(!found_entry) {
         rcu_read_unlock();
+        UA_DIAGNOSTICS_NODESTOREGET(UA_FALSE);
         return UA_NULL;
     }
+    UA_DIAGNOSTICS_NODESTOREGET(UA_TRUE);
 
     /* This is done within a read-lock. The node will not be marked dead within a read-lock. */
     uatomic_inc(&found_entry->refcount);
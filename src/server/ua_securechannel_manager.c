@@ -3,35 +3,91 @@
 #include "ua_securechannel_manager.h"
 #include "ua_session.h"
 #include "ua_statuscodes.h"
+#ifdef UA_MULTITHREADING
+#include "ua_server_internal.h"
+#endif
 
 struct channel_list_entry {
     UA_SecureChannel channel;
     LIST_ENTRY(channel_list_entry) pointers;
+    TAILQ_ENTRY(channel_list_entry) expiry;
+    UA_DateTime validTill;
 };
 
+/* With multithreading, the lists are protected by a lock */
+#ifdef UA_MULTITHREADING
+#define LOCK(cm) pthread_mutex_lock(&(cm)->lock)
+#define UNLOCK(cm) pthread_mutex_unlock(&(cm)->lock)
+#else
+#define LOCK(cm)
+#define UNLOCK(cm)
+#endif
+
+/** The token lifetime is given in ms. Clients renew after 75% of the lifetime
+    has passed, the server waits for 125% before the channel is closed. */
+static UA_DateTime tokenValidTill(const UA_ChannelSecurityToken *token) {
+    return token->createdAt + ((UA_DateTime)token->revisedLifetime * 10000 * 5) / 4;
+}
+
+static void insertExpiry(UA_SecureChannelManager *cm, struct channel_list_entry *entry) {
+    entry->validTill = tokenValidTill(&entry->channel.securityToken);
+    struct channel_list_entry *prev = TAILQ_LAST(&cm->expiry, channel_expiry);
+    while(prev && prev->validTill > entry->validTill)
+        prev = TAILQ_PREV(prev, channel_expiry, expiry);
+    if(prev)
+        TAILQ_INSERT_AFTER(&cm->expiry, prev, entry, expiry);
+    else
+        TAILQ_INSERT_HEAD(&cm->expiry, entry, expiry);
+}
+
+static void deleteChannelEntry(UA_Server *server, struct channel_list_entry *entry) {
+    UA_SecureChannel_deleteMembers(&entry->channel);
+    UA_free(entry);
+}
+
+/** Call with the lock held */
+static void removeChannelEntry(UA_SecureChannelManager *cm, struct channel_list_entry *entry) {
+    if(entry->channel.connection)
+        entry->channel.connection->channel = UA_NULL; // remove pointer back to the channel
+    if(entry->channel.session)
+        entry->channel.session->channel = UA_NULL; // remove ponter back to the channel
+    LIST_REMOVE(entry, pointers);
+    TAILQ_REMOVE(&cm->expiry, entry, expiry);
+#ifdef UA_MULTITHREADING
+    if(cm->server) {
+        // a worker may still process a message of the channel
+        UA_Server_addDelayedMethodCall(cm->server, (void (*)(UA_Server*, void*))deleteChannelEntry, entry);
+        return;
+    }
+#endif
+    deleteChannelEntry(cm->server, entry);
+}
+
 UA_StatusCode UA_SecureChannelManager_init(UA_SecureChannelManager *cm, UA_UInt32 maxChannelCount,
                                            UA_UInt32 tokenLifetime, UA_UInt32 startChannelId,
-                                           UA_UInt32 startTokenId) {
+                                           UA_UInt32 startTokenId, UA_Server *server) {
     LIST_INIT(&cm->channels);
+    TAILQ_INIT(&cm->expiry);
     cm->lastChannelId      = startChannelId;
     cm->lastTokenId        = startTokenId;
     cm->maxChannelLifetime = tokenLifetime;
     cm->maxChannelCount    = maxChannelCount;
+    cm->server             = server;
+#ifdef UA_MULTITHREADING
+    pthread_mutex_init(&cm->lock, UA_NULL);
+#endif
     return UA_STATUSCODE_GOOD;
 }
 
+/** The worker threads have stopped. So the channels are freed right away. */
 void UA_SecureChannelManager_deleteMembers(UA_SecureChannelManager *cm) {
-    struct channel_list_entry *entry = LIST_FIRST(&cm->channels);
-    while(entry) {
-        LIST_REMOVE(entry, pointers);
-        if(entry->channel.session)
-            entry->channel.session->channel = UA_NULL;
-        if(entry->channel.connection)
-            entry->channel.connection->channel = UA_NULL;
-        UA_SecureChannel_deleteMembers(&entry->channel);
-        UA_free(entry);
-        entry = LIST_FIRST(&cm->channels);
-    }
+    cm->server = UA_NULL;
+    struct channel_list_entry *entry;
+    while((entry = LIST_FIRST(&cm->channels)))
+        removeChannelEntry(cm, entry);
+#ifdef UA_MULTITHREADING
+    pthread_mutex_destroy(&cm->lock);
+#endif
 }
 
 UA_StatusCode UA_SecureChannelManager_open(UA_SecureChannelManager           *cm,
@@ -45,7 +101,9 @@ UA_StatusCode UA_SecureChannelManager_open(UA_SecureChannelManager           *cm
 
         // fall through and handle afterwards
     /* case UA_MESSAGESECURITYMODE_NONE: */
-    /*     UA_ByteString_copy(&request->clientNonce, &entry->channel.clientNonce); */
+    /*     UA_SecureChannel_updateResponseHeader(&entry->channel);
+
+    UA_ByteString_copy(&request->clientNonce, &entry->channel.clientNonce); */
     /*     break; */
 
     case UA_MESSAGESECURITYMODE_SIGN:
@@ -67,8 +125,10 @@ UA_StatusCode UA_SecureChannelManager_open(UA_SecureChannelManager           *cm
 
     entry->channel.connection = conn;
     conn->channel = &entry->channel;
+    LOCK(cm);
     entry->channel.securityToken.channelId       = cm->lastChannelId++;
     entry->channel.securityToken.tokenId         = cm->lastTokenId++;
+    UNLOCK(cm);
     entry->channel.securityToken.createdAt       = UA_DateTime_now();
     entry->channel.securityToken.revisedLifetime =
         request->requestedLifetime > cm->maxChannelLifetime ?
@@ -77,7 +137,10 @@ UA_StatusCode UA_SecureChannelManager_open(UA_SecureChannelManager           *cm
     UA_ByteString_copy(&request->clientNonce, &entry->channel.clientNonce);
     UA_String_copycstring("http://opcfoundation.org/UA/SecurityPolicy#None",
                           (UA_String *)&entry->channel.serverAsymAlgSettings.securityPolicyUri);
+    LOCK(cm);
     LIST_INSERT_HEAD(&cm->channels, entry, pointers);
+    insertExpiry(cm, entry);
+    UNLOCK(cm);
 
     response->serverProtocolVersion = 0;
     UA_SecureChannel_generateNonce(&entry->channel.serverNonce);
@@ -95,10 +158,13 @@ UA_StatusCode UA_SecureChannelManager_renew(UA_SecureChannelManager           *c
     UA_SecureChannel *channel = conn->channel;
     if(channel == UA_NULL) return UA_STATUSCODE_BADINTERNALERROR;
 
+    LOCK(cm);
     channel->securityToken.tokenId         = cm->lastTokenId++;
+    UNLOCK(cm);
     channel->securityToken.createdAt       = UA_DateTime_now(); // todo: is wanted?
     channel->securityToken.revisedLifetime = request->requestedLifetime > cm->maxChannelLifetime ?
                                              cm->maxChannelLifetime : request->requestedLifetime;
+    UA_SecureChannel_updateResponseHeader(channel);
 
     if(channel->serverNonce.data != UA_NULL)
         UA_ByteString_deleteMembers(&channel->serverNonce);
@@ -106,34 +172,58 @@ UA_StatusCode UA_SecureChannelManager_renew(UA_SecureChannelManager           *c
     UA_ByteString_copy(&channel->serverNonce, &response->serverNonce);
     UA_ChannelSecurityToken_copy(&channel->securityToken, &response->securityToken);
 
+    // the channel is the first member of the list entry
+    struct channel_list_entry *entry = (struct channel_list_entry*)channel;
+    LOCK(cm);
+    TAILQ_REMOVE(&cm->expiry, entry, expiry);
+    insertExpiry(cm, entry);
+    UNLOCK(cm);
     return UA_STATUSCODE_GOOD;
 }
 
 UA_SecureChannel * UA_SecureChannelManager_get(UA_SecureChannelManager *cm, UA_UInt32 channelId) {
     struct channel_list_entry *entry;
+    LOCK(cm);
     LIST_FOREACH(entry, &cm->channels, pointers) {
         if(entry->channel.securityToken.channelId == channelId)
-            return &entry->channel;
+            break;
     }
-    return UA_NULL;
+    UNLOCK(cm);
+    return entry ? &entry->channel : UA_NULL;
 }
 
 UA_StatusCode UA_SecureChannelManager_close(UA_SecureChannelManager *cm, UA_UInt32 channelId) {
-    //TODO lock access
     // TODO: close the binaryconnection if it is still open. So we dö not have stray pointers..
     struct channel_list_entry *entry;
+    LOCK(cm);
     LIST_FOREACH(entry, &cm->channels, pointers) {
         if(entry->channel.securityToken.channelId == channelId) {
-            if(entry->channel.connection)
-                entry->channel.connection->channel = UA_NULL; // remove pointer back to the channel
-            if(entry->channel.session)
-                entry->channel.session->channel = UA_NULL; // remove ponter back to the channel
-            UA_SecureChannel_deleteMembers(&entry->channel);
-            LIST_REMOVE(entry, pointers);
-            UA_free(entry);
+            removeChannelEntry(cm, entry);
+            UNLOCK(cm);
             return UA_STATUSCODE_GOOD;
         }
     }
+    UNLOCK(cm);
     //TODO notify server application that secureChannel has been closed part 6 - §7.1.4
     return UA_STATUSCODE_BADINTERNALERROR;
 }
+
+UA_UInt32 UA_SecureChannelManager_cleanupTimedOut(UA_SecureChannelManager *cm, UA_DateTime now,
+                                                  UA_UInt32 maxRemovals) {
+    UA_UInt32 removed = 0;
+    struct channel_list_entry *entry;
+    LOCK(cm);
+    while(removed < maxRemovals && (entry = TAILQ_FIRST(&cm->expiry))) {
+        if(entry->validTill > now)
+            break; // all following channels are valid for longer
+        // the client did not renew the token. close the connection, so that no
+        // further messages arrive for the channel
+        UA_Connection *connection = entry->channel.connection;
+        removeChannelEntry(cm, entry);
+        if(connection)
+            connection->close(connection);
+        removed++;
+    }
+    UNLOCK(cm);
+    return removed;
+}
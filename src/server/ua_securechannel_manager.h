@@ -6,19 +6,31 @@
 #include "ua_securechannel.h"
 #include "ua_util.h"
 
+#ifdef UA_MULTITHREADING
+#include <pthread.h>
+#endif
+
 typedef struct UA_SecureChannelManager {
     LIST_HEAD(channel_list, channel_list_entry) channels; // doubly-linked list of channels
+    TAILQ_HEAD(channel_expiry, channel_list_entry) expiry; // the channels ordered by token expiry
     UA_Int32    maxChannelCount;
     UA_DateTime maxChannelLifetime;
     UA_MessageSecurityMode securityMode;
     UA_DateTime channelLifeTime;
     UA_Int32    lastChannelId;
     UA_UInt32   lastTokenId;
+    UA_Server  *server; // removed channels are freed as delayed work of the server
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t lock; // protects the lists
+#endif
 } UA_SecureChannelManager;
 
+/** With multithreading, worker threads may still use a channel that is
+    closed. Then the channel is freed as delayed work of the server. If the
+    server is UA_NULL, the channel is freed right away. */
 UA_StatusCode UA_SecureChannelManager_init(UA_SecureChannelManager *cm, UA_UInt32 maxChannelCount,
                                            UA_UInt32 tokenLifetime, UA_UInt32 startChannelId,
-                                           UA_UInt32 startTokenId);
+                                           UA_UInt32 startTokenId, UA_Server *server);
 void UA_SecureChannelManager_deleteMembers(UA_SecureChannelManager *cm);
 UA_StatusCode UA_SecureChannelManager_open(UA_SecureChannelManager *cm, UA_Connection *conn,
                                            const UA_OpenSecureChannelRequest *request,
@@ -29,4 +41,10 @@ UA_StatusCode UA_SecureChannelManager_renew(UA_SecureChannelManager *cm, UA_Conn
 UA_SecureChannel * UA_SecureChannelManager_get(UA_SecureChannelManager *cm, UA_UInt32 channelId);
 UA_StatusCode UA_SecureChannelManager_close(UA_SecureChannelManager *cm, UA_UInt32 channelId);
 
+/** Closes channels whose security token expired before now without being
+    renewed. At most maxRemovals channels are removed per call. Returns the
+    number of removed channels. */
+UA_UInt32 UA_SecureChannelManager_cleanupTimedOut(UA_SecureChannelManager *cm, UA_DateTime now,
+                                                  UA_UInt32 maxRemovals);
+
 #endif /* UA_CHANNEL_MANAGER_H_ */
@@ -35,10 +35,36 @@ void UA_Server_addNetworkLayer(UA_Server *server, UA_ServerNetworkLayer networkL
     server->nlsSize++;
 }
 
+void UA_Server_addNetworkLayerWithLoop(UA_Server *server, UA_ServerNetworkLayer networkLayer) {
+#ifdef UA_MULTITHREADING
+    server->loopNls = UA_realloc(server->loopNls, sizeof(UA_ServerNetworkLayer)*(server->loopNlsSize+1));
+    server->loopNls[server->loopNlsSize] = networkLayer;
+    server->loopNlsSize++;
+#else
+    UA_Server_addNetworkLayer(server, networkLayer);
+#endif
+}
+
 void UA_Server_setServerCertificate(UA_Server *server, UA_ByteString certificate) {
     UA_ByteString_copy(&certificate, &server->serverCertificate);
 }
 
+void UA_Server_setMaxRequestsInFlight(UA_Server *server, UA_UInt32 maxRequestsInFlight) {
+    server->maxRequestsInFlight = maxRequestsInFlight;
+}
+
+void UA_Server_setMaxSessionTimeout(UA_Server *server, UA_UInt32 maxSessionTimeout) {
+    server->sessionManager.maxSessionTimeout = maxSessionTimeout;
+}
+
+void UA_Server_setLogger(UA_Server *server, UA_Logger logger) {
+    server->logger = logger;
+}
+
+#ifdef UA_TRACING
+UA_Tracer UA_tracer = {.handle = UA_NULL, .trace = UA_NULL};
+#endif
+
 /**********/
 /* Server */
 /**********/
@@ -46,24 +72,37 @@ void UA_Server_setServerCertificate(UA_Server *server, UA_ByteString certificate
 void UA_Server_delete(UA_Server *server) {
     // The server needs to be stopped before it can be deleted
 
+    // Delete the channels and sessions first. Channels hold a pointer to their
+    // connection that is freed with the network layer.
+    UA_SecureChannelManager_deleteMembers(&server->secureChannelManager);
+    UA_SessionManager_deleteMembers(&server->sessionManager);
+
     // Delete the network layers
     for(UA_Int32 i=0;i<server->nlsSize;i++) {
         server->nls[i].free(server->nls[i].nlHandle);
     }
     UA_free(server->nls);
+    for(UA_Int32 i=0;i<server->loopNlsSize;i++) {
+        server->loopNls[i].free(server->loopNls[i].nlHandle);
+    }
+    UA_free(server->loopNls);
 
     // Delete the timed work
     UA_Server_deleteTimedWork(server);
 
     // Delete all internal data
     UA_ApplicationDescription_deleteMembers(&server->description);
-    UA_SecureChannelManager_deleteMembers(&server->secureChannelManager);
-    UA_SessionManager_deleteMembers(&server->sessionManager);
     UA_NodeStore_delete(server->nodestore);
+#ifdef UA_DIAGNOSTICS
+    UA_ServerDiagnostics_deleteMembers(&server->diagnostics);
+#endif
     UA_ByteString_deleteMembers(&server->serverCertificate);
     UA_Array_delete(server->endpointDescriptions, &UA_TYPES[UA_TYPES_ENDPOINTDESCRIPTION], server->endpointDescriptionsSize);
+    UA_free(server->customServices);
 #ifdef UA_MULTITHREADING
     pthread_cond_destroy(&server->dispatchQueue_condition); // so the workers don't spin if the queue is empty
+    pthread_mutex_destroy(&server->asyncReadsMutex);
+    pthread_mutex_destroy(&server->serviceMutex);
     rcu_barrier(); // wait for all scheduled call_rcu work to complete
 #endif
     UA_free(server);
@@ -101,18 +140,42 @@ UA_Server * UA_Server_new(void) {
         return UA_NULL;
 
     LIST_INIT(&server->timedWork);
+    LIST_INIT(&server->asyncReads);
+    UA_memset(&server->logger, 0, sizeof(UA_Logger));
 #ifdef UA_MULTITHREADING
     rcu_init();
+    pthread_mutex_init(&server->asyncReadsMutex, UA_NULL);
+    pthread_mutex_init(&server->serviceMutex, UA_NULL);
 	cds_wfcq_init(&server->dispatchQueue_head, &server->dispatchQueue_tail);
+	cds_wfcq_init(&server->loopDelayedWork_head, &server->loopDelayedWork_tail);
     server->delayedWork = UA_NULL;
+    server->nThreads = 0;
+#define PARALLELTHRESHOLD 1000
+#define PARALLELMINRANGESIZE 250
+    server->parallelThreshold = PARALLELTHRESHOLD;
+    server->parallelMinRangeSize = PARALLELMINRANGESIZE;
+#endif
+
+#ifdef UA_DIAGNOSTICS
+    UA_ServerDiagnostics_init(&server->diagnostics);
 #endif
 
+    // services
+    UA_memset(server->services, 0, sizeof(server->services));
+    server->customServicesSize = 0;
+    server->customServices = UA_NULL;
+    UA_Server_addStandardServices(server);
+#define MAXREQUESTSINFLIGHT 64
+    server->maxRequestsInFlight = MAXREQUESTSINFLIGHT;
+
     // random seed
     server->random_seed = (UA_UInt32) UA_DateTime_now();
 
     // networklayers
     server->nls = UA_NULL;
     server->nlsSize = 0;
+    server->loopNls = UA_NULL;
+    server->loopNlsSize = 0;
 
     UA_ByteString_init(&server->serverCertificate);
         
@@ -152,12 +215,13 @@ UA_Server * UA_Server_new(void) {
 #define TOKENLIFETIME 600000
 #define STARTTOKENID 1
     UA_SecureChannelManager_init(&server->secureChannelManager, MAXCHANNELCOUNT,
-                                 TOKENLIFETIME, STARTCHANNELID, STARTTOKENID);
+                                 TOKENLIFETIME, STARTCHANNELID, STARTTOKENID, server);
 
 #define MAXSESSIONCOUNT 1000
-#define SESSIONLIFETIME 10000
+#define MAXSESSIONTIMEOUT 3600000 // 1h
 #define STARTSESSIONID 1
-    UA_SessionManager_init(&server->sessionManager, MAXSESSIONCOUNT, SESSIONLIFETIME, STARTSESSIONID);
+    UA_SessionManager_init(&server->sessionManager, MAXSESSIONCOUNT, MAXSESSIONTIMEOUT, STARTSESSIONID,
+                           server);
 
     server->nodestore = UA_NodeStore_new();
 
@@ -723,5 +787,9 @@ UA_Server * UA_Server_new(void) {
                       &UA_EXPANDEDNODEID_STATIC(0, UA_NS0ID_BASEDATATYPE),
                       &UA_NODEID_STATIC(0, UA_NS0ID_ORGANIZES));
 
+#ifdef UA_DIAGNOSTICS
+    UA_ServerDiagnostics_addNodes(server);
+#endif
+
     return server;
 }
@@ -32,6 +32,10 @@ UA_StatusCode UA_Server_addDataSourceVariableNode(UA_Server *server, UA_DataSour
     UA_VariableNode *node = UA_VariableNode_new();
     node->variableType = UA_VARIABLENODETYPE_DATASOURCE;
     node->variable.dataSource = dataSource;
+    if(dataSource.maxAge > 0.0 && !(node->cache = UA_DataSourceCache_new())) {
+        UA_VariableNode_delete(node);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
     UA_NodeId_copy(nodeId, &node->nodeId);
     UA_QualifiedName_copy(browseName, &node->browseName);
     UA_String_copy(&browseName->name, &node->displayName.text);
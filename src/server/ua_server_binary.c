@@ -1,5 +1,3 @@
-#include <stdio.h>
-
 #include "ua_server_internal.h"
 #include "ua_types_encoding_binary.h"
 #include "ua_transport_generated.h"
@@ -10,9 +8,17 @@
 #include "ua_util.h"
 #include "ua_nodeids.h"
 
-/** Max size of messages that are allocated on the stack */
+#ifdef UA_MULTITHREADING
+#include <urcu/uatomic.h>
+#endif
+
+/** Size of the stack buffer that responses are encoded into. Larger responses
+    are moved to the heap. */
 #define MAX_STACK_MESSAGE 65536
 
+/** Size of the stack buffer for the acknowledge and open securechannel response */
+#define MAX_HANDSHAKE_MESSAGE 512
+
 static UA_StatusCode UA_ByteStringArray_deleteMembers(UA_ByteStringArray *stringarray) {
     if(!stringarray)
         return UA_STATUSCODE_BADINTERNALERROR;
@@ -21,6 +27,14 @@ static UA_StatusCode UA_ByteStringArray_deleteMembers(UA_ByteStringArray *string
     return UA_STATUSCODE_GOOD;
 }
 
+/** Writes the size of the complete message into the tcp message header */
+static void patchMessageSize(UA_ByteString *message, size_t messageSize) {
+    UA_UInt32 size = (UA_UInt32)messageSize;
+    size_t sizePos = 4; // behind the message type
+    UA_UInt32_encodeBinary(&size, message, &sizePos);
+    message->length = (UA_Int32)messageSize;
+}
+
 static void processHEL(UA_Connection *connection, const UA_ByteString *msg, size_t *pos) {
     UA_TcpHelloMessage helloMessage;
     if(UA_TcpHelloMessage_decodeBinary(msg, pos, &helloMessage) != UA_STATUSCODE_GOOD) {
@@ -45,18 +59,19 @@ static void processHEL(UA_Connection *connection, const UA_ByteString *msg, size
 
     UA_TcpMessageHeader ackHeader;
     ackHeader.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_ACKF;
-    ackHeader.messageSize = UA_TcpAcknowledgeMessage_calcSizeBinary(&ackMessage) +
-                            UA_TcpMessageHeader_calcSizeBinary(&ackHeader);
+    ackHeader.messageSize = 0; // back-patched when the message is encoded
 
     // The message is on the stack. That's ok since ack is very small.
-    UA_ByteString ack_msg = (UA_ByteString){ .length = ackHeader.messageSize,
-                                             .data = UA_alloca(ackHeader.messageSize) };
+    UA_Byte ackData[MAX_HANDSHAKE_MESSAGE];
+    UA_ByteString ack_msg = (UA_ByteString){ .length = MAX_HANDSHAKE_MESSAGE, .data = ackData };
     size_t tmpPos = 0;
     UA_TcpMessageHeader_encodeBinary(&ackHeader, &ack_msg, &tmpPos);
-    UA_TcpAcknowledgeMessage_encodeBinary(&ackMessage, &ack_msg, &tmpPos);
-    UA_ByteStringArray answer_buf = { .stringsSize = 1, .strings = &ack_msg };
-    // the string is freed internall in the (asynchronous) write
-    connection->write(connection, answer_buf);
+    if(UA_TcpAcknowledgeMessage_encodeBinary(&ackMessage, &ack_msg, &tmpPos) == UA_STATUSCODE_GOOD) {
+        patchMessageSize(&ack_msg, tmpPos);
+        UA_ByteStringArray answer_buf = { .stringsSize = 1, .strings = &ack_msg };
+        connection->write(connection, answer_buf);
+        UA_TRACE(WRITE, 0, tmpPos);
+    }
     UA_TcpHelloMessage_deleteMembers(&helloMessage);
 }
 
@@ -99,27 +114,29 @@ static void processOPN(UA_Connection *connection, UA_Server *server, const UA_By
     UA_NodeId responseType = UA_NODEID_STATIC(0, UA_NS0ID_OPENSECURECHANNELRESPONSE);
     responseType.identifier.numeric += UA_ENCODINGOFFSET_BINARY;
 
-    respHeader.messageHeader.messageSize =
-        UA_SecureConversationMessageHeader_calcSizeBinary(&respHeader)
-        + UA_AsymmetricAlgorithmSecurityHeader_calcSizeBinary(&asymHeader)
-        + UA_SequenceHeader_calcSizeBinary(&seqHeader)
-        + UA_NodeId_calcSizeBinary(&responseType)
-        + UA_OpenSecureChannelResponse_calcSizeBinary(&p);
-
-    UA_ByteString resp_msg = (UA_ByteString){ .length = respHeader.messageHeader.messageSize,
-                                              .data = UA_alloca(respHeader.messageHeader.messageSize) };
-
+    UA_Byte respData[MAX_HANDSHAKE_MESSAGE];
+    UA_ByteString resp_msg = (UA_ByteString){ .length = MAX_HANDSHAKE_MESSAGE, .data = respData };
+    UA_Boolean onHeap = UA_FALSE;
     size_t tmpPos = 0;
     UA_SecureConversationMessageHeader_encodeBinary(&respHeader, &resp_msg, &tmpPos);
-    UA_AsymmetricAlgorithmSecurityHeader_encodeBinary(&asymHeader, &resp_msg, &tmpPos); // just mirror back
-    UA_SequenceHeader_encodeBinary(&seqHeader, &resp_msg, &tmpPos); // just mirror back
-    UA_NodeId_encodeBinary(&responseType, &resp_msg, &tmpPos);
-    UA_OpenSecureChannelResponse_encodeBinary(&p, &resp_msg, &tmpPos);
+    UA_StatusCode retval = UA_encodeBinaryGrowing(&asymHeader, &UA_TRANSPORT[UA_TRANSPORT_ASYMMETRICALGORITHMSECURITYHEADER],
+                                                  &resp_msg, &tmpPos, &onHeap); // just mirror back
+    retval |= UA_encodeBinaryGrowing(&seqHeader, &UA_TRANSPORT[UA_TRANSPORT_SEQUENCEHEADER],
+                                     &resp_msg, &tmpPos, &onHeap); // just mirror back
+    retval |= UA_encodeBinaryGrowing(&responseType, &UA_TYPES[UA_TYPES_NODEID], &resp_msg, &tmpPos, &onHeap);
+    retval |= UA_encodeBinaryGrowing(&p, &UA_TYPES[UA_TYPES_OPENSECURECHANNELRESPONSE],
+                                     &resp_msg, &tmpPos, &onHeap);
 
     UA_OpenSecureChannelRequest_deleteMembers(&r);
     UA_OpenSecureChannelResponse_deleteMembers(&p);
     UA_AsymmetricAlgorithmSecurityHeader_deleteMembers(&asymHeader);
-    connection->write(connection, (UA_ByteStringArray){ .stringsSize = 1, .strings = &resp_msg });
+    if(retval == UA_STATUSCODE_GOOD) {
+        patchMessageSize(&resp_msg, tmpPos);
+        connection->write(connection, (UA_ByteStringArray){ .stringsSize = 1, .strings = &resp_msg });
+        UA_TRACE(WRITE, seqHeader.requestId, tmpPos);
+    }
+    if(onHeap)
+        UA_free(resp_msg.data);
 }
 
 static void init_response_header(const UA_RequestHeader *p, UA_ResponseHeader *r) {
@@ -129,31 +146,312 @@ static void init_response_header(const UA_RequestHeader *p, UA_ResponseHeader *r
     r->timestamp       = UA_DateTime_now();
 }
 
-// if the message is small enough, we allocate it on the stack and save a malloc
-#define ALLOC_MESSAGE(MESSAGE, SIZE) do {                               \
-        UA_UInt32 messageSize = SIZE;                                   \
-        if(messageSize <= MAX_STACK_MESSAGE) {                          \
-            messageOnStack = UA_TRUE;                                   \
-            *MESSAGE = (UA_ByteString){.length = messageSize,           \
-                                       .data = UA_alloca(messageSize)}; \
-        } else                                                          \
-            UA_ByteString_newMembers(MESSAGE, messageSize);             \
-    } while(0)
-
-#define INVOKE_SERVICE(TYPE) do {                                       \
-        UA_##TYPE##Request p;                                           \
-        UA_##TYPE##Response r;                                          \
-        if(UA_##TYPE##Request_decodeBinary(msg, pos, &p))               \
-            return;                                                     \
-        UA_##TYPE##Response_init(&r);                                   \
-        init_response_header(&p.requestHeader, &r.responseHeader);      \
-        Service_##TYPE(server, clientSession, &p, &r);                  \
-        ALLOC_MESSAGE(message, UA_##TYPE##Response_calcSizeBinary(&r)); \
-        UA_##TYPE##Response_encodeBinary(&r, message, &sendOffset);     \
-        UA_##TYPE##Request_deleteMembers(&p);                           \
-        UA_##TYPE##Response_deleteMembers(&r);                          \
-        responseType = requestType.identifier.numeric + 3;              \
-    } while(0)
+/** Encodes the nodeid of the response type. The ids of the standard responses
+    fit into the four-byte encoding and are written directly. */
+static void encodeResponseTypeId(const UA_DataType *responseType, UA_ByteString *message, size_t *pos) {
+    UA_NodeId responseId = responseType->typeId;
+    responseId.identifier.numeric += UA_ENCODINGOFFSET_BINARY;
+    if(responseId.namespaceIndex != 0 || responseId.identifier.numeric <= UA_BYTE_MAX ||
+       responseId.identifier.numeric > UA_UINT16_MAX) {
+        UA_NodeId_encodeBinary(&responseId, message, pos);
+        return;
+    }
+    UA_UInt16 numeric = (UA_UInt16)responseId.identifier.numeric;
+    message->data[(*pos)++] = 0x01; // four-byte encoding
+    message->data[(*pos)++] = 0; // namespace zero
+    UA_UInt16_encodeBinary(&numeric, message, pos);
+}
+
+/** Writes the message headers from the template of the channel and the
+    sequence header. They always fit into the stack buffer. */
+static size_t encodeMessageHeaders(const UA_SecureChannel *channel, UA_UInt32 sequenceNumber,
+                                   UA_UInt32 requestId, UA_ByteString *message) {
+    UA_memcpy(message->data, channel->responseHeader, UA_SECURECHANNEL_RESPONSEHEADERSIZE);
+    size_t rpos = UA_SECURECHANNEL_RESPONSEHEADERSIZE;
+    UA_UInt32_encodeBinary(&sequenceNumber, message, &rpos);
+    UA_UInt32_encodeBinary(&requestId, message, &rpos);
+    return rpos;
+}
+
+/** A ServiceFault consists of the response header only */
+static UA_StatusCode encodeServiceFault(UA_UInt32 requestHandle, UA_StatusCode serviceResult,
+                                        UA_ByteString *message, size_t *pos) {
+    UA_NodeId faultId = UA_NODEID_STATIC(0, UA_NS0ID_SERVICEFAULT + UA_ENCODINGOFFSET_BINARY);
+    UA_ResponseHeader r;
+    UA_ResponseHeader_init(&r);
+    r.requestHandle = requestHandle;
+    r.timestamp     = UA_DateTime_now();
+    r.serviceResult = serviceResult;
+    UA_StatusCode retval = UA_NodeId_encodeBinary(&faultId, message, pos);
+    retval |= UA_ResponseHeader_encodeBinary(&r, message, pos);
+    return retval;
+}
+
+/** Encodes the message headers and the response in a single pass and sends
+    the message. The header starts with the template of the channel. The
+    encoding starts on the stack and moves to the heap only for large
+    responses. The message size is back-patched at the end. If the response
+    cannot be encoded, a ServiceFault with the status of the encoding is sent
+    instead, so that the client does not wait for the response. */
+static void sendResponse(UA_Connection *connection, const UA_SecureChannel *channel,
+                         UA_UInt32 sequenceNumber, UA_UInt32 requestId, const void *response,
+                         const UA_DataType *responseType) {
+    UA_Byte messageData[MAX_STACK_MESSAGE];
+    UA_ByteString message = { .length = MAX_STACK_MESSAGE, .data = messageData };
+    UA_Boolean onHeap = UA_FALSE;
+    size_t rpos = encodeMessageHeaders(channel, sequenceNumber, requestId, &message);
+    encodeResponseTypeId(responseType, &message, &rpos);
+    UA_StatusCode retval = UA_encodeBinaryGrowing(response, responseType, &message, &rpos, &onHeap);
+    if(retval != UA_STATUSCODE_GOOD) {
+        if(onHeap) {
+            UA_free(message.data);
+            message = (UA_ByteString){ .length = MAX_STACK_MESSAGE, .data = messageData };
+            onHeap = UA_FALSE;
+        }
+        // all responses start with the response header
+        rpos = encodeMessageHeaders(channel, sequenceNumber, requestId, &message);
+        retval = encodeServiceFault(((const UA_ResponseHeader*)response)->requestHandle, retval,
+                                    &message, &rpos);
+    }
+
+    // todo: sign & encrypt
+
+    if(retval == UA_STATUSCODE_GOOD) {
+        patchMessageSize(&message, rpos);
+        connection->write(connection, (UA_ByteStringArray){ .stringsSize = 1, .strings = &message });
+        UA_TRACE(WRITE, requestId, rpos);
+        UA_DIAGNOSTICS_BYTESSENT(rpos);
+    }
+    if(onHeap)
+        UA_free(message.data);
+}
+
+/**********************/
+/* Requests in Flight */
+/**********************/
+
+/** Counts the request as in flight on the channel. Fails if the channel has
+    reached the limit. Then the client has to wait for outstanding responses. */
+static UA_Boolean beginRequest(UA_Server *server, UA_SecureChannel *channel) {
+#ifdef UA_MULTITHREADING
+    UA_UInt32 inFlight = uatomic_add_return(&channel->requestsInFlight, 1);
+#else
+    UA_UInt32 inFlight = ++channel->requestsInFlight;
+#endif
+    if(server->maxRequestsInFlight == 0 || inFlight <= server->maxRequestsInFlight)
+        return UA_TRUE;
+#ifdef UA_MULTITHREADING
+    uatomic_dec(&channel->requestsInFlight);
+#else
+    channel->requestsInFlight--;
+#endif
+    return UA_FALSE;
+}
+
+/** Called when the response has been sent */
+static void endRequest(UA_SecureChannel *channel) {
+#ifdef UA_MULTITHREADING
+    uatomic_dec(&channel->requestsInFlight);
+#else
+    channel->requestsInFlight--;
+#endif
+}
+
+/** A read response that is sent when the asynchronous datasources have
+    delivered all values */
+struct AsyncReadResponse {
+    UA_AsyncRead read;
+    UA_UInt32 channelId;
+    UA_UInt32 sequenceNumber;
+    UA_UInt32 requestId;
+};
+
+static void sendAsyncReadResponse(UA_Server *server, UA_AsyncRead *read) {
+    struct AsyncReadResponse *arr = (struct AsyncReadResponse*)read;
+    // the channel might have been closed in the meantime
+    UA_SecureChannel *channel = UA_SecureChannelManager_get(&server->secureChannelManager, arr->channelId);
+    if(channel) {
+        if(channel->connection)
+            sendResponse(channel->connection, channel, arr->sequenceNumber, arr->requestId,
+                         &read->response, &UA_TYPES[UA_TYPES_READRESPONSE]);
+        endRequest(channel);
+    }
+    UA_ReadRequest_deleteMembers(&read->request);
+    UA_ReadResponse_deleteMembers(&read->response);
+    UA_free(arr);
+}
+
+/*****************/
+/* Service Table */
+/*****************/
+
+static void getEndpoints(UA_Server *server, UA_SecureChannel *channel, UA_Session *session,
+                         const void *request, void *response) {
+    Service_GetEndpoints(server, request, response);
+}
+
+static void createSession(UA_Server *server, UA_SecureChannel *channel, UA_Session *session,
+                          const void *request, void *response) {
+    Service_CreateSession(server, channel, request, response);
+}
+
+static void activateSession(UA_Server *server, UA_SecureChannel *channel, UA_Session *session,
+                            const void *request, void *response) {
+    Service_ActivateSession(server, channel, request, response);
+}
+
+static void closeSession(UA_Server *server, UA_SecureChannel *channel, UA_Session *session,
+                         const void *request, void *response) {
+    Service_CloseSession(server, request, response);
+}
+
+#define SESSION_SERVICE(NAME, TYPE)                                     \
+    static void NAME(UA_Server *server, UA_SecureChannel *channel, UA_Session *session, \
+                     const void *request, void *response) {             \
+        Service_##TYPE(server, session, request, response);             \
+    }
+
+SESSION_SERVICE(readService, Read)
+SESSION_SERVICE(writeService, Write)
+SESSION_SERVICE(browseService, Browse)
+SESSION_SERVICE(addReferencesService, AddReferences)
+SESSION_SERVICE(translateBrowsePathsService, TranslateBrowsePathsToNodeIds)
+
+void UA_Server_addStandardServices(UA_Server *server) {
+    const UA_UInt32 sessionFlags = UA_SERVICEFLAG_SESSION | UA_SERVICEFLAG_CONCURRENT;
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_GETENDPOINTSREQUEST],
+                         &UA_TYPES[UA_TYPES_GETENDPOINTSRESPONSE], getEndpoints,
+                         UA_SERVICEFLAG_CONCURRENT | UA_SERVICEFLAG_READONLY);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_CREATESESSIONREQUEST],
+                         &UA_TYPES[UA_TYPES_CREATESESSIONRESPONSE], createSession, UA_SERVICEFLAG_CONCURRENT);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_ACTIVATESESSIONREQUEST],
+                         &UA_TYPES[UA_TYPES_ACTIVATESESSIONRESPONSE], activateSession, UA_SERVICEFLAG_CONCURRENT);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_CLOSESESSIONREQUEST],
+                         &UA_TYPES[UA_TYPES_CLOSESESSIONRESPONSE], closeSession, UA_SERVICEFLAG_CONCURRENT);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_READREQUEST], &UA_TYPES[UA_TYPES_READRESPONSE],
+                         readService, sessionFlags | UA_SERVICEFLAG_STATELESS | UA_SERVICEFLAG_BORROWREQUEST |
+                         UA_SERVICEFLAG_READONLY);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_WRITEREQUEST], &UA_TYPES[UA_TYPES_WRITERESPONSE],
+                         writeService, sessionFlags | UA_SERVICEFLAG_STATELESS | UA_SERVICEFLAG_BORROWREQUEST);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_BROWSEREQUEST], &UA_TYPES[UA_TYPES_BROWSERESPONSE],
+                         browseService, sessionFlags | UA_SERVICEFLAG_STATELESS | UA_SERVICEFLAG_BORROWREQUEST |
+                         UA_SERVICEFLAG_READONLY);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_ADDREFERENCESREQUEST],
+                         &UA_TYPES[UA_TYPES_ADDREFERENCESRESPONSE], addReferencesService,
+                         sessionFlags | UA_SERVICEFLAG_BORROWREQUEST);
+    UA_Server_addService(server, &UA_TYPES[UA_TYPES_TRANSLATEBROWSEPATHSTONODEIDSREQUEST],
+                         &UA_TYPES[UA_TYPES_TRANSLATEBROWSEPATHSTONODEIDSRESPONSE], translateBrowsePathsService,
+                         sessionFlags | UA_SERVICEFLAG_BORROWREQUEST | UA_SERVICEFLAG_READONLY);
+}
+
+UA_StatusCode UA_Server_addService(UA_Server *server, const UA_DataType *requestType,
+                                   const UA_DataType *responseType, UA_ServiceHandler handler,
+                                   UA_UInt32 flags) {
+    if(!requestType || !responseType || !handler)
+        return UA_STATUSCODE_BADINTERNALERROR;
+    UA_Service service = {.requestType = requestType, .responseType = responseType,
+                          .handler = handler, .flags = flags};
+#ifdef UA_DIAGNOSTICS
+    service.diagnosticsIndex = UA_ServerDiagnostics_addService(server, requestType);
+#endif
+    if(requestType->namespaceZero) {
+        server->services[requestType->typeIndex] = service;
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_StatusCode retval = UA_registerDataTypes(requestType, 1);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    for(UA_Int32 i = 0; i < server->customServicesSize; i++) {
+        if(server->customServices[i].requestType == requestType) {
+            server->customServices[i] = service;
+            return UA_STATUSCODE_GOOD;
+        }
+    }
+    UA_Service *services = UA_realloc(server->customServices,
+                                      sizeof(UA_Service) * (server->customServicesSize + 1));
+    if(!services)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    services[server->customServicesSize] = service;
+    server->customServices = services;
+    server->customServicesSize++;
+    return UA_STATUSCODE_GOOD;
+}
+
+static const UA_Service * findService(UA_Server *server, const UA_NodeId *requestTypeId) {
+    const UA_DataType *requestType = UA_findDataTypeByBinaryEncodingId(requestTypeId);
+    if(!requestType)
+        return UA_NULL;
+    if(requestType->namespaceZero) {
+        if(!server->services[requestType->typeIndex].handler)
+            return UA_NULL;
+        return &server->services[requestType->typeIndex];
+    }
+    for(UA_Int32 i = 0; i < server->customServicesSize; i++) {
+        if(server->customServices[i].requestType == requestType)
+            return &server->customServices[i];
+    }
+    return UA_NULL;
+}
+
+/** Answers with a ServiceFault. The request is not processed. */
+static void sendServiceFault(UA_Connection *connection, UA_SecureChannel *channel,
+                             const UA_SequenceHeader *sequenceHeader, const UA_ByteString *msg,
+                             size_t *pos, UA_StatusCode serviceResult) {
+    UA_RequestHeader p;
+    if(UA_RequestHeader_decodeBinary(msg, pos, &p))
+        return;
+    UA_Byte messageData[MAX_HANDSHAKE_MESSAGE];
+    UA_ByteString message = { .length = MAX_HANDSHAKE_MESSAGE, .data = messageData };
+    size_t rpos = encodeMessageHeaders(channel, sequenceHeader->sequenceNumber,
+                                       sequenceHeader->requestId, &message);
+    if(encodeServiceFault(p.requestHandle, serviceResult, &message, &rpos) == UA_STATUSCODE_GOOD) {
+        patchMessageSize(&message, rpos);
+        connection->write(connection, (UA_ByteStringArray){ .stringsSize = 1, .strings = &message });
+        UA_TRACE(WRITE, sequenceHeader->requestId, rpos);
+        UA_DIAGNOSTICS_BYTESSENT(rpos);
+    }
+    UA_RequestHeader_deleteMembers(&p);
+}
+
+/** Reads may complete asynchronously when the values of asynchronous
+    datasources arrive */
+static void processReadAsync(UA_Connection *connection, UA_Server *server, UA_SecureChannel *channel,
+                             UA_Session *session, const UA_SequenceHeader *sequenceHeader,
+                             const UA_ByteString *msg, size_t *pos) {
+    UA_DIAGNOSTICS_REQUESTSTART(&server->services[UA_TYPES_READREQUEST]);
+    struct AsyncReadResponse *arr = UA_malloc(sizeof(struct AsyncReadResponse));
+    if(!arr) {
+        endRequest(channel);
+        return;
+    }
+    if(UA_ReadRequest_decodeBinary(msg, pos, &arr->read.request)) {
+        UA_free(arr);
+        endRequest(channel);
+        return;
+    }
+    UA_TRACE(DECODED, channel->securityToken.channelId, sequenceHeader->requestId);
+    UA_DIAGNOSTICS_REQUESTPHASE(decode);
+    UA_ReadResponse_init(&arr->read.response);
+    init_response_header(&arr->read.request.requestHeader, &arr->read.response.responseHeader);
+    arr->read.finished = sendAsyncReadResponse;
+    arr->channelId = channel->securityToken.channelId;
+    arr->sequenceNumber = sequenceHeader->sequenceNumber;
+    arr->requestId = sequenceHeader->requestId;
+    UA_StatusCode retval = Service_ReadAsync(server, session, &arr->read);
+    UA_TRACE(SERVICED, channel->securityToken.channelId, sequenceHeader->requestId);
+    UA_DIAGNOSTICS_REQUESTPHASE(service);
+    if(retval == UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY)
+        return; // the response is sent when the last value arrives
+    sendResponse(connection, channel, sequenceHeader->sequenceNumber, sequenceHeader->requestId,
+                 &arr->read.response, &UA_TYPES[UA_TYPES_READRESPONSE]);
+    UA_DIAGNOSTICS_REQUESTPHASE(encode);
+    UA_DIAGNOSTICS_REQUESTRESULT(&arr->read.response.responseHeader);
+    endRequest(channel);
+    UA_ReadRequest_deleteMembers(&arr->read.request);
+    UA_ReadResponse_deleteMembers(&arr->read.response);
+    UA_free(arr);
+}
 
 static void processMSG(UA_Connection *connection, UA_Server *server, const UA_ByteString *msg, size_t *pos) {
     // 1) Read in the securechannel
@@ -170,8 +468,11 @@ static void processMSG(UA_Connection *connection, UA_Server *server, const UA_By
         clientSession = &anonymousSession;
     } 
 #endif
-    if(!clientSession && clientChannel)
+    if(!clientSession && clientChannel) {
         clientSession = clientChannel->session;
+        if(clientSession) // activity on the session extends the lifetime
+            UA_SessionManager_updateSessionLifetime(&server->sessionManager, clientSession);
+    }
 
     // 2) Read the security header
     UA_UInt32 tokenId;
@@ -179,9 +480,10 @@ static void processMSG(UA_Connection *connection, UA_Server *server, const UA_By
     UA_SequenceHeader sequenceHeader;
     if(UA_SequenceHeader_decodeBinary(msg, pos, &sequenceHeader))
         return;
+    UA_TRACE(REQUEST, secureChannelId, sequenceHeader.requestId);
 
-    clientChannel->sequenceNumber = sequenceHeader.sequenceNumber;
-    clientChannel->requestId = sequenceHeader.requestId;
+    // the sequence header stays on the stack. the channel is shared by the
+    // requests that are processed concurrently.
     // todo
     //UA_SecureChannel_checkSequenceNumber(channel,sequenceHeader.sequenceNumber);
     //UA_SecureChannel_checkRequestId(channel,sequenceHeader.requestId);
@@ -193,203 +495,84 @@ static void processMSG(UA_Connection *connection, UA_Server *server, const UA_By
     if(requestType.identifierType != UA_NODEIDTYPE_NUMERIC) {
         // if the nodeidtype is numeric, we do not have to free anything
         UA_NodeId_deleteMembers(&requestType);
+        sendServiceFault(connection, clientChannel, &sequenceHeader, msg, pos,
+                         UA_STATUSCODE_BADSERVICEUNSUPPORTED);
         return;
     }
 
-    // 4) process the request
-    UA_ByteString responseBufs[2]; // 0->header, 1->response payload
-    UA_UInt32 responseType;
-    UA_ByteString *header     = &responseBufs[0];
-    UA_ByteString *message    = &responseBufs[1];
-    UA_Boolean messageOnStack = UA_FALSE;
-    size_t sendOffset      = 0;
-
-#ifdef EXTENSION_STATELESS
-    //only some calls allow to be stateless
-    if(clientSession == &anonymousSession) {
-    	//subtract UA_ENCODINGOFFSET_BINARY for binary encoding
-    	switch(requestType.identifier.numeric - UA_ENCODINGOFFSET_BINARY) {
-    	case UA_NS0ID_READREQUEST:
-    		INVOKE_SERVICE(Read);
-    		break;
-
-    	case UA_NS0ID_WRITEREQUEST:
-    		INVOKE_SERVICE(Write);
-    		break;
-
-    	case UA_NS0ID_BROWSEREQUEST:
-    		INVOKE_SERVICE(Browse);
-    		break;
-
-    	default: {
-    		printf("SL_processMessage - stateless call for an unknown or not allowed request, namespace=%d, request=%d\n",
-    				requestType.namespaceIndex, requestType.identifier.numeric);
-    		UA_RequestHeader  p;
-    		UA_ResponseHeader r;
-    		if(UA_RequestHeader_decodeBinary(msg, pos, &p))
-                return;
-    		UA_ResponseHeader_init(&r);
-    		init_response_header(&p, &r);
-    		r.serviceResult = UA_STATUSCODE_BADSERVICEUNSUPPORTED;
-    		ALLOC_MESSAGE(message, UA_ResponseHeader_calcSizeBinary(&r));
-    		UA_ResponseHeader_encodeBinary(&r, message, &sendOffset);
-    		UA_RequestHeader_deleteMembers(&p);
-    		UA_ResponseHeader_deleteMembers(&r);
-    		responseType = UA_NS0ID_RESPONSEHEADER + UA_ENCODINGOFFSET_BINARY; }
-            break;
-    	}
-    } else {
-#endif
-    	//non-stateless service calls
-    	//subtract UA_ENCODINGOFFSET_BINARY for binary encoding
-    	switch(requestType.identifier.numeric - UA_ENCODINGOFFSET_BINARY) {
-    	case UA_NS0ID_GETENDPOINTSREQUEST: {
-    		UA_GetEndpointsRequest  p;
-    		UA_GetEndpointsResponse r;
-    		if(UA_GetEndpointsRequest_decodeBinary(msg, pos, &p))
-                return;
-    		UA_GetEndpointsResponse_init(&r);
-    		init_response_header(&p.requestHeader, &r.responseHeader);
-    		Service_GetEndpoints(server, &p, &r);
-    		ALLOC_MESSAGE(message, UA_GetEndpointsResponse_calcSizeBinary(&r));
-    		UA_GetEndpointsResponse_encodeBinary(&r, message, &sendOffset);
-    		UA_GetEndpointsRequest_deleteMembers(&p);
-    		UA_GetEndpointsResponse_deleteMembers(&r);
-    		responseType = requestType.identifier.numeric + 3;
-    		break;
-    	}
-
-    	case UA_NS0ID_CREATESESSIONREQUEST: {
-    		UA_CreateSessionRequest  p;
-    		UA_CreateSessionResponse r;
-            if(UA_CreateSessionRequest_decodeBinary(msg, pos, &p))
-                return;
-    		UA_CreateSessionResponse_init(&r);
-    		init_response_header(&p.requestHeader, &r.responseHeader);
-    		Service_CreateSession(server, clientChannel,  &p, &r);
-    		ALLOC_MESSAGE(message, UA_CreateSessionResponse_calcSizeBinary(&r));
-    		UA_CreateSessionResponse_encodeBinary(&r, message, &sendOffset);
-    		UA_CreateSessionRequest_deleteMembers(&p);
-    		UA_CreateSessionResponse_deleteMembers(&r);
-    		responseType = requestType.identifier.numeric + 3;
-    		break;
-    	}
-
-    	case UA_NS0ID_ACTIVATESESSIONREQUEST: {
-    		UA_ActivateSessionRequest  p;
-    		UA_ActivateSessionResponse r;
-    		if(UA_ActivateSessionRequest_decodeBinary(msg, pos, &p))
-                return;
-    		UA_ActivateSessionResponse_init(&r);
-    		init_response_header(&p.requestHeader, &r.responseHeader);
-    		Service_ActivateSession(server, clientChannel,  &p, &r);
-    		ALLOC_MESSAGE(message, UA_ActivateSessionResponse_calcSizeBinary(&r));
-    		UA_ActivateSessionResponse_encodeBinary(&r, message, &sendOffset);
-    		UA_ActivateSessionRequest_deleteMembers(&p);
-    		UA_ActivateSessionResponse_deleteMembers(&r);
-    		responseType = requestType.identifier.numeric + 3;
-    		break;
-    	}
-
-    	case UA_NS0ID_CLOSESESSIONREQUEST: {
-    		UA_CloseSessionRequest  p;
-    		UA_CloseSessionResponse r;
-    		if(UA_CloseSessionRequest_decodeBinary(msg, pos, &p))
-                return;
-    		UA_CloseSessionResponse_init(&r);
-    		init_response_header(&p.requestHeader, &r.responseHeader);
-    		Service_CloseSession(server, &p, &r);
-    		ALLOC_MESSAGE(message, UA_CloseSessionResponse_calcSizeBinary(&r));
-    		UA_CloseSessionResponse_encodeBinary(&r, message, &sendOffset);
-    		UA_CloseSessionRequest_deleteMembers(&p);
-    		UA_CloseSessionResponse_deleteMembers(&r);
-    		responseType = requestType.identifier.numeric + 3;
-    		break;
-    	}
-
-    	case UA_NS0ID_READREQUEST:
-    		INVOKE_SERVICE(Read);
-    		break;
-
-    	case UA_NS0ID_WRITEREQUEST:
-    		INVOKE_SERVICE(Write);
-    		break;
-
-    	case UA_NS0ID_BROWSEREQUEST:
-    		INVOKE_SERVICE(Browse);
-    		break;
-
-    	case UA_NS0ID_ADDREFERENCESREQUEST:
-    		INVOKE_SERVICE(AddReferences);
-    		break;
-
-    	case UA_NS0ID_TRANSLATEBROWSEPATHSTONODEIDSREQUEST:
-    		INVOKE_SERVICE(TranslateBrowsePathsToNodeIds);
-    		break;
-
-    	default: {
-    		printf("SL_processMessage - unknown request, namespace=%d, request=%d\n",
-    				requestType.namespaceIndex, requestType.identifier.numeric);
-    		UA_RequestHeader  p;
-    		UA_ResponseHeader r;
-    		if(UA_RequestHeader_decodeBinary(msg, pos, &p))
-                return;
-    		UA_ResponseHeader_init(&r);
-    		init_response_header(&p, &r);
-    		r.serviceResult = UA_STATUSCODE_BADSERVICEUNSUPPORTED;
-    		ALLOC_MESSAGE(message, UA_ResponseHeader_calcSizeBinary(&r));
-    		UA_ResponseHeader_encodeBinary(&r, message, &sendOffset);
-    		UA_RequestHeader_deleteMembers(&p);
-    		UA_ResponseHeader_deleteMembers(&r);
-    		responseType = UA_NS0ID_RESPONSEHEADER + UA_ENCODINGOFFSET_BINARY;
-    	}
-    	break;
-    	}
-#ifdef EXTENSION_STATELESS
+    // 4) Look up the service
+    const UA_Service *service = findService(server, &requestType);
+    if(!service) {
+        sendServiceFault(connection, clientChannel, &sequenceHeader, msg, pos,
+                         UA_STATUSCODE_BADSERVICEUNSUPPORTED);
+        return;
+    }
+    UA_Boolean stateless = (clientSession == &anonymousSession);
+    if(stateless && !(service->flags & UA_SERVICEFLAG_STATELESS)) {
+        sendServiceFault(connection, clientChannel, &sequenceHeader, msg, pos,
+                         UA_STATUSCODE_BADSERVICEUNSUPPORTED);
+        return;
+    }
+    if(!clientSession && (service->flags & UA_SERVICEFLAG_SESSION)) {
+        sendServiceFault(connection, clientChannel, &sequenceHeader, msg, pos,
+                         UA_STATUSCODE_BADSESSIONIDINVALID);
+        return;
     }
-#endif
-
-    // 5) Build the header
-    UA_SecureConversationMessageHeader respHeader;
-    respHeader.messageHeader.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_MSGF;
-    respHeader.messageHeader.messageSize = 0;
-    respHeader.secureChannelId = clientChannel->securityToken.channelId;
-
-    UA_SymmetricAlgorithmSecurityHeader symSecHeader;
-    symSecHeader.tokenId = clientChannel->securityToken.tokenId;
-
-    UA_SequenceHeader seqHeader;
-    seqHeader.sequenceNumber = clientChannel->sequenceNumber;
-    seqHeader.requestId      = clientChannel->requestId;
-
-    UA_NodeId response_nodeid = { .namespaceIndex = 0, .identifierType = UA_NODEIDTYPE_NUMERIC,
-                                  .identifier.numeric = responseType };
-
-    UA_UInt32 headerSize =
-        UA_SecureConversationMessageHeader_calcSizeBinary(&respHeader)
-        + UA_SymmetricAlgorithmSecurityHeader_calcSizeBinary(&symSecHeader)
-        + UA_SequenceHeader_calcSizeBinary(&seqHeader)
-        + UA_NodeId_calcSizeBinary(&response_nodeid);
-
-    *header = (UA_ByteString){ .length = headerSize, .data = UA_alloca(headerSize) };
-    respHeader.messageHeader.messageSize = header->length + message->length;
-
-    size_t rpos = 0;
-    UA_SecureConversationMessageHeader_encodeBinary(&respHeader, header, &rpos);
-    UA_SymmetricAlgorithmSecurityHeader_encodeBinary(&symSecHeader, header, &rpos);
-    UA_SequenceHeader_encodeBinary(&seqHeader, header, &rpos);
-    UA_NodeId_encodeBinary(&response_nodeid, header, &rpos);
 
-    // todo: sign & encrypt
+    // 5) Responses are matched by the requestId. So requests can complete out
+    // of order, either on different worker threads or when asynchronous
+    // datasources deliver late.
+    if(!beginRequest(server, clientChannel)) {
+        sendServiceFault(connection, clientChannel, &sequenceHeader, msg, pos,
+                         UA_STATUSCODE_BADTCPSERVERTOOBUSY);
+        return;
+    }
 
-    // 6) Send it over the wire.
-    UA_ByteStringArray responseBufArray;
-    responseBufArray.strings     = responseBufs;
-    responseBufArray.stringsSize = 2;
-    connection->write(connection, responseBufArray);
+    if(service->handler == readService && !stateless) {
+        processReadAsync(connection, server, clientChannel, clientSession, &sequenceHeader, msg, pos);
+        return;
+    }
 
-    if(!messageOnStack)
-        UA_free(message->data);
+    // 6) Process the request and send the response. msg outlives the service
+    // call and the sending of the response. So the request may borrow the
+    // strings from msg.
+    UA_DIAGNOSTICS_REQUESTSTART(service);
+    void *request = UA_alloca(service->requestType->memSize);
+    void *response = UA_alloca(service->responseType->memSize);
+    UA_Boolean borrow = service->flags & UA_SERVICEFLAG_BORROWREQUEST;
+    UA_StatusCode retval;
+    if(borrow)
+        retval = UA_decodeBinaryBorrowed(msg, pos, request, service->requestType);
+    else
+        retval = UA_decodeBinary(msg, pos, request, service->requestType);
+    if(retval != UA_STATUSCODE_GOOD) {
+        endRequest(clientChannel);
+        return;
+    }
+    UA_TRACE(DECODED, secureChannelId, sequenceHeader.requestId);
+    UA_DIAGNOSTICS_REQUESTPHASE(decode);
+    UA_init(response, service->responseType);
+    init_response_header((const UA_RequestHeader*)request, (UA_ResponseHeader*)response);
+#ifdef UA_MULTITHREADING
+    if(!(service->flags & UA_SERVICEFLAG_CONCURRENT)) {
+        pthread_mutex_lock(&server->serviceMutex);
+        service->handler(server, clientChannel, clientSession, request, response);
+        pthread_mutex_unlock(&server->serviceMutex);
+    } else
+#endif
+        service->handler(server, clientChannel, clientSession, request, response);
+    UA_TRACE(SERVICED, secureChannelId, sequenceHeader.requestId);
+    UA_DIAGNOSTICS_REQUESTPHASE(service);
+    sendResponse(connection, clientChannel, sequenceHeader.sequenceNumber, sequenceHeader.requestId,
+                 response, service->responseType);
+    UA_DIAGNOSTICS_REQUESTPHASE(encode);
+    UA_DIAGNOSTICS_REQUESTRESULT((UA_ResponseHeader*)response);
+    endRequest(clientChannel);
+    if(borrow)
+        UA_deleteMembersBorrowed(request, service->requestType);
+    else
+        UA_deleteMembers(request, service->requestType);
+    UA_deleteMembers(response, service->responseType);
 }
 
 static void processCLO(UA_Connection *connection, UA_Server *server, const UA_ByteString *msg,
@@ -403,12 +586,80 @@ static void processCLO(UA_Connection *connection, UA_Server *server, const UA_By
 	Service_CloseSecureChannel(server, secureChannelId);
 }
 
+#ifdef UA_MULTITHREADING
+/** Peeks at the request type of the MSG between start and end. */
+static UA_Boolean isReadOnlyMSG(UA_Server *server, const UA_ByteString *msg, size_t start, size_t end) {
+    size_t pos = start + 24; // tcp header, channel id, token id, sequence header
+    if(pos >= end)
+        return UA_FALSE;
+    UA_NodeId requestType;
+    if(UA_NodeId_decodeBinary(msg, &pos, &requestType) != UA_STATUSCODE_GOOD)
+        return UA_FALSE;
+    if(requestType.identifierType != UA_NODEIDTYPE_NUMERIC) {
+        UA_NodeId_deleteMembers(&requestType);
+        return UA_FALSE;
+    }
+    const UA_Service *service = findService(server, &requestType);
+    return pos <= end && service && (service->flags & UA_SERVICEFLAG_READONLY) &&
+        (service->flags & UA_SERVICEFLAG_CONCURRENT);
+}
+
+/** The MSGs of a buffer are only spread over the workers if the channel has an
+    activated session and none of the requests changes the server state.
+    Otherwise the requests are processed in the order they were sent, so that a
+    request cannot overtake one it depends on (e.g. a read the preceding write). */
+static UA_Boolean canDispatchMSGs(UA_Server *server, UA_Connection *connection, const UA_ByteString *msg) {
+    if(server->nThreads <= 1 || !connection->channel || !uatomic_read(&connection->channel->session))
+        return UA_FALSE;
+    size_t pos = 0;
+    UA_UInt32 count = 0;
+    while(msg->length > (UA_Int32)pos) {
+        size_t start = pos;
+        UA_TcpMessageHeader header;
+        if(UA_TcpMessageHeader_decodeBinary(msg, &pos, &header) != UA_STATUSCODE_GOOD)
+            return UA_FALSE;
+        if((header.messageTypeAndFinal & 0xffffff) != (UA_MESSAGETYPEANDFINAL_MSGF & 0xffffff) ||
+           header.messageSize < 8 || start + header.messageSize > (size_t)msg->length ||
+           !isReadOnlyMSG(server, msg, start, start + header.messageSize))
+            return UA_FALSE;
+        pos = start + header.messageSize;
+        count++;
+    }
+    return count > 1;
+}
+
+/** Hands a message over to another worker so that the requests from one buffer
+    are processed concurrently. The message is copied since the buffer is released
+    when the current worker is done with it. */
+static UA_Boolean dispatchMSG(UA_Server *server, UA_Connection *connection, const UA_ByteString *msg,
+                              size_t start, size_t end) {
+    UA_WorkItem *work = UA_malloc(sizeof(UA_WorkItem));
+    if(!work)
+        return UA_FALSE;
+    UA_ByteString copy;
+    if(UA_BufferPool_take(UA_NULL, &copy, end - start) != UA_STATUSCODE_GOOD) {
+        UA_free(work);
+        return UA_FALSE;
+    }
+    UA_memcpy(copy.data, &msg->data[start], copy.length);
+    *work = (UA_WorkItem)
+        {.type = UA_WORKITEMTYPE_POOLEDBINARYNETWORKMESSAGE,
+         .work.binaryNetworkMessage = {.message = copy, .connection = connection}};
+    UA_Server_dispatchWork(server, 1, work); // frees the work array
+    return UA_TRUE;
+}
+#endif
+
 void UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection, const UA_ByteString *msg) {
+    UA_DIAGNOSTICS_ENTER(server);
     size_t pos = 0;
     UA_TcpMessageHeader tcpMessageHeader;
+#ifdef UA_MULTITHREADING
+    UA_Boolean dispatch = canDispatchMSGs(server, connection, msg);
+#endif
     do {
         if(UA_TcpMessageHeader_decodeBinary(msg, &pos, &tcpMessageHeader) != UA_STATUSCODE_GOOD) {
-            printf("ERROR: decoding of header failed \n");
+            UA_LOG_ERROR(server->logger, UA_LOGGINGCATEGORY_CONNECTION, "Decoding of the message header failed");
             connection->close(connection);
             break;
         }
@@ -416,14 +667,25 @@ void UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection
         size_t targetpos = pos - 8 + tcpMessageHeader.messageSize;
         switch(tcpMessageHeader.messageTypeAndFinal & 0xffffff) {
         case UA_MESSAGETYPEANDFINAL_HELF & 0xffffff:
+            UA_DIAGNOSTICS_BYTESRECEIVED(tcpMessageHeader.messageSize);
             processHEL(connection, msg, &pos);
             break;
 
         case UA_MESSAGETYPEANDFINAL_OPNF & 0xffffff:
+            UA_DIAGNOSTICS_BYTESRECEIVED(tcpMessageHeader.messageSize);
             processOPN(connection, server, msg, &pos);
             break;
 
         case UA_MESSAGETYPEANDFINAL_MSGF & 0xffffff:
+#ifdef UA_MULTITHREADING
+            // all but the last message in the buffer go to other workers
+            if(dispatch && (size_t)msg->length > targetpos &&
+               dispatchMSG(server, connection, msg, pos - 8, targetpos)) {
+                pos = targetpos;
+                break; // counted by the worker that processes the copy
+            }
+#endif
+            UA_DIAGNOSTICS_BYTESRECEIVED(tcpMessageHeader.messageSize);
 #ifndef EXTENSION_STATELESS
             if(connection->state == UA_CONNECTION_ESTABLISHED && connection->channel != UA_NULL)
                 processMSG(connection, server, msg, &pos);
@@ -435,6 +697,7 @@ void UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection
             break;
 
         case UA_MESSAGETYPEANDFINAL_CLOF & 0xffffff:
+            UA_DIAGNOSTICS_BYTESRECEIVED(tcpMessageHeader.messageSize);
             processCLO(connection, server, msg, &pos);
             connection->close(connection);
             return;
@@ -442,7 +705,8 @@ void UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection
         
         UA_TcpMessageHeader_deleteMembers(&tcpMessageHeader);
         if(pos != targetpos) {
-            printf("The message size was not as announced or the message could not be processed, skipping to the end of the message.\n");
+            UA_LOG_WARNING(server->logger, UA_LOGGINGCATEGORY_CONNECTION, "The message size was not as announced "
+                           "or the message could not be processed, skipping to the end of the message");
             pos = targetpos;
         }
     } while(msg->length > (UA_Int32)pos);
@@ -0,0 +1,321 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L // clock_gettime
+#endif
+
+#include "ua_server_internal.h"
+
+#ifdef UA_DIAGNOSTICS
+
+#include <stdio.h>
+#include <time.h>
+#include "ua_statuscodes.h"
+#include "ua_nodeids.h"
+
+#ifdef UA_MULTITHREADING
+#include <urcu/uatomic.h>
+__thread UA_ThreadCounters *UA_localCounters = UA_NULL;
+#else
+UA_ThreadCounters *UA_localCounters = UA_NULL;
+#endif
+
+/* Used when no block can be allocated for a thread. The counts are lost. */
+static UA_ThreadCounters discardedCounters;
+
+UA_UInt64 UA_Diagnostics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UA_UInt64)ts.tv_sec * 1000000000 + (UA_UInt64)ts.tv_nsec;
+}
+
+void UA_ServerDiagnostics_init(UA_ServerDiagnostics *diag) {
+    UA_memset(diag, 0, sizeof(UA_ServerDiagnostics));
+}
+
+typedef enum {
+    DIAGNOSTICS_BYTESRECEIVED,
+    DIAGNOSTICS_BYTESSENT,
+    DIAGNOSTICS_NODESTOREHITS,
+    DIAGNOSTICS_NODESTOREMISSES,
+    DIAGNOSTICS_QUEUEDEPTH,
+    DIAGNOSTICS_QUEUEMAXDEPTH,
+    DIAGNOSTICS_BUCKETBOUNDS,
+    DIAGNOSTICS_REQUESTS,
+    DIAGNOSTICS_ERRORS,
+    DIAGNOSTICS_DECODETIME,
+    DIAGNOSTICS_SERVICETIME,
+    DIAGNOSTICS_ENCODETIME
+} DiagnosticsKind;
+
+/* The handle of the datasource of a variable */
+struct DiagnosticsVariable {
+    struct DiagnosticsVariable *next;
+    UA_Server *server;
+    DiagnosticsKind kind;
+    UA_UInt32 service;
+};
+
+void UA_ServerDiagnostics_deleteMembers(UA_ServerDiagnostics *diag) {
+    while(diag->threads) {
+        UA_ThreadCounters *c = diag->threads;
+        diag->threads = c->next;
+        if(c == UA_localCounters)
+            UA_localCounters = UA_NULL;
+        UA_free(c);
+    }
+    while(diag->variables) {
+        struct DiagnosticsVariable *v = diag->variables;
+        diag->variables = v->next;
+        UA_free(v);
+    }
+}
+
+UA_ThreadCounters * UA_ServerDiagnostics_registerThread(UA_Server *server) {
+    UA_ServerDiagnostics *diag = &server->diagnostics;
+    UA_ThreadCounters *c;
+#ifdef UA_MULTITHREADING
+    pthread_t self = pthread_self();
+    for(c = uatomic_read(&diag->threads); c; c = c->next) {
+        if(pthread_equal(c->thread, self))
+            goto found;
+    }
+#else
+    if((c = diag->threads))
+        goto found;
+#endif
+
+    c = UA_malloc(sizeof(UA_ThreadCounters));
+    if(!c) {
+        c = &discardedCounters;
+        goto found;
+    }
+    UA_memset(c, 0, sizeof(UA_ThreadCounters));
+    c->server = server;
+#ifdef UA_MULTITHREADING
+    c->thread = self;
+    UA_ThreadCounters *first;
+    do {
+        first = uatomic_read(&diag->threads);
+        c->next = first;
+    } while(uatomic_cmpxchg(&diag->threads, first, c) != first);
+#else
+    diag->threads = c;
+#endif
+
+ found:
+    UA_localCounters = c;
+    return c;
+}
+
+/*************/
+/* Variables */
+/*************/
+
+/* The counters are summed up without synchronization. A read may miss the
+   latest increments of the other threads. */
+static UA_UInt64 sumCounter(const UA_ServerDiagnostics *diag, size_t offset) {
+    UA_UInt64 sum = 0;
+    for(const UA_ThreadCounters *c = diag->threads; c; c = c->next)
+        sum += *(const UA_UInt64*)((const UA_Byte*)c + offset);
+    return sum;
+}
+
+static void sumHistogram(const UA_ServerDiagnostics *diag, size_t offset, UA_UInt64 *histogram) {
+    for(UA_Int32 i = 0; i < UA_DIAGNOSTICS_BUCKETS; i++)
+        histogram[i] = sumCounter(diag, offset + i * sizeof(UA_UInt64));
+}
+
+static UA_StatusCode readDiagnostics(const void *handle, UA_DataValue *value) {
+    const struct DiagnosticsVariable *v = handle;
+    const UA_ServerDiagnostics *diag = &v->server->diagnostics;
+    size_t service = offsetof(UA_ThreadCounters, services) + v->service * sizeof(UA_ServiceCounters);
+    UA_UInt64 *scalar = UA_NULL;
+    UA_UInt64 *histogram = UA_NULL;
+    if(v->kind < DIAGNOSTICS_BUCKETBOUNDS || v->kind == DIAGNOSTICS_REQUESTS || v->kind == DIAGNOSTICS_ERRORS)
+        scalar = UA_UInt64_new();
+    else
+        histogram = UA_Array_new(&UA_TYPES[UA_TYPES_UINT64], UA_DIAGNOSTICS_BUCKETS);
+    if(!scalar && !histogram)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+
+    switch(v->kind) {
+    case DIAGNOSTICS_BYTESRECEIVED:
+        *scalar = sumCounter(diag, offsetof(UA_ThreadCounters, bytesReceived));
+        break;
+    case DIAGNOSTICS_BYTESSENT:
+        *scalar = sumCounter(diag, offsetof(UA_ThreadCounters, bytesSent));
+        break;
+    case DIAGNOSTICS_NODESTOREHITS:
+        *scalar = sumCounter(diag, offsetof(UA_ThreadCounters, nodestoreHits));
+        break;
+    case DIAGNOSTICS_NODESTOREMISSES:
+        *scalar = sumCounter(diag, offsetof(UA_ThreadCounters, nodestoreMisses));
+        break;
+#ifdef UA_MULTITHREADING
+    case DIAGNOSTICS_QUEUEDEPTH: {
+        UA_UInt64 dequeued = uatomic_read(&diag->dequeued);
+        *scalar = uatomic_read(&diag->enqueued) - dequeued;
+        break; }
+    case DIAGNOSTICS_QUEUEMAXDEPTH:
+        *scalar = uatomic_read(&diag->maxDepth);
+        break;
+#else
+    case DIAGNOSTICS_QUEUEDEPTH:
+    case DIAGNOSTICS_QUEUEMAXDEPTH:
+        *scalar = 0;
+        break;
+#endif
+    case DIAGNOSTICS_BUCKETBOUNDS:
+        for(UA_Int32 i = 0; i < UA_DIAGNOSTICS_BUCKETS; i++)
+            histogram[i] = (UA_UInt64)1 << i; // upper bound in usec
+        histogram[UA_DIAGNOSTICS_BUCKETS - 1] = ~(UA_UInt64)0;
+        break;
+    case DIAGNOSTICS_REQUESTS:
+        *scalar = sumCounter(diag, service + offsetof(UA_ServiceCounters, requests));
+        break;
+    case DIAGNOSTICS_ERRORS:
+        *scalar = sumCounter(diag, service + offsetof(UA_ServiceCounters, errors));
+        break;
+    case DIAGNOSTICS_DECODETIME:
+        sumHistogram(diag, service + offsetof(UA_ServiceCounters, decodeTime), histogram);
+        break;
+    case DIAGNOSTICS_SERVICETIME:
+        sumHistogram(diag, service + offsetof(UA_ServiceCounters, serviceTime), histogram);
+        break;
+    case DIAGNOSTICS_ENCODETIME:
+        sumHistogram(diag, service + offsetof(UA_ServiceCounters, encodeTime), histogram);
+        break;
+    }
+
+    if(scalar)
+        UA_Variant_setValue(&value->value, scalar, &UA_TYPES[UA_TYPES_UINT64]);
+    else
+        UA_Variant_setArray(&value->value, histogram, UA_DIAGNOSTICS_BUCKETS, &UA_TYPES[UA_TYPES_UINT64]);
+    value->hasVariant = UA_TRUE;
+    return UA_STATUSCODE_GOOD;
+}
+
+static void releaseDiagnostics(const void *handle, UA_DataValue *value) {
+    UA_DataValue_deleteMembers(value);
+}
+
+/* The nodeids are strings in namespace 1, e.g. "Diagnostics.Read.ServiceTime" */
+static void makeNodeId(UA_NodeId *id, const char *service, const char *name) {
+    char str[128];
+    if(service)
+        snprintf(str, sizeof(str), "Diagnostics.%s.%s", service, name);
+    else
+        snprintf(str, sizeof(str), "Diagnostics.%s", name);
+    UA_NodeId_init(id);
+    id->namespaceIndex = 1;
+    id->identifierType = UA_NODEIDTYPE_STRING;
+    UA_String_copycstring(str, &id->identifier.string);
+}
+
+static void addNode(UA_Server *server, UA_Node *node, const UA_NodeId *parent, const char *name) {
+    UA_QualifiedName_copycstring(name, &node->browseName);
+    UA_LocalizedText_copycstring(name, &node->displayName);
+    UA_ExpandedNodeId parentId;
+    UA_ExpandedNodeId_init(&parentId);
+    parentId.nodeId = *parent;
+    UA_AddNodesResult res = UA_Server_addNode(server, node, &parentId,
+                                              &UA_NODEID_STATIC(0, UA_NS0ID_HASCOMPONENT));
+    if(res.statusCode != UA_STATUSCODE_GOOD) {
+        if(node->nodeClass == UA_NODECLASS_VARIABLE)
+            UA_VariableNode_delete((UA_VariableNode*)node);
+        else
+            UA_ObjectNode_delete((UA_ObjectNode*)node);
+    }
+    UA_AddNodesResult_deleteMembers(&res);
+}
+
+static void addVariable(UA_Server *server, const UA_NodeId *parent, const char *service, const char *name,
+                        DiagnosticsKind kind, UA_UInt32 serviceIndex) {
+    struct DiagnosticsVariable *v = UA_malloc(sizeof(struct DiagnosticsVariable));
+    if(!v)
+        return;
+    *v = (struct DiagnosticsVariable){.next = server->diagnostics.variables, .server = server,
+                                      .kind = kind, .service = serviceIndex};
+    server->diagnostics.variables = v;
+
+    UA_VariableNode *node = UA_VariableNode_new();
+    makeNodeId(&node->nodeId, service, name);
+    node->variableType = UA_VARIABLENODETYPE_DATASOURCE;
+    node->variable.dataSource = (UA_DataSource) {.handle = v, .read = readDiagnostics,
+                                                 .release = releaseDiagnostics};
+    node->valueRank = (kind < DIAGNOSTICS_BUCKETBOUNDS || kind == DIAGNOSTICS_REQUESTS ||
+                       kind == DIAGNOSTICS_ERRORS) ? -1 : 1;
+    addNode(server, (UA_Node*)node, parent, name);
+}
+
+static const char * serviceName(const UA_DataType *requestType, char *buf, size_t bufSize) {
+    static const struct { UA_UInt32 typeIndex; const char *name; } names[] = {
+        {UA_TYPES_GETENDPOINTSREQUEST, "GetEndpoints"},
+        {UA_TYPES_CREATESESSIONREQUEST, "CreateSession"},
+        {UA_TYPES_ACTIVATESESSIONREQUEST, "ActivateSession"},
+        {UA_TYPES_CLOSESESSIONREQUEST, "CloseSession"},
+        {UA_TYPES_READREQUEST, "Read"},
+        {UA_TYPES_WRITEREQUEST, "Write"},
+        {UA_TYPES_BROWSEREQUEST, "Browse"},
+        {UA_TYPES_ADDREFERENCESREQUEST, "AddReferences"},
+        {UA_TYPES_TRANSLATEBROWSEPATHSTONODEIDSREQUEST, "TranslateBrowsePathsToNodeIds"}};
+    if(requestType->namespaceZero) {
+        for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if(names[i].typeIndex == requestType->typeIndex)
+                return names[i].name;
+        }
+    }
+    snprintf(buf, bufSize, "Service_%u_%u", requestType->typeId.namespaceIndex,
+             requestType->typeId.identifier.numeric);
+    return buf;
+}
+
+static void addServiceNodes(UA_Server *server, UA_UInt32 index) {
+    char buf[32];
+    const char *name = serviceName(server->diagnostics.serviceTypes[index], buf, sizeof(buf));
+    UA_ObjectNode *object = UA_ObjectNode_new();
+    makeNodeId(&object->nodeId, name, "Service");
+    UA_NodeId objectId;
+    UA_NodeId_copy(&object->nodeId, &objectId);
+    addNode(server, (UA_Node*)object, &UA_NODEID_STATIC(0, UA_NS0ID_SERVER_SERVERDIAGNOSTICS), name);
+    addVariable(server, &objectId, name, "RequestCount", DIAGNOSTICS_REQUESTS, index);
+    addVariable(server, &objectId, name, "ErrorCount", DIAGNOSTICS_ERRORS, index);
+    addVariable(server, &objectId, name, "DecodeTime", DIAGNOSTICS_DECODETIME, index);
+    addVariable(server, &objectId, name, "ServiceTime", DIAGNOSTICS_SERVICETIME, index);
+    addVariable(server, &objectId, name, "EncodeTime", DIAGNOSTICS_ENCODETIME, index);
+    UA_NodeId_deleteMembers(&objectId);
+}
+
+void UA_ServerDiagnostics_addNodes(UA_Server *server) {
+    const UA_NodeId diagnosticsId = UA_NODEID_STATIC(0, UA_NS0ID_SERVER_SERVERDIAGNOSTICS);
+    UA_ObjectNode *object = UA_ObjectNode_new();
+    object->nodeId = diagnosticsId;
+    addNode(server, (UA_Node*)object, &UA_NODEID_STATIC(0, UA_NS0ID_SERVER), "ServerDiagnostics");
+
+    addVariable(server, &diagnosticsId, UA_NULL, "BytesReceived", DIAGNOSTICS_BYTESRECEIVED, 0);
+    addVariable(server, &diagnosticsId, UA_NULL, "BytesSent", DIAGNOSTICS_BYTESSENT, 0);
+    addVariable(server, &diagnosticsId, UA_NULL, "NodeStoreHits", DIAGNOSTICS_NODESTOREHITS, 0);
+    addVariable(server, &diagnosticsId, UA_NULL, "NodeStoreMisses", DIAGNOSTICS_NODESTOREMISSES, 0);
+    addVariable(server, &diagnosticsId, UA_NULL, "DispatchQueueDepth", DIAGNOSTICS_QUEUEDEPTH, 0);
+    addVariable(server, &diagnosticsId, UA_NULL, "DispatchQueueMaxDepth", DIAGNOSTICS_QUEUEMAXDEPTH, 0);
+    addVariable(server, &diagnosticsId, UA_NULL, "HistogramBucketBounds", DIAGNOSTICS_BUCKETBOUNDS, 0);
+    for(UA_UInt32 i = 0; i < server->diagnostics.servicesSize; i++)
+        addServiceNodes(server, i);
+    server->diagnostics.nodesAdded = UA_TRUE;
+}
+
+UA_UInt32 UA_ServerDiagnostics_addService(UA_Server *server, const UA_DataType *requestType) {
+    UA_ServerDiagnostics *diag = &server->diagnostics;
+    for(UA_UInt32 i = 0; i < diag->servicesSize; i++) {
+        if(diag->serviceTypes[i] == requestType)
+            return i; // the service is replaced
+    }
+    if(diag->servicesSize >= UA_DIAGNOSTICS_MAXSERVICES)
+        return UA_DIAGNOSTICS_MAXSERVICES - 1;
+    UA_UInt32 index = diag->servicesSize++;
+    diag->serviceTypes[index] = requestType;
+    if(diag->nodesAdded)
+        addServiceNodes(server, index);
+    return index;
+}
+
+#endif /* UA_DIAGNOSTICS */
@@ -0,0 +1,172 @@
+#ifndef UA_SERVER_DIAGNOSTICS_H_
+#define UA_SERVER_DIAGNOSTICS_H_
+
+#include "ua_config.h"
+
+/**
+ * @ingroup server
+ *
+ * @defgroup diagnostics Diagnostics
+ *
+ * @brief Runtime metrics of the server. Enabled with the cmake option
+ * ENABLE_DIAGNOSTICS. Otherwise all hooks compile to nothing.
+ *
+ * Every thread that processes requests counts into its own block of counters.
+ * So the hot path needs no atomic operations and no cache line is shared
+ * between threads. The blocks are summed up when the counters are read via the
+ * variables in the ServerDiagnostics object.
+ *
+ * @{
+ */
+
+#ifdef UA_DIAGNOSTICS
+
+#ifdef UA_MULTITHREADING
+#include <pthread.h>
+#endif
+#include "ua_types.h"
+
+struct UA_Server;
+
+#define UA_DIAGNOSTICS_MAXSERVICES 32 // further services share the last slot
+#define UA_DIAGNOSTICS_BUCKETS 24 // bucket 0 counts below 1us, bucket i below 2^i us
+
+typedef struct {
+    UA_UInt64 requests;
+    UA_UInt64 errors; // a bad serviceResult in the response header
+    UA_UInt64 decodeTime[UA_DIAGNOSTICS_BUCKETS];
+    UA_UInt64 serviceTime[UA_DIAGNOSTICS_BUCKETS];
+    UA_UInt64 encodeTime[UA_DIAGNOSTICS_BUCKETS]; // including the handover to the networklayer
+} UA_ServiceCounters;
+
+typedef struct UA_ThreadCounters {
+    struct UA_ThreadCounters *next;
+    const struct UA_Server *server;
+#ifdef UA_MULTITHREADING
+    pthread_t thread;
+#endif
+    UA_UInt64 bytesReceived;
+    UA_UInt64 bytesSent;
+    UA_UInt64 nodestoreHits;
+    UA_UInt64 nodestoreMisses;
+    UA_ServiceCounters services[UA_DIAGNOSTICS_MAXSERVICES];
+} UA_ThreadCounters;
+
+struct DiagnosticsVariable;
+
+typedef struct {
+    UA_ThreadCounters *threads; // blocks are only added, until the server is deleted
+    UA_UInt32 servicesSize;
+    const UA_DataType *serviceTypes[UA_DIAGNOSTICS_MAXSERVICES]; // the request types
+    struct DiagnosticsVariable *variables; // handles of the datasources
+    UA_Boolean nodesAdded;
+#ifdef UA_MULTITHREADING
+    // the dispatch queue is shared. the workers dequeue, the main loop enqueues.
+    UA_UInt64 enqueued;
+    UA_UInt64 dequeued __attribute__((aligned(64)));
+    UA_UInt64 maxDepth;
+#endif
+} UA_ServerDiagnostics;
+
+#ifdef UA_MULTITHREADING
+extern __thread UA_ThreadCounters *UA_localCounters;
+#else
+extern UA_ThreadCounters *UA_localCounters;
+#endif
+
+void UA_ServerDiagnostics_init(UA_ServerDiagnostics *diag);
+void UA_ServerDiagnostics_deleteMembers(UA_ServerDiagnostics *diag);
+
+/** Adds the ServerDiagnostics object and the variables of the services that
+    are registered so far. Services that are added later get their variables
+    right away. */
+void UA_ServerDiagnostics_addNodes(struct UA_Server *server);
+
+/** Returns the index of the counters for a new service */
+UA_UInt32 UA_ServerDiagnostics_addService(struct UA_Server *server, const UA_DataType *requestType);
+
+UA_ThreadCounters * UA_ServerDiagnostics_registerThread(struct UA_Server *server);
+
+/** Makes the counters of the server current for the thread. The thread is
+    registered on first use. The other hooks count into the current block. */
+static inline void UA_ServerDiagnostics_enter(struct UA_Server *server) {
+    UA_ThreadCounters *c = UA_localCounters;
+    if(!c || c->server != server)
+        UA_ServerDiagnostics_registerThread(server);
+}
+
+/** Monotonic time in nanoseconds */
+UA_UInt64 UA_Diagnostics_now(void);
+
+static inline void UA_Diagnostics_addTime(UA_UInt64 *histogram, UA_UInt64 nanoseconds) {
+    UA_UInt64 us = nanoseconds / 1000;
+    UA_UInt32 bucket = us == 0 ? 0 : 64 - (UA_UInt32)__builtin_clzll(us);
+    if(bucket >= UA_DIAGNOSTICS_BUCKETS)
+        bucket = UA_DIAGNOSTICS_BUCKETS - 1;
+    histogram[bucket]++;
+}
+
+/** Measures the phases of a request */
+typedef struct {
+    UA_ServiceCounters *service;
+    UA_UInt64 time;
+} UA_RequestTimer;
+
+static inline void UA_RequestTimer_lap(UA_RequestTimer *timer, UA_UInt64 *histogram) {
+    UA_UInt64 now = UA_Diagnostics_now();
+    UA_Diagnostics_addTime(histogram, now - timer->time);
+    timer->time = now;
+}
+
+#define UA_DIAGNOSTICS_ENTER(SERVER) UA_ServerDiagnostics_enter(SERVER)
+
+/* Declares the timer of the request in the current scope */
+#define UA_DIAGNOSTICS_REQUESTSTART(SERVICE)                            \
+    UA_RequestTimer diagTimer_ = {                                      \
+        .service = &UA_localCounters->services[(SERVICE)->diagnosticsIndex], \
+        .time = UA_Diagnostics_now() };                                 \
+    diagTimer_.service->requests++
+
+/* PHASE is decode, service or encode. The time since the last phase is added
+   to the histogram. */
+#define UA_DIAGNOSTICS_REQUESTPHASE(PHASE)                              \
+    UA_RequestTimer_lap(&diagTimer_, diagTimer_.service->PHASE##Time)
+
+#define UA_DIAGNOSTICS_REQUESTRESULT(RESPONSEHEADER) do {               \
+        if((RESPONSEHEADER)->serviceResult != UA_STATUSCODE_GOOD)       \
+            diagTimer_.service->errors++;                               \
+    } while(0)
+
+/* Lookups outside of requests (e.g. during startup) are not counted */
+#define UA_DIAGNOSTICS_NODESTOREGET(FOUND) do {                         \
+        UA_ThreadCounters *c_ = UA_localCounters;                       \
+        if(c_) {                                                        \
+            if(FOUND)                                                   \
+                c_->nodestoreHits++;                                    \
+            else                                                        \
+                c_->nodestoreMisses++;                                  \
+        } } while(0)
+
+#define UA_DIAGNOSTICS_BYTESRECEIVED(BYTES) (UA_localCounters->bytesReceived += (BYTES))
+
+/* Responses to asynchronous reads may be sent from threads without counters */
+#define UA_DIAGNOSTICS_BYTESSENT(BYTES) do {                            \
+        if(UA_localCounters)                                            \
+            UA_localCounters->bytesSent += (BYTES);                     \
+    } while(0)
+
+#else /* UA_DIAGNOSTICS */
+
+#define UA_DIAGNOSTICS_ENTER(SERVER)
+#define UA_DIAGNOSTICS_REQUESTSTART(SERVICE)
+#define UA_DIAGNOSTICS_REQUESTPHASE(PHASE)
+#define UA_DIAGNOSTICS_REQUESTRESULT(RESPONSEHEADER)
+#define UA_DIAGNOSTICS_NODESTOREGET(FOUND)
+#define UA_DIAGNOSTICS_BYTESRECEIVED(BYTES)
+#define UA_DIAGNOSTICS_BYTESSENT(BYTES)
+
+#endif /* UA_DIAGNOSTICS */
+
+/** @} */
+
+#endif /* UA_SERVER_DIAGNOSTICS_H_ */
@@ -14,6 +14,7 @@
 #include "ua_session_manager.h"
 #include "ua_securechannel_manager.h"
 #include "ua_nodestore.h"
+#include "ua_server_diagnostics.h"
 
 /** Mapping of namespace-id and url to an external nodestore. For namespaces
     that have no mapping defined, the internal nodestore is used by default. */
@@ -30,6 +31,20 @@ typedef struct UA_TimedWork UA_TimedWork;
 struct UA_DelayedWork;
 typedef struct UA_DelayedWork UA_DelayedWork;
 
+struct UA_AsyncDataSourceRead;
+typedef struct UA_AsyncDataSourceRead UA_AsyncDataSourceRead;
+
+/** An entry of the service table */
+typedef struct {
+    const UA_DataType *requestType;
+    const UA_DataType *responseType;
+    UA_ServiceHandler handler;
+    UA_UInt32 flags;
+#ifdef UA_DIAGNOSTICS
+    UA_UInt32 diagnosticsIndex;
+#endif
+} UA_Service;
+
 struct UA_Server {
     UA_ApplicationDescription description;
     UA_Int32 endpointDescriptionsSize;
@@ -46,28 +61,61 @@ struct UA_Server {
 
     UA_Int32 nlsSize;
     UA_ServerNetworkLayer *nls;
+    UA_Int32 loopNlsSize; // networklayers with their own event loop thread
+    UA_ServerNetworkLayer *loopNls;
 
     UA_UInt32 random_seed;
 
 #ifdef UA_MULTITHREADING
     UA_Boolean *running;
     UA_UInt16 nThreads;
-    UA_UInt32 **workerCounters;
+    UA_UInt32 **workerCounters; // of the workers and then of the networklayer loops
+    UA_UInt16 workerCountersSize;
     UA_DelayedWork *delayedWork;
 
     // worker threads wait on the queue
 	struct cds_wfcq_head dispatchQueue_head;
 	struct cds_wfcq_tail dispatchQueue_tail;
     pthread_cond_t dispatchQueue_condition; // so the workers don't spin if the queue is empty
+
+    // delayed work from the networklayers with an own loop for the main loop
+	struct cds_wfcq_head loopDelayedWork_head;
+	struct cds_wfcq_tail loopDelayedWork_tail;
+
+    // large requests are split up among the workers
+    UA_UInt32 parallelThreshold;
+    UA_UInt32 parallelMinRangeSize;
 #endif
 
     LIST_HEAD(UA_TimedWorkList, UA_TimedWork) timedWork;
 
+    // the services with requests in namespace zero by the type index of the
+    // request. the other services are searched in the custom services.
+    UA_Service services[UA_TYPES_COUNT];
+    UA_Int32 customServicesSize;
+    UA_Service *customServices;
+    UA_UInt32 maxRequestsInFlight; // per securechannel. zero means no limit
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t serviceMutex; // for handlers that cannot run concurrently
+#endif
+
+    // ongoing reads of asynchronous datasources
+    LIST_HEAD(UA_AsyncDataSourceReadList, UA_AsyncDataSourceRead) asyncReads;
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t asyncReadsMutex;
+#endif
+
     UA_DateTime timeStarted;
+#ifdef UA_DIAGNOSTICS
+    UA_ServerDiagnostics diagnostics;
+#endif
 };
 
 void UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection, const UA_ByteString *msg);
 
+/** Fills the service table with the standard services */
+void UA_Server_addStandardServices(UA_Server *server);
+
 UA_AddNodesResult UA_Server_addNodeWithSession(UA_Server *server, UA_Session *session, UA_Node *node,
                                                const UA_ExpandedNodeId *parentNodeId,
                                                const UA_NodeId *referenceTypeId);
@@ -79,6 +127,24 @@ UA_StatusCode UA_Server_addReferenceWithSession(UA_Server *server, UA_Session *s
 
 void UA_Server_deleteTimedWork(UA_Server *server);
 
+#ifdef UA_MULTITHREADING
+/** Hands work over to the worker threads. Can be called from within a worker.
+    The work array is freed by the workers. */
+void UA_Server_dispatchWork(UA_Server *server, UA_Int32 workSize, UA_WorkItem *work);
+
+/** Calls the method once all work that is currently processed has finished.
+    Can be called from any thread. For example, to free memory that workers may
+    still access. */
+void UA_Server_addDelayedMethodCall(UA_Server *server, void (*method)(UA_Server *server, void *data),
+                                    void *data);
+#endif
+
+/** Calls process for consecutive ranges of [0, size). With multithreading,
+    large loops are split up and processed in parallel by the worker threads.
+    Returns when all ranges are processed. */
+void UA_Server_parallelFor(UA_Server *server, UA_Int32 size, void *data,
+                           void (*process)(UA_Server *server, void *data, UA_Int32 start, UA_Int32 end));
+
 /** The (nodes) AttributeIds are defined in part 6, table A1 of the standard */
 typedef enum {
     UA_ATTRIBUTEID_NODEID                  = 1,
@@ -34,6 +34,13 @@ static void processWork(UA_Server *server, const UA_WorkItem *work, UA_Int32 wor
             UA_free(item->work.binaryNetworkMessage.message.data);
             break;
 
+        case UA_WORKITEMTYPE_POOLEDBINARYNETWORKMESSAGE: {
+            UA_ByteString message = item->work.binaryNetworkMessage.message;
+            UA_Server_processBinaryMessage(server, item->work.binaryNetworkMessage.connection, &message);
+            UA_BufferPool_release(&message);
+            break;
+        }
+
         case UA_WORKITEMTYPE_METHODCALL:
         case UA_WORKITEMTYPE_DELAYEDMETHODCALL:
             item->work.methodCall.method(server, item->work.methodCall.data);
@@ -58,6 +65,22 @@ struct workListNode {
     UA_WorkItem *work;
 };
 
+#ifdef UA_DIAGNOSTICS
+/** The depth is the difference of the enqueued and dequeued entries. Several
+    threads may enqueue, so the maximum is updated with a cas loop. */
+static void countEnqueued(UA_ServerDiagnostics *diag) {
+    UA_UInt64 enqueued = uatomic_add_return(&diag->enqueued, 1);
+    UA_UInt64 depth = enqueued - uatomic_read(&diag->dequeued);
+    UA_UInt64 max = uatomic_read(&diag->maxDepth);
+    while(depth > max) {
+        UA_UInt64 old = uatomic_cmpxchg(&diag->maxDepth, max, depth);
+        if(old == max)
+            break;
+        max = old;
+    }
+}
+#endif
+
 /** Dispatch work to workers. Slices the work up if it contains more than
     BATCHSIZE items. The work array is freed by the worker threads. */
 static void dispatchWork(UA_Server *server, UA_Int32 workSize, UA_WorkItem *work) {
@@ -78,7 +101,11 @@ static void dispatchWork(UA_Server *server, UA_Int32 workSize, UA_WorkItem *work
             *wln = (struct workListNode){.workSize = size, .work = work};
         }
         cds_wfcq_node_init(&wln->node);
+        UA_TRACE(DISPATCH, (uintptr_t)wln, size); // before a worker can take it
         cds_wfcq_enqueue(&server->dispatchQueue_head, &server->dispatchQueue_tail, &wln->node);
+#ifdef UA_DIAGNOSTICS
+        countEnqueued(&server->diagnostics);
+#endif
         workSize -= size;
     } 
 }
@@ -86,17 +113,14 @@ static void dispatchWork(UA_Server *server, UA_Int32 workSize, UA_WorkItem *work
 // throwaway struct to bring data into the worker threads
 struct workerStartData {
     UA_Server *server;
-    UA_UInt32 **workerCounter;
+    UA_UInt32 *workerCounter;
 };
 
 /** Waits until work arrives in the dispatch queue (restart after 10ms) and
     processes it. */
 static void * workerLoop(struct workerStartData *startInfo) {
    	rcu_register_thread();
-    UA_UInt32 *c = UA_malloc(sizeof(UA_UInt32));
-    uatomic_set(c, 0);
-
-    *startInfo->workerCounter = c;
+    UA_UInt32 *c = startInfo->workerCounter;
     UA_Server *server = startInfo->server;
     UA_free(startInfo);
     
@@ -109,6 +133,10 @@ static void * workerLoop(struct workerStartData *startInfo) {
         struct workListNode *wln = (struct workListNode*)
             cds_wfcq_dequeue_blocking(&server->dispatchQueue_head, &server->dispatchQueue_tail);
         if(wln) {
+            UA_TRACE(PICKUP, (uintptr_t)wln, wln->workSize);
+#ifdef UA_DIAGNOSTICS
+            uatomic_inc(&server->diagnostics.dequeued);
+#endif
             processWork(server, wln->work, wln->workSize);
             UA_free(wln->work);
             UA_free(wln);
@@ -125,10 +153,19 @@ static void * workerLoop(struct workerStartData *startInfo) {
     return UA_NULL;
 }
 
+void UA_Server_dispatchWork(UA_Server *server, UA_Int32 workSize, UA_WorkItem *work) {
+    dispatchWork(server, workSize, work);
+    pthread_cond_broadcast(&server->dispatchQueue_condition);
+}
+
 static void emptyDispatchQueue(UA_Server *server) {
     while(!cds_wfcq_empty(&server->dispatchQueue_head, &server->dispatchQueue_tail)) {
         struct workListNode *wln = (struct workListNode*)
             cds_wfcq_dequeue_blocking(&server->dispatchQueue_head, &server->dispatchQueue_tail);
+        UA_TRACE(PICKUP, (uintptr_t)wln, wln->workSize);
+#ifdef UA_DIAGNOSTICS
+        uatomic_inc(&server->diagnostics.dequeued);
+#endif
         processWork(server, wln->work, wln->workSize);
         UA_free(wln->work);
         UA_free(wln);
@@ -137,6 +174,125 @@ static void emptyDispatchQueue(UA_Server *server) {
 
 #endif
 
+/******************/
+/* Parallel Loops */
+/******************/
+
+#ifdef UA_MULTITHREADING
+
+/** A loop that is split into ranges. The caller and the dispatched helpers take
+    ranges until none are left. Since the caller participates, the loop finishes
+    even if all other workers are busy. */
+struct parallelJob {
+    UA_Server *server;
+    void *data;
+    void (*process)(UA_Server *server, void *data, UA_Int32 start, UA_Int32 end);
+    UA_Int32 size;
+    UA_Int32 rangeSize;
+    UA_Int32 rangesCount;
+    UA_Int32 nextRange; // atomic
+    UA_Int32 finishedRanges; // atomic
+    UA_Int32 refCount; // atomic. the caller and the helpers that have not run yet
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+};
+
+static void releaseJob(struct parallelJob *job) {
+    if(uatomic_sub_return(&job->refCount, 1) > 0)
+        return;
+    pthread_cond_destroy(&job->finished);
+    pthread_mutex_destroy(&job->mutex);
+    UA_free(job);
+}
+
+static void processRanges(struct parallelJob *job) {
+    while(UA_TRUE) {
+        UA_Int32 range = uatomic_add_return(&job->nextRange, 1) - 1;
+        if(range >= job->rangesCount)
+            break;
+        UA_Int32 start = range * job->rangeSize;
+        UA_Int32 end = start + job->rangeSize;
+        if(end > job->size)
+            end = job->size;
+        job->process(job->server, job->data, start, end);
+        if(uatomic_add_return(&job->finishedRanges, 1) == job->rangesCount) {
+            pthread_mutex_lock(&job->mutex);
+            pthread_cond_signal(&job->finished);
+            pthread_mutex_unlock(&job->mutex);
+        }
+    }
+}
+
+// Dispatched as a methodcall-WorkItem
+static void parallelHelper(UA_Server *server, struct parallelJob *job) {
+    processRanges(job);
+    releaseJob(job);
+}
+
+#endif
+
+void UA_Server_setParallelThreshold(UA_Server *server, UA_UInt32 threshold, UA_UInt32 minRangeSize) {
+#ifdef UA_MULTITHREADING
+    server->parallelThreshold = threshold;
+    server->parallelMinRangeSize = minRangeSize > 0 ? minRangeSize : 1;
+#endif
+}
+
+void UA_Server_parallelFor(UA_Server *server, UA_Int32 size, void *data,
+                           void (*process)(UA_Server *server, void *data, UA_Int32 start, UA_Int32 end)) {
+#ifdef UA_MULTITHREADING
+    if(size <= 0 || (UA_UInt32)size < server->parallelThreshold || server->nThreads < 2) {
+        process(server, data, 0, size);
+        return;
+    }
+
+    // a few ranges per thread, so that the load is balanced
+    UA_Int32 rangesCount = size / server->parallelMinRangeSize;
+    if(rangesCount > server->nThreads * 4)
+        rangesCount = server->nThreads * 4;
+    if(rangesCount < 2) {
+        process(server, data, 0, size);
+        return;
+    }
+
+    struct parallelJob *job = UA_malloc(sizeof(struct parallelJob));
+    UA_Int32 helpersCount = server->nThreads - 1; // the caller is a worker itself
+    if(helpersCount > rangesCount - 1)
+        helpersCount = rangesCount - 1;
+    UA_WorkItem *helpers = UA_malloc(sizeof(UA_WorkItem) * helpersCount);
+    if(!job || !helpers) {
+        UA_free(job);
+        UA_free(helpers);
+        process(server, data, 0, size);
+        return;
+    }
+
+    *job = (struct parallelJob){.server = server, .data = data, .process = process, .size = size,
+                                .rangeSize = (size + rangesCount - 1) / rangesCount,
+                                .rangesCount = rangesCount, .nextRange = 0, .finishedRanges = 0,
+                                .refCount = helpersCount + 1};
+    job->rangesCount = (size + job->rangeSize - 1) / job->rangeSize; // no empty ranges at the end
+    pthread_mutex_init(&job->mutex, UA_NULL);
+    pthread_cond_init(&job->finished, UA_NULL);
+    for(UA_Int32 i = 0;i < helpersCount;i++)
+        helpers[i] = (UA_WorkItem)
+            {.type = UA_WORKITEMTYPE_METHODCALL,
+             .work.methodCall = {.method = (void (*)(UA_Server*, void*))parallelHelper, .data = job}};
+    dispatchWork(server, helpersCount, helpers); // frees the helpers array
+    pthread_cond_broadcast(&server->dispatchQueue_condition);
+
+    // fork: take ranges ourselves. join: wait until the helpers have finished theirs
+    processRanges(job);
+    pthread_mutex_lock(&job->mutex);
+    while(uatomic_read(&job->finishedRanges) < job->rangesCount)
+        pthread_cond_wait(&job->finished, &job->mutex);
+    pthread_mutex_unlock(&job->mutex);
+    releaseJob(job);
+#else
+    process(server, data, 0, size);
+#endif
+}
+
 /**************/
 /* Timed Work */
 /**************/
@@ -309,8 +465,8 @@ struct UA_DelayedWork {
 
 // Dispatched as a methodcall-WorkItem when the delayedwork is added
 static void getCounters(UA_Server *server, UA_DelayedWork *delayed) {
-    UA_UInt32 *counters = UA_malloc(server->nThreads * sizeof(UA_UInt32));
-    for(UA_UInt16 i = 0;i<server->nThreads;i++)
+    UA_UInt32 *counters = UA_malloc(server->workerCountersSize * sizeof(UA_UInt32));
+    for(UA_UInt16 i = 0;i<server->workerCountersSize;i++)
         counters[i] = *server->workerCounters[i];
     delayed->workerCounters = counters;
 }
@@ -374,10 +530,11 @@ static void dispatchDelayedWork(UA_Server *server, void *data /* not used, but n
         }
 
         UA_Boolean countersMoved = UA_TRUE;
-        for(UA_UInt16 i=0;i<server->nThreads;i++) {
-            if(*server->workerCounters[i] == dw->workerCounters[i])
+        for(UA_UInt16 i=0;i<server->workerCountersSize;i++) {
+            if(*server->workerCounters[i] == dw->workerCounters[i]) {
                 countersMoved = UA_FALSE;
                 break;
+            }
         }
         
         if(countersMoved) {
@@ -401,6 +558,112 @@ static void dispatchDelayedWork(UA_Server *server, void *data /* not used, but n
 
 #endif
 
+/**********************/
+/* Networklayer Loops */
+/**********************/
+
+#ifdef UA_MULTITHREADING
+
+/** Delayed work from the loop of a networklayer or from the workers. It is
+    handed to the main thread since only the main thread may add delayed
+    work. */
+struct loopDelayedWorkNode {
+    struct cds_wfcq_node node;
+    UA_WorkItem work;
+};
+
+static void enqueueLoopDelayedWork(UA_Server *server, const UA_WorkItem *work) {
+    struct loopDelayedWorkNode *n = UA_malloc(sizeof(struct loopDelayedWorkNode));
+    if(!n)
+        return;
+    n->work = *work;
+    cds_wfcq_node_init(&n->node);
+    cds_wfcq_enqueue(&server->loopDelayedWork_head, &server->loopDelayedWork_tail, &n->node);
+}
+
+static void forwardDelayedWork(UA_Server *server, UA_WorkItem *work, UA_Int32 workSize) {
+    for(UA_Int32 k=0;k<workSize;k++) {
+        if(work[k].type != UA_WORKITEMTYPE_DELAYEDMETHODCALL)
+            continue;
+        enqueueLoopDelayedWork(server, &work[k]);
+        work[k].type = UA_WORKITEMTYPE_NOTHING;
+    }
+}
+
+void UA_Server_addDelayedMethodCall(UA_Server *server, void (*method)(UA_Server *server, void *data),
+                                    void *data) {
+    UA_WorkItem work = {.type = UA_WORKITEMTYPE_DELAYEDMETHODCALL,
+                        .work.methodCall = {.method = method, .data = data}};
+    enqueueLoopDelayedWork(server, &work);
+}
+
+// Call from the main thread only
+static void collectLoopDelayedWork(UA_Server *server) {
+    while(!cds_wfcq_empty(&server->loopDelayedWork_head, &server->loopDelayedWork_tail)) {
+        struct loopDelayedWorkNode *n = (struct loopDelayedWorkNode*)
+            cds_wfcq_dequeue_blocking(&server->loopDelayedWork_head, &server->loopDelayedWork_tail);
+        addDelayedWork(server, n->work);
+        UA_free(n);
+    }
+}
+
+// throwaway struct to bring data into the networklayer threads
+struct networkLoopStartData {
+    UA_Server *server;
+    UA_ServerNetworkLayer *nl;
+    UA_UInt32 *loopCounter;
+};
+
+/** Gets the work from a single networklayer and processes it in the same
+    thread. The worker threads are only used for the work that the processing
+    dispatches itself. The loop processes requests on shared sessions, channels
+    and connections. So it counts its iterations like the workers, and delayed
+    work waits for the loop as well. */
+static void * networkLoop(struct networkLoopStartData *startData) {
+   	rcu_register_thread();
+    UA_Server *server = startData->server;
+    UA_ServerNetworkLayer *nl = startData->nl;
+    UA_UInt32 *c = startData->loopCounter;
+    UA_free(startData);
+
+    UA_WorkItem *work;
+    UA_Int32 workSize;
+    while(*server->running) {
+        workSize = nl->getWork(nl->nlHandle, &work, MAXTIMEOUT);
+        UA_TRACE(RECEIVE, workSize, 0);
+        forwardDelayedWork(server, work, workSize);
+        processWork(server, work, workSize);
+        UA_free(work);
+        uatomic_inc(c); // the loop holds no references from the last iteration
+    }
+    workSize = nl->stop(nl->nlHandle, &work);
+    forwardDelayedWork(server, work, workSize);
+    processWork(server, work, workSize);
+    UA_free(work);
+   	rcu_unregister_thread();
+    return UA_NULL;
+}
+
+#endif
+
+/******************************/
+/* Session and Channel Expiry */
+/******************************/
+
+#define CLEANUPINTERVAL 10000000 // sweep every second (in 100ns resolution)
+#define CLEANUPBUDGET 100 // max number of sessions and channels removed per sweep
+
+/** Removes timed out sessions and channels. The managers keep them ordered by
+    the expiry date, so only the expired entries are visited. If more entries
+    have timed out than the budget allows, the rest is removed in the next
+    sweeps. With multithreading, the managers free the removed entries as
+    delayed work, since workers may still process their messages. */
+static void cleanupTimedOut(UA_Server *server, void *data /* not used, but needed for the signature*/) {
+    UA_DateTime now = UA_DateTime_now();
+    UA_SessionManager_cleanupTimedOut(&server->sessionManager, now, CLEANUPBUDGET);
+    UA_SecureChannelManager_cleanupTimedOut(&server->secureChannelManager, now, CLEANUPBUDGET);
+}
+
 /********************/
 /* Main Server Loop */
 /********************/
@@ -412,11 +675,18 @@ UA_StatusCode UA_Server_run(UA_Server *server, UA_UInt16 nThreads, UA_Boolean *r
     server->nThreads = nThreads;
     pthread_cond_init(&server->dispatchQueue_condition, 0);
     pthread_t *thr = UA_malloc(nThreads * sizeof(pthread_t));
-    server->workerCounters = UA_malloc(nThreads * sizeof(UA_UInt32 *));
+    // the counters are set up before the threads start, so that getCounters
+    // always finds them
+    server->workerCountersSize = nThreads + server->loopNlsSize;
+    server->workerCounters = UA_malloc(server->workerCountersSize * sizeof(UA_UInt32 *));
+    for(UA_UInt16 i=0;i<server->workerCountersSize;i++) {
+        server->workerCounters[i] = UA_malloc(sizeof(UA_UInt32));
+        *server->workerCounters[i] = 0;
+    }
     for(UA_UInt32 i=0;i<nThreads;i++) {
         struct workerStartData *startData = UA_malloc(sizeof(struct workerStartData));
         startData->server = server;
-        startData->workerCounter = &server->workerCounters[i];
+        startData->workerCounter = server->workerCounters[i];
         pthread_create(&thr[i], UA_NULL, (void* (*)(void*))workerLoop, startData);
     }
 
@@ -426,9 +696,24 @@ UA_StatusCode UA_Server_run(UA_Server *server, UA_UInt16 nThreads, UA_Boolean *r
     UA_Server_addRepeatedWorkItem(server, &processDelayed, 10000000, UA_NULL);
 #endif
 
+    UA_WorkItem cleanup = {.type = UA_WORKITEMTYPE_METHODCALL,
+                           .work.methodCall = {.method = cleanupTimedOut, .data = UA_NULL} };
+    UA_Server_addRepeatedWorkItem(server, &cleanup, CLEANUPINTERVAL, UA_NULL);
+
     // 2) Start the networklayers
     for(UA_Int32 i=0;i<server->nlsSize;i++)
         server->nls[i].start(server->nls[i].nlHandle);
+#ifdef UA_MULTITHREADING
+    pthread_t *loopThr = UA_malloc(server->loopNlsSize * sizeof(pthread_t));
+    for(UA_Int32 i=0;i<server->loopNlsSize;i++) {
+        server->loopNls[i].start(server->loopNls[i].nlHandle);
+        struct networkLoopStartData *startData = UA_malloc(sizeof(struct networkLoopStartData));
+        startData->server = server;
+        startData->nl = &server->loopNls[i];
+        startData->loopCounter = server->workerCounters[nThreads + i];
+        pthread_create(&loopThr[i], UA_NULL, (void* (*)(void*))networkLoop, startData);
+    }
+#endif
 
     // 3) The loop
     server->timeStarted = UA_DateTime_now();
@@ -449,6 +734,7 @@ UA_StatusCode UA_Server_run(UA_Server *server, UA_UInt16 nThreads, UA_Boolean *r
             } else {
                 workSize = server->nls[i].stop(nl->nlHandle, &work);
             }
+            UA_TRACE(RECEIVE, workSize, 0);
 
 #ifdef UA_MULTITHREADING
             // Filter out delayed work
@@ -467,21 +753,37 @@ UA_StatusCode UA_Server_run(UA_Server *server, UA_UInt16 nThreads, UA_Boolean *r
 #endif
         }
 
-        // 3.3) Exit?
+#ifdef UA_MULTITHREADING
+        // 3.3) Take over the delayed work from the networklayers with a loop
+        collectLoopDelayedWork(server);
+        if(server->nlsSize == 0 && *running) {
+            // there is no networklayer that waits for the timeout
+            struct timespec sleep = {0, timeout * 1000};
+            nanosleep(&sleep, UA_NULL);
+        }
+#endif
+
+        // 3.4) Exit?
         if(!*running)
             break;
     }
 
 #ifdef UA_MULTITHREADING
-    // 4) Clean up: Wait until all worker threads finish, then empty the
-    // dispatch queue, then process the remaining delayed work
-    for(UA_UInt32 i=0;i<nThreads;i++) {
+    // 4) Clean up: Wait until the networklayer loops and all worker threads
+    // finish, then empty the dispatch queue, then process the remaining delayed
+    // work
+    for(UA_Int32 i=0;i<server->loopNlsSize;i++)
+        pthread_join(loopThr[i], UA_NULL);
+    UA_free(loopThr);
+    collectLoopDelayedWork(server);
+    for(UA_UInt32 i=0;i<nThreads;i++)
         pthread_join(thr[i], UA_NULL);
+    for(UA_UInt16 i=0;i<server->workerCountersSize;i++)
         UA_free(server->workerCounters[i]);
-    }
     UA_free(server->workerCounters);
     UA_free(thr);
     emptyDispatchQueue(server);
+    collectLoopDelayedWork(server); // from the work in the dispatch queue
     processDelayedWork(server);
 #endif
 
@@ -173,6 +173,24 @@ void Service_TranslateBrowsePathsToNodeIds(UA_Server *server, UA_Session *sessio
  * read individual elements or to read ranges of elements of the composite.
  */
 void Service_Read(UA_Server *server, UA_Session *session, const UA_ReadRequest *request, UA_ReadResponse *response);
+
+/** A Read whose values are (partly) provided by asynchronous datasources. The
+    caller allocates the context and keeps it alive until finished is called. */
+typedef struct UA_AsyncRead UA_AsyncRead;
+struct UA_AsyncRead {
+    UA_ReadRequest request;
+    UA_ReadResponse response;
+    UA_UInt32 pending; // number of values that have not arrived yet
+    void (*finished)(UA_Server *server, UA_AsyncRead *read); // called when the last value arrives
+};
+
+/**
+ * Same as Service_Read, but the values of asynchronous datasources are not read
+ * inline. Returns UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY if values are still
+ * pending. Then, the finished callback is called when the last value has
+ * arrived. Otherwise, the response is complete when the function returns.
+ */
+UA_StatusCode Service_ReadAsync(UA_Server *server, UA_Session *session, UA_AsyncRead *read);
 // Service_HistoryRead
 
 /**
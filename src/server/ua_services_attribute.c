@@ -4,7 +4,10 @@
 #include "ua_statuscodes.h"
 #include "ua_nodestore.h"
 #include "ua_util.h"
-#include "stdio.h"
+
+#ifdef UA_MULTITHREADING
+#include <urcu/uatomic.h>
+#endif
 
 #define CHECK_NODECLASS(CLASS)                                  \
     if(!(node->nodeClass & (CLASS))) {                          \
@@ -13,8 +16,238 @@
         break;                                                  \
     }
 
-/** Reads a single attribute from a node in the nodestore. */
-static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue *v) {
+/**************************/
+/* DataSource Value Cache */
+/**************************/
+
+static void lockCache(UA_DataSourceCache *cache) {
+#ifdef UA_MULTITHREADING
+    pthread_mutex_lock(&cache->mutex);
+#endif
+}
+
+static void unlockCache(UA_DataSourceCache *cache) {
+#ifdef UA_MULTITHREADING
+    pthread_mutex_unlock(&cache->mutex);
+#endif
+}
+
+/** Returns how old (in 100ns) a cached value may be. A maxAge of zero requests
+    a fresh value. Otherwise, the maxAge of the client is extended to the
+    sampling interval, since the value does not change faster. But it never
+    exceeds the maxAge of the datasource. */
+static UA_DateTime acceptableCacheAge(const UA_VariableNode *vn, UA_Double maxAge) {
+    if(maxAge <= 0)
+        return 0;
+    if(maxAge < vn->minimumSamplingInterval)
+        maxAge = vn->minimumSamplingInterval;
+    if(maxAge > vn->variable.dataSource.maxAge)
+        maxAge = vn->variable.dataSource.maxAge;
+    return (UA_DateTime)(maxAge * 10000.0); // ms to 100ns
+}
+
+/** Copies the cached value into v if it is recent enough. */
+static UA_Boolean readCachedValue(const UA_VariableNode *vn, UA_Double maxAge, UA_DataValue *v) {
+    UA_DataSourceCache *cache = vn->cache;
+    if(!cache)
+        return UA_FALSE;
+    UA_DateTime age = acceptableCacheAge(vn, maxAge);
+    if(age <= 0)
+        return UA_FALSE;
+
+    UA_Boolean hit = UA_FALSE;
+    UA_DateTime now = UA_DateTime_now();
+    lockCache(cache);
+    if(cache->readTime != 0 && now - cache->readTime <= age &&
+       UA_DataValue_copy(&cache->value, v) == UA_STATUSCODE_GOOD) {
+        v->hasServerTimestamp = UA_TRUE;
+        v->serverTimestamp = cache->readTime;
+        hit = UA_TRUE;
+    }
+    unlockCache(cache);
+    return hit;
+}
+
+static void updateCachedValue(const UA_VariableNode *vn, const UA_DataValue *value) {
+    UA_DataSourceCache *cache = vn->cache;
+    if(!cache || (value->hasStatus && value->status != UA_STATUSCODE_GOOD))
+        return;
+    lockCache(cache);
+    UA_DataValue_deleteMembers(&cache->value);
+    if(UA_DataValue_copy(value, &cache->value) == UA_STATUSCODE_GOOD)
+        cache->readTime = UA_DateTime_now();
+    else
+        cache->readTime = 0;
+    unlockCache(cache);
+}
+
+/** The cached value is outdated after a write */
+static void invalidateCachedValue(const UA_VariableNode *vn) {
+    UA_DataSourceCache *cache = vn->cache;
+    if(!cache)
+        return;
+    lockCache(cache);
+    cache->readTime = 0;
+    unlockCache(cache);
+}
+
+/** Gets the value of the datasource, from the cache if possible. The value is
+    returned with releaseDataSourceValue. */
+static UA_StatusCode getDataSourceValue(const UA_VariableNode *vn, UA_Double maxAge, UA_DataValue *val,
+                                        UA_Boolean *cached) {
+    *cached = readCachedValue(vn, maxAge, val);
+    if(*cached)
+        return UA_STATUSCODE_GOOD;
+    return vn->variable.dataSource.read(vn->variable.dataSource.handle, val);
+}
+
+static void releaseDataSourceValue(const UA_VariableNode *vn, UA_DataValue *val, UA_Boolean cached) {
+    if(cached)
+        UA_DataValue_deleteMembers(val);
+    else
+        vn->variable.dataSource.release(vn->variable.dataSource.handle, val);
+}
+
+/********************************/
+/* Asynchronous DataSource Read */
+/********************************/
+
+struct asyncReadTarget {
+    struct asyncReadTarget *next;
+    UA_AsyncRead *read;
+    UA_DataValue *value; // points into the results of the read response
+};
+
+/** An ongoing readAsync of a datasource. Reads of the same datasource that
+    arrive in the meantime are added to the targets and served by the same
+    callback. */
+struct UA_AsyncDataSourceRead {
+    LIST_ENTRY(UA_AsyncDataSourceRead) pointers;
+    const UA_VariableNode *node; // released when the read completes. the value is cached there
+    struct asyncReadTarget *targets;
+};
+
+static void retainPending(UA_AsyncRead *read) {
+#ifdef UA_MULTITHREADING
+    uatomic_inc(&read->pending);
+#else
+    read->pending++;
+#endif
+}
+
+/** Returns true if the last pending value has arrived */
+static UA_Boolean releasePending(UA_AsyncRead *read) {
+#ifdef UA_MULTITHREADING
+    return uatomic_sub_return(&read->pending, 1) == 0;
+#else
+    read->pending--;
+    return read->pending == 0;
+#endif
+}
+
+static void lockAsyncReads(UA_Server *server) {
+#ifdef UA_MULTITHREADING
+    pthread_mutex_lock(&server->asyncReadsMutex);
+#endif
+}
+
+static void unlockAsyncReads(UA_Server *server) {
+#ifdef UA_MULTITHREADING
+    pthread_mutex_unlock(&server->asyncReadsMutex);
+#endif
+}
+
+/** The callback handed to the datasource */
+static void asyncReadDone(UA_Server *server, void *readHandle, UA_StatusCode status,
+                          const UA_DataValue *value) {
+    UA_AsyncDataSourceRead *dsr = readHandle;
+
+    // no more targets are added once the entry is removed from the list
+    lockAsyncReads(server);
+    LIST_REMOVE(dsr, pointers);
+    unlockAsyncReads(server);
+
+    if(status == UA_STATUSCODE_GOOD && value)
+        updateCachedValue(dsr->node, value);
+
+    UA_DateTime now = UA_DateTime_now();
+    struct asyncReadTarget *target = dsr->targets;
+    while(target) {
+        UA_StatusCode retval = status;
+        if(retval == UA_STATUSCODE_GOOD && value)
+            retval = UA_DataValue_copy(value, target->value);
+        else if(retval == UA_STATUSCODE_GOOD)
+            retval = UA_STATUSCODE_BADNOTREADABLE;
+        if(retval == UA_STATUSCODE_GOOD) {
+            target->value->hasServerTimestamp = UA_TRUE;
+            target->value->serverTimestamp = now;
+        } else {
+            target->value->hasStatus = UA_TRUE;
+            target->value->status = retval;
+        }
+        struct asyncReadTarget *next = target->next;
+        if(releasePending(target->read))
+            target->read->finished(server, target->read);
+        UA_free(target);
+        target = next;
+    }
+    UA_NodeStore_release((const UA_Node*)dsr->node);
+    UA_free(dsr);
+}
+
+/** Adds the value as a target of an ongoing read of the datasource, or starts a
+    new read. Takes over the reference to the node. */
+static UA_StatusCode startAsyncRead(UA_Server *server, const UA_VariableNode *vn, UA_AsyncRead *read,
+                                    UA_DataValue *v) {
+    const UA_DataSource *ds = &vn->variable.dataSource;
+    struct asyncReadTarget *target = UA_malloc(sizeof(struct asyncReadTarget));
+    if(!target) {
+        UA_NodeStore_release((const UA_Node*)vn);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    target->read = read;
+    target->value = v;
+    retainPending(read);
+
+    lockAsyncReads(server);
+    UA_AsyncDataSourceRead *dsr;
+    LIST_FOREACH(dsr, &server->asyncReads, pointers) {
+        if(dsr->node->variable.dataSource.handle == ds->handle &&
+           dsr->node->variable.dataSource.readAsync == ds->readAsync)
+            break;
+    }
+    if(dsr) {
+        // coalesce with the ongoing read
+        target->next = dsr->targets;
+        dsr->targets = target;
+        unlockAsyncReads(server);
+        UA_NodeStore_release((const UA_Node*)vn);
+        return UA_STATUSCODE_GOOD;
+    }
+    if(!(dsr = UA_malloc(sizeof(UA_AsyncDataSourceRead)))) {
+        unlockAsyncReads(server);
+        releasePending(read); // we still hold the reference from Service_ReadAsync
+        UA_free(target);
+        UA_NodeStore_release((const UA_Node*)vn);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    dsr->node = vn;
+    target->next = UA_NULL;
+    dsr->targets = target;
+    LIST_INSERT_HEAD(&server->asyncReads, dsr, pointers);
+    unlockAsyncReads(server);
+
+    UA_StatusCode retval = ds->readAsync(ds->handle, server, asyncReadDone, dsr);
+    if(retval != UA_STATUSCODE_GOOD && retval != UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY)
+        asyncReadDone(server, dsr, retval, UA_NULL); // the datasource does not call back
+    return UA_STATUSCODE_GOOD;
+}
+
+/** Reads a single attribute from a node in the nodestore. If async is set, the
+    values of asynchronous datasources are filled in later. Cached datasource
+    values up to maxAge (in ms) are accepted. */
+static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue *v,
+                      UA_Double maxAge, UA_AsyncRead *async) {
     UA_Node const *node = UA_NodeStore_get(server->nodestore, &(id->nodeId));
     if(!node) {
         v->hasStatus = UA_TRUE;
@@ -108,6 +341,11 @@ static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue
                     v->hasServerTimestamp = UA_TRUE;
                     v->serverTimestamp = UA_DateTime_now();
                 }
+            } else if(readCachedValue(vn, maxAge, v)) {
+                // served from the cache without calling the datasource
+            } else if(async && vn->variable.dataSource.readAsync) {
+                retval = startAsyncRead(server, vn, async, v);
+                node = UA_NULL; // released when the read completes
             } else {
                 UA_DataValue val;
                 UA_DataValue_init(&val);
@@ -115,6 +353,8 @@ static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue
                 if(retval != UA_STATUSCODE_GOOD)
                     break;
                 retval |= UA_DataValue_copy(&val, v);
+                if(retval == UA_STATUSCODE_GOOD)
+                    updateCachedValue(vn, &val);
                 vn->variable.dataSource.release(vn->variable.dataSource.handle, &val);
                 if(retval != UA_STATUSCODE_GOOD)
                     break;
@@ -139,12 +379,13 @@ static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue
             else {
                 UA_DataValue val;
                 UA_DataValue_init(&val);
-                retval |= vn->variable.dataSource.read(vn->variable.dataSource.handle, &val);
+                UA_Boolean cached;
+                retval |= getDataSourceValue(vn, maxAge, &val, &cached);
                 if(retval != UA_STATUSCODE_GOOD)
                     break;
                 retval |= UA_Variant_copySetValue(&v->value, &val.value.type->typeId,
                                                   &UA_TYPES[UA_TYPES_NODEID]);
-                vn->variable.dataSource.release(vn->variable.dataSource.handle, &val);
+                releaseDataSourceValue(vn, &val, cached);
                 if(retval != UA_STATUSCODE_GOOD)
                     break;
             }
@@ -171,17 +412,18 @@ static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue
             } else {
                 UA_DataValue val;
                 UA_DataValue_init(&val);
-                retval |= vn->variable.dataSource.read(vn->variable.dataSource.handle, &val);
+                UA_Boolean cached;
+                retval |= getDataSourceValue(vn, maxAge, &val, &cached);
                 if(retval != UA_STATUSCODE_GOOD)
                     break;
                 if(!val.hasVariant) {
-                    vn->variable.dataSource.release(vn->variable.dataSource.handle, &val);
+                    releaseDataSourceValue(vn, &val, cached);
                     retval = UA_STATUSCODE_BADNOTREADABLE;
                     break;
                 }
                 retval = UA_Variant_copySetArray(&v->value, val.value.arrayDimensions,
                                                  val.value.arrayDimensionsSize, &UA_TYPES[UA_TYPES_INT32]);
-                vn->variable.dataSource.release(vn->variable.dataSource.handle, &val);
+                releaseDataSourceValue(vn, &val, cached);
             }
         }
         break;
@@ -234,10 +476,12 @@ static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue
         break;
     }
 
-    UA_NodeStore_release(node);
+    if(node)
+        UA_NodeStore_release(node);
 
     if(v->hasVariant && v->value.type == UA_NULL) {
-        printf("%i", id->attributeId);
+        UA_LOG_ERROR(server->logger, UA_LOGGINGCATEGORY_SERVER,
+                     "Reading attribute %i returned a variant without a type", id->attributeId);
         UA_assert(UA_FALSE);
     }
 
@@ -247,8 +491,108 @@ static void readValue(UA_Server *server, const UA_ReadValueId *id, UA_DataValue
     }
 }
 
-void Service_Read(UA_Server *server, UA_Session *session, const UA_ReadRequest *request,
-                  UA_ReadResponse *response) {
+struct batchCandidate {
+    UA_UInt32 index;
+    const UA_VariableNode *node; // released after the batch read
+};
+
+/** Datasources with a readBatch callback get all value reads of the request
+    that target them in a single call. The handled ids are marked. The indices
+    array has the size of the request and is used as scratch space. */
+static void readBatches(UA_Server *server, const UA_ReadRequest *request, UA_ReadResponse *response,
+                        UA_Boolean *isHandled, UA_UInt32 *indices, const UA_AsyncRead *async) {
+    struct batchCandidate *candidates = UA_NULL;
+    UA_Int32 candidatesSize = 0;
+    for(UA_Int32 i = 0;i < request->nodesToReadSize;i++) {
+        if(isHandled[i] || request->nodesToRead[i].attributeId != UA_ATTRIBUTEID_VALUE)
+            continue;
+        const UA_Node *node = UA_NodeStore_get(server->nodestore, &request->nodesToRead[i].nodeId);
+        if(!node)
+            continue;
+        const UA_VariableNode *vn = (const UA_VariableNode*)node;
+        if(node->nodeClass != UA_NODECLASS_VARIABLE || vn->variableType != UA_VARIABLENODETYPE_DATASOURCE ||
+           !vn->variable.dataSource.readBatch || (async && vn->variable.dataSource.readAsync)) {
+            UA_NodeStore_release(node);
+            continue;
+        }
+        if(readCachedValue(vn, request->maxAge, &response->results[i])) {
+            isHandled[i] = UA_TRUE;
+            UA_NodeStore_release(node);
+            continue;
+        }
+        if(!candidates)
+            candidates = UA_malloc(sizeof(struct batchCandidate) * request->nodesToReadSize);
+        if(!candidates) {
+            UA_NodeStore_release(node);
+            continue;
+        }
+        candidates[candidatesSize].index = i;
+        candidates[candidatesSize].node = vn;
+        candidatesSize++;
+    }
+    if(candidatesSize == 0) {
+        UA_free(candidates);
+        return;
+    }
+
+    for(UA_Int32 c = 0;c < candidatesSize;c++) {
+        if(isHandled[candidates[c].index])
+            continue;
+        // collect all candidates with the same datasource
+        const UA_DataSource *ds = &candidates[c].node->variable.dataSource;
+        UA_UInt32 indicesSize = 0;
+        for(UA_Int32 d = c;d < candidatesSize;d++) {
+            if(candidates[d].node->variable.dataSource.handle != ds->handle ||
+               candidates[d].node->variable.dataSource.readBatch != ds->readBatch)
+                continue;
+            indices[indicesSize] = candidates[d].index;
+            isHandled[candidates[d].index] = UA_TRUE;
+            indicesSize++;
+        }
+
+        UA_StatusCode retval = ds->readBatch(ds->handle, request->nodesToRead, indices, indicesSize,
+                                             response->results);
+        UA_DateTime now = UA_DateTime_now();
+        for(UA_UInt32 k = 0;k < indicesSize;k++) {
+            UA_DataValue *v = &response->results[indices[k]];
+            if(retval != UA_STATUSCODE_GOOD) {
+                UA_DataValue_deleteMembers(v);
+                UA_DataValue_init(v);
+                v->hasStatus = UA_TRUE;
+                v->status = UA_STATUSCODE_BADNOTREADABLE;
+                continue;
+            }
+            v->hasServerTimestamp = UA_TRUE;
+            v->serverTimestamp = now;
+        }
+    }
+
+    for(UA_Int32 c = 0;c < candidatesSize;c++) {
+        const UA_DataValue *v = &response->results[candidates[c].index];
+        if(!v->hasStatus || v->status == UA_STATUSCODE_GOOD)
+            updateCachedValue(candidates[c].node, v);
+        UA_NodeStore_release((const UA_Node*)candidates[c].node);
+    }
+    UA_free(candidates);
+}
+
+struct readRange {
+    const UA_ReadRequest *request;
+    UA_ReadResponse *response;
+    const UA_Boolean *isHandled;
+    UA_AsyncRead *async;
+};
+
+static void readRange(UA_Server *server, struct readRange *r, UA_Int32 start, UA_Int32 end) {
+    for(UA_Int32 i = start;i < end;i++) {
+        if(!r->isHandled[i])
+            readValue(server, &r->request->nodesToRead[i], &r->response->results[i],
+                      r->request->maxAge, r->async);
+    }
+}
+
+static void readNodes(UA_Server *server, UA_Session *session, const UA_ReadRequest *request,
+                      UA_ReadResponse *response, UA_AsyncRead *async) {
     if(request->nodesToReadSize <= 0) {
         response->responseHeader.serviceResult = UA_STATUSCODE_BADNOTHINGTODO;
         return;
@@ -261,15 +605,15 @@ void Service_Read(UA_Server *server, UA_Session *session, const UA_ReadRequest *
     }
 
     /* ### Begin External Namespaces */
-    UA_Boolean *isExternal = UA_alloca(sizeof(UA_Boolean) * request->nodesToReadSize);
-    UA_memset(isExternal, UA_FALSE, sizeof(UA_Boolean)*request->nodesToReadSize);
+    UA_Boolean *isHandled = UA_alloca(sizeof(UA_Boolean) * request->nodesToReadSize);
+    UA_memset(isHandled, UA_FALSE, sizeof(UA_Boolean)*request->nodesToReadSize);
     UA_UInt32 *indices = UA_alloca(sizeof(UA_UInt32) * request->nodesToReadSize);
     for(UA_Int32 j = 0;j<server->externalNamespacesSize;j++) {
         UA_UInt32 indexSize = 0;
         for(UA_Int32 i = 0;i < request->nodesToReadSize;i++) {
             if(request->nodesToRead[i].nodeId.namespaceIndex != server->externalNamespaces[j].index)
                 continue;
-            isExternal[i] = UA_TRUE;
+            isHandled[i] = UA_TRUE;
             indices[indexSize] = i;
             indexSize++;
         }
@@ -281,11 +625,12 @@ void Service_Read(UA_Server *server, UA_Session *session, const UA_ReadRequest *
     }
     /* ### End External Namespaces */
 
+    readBatches(server, request, response, isHandled, indices, async);
+
     response->resultsSize = request->nodesToReadSize;
-    for(UA_Int32 i = 0;i < response->resultsSize;i++) {
-        if(!isExternal[i])
-            readValue(server, &request->nodesToRead[i], &response->results[i]);
-    }
+    struct readRange r = {.request = request, .response = response, .isHandled = isHandled, .async = async};
+    UA_Server_parallelFor(server, response->resultsSize, &r,
+                          (void (*)(UA_Server*, void*, UA_Int32, UA_Int32))readRange);
 
 #ifdef EXTENSION_STATELESS
     if(session==&anonymousSession){
@@ -320,6 +665,21 @@ void Service_Read(UA_Server *server, UA_Session *session, const UA_ReadRequest *
 #endif
 }
 
+void Service_Read(UA_Server *server, UA_Session *session, const UA_ReadRequest *request,
+                  UA_ReadResponse *response) {
+    readNodes(server, session, request, response, UA_NULL);
+}
+
+UA_StatusCode Service_ReadAsync(UA_Server *server, UA_Session *session, UA_AsyncRead *read) {
+    // hold a reference until all values are requested. so the read does not
+    // finish while we are still iterating
+    read->pending = 1;
+    readNodes(server, session, &read->request, &read->response, read);
+    if(releasePending(read))
+        return UA_STATUSCODE_GOOD;
+    return UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY;
+}
+
 static UA_StatusCode writeValue(UA_Server *server, UA_WriteValue *wvalue) {
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
 
@@ -354,6 +714,8 @@ static UA_StatusCode writeValue(UA_Server *server, UA_WriteValue *wvalue) {
                         break;
                     }
                     retval = vn->variable.dataSource.write(vn->variable.dataSource.handle, &wvalue->value.value);
+                    if(retval == UA_STATUSCODE_GOOD)
+                        invalidateCachedValue(vn);
                     done = UA_TRUE;
                     break;
                 }
@@ -442,6 +804,19 @@ static UA_StatusCode writeValue(UA_Server *server, UA_WriteValue *wvalue) {
     return retval;
 }
 
+struct writeRange {
+    const UA_WriteRequest *request;
+    UA_WriteResponse *response;
+    const UA_Boolean *isExternal;
+};
+
+static void writeRange(UA_Server *server, struct writeRange *w, UA_Int32 start, UA_Int32 end) {
+    for(UA_Int32 i = start;i < end;i++) {
+        if(!w->isExternal[i])
+            w->response->results[i] = writeValue(server, &w->request->nodesToWrite[i]);
+    }
+}
+
 void Service_Write(UA_Server *server, UA_Session *session,
                    const UA_WriteRequest *request, UA_WriteResponse *response) {
     UA_assert(server != UA_NULL && session != UA_NULL && request != UA_NULL && response != UA_NULL);
@@ -475,8 +850,7 @@ void Service_Write(UA_Server *server, UA_Session *session,
     /* ### End External Namespaces */
     
     response->resultsSize = request->nodesToWriteSize;
-    for(UA_Int32 i = 0;i < request->nodesToWriteSize;i++) {
-        if(!isExternal[i])
-            response->results[i] = writeValue(server, &request->nodesToWrite[i]);
-    }
+    struct writeRange w = {.request = request, .response = response, .isExternal = isExternal};
+    UA_Server_parallelFor(server, request->nodesToWriteSize, &w,
+                          (void (*)(UA_Server*, void*, UA_Int32, UA_Int32))writeRange);
 }
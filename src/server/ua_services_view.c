@@ -222,6 +222,20 @@ static void getBrowseResult(UA_NodeStore *ns, const UA_BrowseDescription *browse
         UA_Array_delete(relevantReferenceTypes, &UA_TYPES[UA_TYPES_NODEID], relevantReferenceTypesSize);
 }
 
+struct browseRange {
+    const UA_BrowseRequest *request;
+    UA_BrowseResponse *response;
+    const UA_Boolean *isExternal;
+};
+
+static void browseRange(UA_Server *server, struct browseRange *b, UA_Int32 start, UA_Int32 end) {
+    for(UA_Int32 i = start;i < end;i++) {
+        if(!b->isExternal[i])
+            getBrowseResult(server->nodestore, &b->request->nodesToBrowse[i],
+                            b->request->requestedMaxReferencesPerNode, &b->response->results[i]);
+    }
+}
+
 void Service_Browse(UA_Server *server, UA_Session *session, const UA_BrowseRequest *request,
                     UA_BrowseResponse *response) {
    if(request->nodesToBrowseSize <= 0) {
@@ -259,12 +273,9 @@ void Service_Browse(UA_Server *server, UA_Session *session, const UA_BrowseReque
 
 
     response->resultsSize = request->nodesToBrowseSize;
-    for(UA_Int32 i = 0;i < request->nodesToBrowseSize;i++){
-        if(!isExternal[i]) {
-            getBrowseResult(server->nodestore, &request->nodesToBrowse[i],
-                        request->requestedMaxReferencesPerNode, &response->results[i]);
-        }
-    }
+    struct browseRange b = {.request = request, .response = response, .isExternal = isExternal};
+    UA_Server_parallelFor(server, request->nodesToBrowseSize, &b,
+                          (void (*)(UA_Server*, void*, UA_Int32, UA_Int32))browseRange);
 }
 
 void Service_TranslateBrowsePathsToNodeIds(UA_Server *server, UA_Session *session,
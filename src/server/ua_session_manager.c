@@ -1,38 +1,97 @@
 #include "ua_session_manager.h"
 #include "ua_statuscodes.h"
 #include "ua_util.h"
+#ifdef UA_MULTITHREADING
+#include "ua_server_internal.h"
+#endif
 
 /**
- The functions in this file are not thread-safe. For multi-threaded access, a
- second implementation should be provided. See for example, how a nodestore
- implementation is choosen based on whether multithreading is enabled or not.
+ With multithreading, the lists are protected by a lock. The requests only set
+ the validTill date of their session without the lock. So the expiry index is
+ ordered by the expiryKey of the entries, the validTill when the entry was
+ sorted in. Since validTill only grows beyond that, the cleanup stops at the
+ first key that lies in the future. Sessions that were active in the meantime
+ are sorted in again when the cleanup reaches them.
  */
 
 struct session_list_entry {
     UA_Session session;
     LIST_ENTRY(session_list_entry) pointers;
+    TAILQ_ENTRY(session_list_entry) expiry;
+    UA_DateTime expiryKey;
+    UA_Boolean removed;
 };
 
+#ifdef UA_MULTITHREADING
+#define LOCK(sm) pthread_mutex_lock(&(sm)->lock)
+#define UNLOCK(sm) pthread_mutex_unlock(&(sm)->lock)
+#else
+#define LOCK(sm)
+#define UNLOCK(sm)
+#endif
+
+/** Sessions are mostly inserted with the latest expiry date. So we search for
+    the position from the back. */
+static void insertExpiry(UA_SessionManager *sessionManager, struct session_list_entry *entry) {
+    entry->expiryKey = entry->session.validTill;
+    struct session_list_entry *prev = TAILQ_LAST(&sessionManager->expiry, session_expiry);
+    while(prev && prev->expiryKey > entry->expiryKey)
+        prev = TAILQ_PREV(prev, session_expiry, expiry);
+    if(prev)
+        TAILQ_INSERT_AFTER(&sessionManager->expiry, prev, entry, expiry);
+    else
+        TAILQ_INSERT_HEAD(&sessionManager->expiry, entry, expiry);
+}
+
+static void deleteSessionEntry(UA_Server *server, struct session_list_entry *entry) {
+    UA_Session_deleteMembers(&entry->session);
+    UA_free(entry);
+}
+
+/** Call with the lock held */
+static void removeSessionEntry(UA_SessionManager *sessionManager, struct session_list_entry *entry) {
+    LIST_REMOVE(entry, pointers);
+    TAILQ_REMOVE(&sessionManager->expiry, entry, expiry);
+    entry->removed = UA_TRUE;
+    sessionManager->currentSessionCount--;
+    if(entry->session.channel)
+        entry->session.channel->session = UA_NULL; // the channel is no longer attached to a session
+#ifdef UA_MULTITHREADING
+    if(sessionManager->server) {
+        // a worker may still process a request of the session
+        UA_Server_addDelayedMethodCall(sessionManager->server,
+                                       (void (*)(UA_Server*, void*))deleteSessionEntry, entry);
+        return;
+    }
+#endif
+    deleteSessionEntry(sessionManager->server, entry);
+}
+
 UA_StatusCode UA_SessionManager_init(UA_SessionManager *sessionManager, UA_UInt32 maxSessionCount,
-                                    UA_UInt32 sessionTimeout, UA_UInt32 startSessionId) {
+                                    UA_UInt32 maxSessionTimeout, UA_UInt32 startSessionId,
+                                    UA_Server *server) {
     LIST_INIT(&sessionManager->sessions);
+    TAILQ_INIT(&sessionManager->expiry);
     sessionManager->maxSessionCount = maxSessionCount;
     sessionManager->lastSessionId   = startSessionId;
-    sessionManager->sessionTimeout  = sessionTimeout;
+    sessionManager->maxSessionTimeout = maxSessionTimeout;
     sessionManager->currentSessionCount = 0;
+    sessionManager->server = server;
+#ifdef UA_MULTITHREADING
+    pthread_mutex_init(&sessionManager->lock, UA_NULL);
+#endif
     return UA_STATUSCODE_GOOD;
 }
 
+/** The worker threads have stopped. So the sessions are freed right away. */
 void UA_SessionManager_deleteMembers(UA_SessionManager *sessionManager) {
-    struct session_list_entry *current = LIST_FIRST(&sessionManager->sessions);
-    while(current) {
-        LIST_REMOVE(current, pointers);
-        if(current->session.channel)
-            current->session.channel->session = UA_NULL; // the channel is no longer attached to a session
-        UA_Session_deleteMembers(&current->session);
-        UA_free(current);
-        current = LIST_FIRST(&sessionManager->sessions);
-    }
+    sessionManager->server = UA_NULL;
+    struct session_list_entry *current;
+    while((current = LIST_FIRST(&sessionManager->sessions)))
+        removeSessionEntry(sessionManager, current);
+#ifdef UA_MULTITHREADING
+    pthread_mutex_destroy(&sessionManager->lock);
+#endif
 }
 
 UA_StatusCode UA_SessionManager_getSessionById(UA_SessionManager *sessionManager, const UA_NodeId *sessionId,
@@ -43,10 +102,12 @@ UA_StatusCode UA_SessionManager_getSessionById(UA_SessionManager *sessionManager
     }
 
     struct session_list_entry *current = UA_NULL;
+    LOCK(sessionManager);
     LIST_FOREACH(current, &sessionManager->sessions, pointers) {
         if(UA_NodeId_equal(&current->session.sessionId, sessionId))
             break;
     }
+    UNLOCK(sessionManager);
 
     if(!current) {
         *session = UA_NULL;
@@ -54,7 +115,9 @@ UA_StatusCode UA_SessionManager_getSessionById(UA_SessionManager *sessionManager
     }
 
     // Lifetime handling is not done here, but in a regular cleanup by the
-    // server. If the session still exists, then it is valid.
+    // server (UA_SessionManager_cleanupTimedOut). If the session still exists,
+    // then it is valid. A removed session is freed only after the current work
+    // of the workers has finished.
     *session = &current->session;
     return UA_STATUSCODE_GOOD;
 }
@@ -67,10 +130,12 @@ UA_StatusCode UA_SessionManager_getSessionByToken(UA_SessionManager *sessionMana
     }
 
     struct session_list_entry *current = UA_NULL;
+    LOCK(sessionManager);
     LIST_FOREACH(current, &sessionManager->sessions, pointers) {
         if(UA_NodeId_equal(&current->session.authenticationToken, token))
             break;
     }
+    UNLOCK(sessionManager);
 
     if(!current) {
         *session = UA_NULL;
@@ -78,21 +143,27 @@ UA_StatusCode UA_SessionManager_getSessionByToken(UA_SessionManager *sessionMana
     }
 
     // Lifetime handling is not done here, but in a regular cleanup by the
-    // server. If the session still exists, then it is valid.
+    // server (UA_SessionManager_cleanupTimedOut). If the session still exists,
+    // then it is valid. A removed session is freed only after the current work
+    // of the workers has finished.
     *session = &current->session;
     return UA_STATUSCODE_GOOD;
 }
 
 /** Creates and adds a session. */
 UA_StatusCode UA_SessionManager_createSession(UA_SessionManager *sessionManager, UA_SecureChannel *channel,
-                                              UA_Session **session) {
-    if(sessionManager->currentSessionCount >= sessionManager->maxSessionCount)
-        return UA_STATUSCODE_BADTOOMANYSESSIONS;
-
+                                              UA_Double requestedTimeout, UA_Session **session) {
     struct session_list_entry *newentry = UA_malloc(sizeof(struct session_list_entry));
     if(!newentry)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
+    LOCK(sessionManager);
+    if(sessionManager->currentSessionCount >= sessionManager->maxSessionCount) {
+        UNLOCK(sessionManager);
+        UA_free(newentry);
+        return UA_STATUSCODE_BADTOOMANYSESSIONS;
+    }
+
     UA_Session_init(&newentry->session);
     newentry->session.sessionId = (UA_NodeId) {.namespaceIndex = 1, .identifierType = UA_NODEIDTYPE_NUMERIC,
                                                .identifier.numeric = sessionManager->lastSessionId++ };
@@ -100,29 +171,73 @@ UA_StatusCode UA_SessionManager_createSession(UA_SessionManager *sessionManager,
                                                          .identifierType = UA_NODEIDTYPE_NUMERIC,
                                                          .identifier.numeric = sessionManager->lastSessionId };
     newentry->session.channel = channel;
-    newentry->session.timeout = 3600 * 1000; // 1h
+    if(requestedTimeout > 0 && requestedTimeout < sessionManager->maxSessionTimeout)
+        newentry->session.timeout = (UA_Int64)requestedTimeout;
+    else
+        newentry->session.timeout = sessionManager->maxSessionTimeout;
     UA_Session_setExpirationDate(&newentry->session);
+    newentry->removed = UA_FALSE;
 
     sessionManager->currentSessionCount++;
     LIST_INSERT_HEAD(&sessionManager->sessions, newentry, pointers);
+    insertExpiry(sessionManager, newentry);
+    UNLOCK(sessionManager);
     *session = &newentry->session;
     return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_SessionManager_removeSession(UA_SessionManager *sessionManager, const UA_NodeId *sessionId) {
     struct session_list_entry *current = UA_NULL;
+    LOCK(sessionManager);
     LIST_FOREACH(current, &sessionManager->sessions, pointers) {
         if(UA_NodeId_equal(&current->session.sessionId, sessionId))
             break;
     }
 
-    if(!current)
+    if(!current) {
+        UNLOCK(sessionManager);
         return UA_STATUSCODE_BADINTERNALERROR;
+    }
 
-    LIST_REMOVE(current, pointers);
-    if(current->session.channel)
-        current->session.channel->session = UA_NULL; // the channel is no longer attached to a session
-    UA_Session_deleteMembers(&current->session);
-    UA_free(current);
+    removeSessionEntry(sessionManager, current);
+    UNLOCK(sessionManager);
     return UA_STATUSCODE_GOOD;
 }
+
+void UA_SessionManager_updateSessionLifetime(UA_SessionManager *sessionManager, UA_Session *session) {
+    // the session is the first member of the list entry
+    struct session_list_entry *entry = (struct session_list_entry*)session;
+    UA_Session_setExpirationDate(session);
+    if(session->validTill >= entry->expiryKey)
+        return; // the cleanup sorts the entry in again when it reaches it
+
+    // the timeout was shortened. sort the entry in at the earlier date
+    LOCK(sessionManager);
+    if(!entry->removed) {
+        TAILQ_REMOVE(&sessionManager->expiry, entry, expiry);
+        insertExpiry(sessionManager, entry);
+    }
+    UNLOCK(sessionManager);
+}
+
+UA_UInt32 UA_SessionManager_cleanupTimedOut(UA_SessionManager *sessionManager, UA_DateTime now,
+                                            UA_UInt32 maxVisits) {
+    UA_UInt32 removed = 0;
+    struct session_list_entry *entry;
+    LOCK(sessionManager);
+    for(UA_UInt32 visits = 0; visits < maxVisits && (entry = TAILQ_FIRST(&sessionManager->expiry)); visits++) {
+        if(entry->expiryKey > now)
+            break; // all following sessions are valid for longer
+        if(entry->session.validTill > now) {
+            // the session was active since it was sorted in. the new key lies
+            // in the future, so the entry is not visited again.
+            TAILQ_REMOVE(&sessionManager->expiry, entry, expiry);
+            insertExpiry(sessionManager, entry);
+            continue; // counts against the budget as well
+        }
+        removeSessionEntry(sessionManager, entry);
+        removed++;
+    }
+    UNLOCK(sessionManager);
+    return removed;
+}
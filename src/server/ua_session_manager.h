@@ -6,22 +6,38 @@
 #include "ua_util.h"
 #include "ua_session.h"
 
+#ifdef UA_MULTITHREADING
+#include <pthread.h>
+#endif
+
 typedef struct UA_SessionManager {
     LIST_HEAD(session_list, session_list_entry) sessions; // doubly-linked list of sessions
+    TAILQ_HEAD(session_expiry, session_list_entry) expiry; // the sessions ordered by the expiry date
     UA_UInt32    maxSessionCount;
     UA_Int32     lastSessionId;
     UA_UInt32    currentSessionCount;
     UA_DateTime  maxSessionLifeTime;
-    UA_DateTime  sessionTimeout;
+    UA_DateTime  maxSessionTimeout; // in ms. the requested timeouts are revised down to this
+    UA_Server   *server; // removed sessions are freed as delayed work of the server
+#ifdef UA_MULTITHREADING
+    pthread_mutex_t lock; // protects the lists
+#endif
 } UA_SessionManager;
 
+/** With multithreading, worker threads may still use a session that is
+    removed. Then the session is freed as delayed work of the server. If the
+    server is UA_NULL, the session is freed right away. */
 UA_StatusCode UA_SessionManager_init(UA_SessionManager *sessionManager, UA_UInt32 maxSessionCount,
-                                    UA_UInt32 sessionLifetime, UA_UInt32 startSessionId);
+                                    UA_UInt32 maxSessionTimeout, UA_UInt32 startSessionId,
+                                    UA_Server *server);
 
 void UA_SessionManager_deleteMembers(UA_SessionManager *sessionManager);
 
+/** Creates a session with the requested timeout in ms. Timeouts that are not
+    positive or lie above the maximum are revised to the maximum. */
 UA_StatusCode UA_SessionManager_createSession(UA_SessionManager *sessionManager,
-                                              UA_SecureChannel *channel, UA_Session **session);
+                                              UA_SecureChannel *channel, UA_Double requestedTimeout,
+                                              UA_Session **session);
 
 UA_StatusCode UA_SessionManager_removeSession(UA_SessionManager *sessionManager,
                                               const UA_NodeId *sessionId);
@@ -33,6 +49,19 @@ UA_StatusCode UA_SessionManager_getSessionById(UA_SessionManager *sessionManager
 UA_StatusCode UA_SessionManager_getSessionByToken(UA_SessionManager *sessionManager,
                                                   const UA_NodeId *token, UA_Session **session);
 
+/** Extends the lifetime of the session after activity. The session must be
+    managed by the sessionManager. Only the date is set, the expiry index is
+    brought up to date by the cleanup. So no lock is taken unless the timeout of
+    the session was shortened. */
+void UA_SessionManager_updateSessionLifetime(UA_SessionManager *sessionManager, UA_Session *session);
+
+/** Removes sessions whose validTill lies before now. At most maxVisits
+    sessions are removed or sorted in again (when they were active in the
+    meantime) per call, so the cleanup runs incrementally. Returns the number of
+    removed sessions. */
+UA_UInt32 UA_SessionManager_cleanupTimedOut(UA_SessionManager *sessionManager, UA_DateTime now,
+                                            UA_UInt32 maxVisits);
+
 //UA_Int32 UA_SessionManager_updateSessions();
 //UA_Int32 UA_SessionManager_generateToken(UA_Session session, UA_Int32 requestedLifeTime, SecurityTokenRequestType requestType, UA_ChannelSecurityToken* newToken);
 
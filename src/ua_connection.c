@@ -0,0 +1,136 @@
+#include "ua_connection.h"
+#include "ua_util.h"
+#include "ua_statuscodes.h"
+
+#ifdef UA_MULTITHREADING
+#include <urcu/uatomic.h>
+#endif
+
+/*************************/
+/* Receive Buffer Pool   */
+/*************************/
+
+#define MINSIZESHIFT 6 // the smallest size class holds 64 bytes
+#define MAXSIZESHIFT 16 // UA_BUFFERPOOL_MAXSIZE
+#define SIZECLASSES (MAXSIZESHIFT - MINSIZESHIFT + 1)
+#define MAXCACHED 64 // released buffers that are kept per size class
+
+/* Precedes the data of every buffer that is handed out. The pool is null for
+   buffers that are not pooled. */
+typedef struct PooledBuffer {
+    struct PooledBuffer *next;
+    UA_BufferPool *pool;
+    UA_UInt32 sizeClass;
+} PooledBuffer;
+
+/* Every size class is a stack of free buffers. Buffers are pushed from any
+   thread, but only the owning networklayer pops. With a single consumer, a
+   buffer cannot be popped and pushed back while a pop is in progress. So the
+   compare-and-swap in the pop does not suffer from the ABA problem. */
+struct UA_BufferPool {
+    PooledBuffer *free[SIZECLASSES];
+    UA_UInt32 cached[SIZECLASSES];
+};
+
+UA_BufferPool * UA_BufferPool_new(void) {
+    UA_BufferPool *pool = UA_malloc(sizeof(UA_BufferPool));
+    if(pool)
+        UA_memset(pool, 0, sizeof(UA_BufferPool));
+    return pool;
+}
+
+void UA_BufferPool_delete(UA_BufferPool *pool) {
+    if(!pool)
+        return;
+    for(UA_UInt32 i = 0; i < SIZECLASSES; i++) {
+        while(pool->free[i]) {
+            PooledBuffer *b = pool->free[i];
+            pool->free[i] = b->next;
+            UA_free(b);
+        }
+    }
+    UA_free(pool);
+}
+
+static UA_UInt32 sizeClass(size_t length) {
+    UA_UInt32 c = 0;
+    while(((size_t)1 << (c + MINSIZESHIFT)) < length)
+        c++;
+    return c;
+}
+
+static PooledBuffer * popBuffer(UA_BufferPool *pool, UA_UInt32 c) {
+#ifdef UA_MULTITHREADING
+    PooledBuffer *b;
+    do {
+        b = uatomic_read(&pool->free[c]);
+        if(!b)
+            return UA_NULL;
+    } while(uatomic_cmpxchg(&pool->free[c], b, b->next) != b);
+    uatomic_dec(&pool->cached[c]);
+#else
+    PooledBuffer *b = pool->free[c];
+    if(!b)
+        return UA_NULL;
+    pool->free[c] = b->next;
+    pool->cached[c]--;
+#endif
+    return b;
+}
+
+static UA_Boolean pushBuffer(UA_BufferPool *pool, PooledBuffer *b) {
+    UA_UInt32 c = b->sizeClass;
+#ifdef UA_MULTITHREADING
+    if(uatomic_add_return(&pool->cached[c], 1) > MAXCACHED) {
+        uatomic_dec(&pool->cached[c]);
+        return UA_FALSE;
+    }
+    PooledBuffer *top;
+    do {
+        top = uatomic_read(&pool->free[c]);
+        b->next = top;
+    } while(uatomic_cmpxchg(&pool->free[c], top, b) != top);
+#else
+    if(pool->cached[c] >= MAXCACHED)
+        return UA_FALSE;
+    pool->cached[c]++;
+    b->next = pool->free[c];
+    pool->free[c] = b;
+#endif
+    return UA_TRUE;
+}
+
+UA_StatusCode UA_BufferPool_take(UA_BufferPool *pool, UA_ByteString *buf, size_t length) {
+    PooledBuffer *b = UA_NULL;
+    if(length <= UA_BUFFERPOOL_MAXSIZE) {
+        UA_UInt32 c = sizeClass(length);
+        if(pool)
+            b = popBuffer(pool, c);
+        if(!b) {
+            b = UA_malloc(sizeof(PooledBuffer) + ((size_t)1 << (c + MINSIZESHIFT)));
+            if(b)
+                b->sizeClass = c;
+        }
+    } else {
+        b = UA_malloc(sizeof(PooledBuffer) + length);
+        if(b)
+            b->sizeClass = SIZECLASSES;
+    }
+    if(!b) {
+        UA_ByteString_init(buf);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    b->pool = b->sizeClass < SIZECLASSES ? pool : UA_NULL;
+    buf->data = (UA_Byte*)&b[1];
+    buf->length = length;
+    return UA_STATUSCODE_GOOD;
+}
+
+void UA_BufferPool_release(UA_ByteString *buf) {
+    if(!buf->data)
+        return;
+    PooledBuffer *b = &((PooledBuffer*)buf->data)[-1];
+    if(!b->pool || !pushBuffer(b->pool, b))
+        UA_free(b);
+    UA_ByteString_init(buf);
+}
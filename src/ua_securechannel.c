@@ -1,4 +1,5 @@
 #include "ua_securechannel.h"
+#include "ua_types_encoding_binary.h"
 #include "ua_util.h"
 #include "ua_statuscodes.h"
 
@@ -20,8 +21,10 @@ void UA_SecureChannel_init(UA_SecureChannel *channel) {
     UA_ByteString_init(&channel->serverNonce);
     channel->requestId = 0;
     channel->sequenceNumber = 0;
+    channel->requestsInFlight = 0;
     channel->connection = UA_NULL;
     channel->session    = UA_NULL;
+    UA_SecureChannel_updateResponseHeader(channel);
 }
 
 void UA_SecureChannel_deleteMembers(UA_SecureChannel *channel) {
@@ -37,6 +40,20 @@ void UA_SecureChannel_delete(UA_SecureChannel *channel) {
     UA_free(channel);
 }
 
+void UA_SecureChannel_updateResponseHeader(UA_SecureChannel *channel) {
+    UA_SecureConversationMessageHeader respHeader;
+    respHeader.messageHeader.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_MSGF;
+    respHeader.messageHeader.messageSize = 0;
+    respHeader.secureChannelId = channel->securityToken.channelId;
+    UA_SymmetricAlgorithmSecurityHeader symSecHeader;
+    symSecHeader.tokenId = channel->securityToken.tokenId;
+    UA_ByteString header = { .length = UA_SECURECHANNEL_RESPONSEHEADERSIZE,
+                             .data = channel->responseHeader };
+    size_t pos = 0;
+    UA_SecureConversationMessageHeader_encodeBinary(&respHeader, &header, &pos);
+    UA_SymmetricAlgorithmSecurityHeader_encodeBinary(&symSecHeader, &header, &pos);
+}
+
 UA_Boolean UA_SecureChannel_compare(UA_SecureChannel *sc1, UA_SecureChannel *sc2) {
     return (sc1->securityToken.channelId == sc2->securityToken.channelId);
 }
@@ -11,8 +11,9 @@
  * @{
  */
 
-struct UA_Session;
-typedef struct UA_Session UA_Session;
+/** Size of the start of the response message header that is the same for all
+    responses on a channel */
+#define UA_SECURECHANNEL_RESPONSEHEADERSIZE 16
 
 struct UA_SecureChannel {
     UA_MessageSecurityMode  securityMode;
@@ -25,6 +26,10 @@ struct UA_SecureChannel {
     UA_UInt32      sequenceNumber;
     UA_Connection *connection; // make this more generic when http connections exist
     UA_Session    *session;
+    UA_UInt32      requestsInFlight; // requests that are not answered yet (atomic with multithreading)
+    /* The pre-encoded start of the response message header with the channel
+       and token id. The message size is patched in when a response is sent. */
+    UA_Byte responseHeader[UA_SECURECHANNEL_RESPONSEHEADERSIZE];
 };
 
 void UA_SecureChannel_init(UA_SecureChannel *channel);
@@ -32,6 +37,9 @@ void UA_SecureChannel_deleteMembers(UA_SecureChannel *channel);
 void UA_SecureChannel_delete(UA_SecureChannel *channel);
 UA_Boolean UA_SecureChannel_compare(UA_SecureChannel *sc1, UA_SecureChannel *sc2);
 
+/** Encodes the response header template. Call when the security token changes. */
+void UA_SecureChannel_updateResponseHeader(UA_SecureChannel *channel);
+
 UA_StatusCode UA_SecureChannel_generateNonce(UA_ByteString *nonce);
 UA_Int32 UA_SecureChannel_updateRequestId(UA_SecureChannel *channel, UA_UInt32 requestId);
 UA_Int32 UA_SecureChannel_updateSequenceNumber(UA_SecureChannel *channel, UA_UInt32 sequenceNumber);
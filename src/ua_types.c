@@ -103,8 +103,11 @@ void UA_String_init(UA_String *p) {
 }
 
 UA_TYPE_DELETE_DEFAULT(UA_String)
+UA_THREAD_LOCAL UA_Boolean UA_stringsBorrowed = UA_FALSE;
+
 void UA_String_deleteMembers(UA_String *p) {
-    UA_free(p->data);
+    if(!UA_stringsBorrowed)
+        UA_free(p->data);
 }
 
 UA_StatusCode UA_String_copy(UA_String const *src, UA_String *dst) {
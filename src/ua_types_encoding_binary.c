@@ -4,6 +4,10 @@
 #include "ua_statuscodes.h"
 #include "ua_types_generated.h"
 
+#ifdef UA_MULTITHREADING
+#include <pthread.h>
+#endif
+
 #define UA_TYPE_CALCSIZEBINARY_MEMSIZE(TYPE) \
     size_t TYPE##_calcSizeBinary(TYPE const *p) { return sizeof(TYPE); }
 
@@ -18,10 +22,127 @@
         return TYPE_AS##_decodeBinary(src, offset, (TYPE_AS *)dst);     \
     }
 
+/* Integers are little-endian on the wire. Hosts with the same byte order copy
+   them as whole words. memcpy takes care of unaligned positions and compiles to
+   a single load or store where the architecture allows it. Big-endian hosts
+   swap the bytes after the copy. If the byte order is not known at compile
+   time, the integers are assembled byte by byte. */
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+# define UA_BINARY_LITTLEENDIAN
+# define UA_BINARY_WORDCOPY
+# define UA_SWAP16(x) (x)
+# define UA_SWAP32(x) (x)
+# define UA_SWAP64(x) (x)
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define UA_BINARY_WORDCOPY
+# define UA_SWAP16(x) ((UA_UInt16)(((x) << 8) | ((x) >> 8)))
+# define UA_SWAP32(x) __builtin_bswap32(x)
+# define UA_SWAP64(x) __builtin_bswap64(x)
+#endif
+
+/* The read and write functions do not check the bounds. This is up to the caller. */
+static UA_UInt16 readUInt16(const UA_Byte *buf) {
+#ifdef UA_BINARY_WORDCOPY
+    UA_UInt16 v;
+    memcpy(&v, buf, sizeof(UA_UInt16));
+    return UA_SWAP16(v);
+#else
+    return (UA_UInt16)((UA_UInt16)buf[0] | (UA_UInt16)buf[1] << 8);
+#endif
+}
+
+static void writeUInt16(UA_Byte *buf, UA_UInt16 v) {
+#ifdef UA_BINARY_WORDCOPY
+    v = UA_SWAP16(v);
+    memcpy(buf, &v, sizeof(UA_UInt16));
+#else
+    buf[0] = (UA_Byte)v;
+    buf[1] = (UA_Byte)(v >> 8);
+#endif
+}
+
+static UA_UInt32 readUInt32(const UA_Byte *buf) {
+#ifdef UA_BINARY_WORDCOPY
+    UA_UInt32 v;
+    memcpy(&v, buf, sizeof(UA_UInt32));
+    return UA_SWAP32(v);
+#else
+    return (UA_UInt32)buf[0] | (UA_UInt32)buf[1] << 8 |
+        (UA_UInt32)buf[2] << 16 | (UA_UInt32)buf[3] << 24;
+#endif
+}
+
+static void writeUInt32(UA_Byte *buf, UA_UInt32 v) {
+#ifdef UA_BINARY_WORDCOPY
+    v = UA_SWAP32(v);
+    memcpy(buf, &v, sizeof(UA_UInt32));
+#else
+    buf[0] = (UA_Byte)v;
+    buf[1] = (UA_Byte)(v >> 8);
+    buf[2] = (UA_Byte)(v >> 16);
+    buf[3] = (UA_Byte)(v >> 24);
+#endif
+}
+
+static UA_UInt64 readUInt64(const UA_Byte *buf) {
+#ifdef UA_BINARY_WORDCOPY
+    UA_UInt64 v;
+    memcpy(&v, buf, sizeof(UA_UInt64));
+    return UA_SWAP64(v);
+#else
+    return (UA_UInt64)readUInt32(buf) | (UA_UInt64)readUInt32(&buf[4]) << 32;
+#endif
+}
+
+static void writeUInt64(UA_Byte *buf, UA_UInt64 v) {
+#ifdef UA_BINARY_WORDCOPY
+    v = UA_SWAP64(v);
+    memcpy(buf, &v, sizeof(UA_UInt64));
+#else
+    writeUInt32(buf, (UA_UInt32)v);
+    writeUInt32(&buf[4], (UA_UInt32)(v >> 32));
+#endif
+}
+
+/* Points to the heap flag of the target buffer while encoding in the growing
+   mode. The encoders then enlarge the buffer instead of failing when it runs
+   full. */
+static UA_THREAD_LOCAL UA_Boolean *growOnHeap = UA_NULL;
+
+static UA_Boolean growBuffer(UA_ByteString *dst, size_t minLength) {
+    if(!growOnHeap || minLength > UA_INT32_MAX)
+        return UA_FALSE;
+    size_t newLength = dst->length > 0 ? (size_t)dst->length : 64;
+    while(newLength < minLength)
+        newLength *= 2;
+    if(newLength > UA_INT32_MAX)
+        newLength = UA_INT32_MAX;
+    UA_Byte *newData;
+    if(*growOnHeap)
+        newData = UA_realloc(dst->data, newLength);
+    else {
+        // move the content off the initial (stack) buffer
+        newData = UA_malloc(newLength);
+        if(newData && dst->length > 0)
+            memcpy(newData, dst->data, dst->length);
+    }
+    if(!newData)
+        return UA_FALSE;
+    *growOnHeap = UA_TRUE;
+    dst->data = newData;
+    dst->length = (UA_Int32)newLength;
+    return UA_TRUE;
+}
+
+/* Ensures that size bytes can be written at offset */
+static UA_Boolean hasRoom(UA_ByteString *dst, size_t offset, size_t size) {
+    return offset + size <= (size_t)dst->length || growBuffer(dst, offset + size);
+}
+
 /* Boolean */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_Boolean)
 UA_StatusCode UA_Boolean_encodeBinary(const UA_Boolean *src, UA_ByteString *dst, size_t *offset) {
-    if(*offset + sizeof(UA_Boolean) > (size_t)dst->length)
+    if(!hasRoom(dst, *offset, sizeof(UA_Boolean)))
         return UA_STATUSCODE_BADENCODINGERROR;
     dst->data[*offset] = (UA_Byte)*src;
     (*offset)++;
@@ -42,7 +163,7 @@ UA_TYPE_BINARY_ENCODING_AS(UA_SByte, UA_Byte)
 /* Byte */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_Byte)
 UA_StatusCode UA_Byte_encodeBinary(const UA_Byte *src, UA_ByteString *dst, size_t *offset) {
-    if(*offset + sizeof(UA_Byte) > (size_t)dst->length)
+    if(!hasRoom(dst, *offset, sizeof(UA_Byte)))
         return UA_STATUSCODE_BADENCODINGERROR;
     dst->data[*offset] = (UA_Byte)*src;
     (*offset)++;
@@ -63,18 +184,18 @@ UA_TYPE_BINARY_ENCODING_AS(UA_Int16, UA_UInt16)
 /* UInt16 */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_UInt16)
 UA_StatusCode UA_UInt16_encodeBinary(UA_UInt16 const *src, UA_ByteString * dst, size_t *offset) {
-    if(*offset + sizeof(UA_UInt16) > (size_t)dst->length )
+    if(!hasRoom(dst, *offset, sizeof(UA_UInt16)))
         return UA_STATUSCODE_BADENCODINGERROR;
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x00FF) >> 0);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0xFF00) >> 8);
+    writeUInt16(&dst->data[*offset], *src);
+    *offset += sizeof(UA_UInt16);
     return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_UInt16_decodeBinary(UA_ByteString const *src, size_t *offset, UA_UInt16 * dst) {
     if(*offset + sizeof(UA_UInt16) > (size_t)src->length)
         return UA_STATUSCODE_BADDECODINGERROR;
-    *dst =  (UA_UInt16)src->data[(*offset)++] << 0;
-    *dst |= (UA_UInt16)src->data[(*offset)++] << 8;
+    *dst = readUInt16(&src->data[*offset]);
+    *offset += sizeof(UA_UInt16);
     return UA_STATUSCODE_GOOD;
 }
 
@@ -84,22 +205,18 @@ UA_TYPE_BINARY_ENCODING_AS(UA_Int32, UA_UInt32)
 /* UInt32 */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_UInt32)
 UA_StatusCode UA_UInt32_encodeBinary(UA_UInt32 const *src, UA_ByteString * dst, size_t *offset) {
-    if(*offset + sizeof(UA_UInt32) > (size_t)dst->length )
+    if(!hasRoom(dst, *offset, sizeof(UA_UInt32)))
         return UA_STATUSCODE_BADENCODINGERROR;
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x000000FF) >> 0);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x0000FF00) >> 8);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x00FF0000) >> 16);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0xFF000000) >> 24);
+    writeUInt32(&dst->data[*offset], *src);
+    *offset += sizeof(UA_UInt32);
     return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_UInt32_decodeBinary(UA_ByteString const *src, size_t *offset, UA_UInt32 * dst) {
     if(*offset + sizeof(UA_UInt32) > (size_t)src->length)
         return UA_STATUSCODE_BADDECODINGERROR;
-    *dst  = (UA_UInt32)src->data[(*offset)++] << 0;
-    *dst |= (UA_UInt32)src->data[(*offset)++] << 8;
-    *dst |= (UA_UInt32)src->data[(*offset)++] << 16;
-    *dst |= (UA_UInt32)src->data[(*offset)++] << 24;
+    *dst = readUInt32(&src->data[*offset]);
+    *offset += sizeof(UA_UInt32);
     return UA_STATUSCODE_GOOD;
 }
 
@@ -109,96 +226,65 @@ UA_TYPE_BINARY_ENCODING_AS(UA_Int64, UA_UInt64)
 /* UInt64 */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_UInt64)
 UA_StatusCode UA_UInt64_encodeBinary(UA_UInt64 const *src, UA_ByteString *dst, size_t *offset) {
-    if(*offset + sizeof(UA_UInt64) > (size_t)dst->length )
+    if(!hasRoom(dst, *offset, sizeof(UA_UInt64)))
         return UA_STATUSCODE_BADENCODINGERROR;
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x00000000000000FF) >> 0);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x000000000000FF00) >> 8);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x0000000000FF0000) >> 16);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x00000000FF000000) >> 24);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x000000FF00000000) >> 32);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x0000FF0000000000) >> 40);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0x00FF000000000000) >> 48);
-    dst->data[(*offset)++] = (UA_Byte)((*src & 0xFF00000000000000) >> 56);
+    writeUInt64(&dst->data[*offset], *src);
+    *offset += sizeof(UA_UInt64);
     return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_UInt64_decodeBinary(UA_ByteString const *src, size_t *offset, UA_UInt64 * dst) {
     if(*offset + sizeof(UA_UInt64) > (size_t)src->length)
         return UA_STATUSCODE_BADDECODINGERROR;
-    *dst  = (UA_UInt64)src->data[(*offset)++] << 0;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 8;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 16;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 24;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 32;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 40;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 48;
-    *dst |= (UA_UInt64)src->data[(*offset)++] << 56;
+    *dst = readUInt64(&src->data[*offset]);
+    *offset += sizeof(UA_UInt64);
     return UA_STATUSCODE_GOOD;
 }
 
+/* Float and Double are transferred as their IEEE 754 bit pattern in
+   little-endian byte order. The bits are moved with memcpy to avoid aliasing
+   the floating point value with an integer pointer. */
+
 /* Float */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_Float)
-// FIXME: Implement NaN, Inf and Zero(s)
-UA_Byte UA_FLOAT_ZERO[] = { 0x00, 0x00, 0x00, 0x00 };
 UA_StatusCode UA_Float_decodeBinary(UA_ByteString const *src, size_t *offset, UA_Float * dst) {
     if(*offset + sizeof(UA_Float) > (size_t)src->length )
         return UA_STATUSCODE_BADDECODINGERROR;
-    UA_Float mantissa;
-    UA_UInt32 biasedExponent;
-    UA_Float sign;
-    if(memcmp(&src->data[*offset], UA_FLOAT_ZERO, 4) == 0)
-        return UA_Int32_decodeBinary(src, offset, (UA_Int32 *)dst);
-    mantissa = (UA_Float)(src->data[*offset] & 0xFF);                                   // bits 0-7
-    mantissa = (mantissa / (UA_Float)256.0 ) + (UA_Float)(src->data[*offset+1] & 0xFF); // bits 8-15
-    mantissa = (mantissa / (UA_Float)256.0 ) + (UA_Float)(src->data[*offset+2] & 0x7F); // bits 16-22
-    biasedExponent  = (src->data[*offset+2] & 0x80) >>  7;                              // bits 23
-    biasedExponent |= (UA_UInt32)(src->data[*offset+3] & 0x7F) <<  1;                   // bits 24-30
-    sign = ( src->data[*offset+ 3] & 0x80 ) ? -1.0 : 1.0;                               // bit 31
-    if(biasedExponent >= 127)
-        *dst = (UA_Float)sign * (1 << (biasedExponent-127)) * (1.0 + mantissa / 128.0 );
-    else
-        *dst = (UA_Float)sign * 2.0 * (1.0 + mantissa / 128.0 ) / ((UA_Float)(biasedExponent-127));
-    *offset += 4;
+    UA_UInt32 bits = readUInt32(&src->data[*offset]);
+    memcpy(dst, &bits, sizeof(UA_Float));
+    *offset += sizeof(UA_Float);
     return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_Float_encodeBinary(UA_Float const *src, UA_ByteString * dst, size_t *offset) {
-    return UA_Int32_encodeBinary((const UA_Int32 *)src, dst, offset);
+    if(!hasRoom(dst, *offset, sizeof(UA_Float)))
+        return UA_STATUSCODE_BADENCODINGERROR;
+    UA_UInt32 bits;
+    memcpy(&bits, src, sizeof(UA_Float));
+    writeUInt32(&dst->data[*offset], bits);
+    *offset += sizeof(UA_Float);
+    return UA_STATUSCODE_GOOD;
 }
 
 /* Double */
 UA_TYPE_CALCSIZEBINARY_MEMSIZE(UA_Double)
-// FIXME: Implement NaN, Inf and Zero(s)
-UA_Byte UA_DOUBLE_ZERO[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 UA_StatusCode UA_Double_decodeBinary(UA_ByteString const *src, size_t *offset, UA_Double * dst) {
-    if(*offset + sizeof(UA_Double) > (UA_UInt32)src->length )
+    if(*offset + sizeof(UA_Double) > (size_t)src->length )
         return UA_STATUSCODE_BADDECODINGERROR;
-    UA_Double sign;
-    UA_Double mantissa;
-    UA_UInt32 biasedExponent;
-    if(memcmp(&src->data[*offset], UA_DOUBLE_ZERO, 8) == 0)
-        return UA_Int64_decodeBinary(src, offset, (UA_Int64 *)dst);
-    mantissa = (UA_Double)(src->data[*offset] & 0xFF);                         // bits 0-7
-    mantissa = (mantissa / 256.0 ) + (UA_Double)(src->data[*offset+1] & 0xFF); // bits 8-15
-    mantissa = (mantissa / 256.0 ) + (UA_Double)(src->data[*offset+2] & 0xFF); // bits 16-23
-    mantissa = (mantissa / 256.0 ) + (UA_Double)(src->data[*offset+3] & 0xFF); // bits 24-31
-    mantissa = (mantissa / 256.0 ) + (UA_Double)(src->data[*offset+4] & 0xFF); // bits 32-39
-    mantissa = (mantissa / 256.0 ) + (UA_Double)(src->data[*offset+5] & 0xFF); // bits 40-47
-    mantissa = (mantissa / 256.0 ) + (UA_Double)(src->data[*offset+6] & 0x0F); // bits 48-51
-    biasedExponent  = (src->data[*offset+6] & 0xF0) >>  4; // bits 52-55
-    biasedExponent |= ((UA_UInt32)(src->data[*offset+7] & 0x7F)) <<  4; // bits 56-62
-    sign = ( src->data[*offset+7] & 0x80 ) ? -1.0 : 1.0; // bit 63
-    if(biasedExponent >= 1023)
-        *dst = (UA_Double)sign * (1 << (biasedExponent-1023)) * (1.0 + mantissa / 8.0 );
-    else
-        *dst = (UA_Double)sign * 2.0 *
-            (1.0 + mantissa / 8.0 ) / ((UA_Double)(biasedExponent-1023));
-    *offset += 8;
+    UA_UInt64 bits = readUInt64(&src->data[*offset]);
+    memcpy(dst, &bits, sizeof(UA_Double));
+    *offset += sizeof(UA_Double);
     return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_Double_encodeBinary(UA_Double const *src, UA_ByteString * dst, size_t *offset) {
-    return UA_Int64_encodeBinary((const UA_Int64*)src, dst, offset);
+    if(!hasRoom(dst, *offset, sizeof(UA_Double)))
+        return UA_STATUSCODE_BADENCODINGERROR;
+    UA_UInt64 bits;
+    memcpy(&bits, src, sizeof(UA_Double));
+    writeUInt64(&dst->data[*offset], bits);
+    *offset += sizeof(UA_Double);
+    return UA_STATUSCODE_GOOD;
 }
 
 /* String */
@@ -210,7 +296,7 @@ size_t UA_String_calcSizeBinary(UA_String const *string) {
 }
 
 UA_StatusCode UA_String_encodeBinary(UA_String const *src, UA_ByteString *dst, size_t *offset) {
-    if(*offset + UA_String_calcSizeBinary(src) > (size_t)dst->length)
+    if(!hasRoom(dst, *offset, UA_String_calcSizeBinary(src)))
         return UA_STATUSCODE_BADENCODINGERROR;
 
     UA_StatusCode retval = UA_Int32_encodeBinary(&src->length, dst, offset);
@@ -236,11 +322,14 @@ UA_StatusCode UA_String_decodeBinary(UA_ByteString const *src, size_t *offset, U
         
     if(*offset + (size_t)length > (size_t)src->length)
         return UA_STATUSCODE_BADINTERNALERROR;
-    
-    if(!(dst->data = UA_malloc(length)))
-        return UA_STATUSCODE_BADOUTOFMEMORY;
 
-    UA_memcpy(dst->data, &src->data[*offset], length);
+    if(UA_stringsBorrowed)
+        dst->data = &src->data[*offset];
+    else {
+        if(!(dst->data = UA_malloc(length)))
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        UA_memcpy(dst->data, &src->data[*offset], length);
+    }
     dst->length = length;
     *offset += length;
     return UA_STATUSCODE_GOOD;
@@ -254,25 +343,34 @@ size_t UA_Guid_calcSizeBinary(UA_Guid const *p) {
     return 16;
 }
 
+static void writeGuid(UA_Byte *buf, const UA_Guid *src) {
+    writeUInt32(buf, src->data1);
+    writeUInt16(&buf[4], src->data2);
+    writeUInt16(&buf[6], src->data3);
+    memcpy(&buf[8], src->data4, 8);
+}
+
+static void readGuid(const UA_Byte *buf, UA_Guid *dst) {
+    dst->data1 = readUInt32(buf);
+    dst->data2 = readUInt16(&buf[4]);
+    dst->data3 = readUInt16(&buf[6]);
+    memcpy(dst->data4, &buf[8], 8);
+}
+
 UA_StatusCode UA_Guid_encodeBinary(UA_Guid const *src, UA_ByteString * dst, size_t *offset) {
-    UA_StatusCode retval = UA_UInt32_encodeBinary(&src->data1, dst, offset);
-    retval |= UA_UInt16_encodeBinary(&src->data2, dst, offset);
-    retval |= UA_UInt16_encodeBinary(&src->data3, dst, offset);
-    for(UA_Int32 i = 0;i < 8;i++)
-        retval |= UA_Byte_encodeBinary(&src->data4[i], dst, offset);
-    return retval;
+    if(!hasRoom(dst, *offset, 16))
+        return UA_STATUSCODE_BADENCODINGERROR;
+    writeGuid(&dst->data[*offset], src);
+    *offset += 16;
+    return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode UA_Guid_decodeBinary(UA_ByteString const *src, size_t *offset, UA_Guid * dst) {
-    // This could be done with a single memcpy (if the compiler does no fancy realigning of structs)
-    UA_StatusCode retval = UA_UInt32_decodeBinary(src, offset, &dst->data1);
-    retval |= UA_UInt16_decodeBinary(src, offset, &dst->data2);
-    retval |= UA_UInt16_decodeBinary(src, offset, &dst->data3);
-    for(size_t i = 0;i < 8;i++)
-        retval |= UA_Byte_decodeBinary(src, offset, &dst->data4[i]);
-    if(retval)
-        UA_Guid_deleteMembers(dst);
-    return retval;
+    if(*offset + 16 > (size_t)src->length)
+        return UA_STATUSCODE_BADDECODINGERROR;
+    readGuid(&src->data[*offset], dst);
+    *offset += 16;
+    return UA_STATUSCODE_GOOD;
 }
 
 /* ByteString */
@@ -679,6 +777,119 @@ enum UA_VARIANT_ENCODINGMASKTYPE_enum {
     UA_VARIANT_ENCODINGMASKTYPE_ARRAY       = (0x01 << 7)      // bit 7
 };
 
+/* Index in UA_TYPES by the builtin type id in the variant encoding byte */
+static const UA_UInt16 builtinTypeIndex[26] = {
+    UA_TYPES_COUNT, UA_TYPES_BOOLEAN, UA_TYPES_SBYTE, UA_TYPES_BYTE, UA_TYPES_INT16,
+    UA_TYPES_UINT16, UA_TYPES_INT32, UA_TYPES_UINT32, UA_TYPES_INT64, UA_TYPES_UINT64,
+    UA_TYPES_FLOAT, UA_TYPES_DOUBLE, UA_TYPES_STRING, UA_TYPES_DATETIME, UA_TYPES_GUID,
+    UA_TYPES_BYTESTRING, UA_TYPES_XMLELEMENT, UA_TYPES_NODEID, UA_TYPES_EXPANDEDNODEID,
+    UA_TYPES_STATUSCODE, UA_TYPES_QUALIFIEDNAME, UA_TYPES_LOCALIZEDTEXT,
+    UA_TYPES_EXTENSIONOBJECT, UA_TYPES_DATAVALUE, UA_TYPES_VARIANT, UA_TYPES_DIAGNOSTICINFO };
+
+/* Index from the binary encoding id of a type to its description. Open
+   addressing with linear probing. The table has at least twice as many slots
+   as entries. It is filled with the types of namespace zero when first used. */
+static struct {
+    const UA_DataType **slots;
+    UA_UInt32 size; // a power of two
+    UA_UInt32 count;
+} encodingIndex = {UA_NULL, 0, 0};
+
+#ifdef UA_MULTITHREADING
+static pthread_once_t encodingIndexOnce = PTHREAD_ONCE_INIT;
+#endif
+
+/* The variant encoder wraps non-builtin types in an extensionobject with this id */
+static UA_UInt32 binaryEncodingId(const UA_DataType *type) {
+    if(type->isStructure)
+        return type->typeId.identifier.numeric + UA_ENCODINGOFFSET_BINARY;
+    return type->typeId.identifier.numeric;
+}
+
+static UA_UInt32 encodingIndexHash(UA_UInt16 namespaceIndex, UA_UInt32 encodingId) {
+    return (encodingId * 2654435761u) ^ ((UA_UInt32)namespaceIndex * 40503u);
+}
+
+static UA_StatusCode insertTypes(const UA_DataType *types, UA_Int32 typesSize) {
+    if(encodingIndex.size < (encodingIndex.count + (UA_UInt32)typesSize) * 2) {
+        UA_UInt32 newSize = 64;
+        while(newSize < (encodingIndex.count + (UA_UInt32)typesSize) * 2)
+            newSize *= 2;
+        const UA_DataType **newSlots = UA_malloc(sizeof(UA_DataType*) * newSize);
+        if(!newSlots)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        UA_memset(newSlots, 0, sizeof(UA_DataType*) * newSize);
+        const UA_DataType **oldSlots = encodingIndex.slots;
+        UA_UInt32 oldSize = encodingIndex.size;
+        encodingIndex.slots = newSlots;
+        encodingIndex.size = newSize;
+        encodingIndex.count = 0;
+        for(UA_UInt32 i = 0; i < oldSize; i++) {
+            if(oldSlots[i])
+                insertTypes(oldSlots[i], 1);
+        }
+        UA_free(oldSlots);
+    }
+
+    for(UA_Int32 i = 0; i < typesSize; i++) {
+        const UA_DataType *type = &types[i];
+        if(type->typeId.identifierType != UA_NODEIDTYPE_NUMERIC || type->typeId.identifier.numeric == 0)
+            continue; // the type has no nodeid
+        UA_UInt32 encodingId = binaryEncodingId(type);
+        UA_UInt32 slot = encodingIndexHash(type->typeId.namespaceIndex, encodingId) & (encodingIndex.size - 1);
+        UA_Boolean known = UA_FALSE;
+        for(; encodingIndex.slots[slot]; slot = (slot + 1) & (encodingIndex.size - 1)) {
+            const UA_DataType *other = encodingIndex.slots[slot];
+            if(other->typeId.namespaceIndex == type->typeId.namespaceIndex &&
+               binaryEncodingId(other) == encodingId) {
+                known = UA_TRUE; // the first registration wins
+                break;
+            }
+        }
+        if(known)
+            continue;
+        encodingIndex.slots[slot] = type;
+        encodingIndex.count++;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static void initEncodingIndex(void) {
+    insertTypes(UA_TYPES, UA_TYPES_COUNT);
+}
+
+UA_StatusCode UA_registerDataTypes(const UA_DataType *types, UA_Int32 typesSize) {
+#ifdef UA_MULTITHREADING
+    pthread_once(&encodingIndexOnce, initEncodingIndex);
+#else
+    if(!encodingIndex.slots)
+        initEncodingIndex();
+#endif
+    if(typesSize <= 0)
+        return UA_STATUSCODE_GOOD;
+    return insertTypes(types, typesSize);
+}
+
+const UA_DataType * UA_findDataTypeByBinaryEncodingId(const UA_NodeId *encodingId) {
+#ifdef UA_MULTITHREADING
+    pthread_once(&encodingIndexOnce, initEncodingIndex);
+#else
+    if(!encodingIndex.slots)
+        initEncodingIndex();
+#endif
+    if(encodingIndex.size == 0 || encodingId->identifierType != UA_NODEIDTYPE_NUMERIC)
+        return UA_NULL;
+    UA_UInt32 slot = encodingIndexHash(encodingId->namespaceIndex, encodingId->identifier.numeric) &
+        (encodingIndex.size - 1);
+    for(; encodingIndex.slots[slot]; slot = (slot + 1) & (encodingIndex.size - 1)) {
+        const UA_DataType *type = encodingIndex.slots[slot];
+        if(type->typeId.namespaceIndex == encodingId->namespaceIndex &&
+           binaryEncodingId(type) == encodingId->identifier.numeric)
+            return type;
+    }
+    return UA_NULL;
+}
+
 size_t UA_Variant_calcSizeBinary(UA_Variant const *p) {
     if(!p->type) // type is not set after init
         return 0;
@@ -742,10 +953,17 @@ UA_StatusCode UA_Variant_encodeBinary(UA_Variant const *src, UA_ByteString *dst,
         	}
             UA_Byte eoEncoding = UA_EXTENSIONOBJECT_ENCODINGMASK_BODYISBYTESTRING;
             UA_Byte_encodeBinary(&eoEncoding, dst, offset);
-            UA_Int32 eoEncodingLength = UA_calcSizeBinary(src->dataPtr, src->type);
-            UA_Int32_encodeBinary(&eoEncodingLength, dst, offset);
-        }
-        retval |= UA_encodeBinary(src->dataPtr, src->type, dst, offset);
+            // reserve the length field and back-patch it when the body is written
+            UA_Int32 eoEncodingLength = 0;
+            retval |= UA_Int32_encodeBinary(&eoEncodingLength, dst, offset);
+            if(retval != UA_STATUSCODE_GOOD)
+                return retval;
+            size_t eoBodyOffset = *offset;
+            retval = UA_encodeBinary(src->dataPtr, src->type, dst, offset);
+            if(retval == UA_STATUSCODE_GOOD)
+                writeUInt32(&dst->data[eoBodyOffset - 4], (UA_UInt32)(*offset - eoBodyOffset));
+        } else
+            retval |= UA_encodeBinary(src->dataPtr, src->type, dst, offset);
     }
 
     if(hasDimensions)
@@ -764,19 +982,46 @@ UA_StatusCode UA_Variant_decodeBinary(UA_ByteString const *src, size_t *offset,
 
     UA_Boolean isArray = encodingByte & UA_VARIANT_ENCODINGMASKTYPE_ARRAY;
     UA_Boolean hasDimensions = isArray && (encodingByte & UA_VARIANT_ENCODINGMASKTYPE_DIMENSIONS);
-    UA_NodeId typeid = { .namespaceIndex = 0, .identifierType = UA_NODEIDTYPE_NUMERIC,
-                         .identifier.numeric = encodingByte & UA_VARIANT_ENCODINGMASKTYPE_TYPEID_MASK };
-
-    UA_UInt16 typeIndex;
-    for(typeIndex = 0; typeIndex < UA_TYPES_COUNT; typeIndex++) {
-        if(UA_TYPES[typeIndex].typeId.identifier.numeric == typeid.identifier.numeric)
-            break;
-    }
-
-    if(typeIndex >= UA_TYPES_COUNT)
+    UA_Byte builtinId = encodingByte & UA_VARIANT_ENCODINGMASKTYPE_TYPEID_MASK;
+    if(builtinId >= sizeof(builtinTypeIndex) / sizeof(UA_UInt16) ||
+       builtinTypeIndex[builtinId] >= UA_TYPES_COUNT)
         return UA_STATUSCODE_BADDECODINGERROR;
-
-    const UA_DataType *dataType = &UA_TYPES[typeIndex];
+    const UA_DataType *dataType = &UA_TYPES[builtinTypeIndex[builtinId]];
+
+    if(!isArray && dataType == &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]) {
+        // decode the body of known types directly into the typed structure
+        size_t eoOffset = *offset;
+        UA_NodeId eoTypeId;
+        UA_Byte eoEncoding = 0;
+        UA_Int32 eoLength = 0;
+        const UA_DataType *eoType = UA_NULL;
+        if(UA_NodeId_decodeBinary(src, offset, &eoTypeId) == UA_STATUSCODE_GOOD) {
+            if(UA_Byte_decodeBinary(src, offset, &eoEncoding) == UA_STATUSCODE_GOOD &&
+               eoEncoding == UA_EXTENSIONOBJECT_ENCODINGMASK_BODYISBYTESTRING &&
+               UA_Int32_decodeBinary(src, offset, &eoLength) == UA_STATUSCODE_GOOD)
+                eoType = UA_findDataTypeByBinaryEncodingId(&eoTypeId);
+            UA_NodeId_deleteMembers(&eoTypeId);
+        }
+        if(eoType) {
+            size_t bodyOffset = *offset;
+            if(!(dst->dataPtr = UA_malloc(eoType->memSize)))
+                return UA_STATUSCODE_BADOUTOFMEMORY;
+            retval = UA_decodeBinary(src, offset, dst->dataPtr, eoType);
+            if(retval == UA_STATUSCODE_GOOD && *offset - bodyOffset != (size_t)eoLength) {
+                UA_deleteMembers(dst->dataPtr, eoType);
+                retval = UA_STATUSCODE_BADDECODINGERROR;
+            }
+            if(retval != UA_STATUSCODE_GOOD) {
+                UA_free(dst->dataPtr);
+                dst->dataPtr = UA_NULL;
+                return retval;
+            }
+            dst->arrayLength = 1;
+            dst->type = eoType;
+            return UA_STATUSCODE_GOOD;
+        }
+        *offset = eoOffset; // unknown type. decode the extensionobject as is
+    }
 
     if(!isArray) {
         if(!(dst->dataPtr = UA_malloc(dataType->memSize)))
@@ -978,7 +1223,228 @@ size_t UA_calcSizeBinary(const void *p, const UA_DataType *dataType) {
     return size;
 }
 
+/* Types without pointers are en- and decoded with a single bounds check for the
+   entire structure or array. The members are then written and read without
+   further checks. */
+
+/* p is not dereferenced, since fixed-size types contain no arrays */
+static size_t fixedSizeBinary(const void *p, const UA_DataType *dataType) {
+    if(dataType->zeroCopyable)
+        return dataType->memSize; // no padding. the encoding has the memory layout
+    return UA_calcSizeBinary(p, dataType);
+}
+
+static UA_Byte * encodeFixedSize(const void *src, const UA_DataType *dataType, UA_Byte *buf) {
+    uintptr_t ptr = (uintptr_t)src;
+    UA_Byte membersSize = dataType->membersSize;
+    for(size_t i=0;i<membersSize; i++) {
+        const UA_DataTypeMember *member = &dataType->members[i];
+        const UA_DataType *memberType;
+        if(member->namespaceZero)
+            memberType = &UA_TYPES[member->memberTypeIndex];
+        else
+            memberType = dataType - dataType->typeIndex + member->memberTypeIndex;
+
+        ptr += member->padding;
+        if(!member->namespaceZero) {
+            buf = encodeFixedSize((const void*)ptr, memberType, buf);
+            ptr += memberType->memSize;
+            continue;
+        }
+
+        switch(member->memberTypeIndex) {
+        case UA_TYPES_BOOLEAN:
+            *buf = (UA_Byte)*(const UA_Boolean*)ptr;
+            buf += 1;
+            break;
+        case UA_TYPES_SBYTE:
+        case UA_TYPES_BYTE:
+            *buf = *(const UA_Byte*)ptr;
+            buf += 1;
+            break;
+        case UA_TYPES_INT16:
+        case UA_TYPES_UINT16:
+            writeUInt16(buf, *(const UA_UInt16*)ptr);
+            buf += 2;
+            break;
+        case UA_TYPES_INT32:
+        case UA_TYPES_UINT32:
+        case UA_TYPES_STATUSCODE:
+        case UA_TYPES_FLOAT: {
+            UA_UInt32 v;
+            memcpy(&v, (const void*)ptr, 4);
+            writeUInt32(buf, v);
+            buf += 4;
+            break;
+        }
+        case UA_TYPES_INT64:
+        case UA_TYPES_UINT64:
+        case UA_TYPES_DOUBLE:
+        case UA_TYPES_DATETIME: {
+            UA_UInt64 v;
+            memcpy(&v, (const void*)ptr, 8);
+            writeUInt64(buf, v);
+            buf += 8;
+            break;
+        }
+        case UA_TYPES_GUID:
+            writeGuid(buf, (const UA_Guid*)ptr);
+            buf += 16;
+            break;
+        default:
+            buf = encodeFixedSize((const void*)ptr, memberType, buf);
+        }
+        ptr += memberType->memSize;
+    }
+    return buf;
+}
+
+static const UA_Byte * decodeFixedSize(const UA_Byte *buf, void *dst, const UA_DataType *dataType) {
+    uintptr_t ptr = (uintptr_t)dst;
+    UA_Byte membersSize = dataType->membersSize;
+    for(size_t i=0;i<membersSize; i++) {
+        const UA_DataTypeMember *member = &dataType->members[i];
+        const UA_DataType *memberType;
+        if(member->namespaceZero)
+            memberType = &UA_TYPES[member->memberTypeIndex];
+        else
+            memberType = dataType - dataType->typeIndex + member->memberTypeIndex;
+
+        ptr += member->padding;
+        if(!member->namespaceZero) {
+            buf = decodeFixedSize(buf, (void*)ptr, memberType);
+            ptr += memberType->memSize;
+            continue;
+        }
+
+        switch(member->memberTypeIndex) {
+        case UA_TYPES_BOOLEAN:
+            *(UA_Boolean*)ptr = (*buf > 0) ? UA_TRUE : UA_FALSE;
+            buf += 1;
+            break;
+        case UA_TYPES_SBYTE:
+        case UA_TYPES_BYTE:
+            *(UA_Byte*)ptr = *buf;
+            buf += 1;
+            break;
+        case UA_TYPES_INT16:
+        case UA_TYPES_UINT16:
+            *(UA_UInt16*)ptr = readUInt16(buf);
+            buf += 2;
+            break;
+        case UA_TYPES_INT32:
+        case UA_TYPES_UINT32:
+        case UA_TYPES_STATUSCODE:
+        case UA_TYPES_FLOAT: {
+            UA_UInt32 v = readUInt32(buf);
+            memcpy((void*)ptr, &v, 4);
+            buf += 4;
+            break;
+        }
+        case UA_TYPES_INT64:
+        case UA_TYPES_UINT64:
+        case UA_TYPES_DOUBLE:
+        case UA_TYPES_DATETIME: {
+            UA_UInt64 v = readUInt64(buf);
+            memcpy((void*)ptr, &v, 8);
+            buf += 8;
+            break;
+        }
+        case UA_TYPES_GUID:
+            readGuid(buf, (UA_Guid*)ptr);
+            buf += 16;
+            break;
+        default:
+            buf = decodeFixedSize(buf, (void*)ptr, memberType);
+        }
+        ptr += memberType->memSize;
+    }
+    return buf;
+}
+
+/* Arrays of the numeric builtin types (everything from SByte to DateTime except
+   Boolean) are moved in bulk. On little-endian hosts, the encoding is the
+   memory layout and a single memcpy suffices. Other hosts swap the elements in
+   a tight loop that the compiler can vectorize. */
+
+static UA_Boolean isNumericBuiltin(const UA_DataType *dataType) {
+    return dataType->typeIndex >= UA_TYPES_SBYTE && dataType->typeIndex <= UA_TYPES_DATETIME &&
+        dataType == &UA_TYPES[dataType->typeIndex];
+}
+
+static void encodeNumericArray(const void *src, UA_Int32 noElements, size_t memSize, UA_Byte *buf) {
+#ifdef UA_BINARY_LITTLEENDIAN
+    memcpy(buf, src, memSize * noElements);
+#else
+    const UA_Byte *p = (const UA_Byte*)src;
+    switch(memSize) {
+    case 2:
+        for(UA_Int32 i = 0; i < noElements; i++) {
+            UA_UInt16 v;
+            memcpy(&v, &p[2*i], 2);
+            writeUInt16(&buf[2*i], v);
+        }
+        break;
+    case 4:
+        for(UA_Int32 i = 0; i < noElements; i++) {
+            UA_UInt32 v;
+            memcpy(&v, &p[4*i], 4);
+            writeUInt32(&buf[4*i], v);
+        }
+        break;
+    case 8:
+        for(UA_Int32 i = 0; i < noElements; i++) {
+            UA_UInt64 v;
+            memcpy(&v, &p[8*i], 8);
+            writeUInt64(&buf[8*i], v);
+        }
+        break;
+    default:
+        memcpy(buf, src, memSize * noElements);
+    }
+#endif
+}
+
+static void decodeNumericArray(const UA_Byte *buf, UA_Int32 noElements, size_t memSize, void *dst) {
+#ifdef UA_BINARY_LITTLEENDIAN
+    memcpy(dst, buf, memSize * noElements);
+#else
+    UA_Byte *p = (UA_Byte*)dst;
+    switch(memSize) {
+    case 2:
+        for(UA_Int32 i = 0; i < noElements; i++) {
+            UA_UInt16 v = readUInt16(&buf[2*i]);
+            memcpy(&p[2*i], &v, 2);
+        }
+        break;
+    case 4:
+        for(UA_Int32 i = 0; i < noElements; i++) {
+            UA_UInt32 v = readUInt32(&buf[4*i]);
+            memcpy(&p[4*i], &v, 4);
+        }
+        break;
+    case 8:
+        for(UA_Int32 i = 0; i < noElements; i++) {
+            UA_UInt64 v = readUInt64(&buf[8*i]);
+            memcpy(&p[8*i], &v, 8);
+        }
+        break;
+    default:
+        memcpy(dst, buf, memSize * noElements);
+    }
+#endif
+}
+
 UA_StatusCode UA_encodeBinary(const void *src, const UA_DataType *dataType, UA_ByteString *dst, size_t *offset) {
+    if(dataType->fixedSize) {
+        size_t size = fixedSizeBinary(src, dataType);
+        if(!hasRoom(dst, *offset, size))
+            return UA_STATUSCODE_BADENCODINGERROR;
+        encodeFixedSize(src, dataType, &dst->data[*offset]);
+        *offset += size;
+        return UA_STATUSCODE_GOOD;
+    }
+
     uintptr_t ptr = (uintptr_t)src;
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
     UA_Byte membersSize = dataType->membersSize;
@@ -1075,6 +1541,15 @@ UA_StatusCode UA_encodeBinary(const void *src, const UA_DataType *dataType, UA_B
 }
 
 UA_StatusCode UA_decodeBinary(const UA_ByteString *src, size_t *offset, void *dst, const UA_DataType *dataType) {
+    if(dataType->fixedSize) {
+        size_t size = fixedSizeBinary(dst, dataType);
+        if(*offset + size > (size_t)src->length)
+            return UA_STATUSCODE_BADDECODINGERROR;
+        decodeFixedSize(&src->data[*offset], dst, dataType);
+        *offset += size;
+        return UA_STATUSCODE_GOOD;
+    }
+
     UA_init(dst, dataType);
     uintptr_t ptr = (uintptr_t)dst;
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
@@ -1172,6 +1647,29 @@ UA_StatusCode UA_decodeBinary(const UA_ByteString *src, size_t *offset, void *ds
     return retval;
 }
 
+UA_StatusCode UA_encodeBinaryGrowing(const void *src, const UA_DataType *dataType, UA_ByteString *dst,
+                                     size_t *offset, UA_Boolean *dstOnHeap) {
+    UA_Boolean *outer = growOnHeap;
+    growOnHeap = dstOnHeap;
+    UA_StatusCode retval = UA_encodeBinary(src, dataType, dst, offset);
+    growOnHeap = outer;
+    return retval;
+}
+
+UA_StatusCode UA_decodeBinaryBorrowed(const UA_ByteString *src, size_t *offset, void *dst,
+                                      const UA_DataType *dataType) {
+    UA_stringsBorrowed = UA_TRUE;
+    UA_StatusCode retval = UA_decodeBinary(src, offset, dst, dataType);
+    UA_stringsBorrowed = UA_FALSE;
+    return retval;
+}
+
+void UA_deleteMembersBorrowed(void *p, const UA_DataType *dataType) {
+    UA_stringsBorrowed = UA_TRUE;
+    UA_deleteMembers(p, dataType);
+    UA_stringsBorrowed = UA_FALSE;
+}
+
 /******************/
 /* Array Handling */
 /******************/
@@ -1199,6 +1697,22 @@ UA_StatusCode UA_Array_encodeBinary(const void *src, UA_Int32 noElements, const
     UA_Int32_encodeBinary(&noElements, dst, offset);
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
     uintptr_t ptr = (uintptr_t)src;
+    if(dataType->fixedSize && noElements > 0) {
+        size_t size = fixedSizeBinary(src, dataType);
+        if(!hasRoom(dst, *offset, (size * noElements)))
+            return UA_STATUSCODE_BADENCODINGERROR;
+        UA_Byte *buf = &dst->data[*offset];
+        if(isNumericBuiltin(dataType))
+            encodeNumericArray(src, noElements, dataType->memSize, buf);
+        else {
+            for(int i=0;i<noElements;i++) {
+                buf = encodeFixedSize((const void*)ptr, dataType, buf);
+                ptr += dataType->memSize;
+            }
+        }
+        *offset += size * noElements;
+        return UA_STATUSCODE_GOOD;
+    }
     for(int i=0;i<noElements && retval == UA_STATUSCODE_GOOD;i++) {
         retval = UA_encodeBinary((const void*)ptr, dataType, dst, offset);
         ptr += dataType->memSize;
@@ -1220,11 +1734,32 @@ UA_StatusCode UA_Array_decodeBinary(const UA_ByteString *src, size_t *offset, UA
     if(*offset + ((dataType->memSize * noElements)/32) > (UA_UInt32)src->length)
         return UA_STATUSCODE_BADDECODINGERROR;
 
+    size_t fixedSize = 0;
+    if(dataType->fixedSize) {
+        fixedSize = fixedSizeBinary(UA_NULL, dataType);
+        if(*offset + (fixedSize * noElements) > (size_t)src->length)
+            return UA_STATUSCODE_BADDECODINGERROR;
+    }
+
     *dst = UA_malloc(dataType->memSize * noElements);
     if(!*dst)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
     uintptr_t ptr = (uintptr_t)*dst;
+    if(dataType->fixedSize) {
+        const UA_Byte *buf = &src->data[*offset];
+        if(isNumericBuiltin(dataType))
+            decodeNumericArray(buf, noElements, dataType->memSize, *dst);
+        else {
+            for(UA_Int32 i=0;i<noElements;i++) {
+                buf = decodeFixedSize(buf, (void*)ptr, dataType);
+                ptr += dataType->memSize;
+            }
+        }
+        *offset += fixedSize * noElements;
+        return UA_STATUSCODE_GOOD;
+    }
+
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
     UA_Int32 i;
     for(i=0;i<noElements && retval == UA_STATUSCODE_GOOD;i++) {
@@ -1235,3 +1770,386 @@ UA_StatusCode UA_Array_decodeBinary(const UA_ByteString *src, size_t *offset, UA
         UA_Array_delete(*dst, dataType, i);
     return retval;
 }
+
+/**********************/
+/* Streaming Decoding */
+/**********************/
+
+enum {
+    UA_DECODEFRAME_VALUE,
+    UA_DECODEFRAME_ARRAY
+};
+
+void UA_DecodeStream_init(UA_DecodeStream *stream, void *dst, const UA_DataType *dataType,
+                          size_t maxMessageSize) {
+    stream->dst = dst;
+    stream->dataType = dataType;
+    UA_init(dst, dataType);
+    stream->frames[0] = (UA_DecodeFrame){.dataType = dataType, .ptr = (uintptr_t)dst,
+                                         .step = 0, .count = 0, .kind = UA_DECODEFRAME_VALUE};
+    stream->depth = 1;
+    UA_ByteString_init(&stream->pending);
+    stream->src = UA_NULL;
+    stream->offset = 0;
+    stream->waiting = UA_FALSE;
+    stream->maxMessageSize = maxMessageSize;
+    stream->received = 0;
+}
+
+void UA_DecodeStream_deleteMembers(UA_DecodeStream *stream) {
+    UA_deleteMembers(stream->dst, stream->dataType);
+    UA_ByteString_deleteMembers(&stream->pending);
+    UA_ByteString_init(&stream->pending);
+    stream->depth = 0;
+}
+
+static UA_DecodeFrame * pushFrame(UA_DecodeStream *stream, const UA_DataType *dataType, void *p) {
+    UA_DecodeFrame *frame = &stream->frames[stream->depth++];
+    *frame = (UA_DecodeFrame){.dataType = dataType, .ptr = (uintptr_t)p, .step = 0, .count = 0,
+                              .kind = UA_DECODEFRAME_VALUE};
+    return frame;
+}
+
+/* The number of bytes from the current position to the end of the message if
+   it has the maximum size */
+static size_t remainingMessage(const UA_DecodeStream *stream) {
+    size_t available = (size_t)stream->src->length - stream->offset;
+    size_t pos = stream->received - available;
+    return pos < stream->maxMessageSize ? stream->maxMessageSize - pos : 0;
+}
+
+/* Decodes a value that is not split up any further. If it does not fit into
+   the remaining input, the decoder waits for the next buffer and tries again.
+   But if the maximum encoded size of the value is available, the value is
+   malformed. Fixed-size values are not larger than their memory size. The
+   others are bounded by the end of the message. */
+static UA_StatusCode decodeWhole(UA_DecodeStream *stream, void *dst, const UA_DataType *dataType) {
+    size_t pos = stream->offset;
+    UA_StatusCode retval = UA_decodeBinary(stream->src, &pos, dst, dataType);
+    if(retval == UA_STATUSCODE_GOOD) {
+        stream->offset = pos;
+        return UA_STATUSCODE_GOOD;
+    }
+    UA_init(dst, dataType);
+    if(retval == UA_STATUSCODE_BADOUTOFMEMORY)
+        return retval;
+    size_t available = (size_t)stream->src->length - stream->offset;
+    size_t maxSize = dataType->fixedSize ? dataType->memSize : remainingMessage(stream);
+    if(available >= maxSize)
+        return UA_STATUSCODE_BADDECODINGERROR;
+    stream->waiting = UA_TRUE; // the value may continue in the next buffer
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Allocates an array with initialized elements. The length is set to -1 if the
+   array cannot be allocated, so that the partially decoded value can be
+   deleted. */
+static UA_StatusCode allocArray(UA_Int32 *noElements, void **p, const UA_DataType *dataType) {
+    *p = UA_NULL;
+    if(*noElements <= 0)
+        return UA_STATUSCODE_GOOD;
+    if((UA_Int32)dataType->memSize * *noElements < 0 ||
+       dataType->memSize * *noElements > MAX_ARRAY_SIZE || !(*p = UA_malloc(dataType->memSize * *noElements))) {
+        *noElements = -1;
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    uintptr_t ptr = (uintptr_t)*p;
+    for(UA_Int32 i = 0; i < *noElements; i++) {
+        UA_init((void*)ptr, dataType);
+        ptr += dataType->memSize;
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode pushArray(UA_DecodeStream *stream, UA_Int32 *noElements, void **p,
+                               const UA_DataType *dataType) {
+    // every element takes at least one byte
+    if(*noElements > 0 && (size_t)*noElements > remainingMessage(stream)) {
+        *p = UA_NULL;
+        *noElements = -1;
+        return UA_STATUSCODE_BADDECODINGERROR;
+    }
+    UA_StatusCode retval = allocArray(noElements, p, dataType);
+    if(retval != UA_STATUSCODE_GOOD || *noElements <= 0)
+        return retval;
+    UA_DecodeFrame *frame = pushFrame(stream, dataType, *p);
+    frame->kind = UA_DECODEFRAME_ARRAY;
+    frame->count = *noElements;
+    return UA_STATUSCODE_GOOD;
+}
+
+/* The string content is copied as it arrives */
+static UA_StatusCode decodeStringStep(UA_DecodeStream *stream, UA_DecodeFrame *frame) {
+    UA_String *s = (UA_String*)frame->ptr;
+    if(frame->step == 0) {
+        UA_Int32 length;
+        UA_StatusCode retval = decodeWhole(stream, &length, &UA_TYPES[UA_TYPES_INT32]);
+        if(retval != UA_STATUSCODE_GOOD || stream->waiting)
+            return retval;
+        if(length <= 0) {
+            s->length = length == 0 ? 0 : -1;
+            stream->depth--;
+            return UA_STATUSCODE_GOOD;
+        }
+        if((size_t)length > remainingMessage(stream))
+            return UA_STATUSCODE_BADDECODINGERROR; // do not allocate before the content arrives
+        if(!(s->data = UA_malloc(length)))
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        s->length = length;
+        frame->step = 1;
+    }
+    size_t available = (size_t)stream->src->length - stream->offset;
+    size_t missing = (size_t)(s->length - frame->count);
+    size_t n = available < missing ? available : missing;
+    UA_memcpy(&s->data[frame->count], &stream->src->data[stream->offset], n);
+    stream->offset += n;
+    frame->count += (UA_Int32)n;
+    if(frame->count < s->length)
+        stream->waiting = UA_TRUE;
+    else
+        stream->depth--;
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Arrays and scalar strings in a variant are decoded as they arrive. The
+   remaining scalars are small and decoded as a whole. */
+static UA_StatusCode decodeVariantStep(UA_DecodeStream *stream, UA_DecodeFrame *frame) {
+    UA_Variant *v = (UA_Variant*)frame->ptr;
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    switch(frame->step) {
+    case 0: {
+        if(stream->offset >= (size_t)stream->src->length) {
+            stream->waiting = UA_TRUE;
+            return UA_STATUSCODE_GOOD;
+        }
+        UA_Byte encodingByte = stream->src->data[stream->offset];
+        UA_Byte builtinId = encodingByte & UA_VARIANT_ENCODINGMASKTYPE_TYPEID_MASK;
+        if(builtinId >= sizeof(builtinTypeIndex) / sizeof(UA_UInt16) ||
+           builtinTypeIndex[builtinId] >= UA_TYPES_COUNT)
+            return UA_STATUSCODE_BADDECODINGERROR;
+        const UA_DataType *dataType = &UA_TYPES[builtinTypeIndex[builtinId]];
+        UA_Boolean isString = (dataType == &UA_TYPES[UA_TYPES_STRING] ||
+                               dataType == &UA_TYPES[UA_TYPES_BYTESTRING] ||
+                               dataType == &UA_TYPES[UA_TYPES_XMLELEMENT]);
+        if(!(encodingByte & UA_VARIANT_ENCODINGMASKTYPE_ARRAY) && !isString) {
+            retval = decodeWhole(stream, v, &UA_TYPES[UA_TYPES_VARIANT]);
+            if(retval == UA_STATUSCODE_GOOD && !stream->waiting)
+                stream->depth--;
+            return retval;
+        }
+        stream->offset++;
+        v->type = dataType;
+        frame->count = encodingByte; // remember the mask for the later steps
+        if(!(encodingByte & UA_VARIANT_ENCODINGMASKTYPE_ARRAY)) {
+            v->arrayLength = 1;
+            frame->step = 2;
+            return pushArray(stream, &v->arrayLength, &v->dataPtr, dataType);
+        }
+        frame->step = 1;
+    }
+    // fall through
+    case 1:
+        retval = decodeWhole(stream, &v->arrayLength, &UA_TYPES[UA_TYPES_INT32]);
+        if(retval != UA_STATUSCODE_GOOD || stream->waiting)
+            return retval;
+        frame->step = 2;
+        return pushArray(stream, &v->arrayLength, &v->dataPtr, v->type);
+    case 2:
+        if(!(frame->count & UA_VARIANT_ENCODINGMASKTYPE_DIMENSIONS)) {
+            stream->depth--;
+            return UA_STATUSCODE_GOOD;
+        }
+        retval = decodeWhole(stream, &v->arrayDimensionsSize, &UA_TYPES[UA_TYPES_INT32]);
+        if(retval != UA_STATUSCODE_GOOD || stream->waiting)
+            return retval;
+        stream->depth--;
+        return pushArray(stream, &v->arrayDimensionsSize, (void**)&v->arrayDimensions,
+                         &UA_TYPES[UA_TYPES_INT32]);
+    default:
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+}
+
+/* The variant in a datavalue is decoded as it arrives */
+static UA_StatusCode decodeDataValueStep(UA_DecodeStream *stream, UA_DecodeFrame *frame) {
+    UA_DataValue *dv = (UA_DataValue*)frame->ptr;
+    if(frame->step == 0) {
+        UA_StatusCode retval = decodeWhole(stream, dv, &UA_TYPES[UA_TYPES_BYTE]);
+        if(retval != UA_STATUSCODE_GOOD || stream->waiting)
+            return retval;
+        frame->step = 1;
+        if(dv->hasVariant) {
+            pushFrame(stream, &UA_TYPES[UA_TYPES_VARIANT], &dv->value);
+            return UA_STATUSCODE_GOOD;
+        }
+    }
+    // the remaining fields are decoded together once they are complete
+    size_t size = 0;
+    if(dv->hasStatus)
+        size += sizeof(UA_StatusCode);
+    if(dv->hasSourceTimestamp)
+        size += sizeof(UA_DateTime);
+    if(dv->hasSourcePicoseconds)
+        size += sizeof(UA_Int16);
+    if(dv->hasServerTimestamp)
+        size += sizeof(UA_DateTime);
+    if(dv->hasServerPicoseconds)
+        size += sizeof(UA_Int16);
+    if(stream->offset + size > (size_t)stream->src->length) {
+        stream->waiting = UA_TRUE;
+        return UA_STATUSCODE_GOOD;
+    }
+    if(dv->hasStatus)
+        UA_StatusCode_decodeBinary(stream->src, &stream->offset, &dv->status);
+    if(dv->hasSourceTimestamp)
+        UA_DateTime_decodeBinary(stream->src, &stream->offset, &dv->sourceTimestamp);
+    if(dv->hasSourcePicoseconds) {
+        UA_Int16_decodeBinary(stream->src, &stream->offset, &dv->sourcePicoseconds);
+        if(dv->sourcePicoseconds > MAX_PICO_SECONDS)
+            dv->sourcePicoseconds = MAX_PICO_SECONDS;
+    }
+    if(dv->hasServerTimestamp)
+        UA_DateTime_decodeBinary(stream->src, &stream->offset, &dv->serverTimestamp);
+    if(dv->hasServerPicoseconds) {
+        UA_Int16_decodeBinary(stream->src, &stream->offset, &dv->serverPicoseconds);
+        if(dv->serverPicoseconds > MAX_PICO_SECONDS)
+            dv->serverPicoseconds = MAX_PICO_SECONDS;
+    }
+    stream->depth--;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode decodeStructureStep(UA_DecodeStream *stream, UA_DecodeFrame *frame) {
+    const UA_DataType *dataType = frame->dataType;
+    if(frame->step >= dataType->membersSize) {
+        stream->depth--;
+        return UA_STATUSCODE_GOOD;
+    }
+    const UA_DataTypeMember *member = &dataType->members[frame->step];
+    const UA_DataType *memberType;
+    if(member->namespaceZero)
+        memberType = &UA_TYPES[member->memberTypeIndex];
+    else
+        memberType = dataType - dataType->typeIndex + member->memberTypeIndex;
+
+    if(!member->isArray) {
+        void *p = (void*)(frame->ptr + member->padding);
+        frame->ptr += member->padding + memberType->memSize;
+        frame->step++;
+        pushFrame(stream, memberType, p);
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_Int32 *noElements = (UA_Int32*)(frame->ptr + (member->padding >> 3));
+    UA_StatusCode retval = decodeWhole(stream, noElements, &UA_TYPES[UA_TYPES_INT32]);
+    if(retval != UA_STATUSCODE_GOOD || stream->waiting)
+        return retval;
+    void **array = (void**)((uintptr_t)noElements + sizeof(UA_Int32) + (member->padding & 0x07));
+    frame->ptr = (uintptr_t)array + sizeof(void*);
+    frame->step++;
+    return pushArray(stream, noElements, array, memberType);
+}
+
+static UA_StatusCode decodeStep(UA_DecodeStream *stream) {
+    UA_DecodeFrame *frame = &stream->frames[stream->depth - 1];
+    if(frame->kind == UA_DECODEFRAME_ARRAY) {
+        if(frame->step >= frame->count) {
+            stream->depth--;
+            return UA_STATUSCODE_GOOD;
+        }
+        void *p = (void*)frame->ptr;
+        frame->ptr += frame->dataType->memSize;
+        frame->step++;
+        pushFrame(stream, frame->dataType, p);
+        return UA_STATUSCODE_GOOD;
+    }
+
+    const UA_DataType *dataType = frame->dataType;
+    UA_Boolean builtin = dataType->namespaceZero && dataType->typeIndex <= UA_TYPES_XMLELEMENT;
+    // values that do not need to be split up. the stack depth is limited.
+    if(dataType->fixedSize || stream->depth >= UA_DECODESTREAM_MAXDEPTH - 1 ||
+       (builtin && dataType->typeIndex != UA_TYPES_STRING &&
+        dataType->typeIndex != UA_TYPES_BYTESTRING && dataType->typeIndex != UA_TYPES_XMLELEMENT &&
+        dataType->typeIndex != UA_TYPES_VARIANT && dataType->typeIndex != UA_TYPES_DATAVALUE)) {
+        UA_StatusCode retval = decodeWhole(stream, (void*)frame->ptr, dataType);
+        if(retval == UA_STATUSCODE_GOOD && !stream->waiting)
+            stream->depth--;
+        return retval;
+    }
+
+    if(!builtin)
+        return decodeStructureStep(stream, frame);
+    switch(dataType->typeIndex) {
+    case UA_TYPES_VARIANT:
+        return decodeVariantStep(stream, frame);
+    case UA_TYPES_DATAVALUE:
+        return decodeDataValueStep(stream, frame);
+    default:
+        return decodeStringStep(stream, frame);
+    }
+}
+
+UA_StatusCode UA_DecodeStream_decode(UA_DecodeStream *stream, const UA_ByteString *src, size_t *offset,
+                                     UA_Boolean *finished) {
+    *finished = UA_FALSE;
+    if(stream->depth == 0)
+        return UA_STATUSCODE_BADINTERNALERROR;
+
+    // continue on the bytes that were left over from the last buffer
+    stream->received += (size_t)src->length - *offset;
+    size_t pendingLength = stream->pending.length > 0 ? (size_t)stream->pending.length : 0;
+    if(pendingLength > 0) {
+        size_t n = (size_t)src->length - *offset;
+        UA_Byte *data = UA_realloc(stream->pending.data, pendingLength + n);
+        if(!data)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        UA_memcpy(&data[pendingLength], &src->data[*offset], n);
+        stream->pending.data = data;
+        stream->pending.length = (UA_Int32)(pendingLength + n);
+        stream->src = &stream->pending;
+        stream->offset = 0;
+    } else {
+        stream->src = src;
+        stream->offset = *offset;
+    }
+
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    stream->waiting = UA_FALSE;
+    while(stream->depth > 0 && !stream->waiting && retval == UA_STATUSCODE_GOOD)
+        retval = decodeStep(stream);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    if(stream->waiting) {
+        if(stream->received >= stream->maxMessageSize)
+            return UA_STATUSCODE_BADDECODINGERROR; // the message cannot continue
+        // keep the beginning of the value that continues in the next buffer
+        size_t rest = (size_t)stream->src->length - stream->offset;
+        if(stream->src == &stream->pending) {
+            memmove(stream->pending.data, &stream->pending.data[stream->offset], rest);
+        } else if(rest > 0) {
+            if(!(stream->pending.data = UA_malloc(rest)))
+                return UA_STATUSCODE_BADOUTOFMEMORY;
+            UA_memcpy(stream->pending.data, &src->data[stream->offset], rest);
+        }
+        stream->pending.length = (UA_Int32)rest;
+        if(rest == 0) {
+            UA_ByteString_deleteMembers(&stream->pending);
+            UA_ByteString_init(&stream->pending);
+        }
+        *offset = (size_t)src->length;
+        return UA_STATUSCODE_GOOD;
+    }
+
+    // the value is complete. point behind it in the last buffer.
+    if(stream->src == &stream->pending) {
+        if(stream->offset < pendingLength)
+            return UA_STATUSCODE_BADDECODINGERROR;
+        *offset += stream->offset - pendingLength;
+        UA_ByteString_deleteMembers(&stream->pending);
+        UA_ByteString_init(&stream->pending);
+    } else
+        *offset = stream->offset;
+    *finished = UA_TRUE;
+    return UA_STATUSCODE_GOOD;
+}
@@ -65,12 +65,102 @@ size_t UA_calcSizeBinary(const void *p, const UA_DataType *dataType);
 UA_StatusCode UA_encodeBinary(const void *src, const UA_DataType *dataType, UA_ByteString *dst, size_t *offset);
 UA_StatusCode UA_decodeBinary(const UA_ByteString *src, size_t *offset, void *dst, const UA_DataType *dataType);
 
+/**
+ * Encodes in a single pass into a buffer that is enlarged on the heap when it
+ * runs full. The size does not need to be computed beforehand. The buffer may
+ * initially point to memory that is not on the heap (e.g. on the stack) if
+ * *dstOnHeap is false. The content is then moved to the heap when more room
+ * is needed and *dstOnHeap is set. A buffer on the heap is freed by the caller.
+ */
+UA_StatusCode UA_encodeBinaryGrowing(const void *src, const UA_DataType *dataType, UA_ByteString *dst,
+                                     size_t *offset, UA_Boolean *dstOnHeap);
+
+/**
+ * Decodes without copying the contents of strings, bytestrings and xmlelements.
+ * They point into the source bytestring instead, so the source needs to stay
+ * alive and unchanged while the decoded value is used. Values decoded this way
+ * are deleted with UA_deleteMembersBorrowed and must not be handed to the
+ * normal deleteMembers. Copies made with the _copy functions are independent
+ * of the source.
+ */
+UA_StatusCode UA_decodeBinaryBorrowed(const UA_ByteString *src, size_t *offset, void *dst,
+                                      const UA_DataType *dataType);
+void UA_deleteMembersBorrowed(void *p, const UA_DataType *dataType);
+
+/**
+ * Registers the types of a generated type array (e.g. of a companion
+ * specification) for the decoding of variants. A variant that holds an
+ * ExtensionObject with the binary encoding id of a known type is decoded
+ * directly into the typed structure. The types of namespace zero are known
+ * from the start. Registration is not thread-safe and shall be done before
+ * decoding starts.
+ */
+UA_StatusCode UA_registerDataTypes(const UA_DataType *types, UA_Int32 typesSize);
+
+/** Returns the type with the given binary encoding id or null if it is unknown. */
+const UA_DataType * UA_findDataTypeByBinaryEncodingId(const UA_NodeId *encodingId);
+
 size_t UA_Array_calcSizeBinary(const void *p, UA_Int32 noElements, const UA_DataType *dataType);
 UA_StatusCode UA_Array_encodeBinary(const void *src, UA_Int32 noElements, const UA_DataType *dataType,
                                     UA_ByteString *dst, size_t *offset);
 UA_StatusCode UA_Array_decodeBinary(const UA_ByteString *src, size_t *offset, UA_Int32 noElements,
                                     void **dst, const UA_DataType *dataType);
 
+/**
+ * Decodes a value from a sequence of buffers (e.g. the bodies of message
+ * chunks) that arrive one after another. The decoder keeps its position in
+ * the nested value between the buffers, so they do not need to be joined
+ * before decoding. The content of strings and bytestrings is copied into the
+ * decoded value as it arrives. A value that is split at a buffer boundary and
+ * is not decoded piecewise (e.g. a nodeid) is kept until the next buffer
+ * completes it.
+ *
+ * The message is limited to maxMessageSize bytes. Strings and arrays that are
+ * longer than the rest of the message are rejected before they are allocated.
+ * A value that does not decode although it cannot continue in the next buffer
+ * is rejected as well. So the bytes kept between the buffers are bounded.
+ */
+
+#define UA_DECODESTREAM_MAXDEPTH 16
+
+typedef struct {
+    const UA_DataType *dataType;
+    uintptr_t ptr; // the decoded value, or the next member or element
+    UA_Int32 step; // the next member, element or field
+    UA_Int32 count; // the number of elements, the bytes of a string
+    UA_Byte kind;
+} UA_DecodeFrame;
+
+typedef struct {
+    void *dst;
+    const UA_DataType *dataType;
+    UA_DecodeFrame frames[UA_DECODESTREAM_MAXDEPTH];
+    UA_Int32 depth;
+    UA_ByteString pending; // the start of a value that continues in the next buffer
+    const UA_ByteString *src;
+    size_t offset;
+    UA_Boolean waiting;
+    size_t maxMessageSize;
+    size_t received; // the bytes of all buffers so far
+} UA_DecodeStream;
+
+/** Prepares decoding into dst. dst is initialized. The message (starting at
+    the offset of the first buffer) has at most maxMessageSize bytes. */
+void UA_DecodeStream_init(UA_DecodeStream *stream, void *dst, const UA_DataType *dataType,
+                          size_t maxMessageSize);
+
+/**
+ * Continues decoding with the next buffer, starting at offset. When the value
+ * is complete, finished is set and offset points behind the value. Otherwise
+ * the entire buffer was consumed and the decoder waits for the next one. If
+ * the value is not finished after the last buffer, the message was malformed.
+ */
+UA_StatusCode UA_DecodeStream_decode(UA_DecodeStream *stream, const UA_ByteString *src, size_t *offset,
+                                     UA_Boolean *finished);
+
+/** Frees the (partially) decoded value and the internal buffer */
+void UA_DecodeStream_deleteMembers(UA_DecodeStream *stream);
+
 /// @} /* end of group */
 
 #endif /* UA_TYPES_ENCODING_BINARY_H_ */
@@ -37,4 +37,18 @@
 # define UA_alloca(SIZE) alloca(SIZE)
 #endif
 
+#ifdef UA_MULTITHREADING
+# ifdef _MSC_VER
+#  define UA_THREAD_LOCAL __declspec(thread)
+# else
+#  define UA_THREAD_LOCAL __thread
+# endif
+#else
+# define UA_THREAD_LOCAL
+#endif
+
+/* Set while a borrowing decode or delete is in progress in the current thread.
+   The string contents then point into the decoded message and are not freed. */
+extern UA_THREAD_LOCAL UA_Boolean UA_stringsBorrowed;
+
 #endif /* UA_UTIL_H_ */
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_types.h"
+#include "ua_connection.h"
+#include "ua_util.h"
+#include "check.h"
+
+START_TEST(takeReturnsRequestedLength) {
+	UA_BufferPool *pool = UA_BufferPool_new();
+	UA_ByteString buf;
+	ck_assert_int_eq(UA_BufferPool_take(pool, &buf, 100), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(buf.length, 100);
+	UA_memset(buf.data, 0xff, buf.length);
+	UA_BufferPool_release(&buf);
+	ck_assert_ptr_eq(buf.data, UA_NULL);
+	UA_BufferPool_delete(pool);
+}
+END_TEST
+
+START_TEST(releasedBufferIsReusedInSizeClass) {
+	UA_BufferPool *pool = UA_BufferPool_new();
+	UA_ByteString buf;
+	UA_BufferPool_take(pool, &buf, 1000);
+	UA_Byte *data = buf.data;
+	UA_BufferPool_release(&buf);
+
+	// 1000 and 1024 bytes are in the same size class
+	UA_BufferPool_take(pool, &buf, 1024);
+	ck_assert_ptr_eq(buf.data, data);
+	UA_BufferPool_release(&buf);
+
+	// a larger size class does not get the buffer
+	UA_BufferPool_take(pool, &buf, 1025);
+	ck_assert_ptr_ne(buf.data, data);
+	UA_BufferPool_release(&buf);
+	UA_BufferPool_delete(pool);
+}
+END_TEST
+
+START_TEST(largeAndUnpooledBuffers) {
+	UA_BufferPool *pool = UA_BufferPool_new();
+	UA_ByteString buf;
+	ck_assert_int_eq(UA_BufferPool_take(pool, &buf, UA_BUFFERPOOL_MAXSIZE + 1), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(buf.length, UA_BUFFERPOOL_MAXSIZE + 1);
+	buf.data[UA_BUFFERPOOL_MAXSIZE] = 1;
+	UA_BufferPool_release(&buf);
+	UA_BufferPool_delete(pool);
+
+	// without a pool, the buffer is freed on release
+	ck_assert_int_eq(UA_BufferPool_take(UA_NULL, &buf, 10), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(buf.length, 10);
+	UA_BufferPool_release(&buf);
+}
+END_TEST
+
+START_TEST(manyBuffersInFlight) {
+	UA_BufferPool *pool = UA_BufferPool_new();
+	UA_ByteString bufs[200];
+	for(int round = 0; round < 3; round++) {
+		for(int i = 0; i < 200; i++) {
+			ck_assert_int_eq(UA_BufferPool_take(pool, &bufs[i], (size_t)(i * 300)), UA_STATUSCODE_GOOD);
+			UA_memset(bufs[i].data, i, bufs[i].length);
+		}
+		for(int i = 0; i < 200; i++)
+			UA_BufferPool_release(&bufs[i]);
+	}
+	UA_BufferPool_delete(pool);
+}
+END_TEST
+
+static Suite * testSuite_BufferPool(void) {
+	Suite *s = suite_create("UA_BufferPool");
+	TCase *tc_pool = tcase_create("Pool");
+	tcase_add_test(tc_pool, takeReturnsRequestedLength);
+	tcase_add_test(tc_pool, releasedBufferIsReusedInSizeClass);
+	tcase_add_test(tc_pool, largeAndUnpooledBuffers);
+	tcase_add_test(tc_pool, manyBuffersInFlight);
+	suite_add_tcase(s, tc_pool);
+	return s;
+}
+
+int main(void) {
+	int number_failed = 0;
+	Suite *s = testSuite_BufferPool();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed += srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
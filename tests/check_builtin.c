@@ -668,6 +668,56 @@ START_TEST(UA_NodeId_decodeStringShallAllocateMemory) {
 }
 END_TEST
 
+START_TEST(UA_NodeId_decodeBorrowedStringShallPointIntoSource) {
+	// given
+	size_t pos = 0;
+	UA_Byte data[] = { UA_NODEIDTYPE_STRING, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 'P', 'L', 'T' };
+	UA_ByteString src = { 10, data };
+	UA_NodeId dst;
+	// when
+	UA_StatusCode retval = UA_decodeBinaryBorrowed(&src, &pos, &dst, &UA_TYPES[UA_TYPES_NODEID]);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(pos, 10);
+	ck_assert_int_eq(dst.identifierType, UA_NODEIDTYPE_STRING);
+	ck_assert_int_eq(dst.identifier.string.length, 3);
+	ck_assert_ptr_eq(dst.identifier.string.data, &data[7]);
+	// finally
+	UA_deleteMembersBorrowed(&dst, &UA_TYPES[UA_TYPES_NODEID]);
+}
+END_TEST
+
+START_TEST(UA_ReadValueId_copyOfBorrowedDecodeShallOutliveSource) {
+	// given
+	UA_ReadValueId rvi;
+	UA_ReadValueId_init(&rvi);
+	rvi.nodeId.namespaceIndex = 1;
+	rvi.nodeId.identifierType = UA_NODEIDTYPE_STRING;
+	UA_String_copycstring("the.answer", &rvi.nodeId.identifier.string);
+	rvi.attributeId = 13;
+	UA_String_copycstring("1:2", &rvi.indexRange);
+	UA_ByteString src;
+	UA_ByteString_newMembers(&src, UA_ReadValueId_calcSizeBinary(&rvi));
+	size_t pos = 0;
+	UA_ReadValueId_encodeBinary(&rvi, &src, &pos);
+	UA_ReadValueId dst, dstCopy;
+	// when
+	pos = 0;
+	UA_StatusCode retval = UA_decodeBinaryBorrowed(&src, &pos, &dst, &UA_TYPES[UA_TYPES_READVALUEID]);
+	retval |= UA_ReadValueId_copy(&dst, &dstCopy);
+	UA_deleteMembersBorrowed(&dst, &UA_TYPES[UA_TYPES_READVALUEID]);
+	UA_ByteString_deleteMembers(&src);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(pos, UA_ReadValueId_calcSizeBinary(&rvi));
+	ck_assert(UA_NodeId_equal(&dstCopy.nodeId, &rvi.nodeId));
+	ck_assert(UA_String_equal(&dstCopy.indexRange, &rvi.indexRange));
+	// finally
+	UA_ReadValueId_deleteMembers(&rvi);
+	UA_ReadValueId_deleteMembers(&dstCopy);
+}
+END_TEST
+
 START_TEST(UA_Variant_decodeWithOutArrayFlagSetShallSetVTAndAllocateMemoryForArray) {
 	// given
 	size_t pos = 0;
@@ -1127,6 +1177,361 @@ START_TEST(UA_DataValue_encodeShallWorkOnExampleWithoutVariant) {
 }
 END_TEST
 
+START_TEST(UA_Variant_encodeNumericArrayShallEncodeLittleEndianAndDecode) {
+	// given
+	UA_Int16 src[3] = { 1, -2, 0x0304 };
+	UA_Variant v;
+	UA_Variant_init(&v);
+	v.type = &UA_TYPES[UA_TYPES_INT16];
+	v.arrayLength = 3;
+	v.dataPtr = src;
+	v.storageType = UA_VARIANT_DATA_NODELETE;
+	UA_Byte data[] = { 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55 };
+	UA_ByteString buf = { 11, data };
+	size_t pos = 0;
+	// when
+	UA_StatusCode retval = UA_Variant_encodeBinary(&v, &buf, &pos);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(pos, 1 + 4 + 3 * 2);
+	ck_assert_int_eq(data[5], 0x01);
+	ck_assert_int_eq(data[6], 0x00);
+	ck_assert_int_eq(data[7], 0xFE);
+	ck_assert_int_eq(data[8], 0xFF);
+	ck_assert_int_eq(data[9], 0x04);
+	ck_assert_int_eq(data[10], 0x03);
+	ck_assert_int_eq(data[11], 0x55);
+	// when
+	UA_Variant dst;
+	pos = 0;
+	retval = UA_Variant_decodeBinary(&buf, &pos, &dst);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(dst.arrayLength, 3);
+	ck_assert_int_eq(((UA_Int16*)dst.dataPtr)[1], -2);
+	ck_assert_int_eq(((UA_Int16*)dst.dataPtr)[2], 0x0304);
+	// finally
+	UA_Variant_deleteMembers(&dst);
+}
+END_TEST
+
+START_TEST(UA_Variant_decodeShallDecodeKnownStructureIntoTypedValue) {
+	// given
+	UA_ReadValueId src;
+	UA_ReadValueId_init(&src);
+	src.nodeId = UA_NODEID_STATIC(1, 4711);
+	src.attributeId = 13;
+	UA_Variant v;
+	UA_Variant_init(&v);
+	v.type = &UA_TYPES[UA_TYPES_READVALUEID];
+	v.arrayLength = 1;
+	v.dataPtr = &src;
+	v.storageType = UA_VARIANT_DATA_NODELETE;
+	UA_ByteString buf;
+	UA_ByteString_newMembers(&buf, UA_Variant_calcSizeBinary(&v));
+	size_t pos = 0;
+	UA_StatusCode retval = UA_Variant_encodeBinary(&v, &buf, &pos);
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	// when
+	UA_Variant dst;
+	pos = 0;
+	retval = UA_Variant_decodeBinary(&buf, &pos, &dst);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(pos, buf.length);
+	ck_assert_ptr_eq(dst.type, &UA_TYPES[UA_TYPES_READVALUEID]);
+	ck_assert_int_eq(dst.arrayLength, 1);
+	ck_assert_int_eq(((UA_ReadValueId*)dst.dataPtr)->nodeId.namespaceIndex, 1);
+	ck_assert_int_eq(((UA_ReadValueId*)dst.dataPtr)->nodeId.identifier.numeric, 4711);
+	ck_assert_int_eq(((UA_ReadValueId*)dst.dataPtr)->attributeId, 13);
+	// finally
+	UA_Variant_deleteMembers(&dst);
+	UA_ByteString_deleteMembers(&buf);
+}
+END_TEST
+
+START_TEST(UA_Variant_decodeShallKeepUnknownExtensionObject) {
+	// given
+	UA_Byte data[] = { 0x16, // variant with an extensionobject
+	                   0x01, 0x00, 0x39, 0x30, // nodeid 0:12345
+	                   0x01, 0x02, 0x00, 0x00, 0x00, 0xAB, 0xCD }; // body of two bytes
+	UA_ByteString buf = { sizeof(data), data };
+	size_t pos = 0;
+	UA_Variant dst;
+	// when
+	UA_StatusCode retval = UA_Variant_decodeBinary(&buf, &pos, &dst);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(pos, sizeof(data));
+	ck_assert_ptr_eq(dst.type, &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]);
+	UA_ExtensionObject *eo = dst.dataPtr;
+	ck_assert_int_eq(eo->typeId.identifier.numeric, 12345);
+	ck_assert_int_eq(eo->body.length, 2);
+	ck_assert_int_eq(eo->body.data[1], 0xCD);
+	// finally
+	UA_Variant_deleteMembers(&dst);
+}
+END_TEST
+
+START_TEST(UA_findDataTypeByBinaryEncodingIdShallFindRegisteredTypes) {
+	// given
+	UA_NodeId encodingId = UA_NODEID_STATIC(0, UA_TYPES[UA_TYPES_READVALUEID].typeId.identifier.numeric +
+	                                         UA_ENCODINGOFFSET_BINARY);
+	UA_DataType custom = UA_TYPES[UA_TYPES_READVALUEID];
+	custom.typeId = UA_NODEID_STATIC(2, 5001);
+	custom.namespaceZero = UA_FALSE;
+	UA_NodeId customEncodingId = UA_NODEID_STATIC(2, 5001 + UA_ENCODINGOFFSET_BINARY);
+	// when, then
+	ck_assert_ptr_eq(UA_findDataTypeByBinaryEncodingId(&encodingId), &UA_TYPES[UA_TYPES_READVALUEID]);
+	ck_assert_ptr_eq(UA_findDataTypeByBinaryEncodingId(&customEncodingId), UA_NULL);
+	ck_assert_int_eq(UA_registerDataTypes(&custom, 1), UA_STATUSCODE_GOOD);
+	ck_assert_ptr_eq(UA_findDataTypeByBinaryEncodingId(&customEncodingId), &custom);
+	ck_assert_ptr_eq(UA_findDataTypeByBinaryEncodingId(&encodingId), &UA_TYPES[UA_TYPES_READVALUEID]);
+}
+END_TEST
+
+START_TEST(UA_encodeBinaryGrowingShallMoveToHeapAndEncodeOnce) {
+	// given
+	UA_ReadResponse src;
+	UA_ReadResponse_init(&src);
+	src.resultsSize = 100;
+	src.results = UA_Array_new(&UA_TYPES[UA_TYPES_DATAVALUE], src.resultsSize);
+	for(UA_Int32 i = 0; i < src.resultsSize; i++) {
+		src.results[i].hasVariant = UA_TRUE;
+		UA_Variant_copySetValue(&src.results[i].value, &i, &UA_TYPES[UA_TYPES_INT32]);
+	}
+	UA_Byte data[16];
+	UA_ByteString buf = { sizeof(data), data };
+	UA_Boolean onHeap = UA_FALSE;
+	size_t pos = 0;
+	// when
+	UA_StatusCode retval = UA_encodeBinaryGrowing(&src, &UA_TYPES[UA_TYPES_READRESPONSE], &buf, &pos, &onHeap);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(onHeap, UA_TRUE);
+	ck_assert_int_eq(pos, UA_ReadResponse_calcSizeBinary(&src));
+	ck_assert_int_ge(buf.length, pos);
+	UA_ReadResponse dst;
+	size_t decodePos = 0;
+	retval = UA_ReadResponse_decodeBinary(&buf, &decodePos, &dst);
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(decodePos, pos);
+	ck_assert_int_eq(dst.resultsSize, 100);
+	ck_assert_int_eq(*(UA_Int32*)dst.results[99].value.dataPtr, 99);
+	// finally
+	UA_ReadResponse_deleteMembers(&dst);
+	UA_ReadResponse_deleteMembers(&src);
+	UA_free(buf.data);
+}
+END_TEST
+
+START_TEST(UA_encodeBinaryShallNotGrowOutsideTheGrowingMode) {
+	// given
+	UA_ReadValueId src;
+	UA_ReadValueId_init(&src);
+	UA_Byte data[4];
+	UA_ByteString buf = { sizeof(data), data };
+	size_t pos = 0;
+	// when
+	UA_StatusCode retval = UA_encodeBinary(&src, &UA_TYPES[UA_TYPES_READVALUEID], &buf, &pos);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_BADENCODINGERROR);
+	ck_assert_ptr_eq(buf.data, data);
+	ck_assert_int_eq(buf.length, 4);
+}
+END_TEST
+
+static void buildWriteRequest(UA_WriteRequest *req) {
+	UA_WriteRequest_init(req);
+	req->requestHeader.timestamp = 12345;
+	req->nodesToWriteSize = 3;
+	req->nodesToWrite = UA_Array_new(&UA_TYPES[UA_TYPES_WRITEVALUE], 3);
+	UA_ByteString body;
+	UA_ByteString_newMembers(&body, 3000);
+	for(UA_Int32 i = 0; i < body.length; i++)
+		body.data[i] = (UA_Byte)i;
+	for(UA_Int32 i = 0; i < 3; i++) {
+		UA_WriteValue *wv = &req->nodesToWrite[i];
+		wv->nodeId = UA_NODEID_STATIC(1, 100 + i);
+		wv->attributeId = 13;
+		UA_String_copycstring("index", &wv->indexRange);
+		wv->value.hasVariant = UA_TRUE;
+		wv->value.hasSourceTimestamp = UA_TRUE;
+		wv->value.sourceTimestamp = 4711 + i;
+		wv->value.hasServerPicoseconds = UA_TRUE;
+		wv->value.serverPicoseconds = 10;
+	}
+	UA_Variant_copySetValue(&req->nodesToWrite[0].value.value, &body, &UA_TYPES[UA_TYPES_BYTESTRING]);
+	UA_Variant_copySetArray(&req->nodesToWrite[1].value.value, &body, 1, &UA_TYPES[UA_TYPES_BYTESTRING]);
+	UA_Int32 ints[5] = {1, 2, 3, 4, 5};
+	UA_Variant_copySetArray(&req->nodesToWrite[2].value.value, ints, 5, &UA_TYPES[UA_TYPES_INT32]);
+	UA_ByteString_deleteMembers(&body);
+}
+
+START_TEST(UA_DecodeStream_shallDecodeAcrossBufferBoundaries) {
+	// given
+	UA_WriteRequest src;
+	buildWriteRequest(&src);
+	size_t size = UA_WriteRequest_calcSizeBinary(&src);
+	UA_ByteString msg;
+	UA_ByteString_newMembers(&msg, size + 7); // some bytes of the next message follow
+	size_t pos = 0;
+	UA_WriteRequest_encodeBinary(&src, &msg, &pos);
+	UA_memset(&msg.data[size], 0xAA, 7);
+	size_t chunkSizes[] = {1, 2, 3, 7, 64, 1000, 4096, size + 7};
+	for(size_t c = 0; c < sizeof(chunkSizes) / sizeof(size_t); c++) {
+		// when
+		UA_WriteRequest dst;
+		UA_DecodeStream stream;
+		UA_DecodeStream_init(&stream, &dst, &UA_TYPES[UA_TYPES_WRITEREQUEST], size);
+		UA_Boolean finished = UA_FALSE;
+		size_t start = 0;
+		size_t offset = 0;
+		UA_ByteString chunk;
+		while(!finished && start < (size_t)msg.length) {
+			size_t length = chunkSizes[c];
+			if(start + length > (size_t)msg.length)
+				length = msg.length - start;
+			chunk = (UA_ByteString){.length = length, .data = &msg.data[start]};
+			offset = 0;
+			UA_StatusCode retval = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+			ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+			start += length;
+		}
+		// then
+		ck_assert(finished);
+		ck_assert_int_eq(start - chunk.length + offset, size);
+		ck_assert_int_le(stream.pending.length, 0);
+		UA_ByteString reencoded;
+		UA_ByteString_newMembers(&reencoded, UA_WriteRequest_calcSizeBinary(&dst));
+		pos = 0;
+		UA_WriteRequest_encodeBinary(&dst, &reencoded, &pos);
+		ck_assert_int_eq(reencoded.length, size);
+		ck_assert_int_eq(memcmp(reencoded.data, msg.data, size), 0);
+		ck_assert_int_eq(dst.nodesToWrite[2].value.sourceTimestamp, 4713);
+		ck_assert_int_eq(((UA_ByteString*)dst.nodesToWrite[0].value.value.dataPtr)->data[2999],
+		                 (UA_Byte)2999);
+		// finally
+		UA_ByteString_deleteMembers(&reencoded);
+		UA_DecodeStream_deleteMembers(&stream);
+	}
+	UA_ByteString_deleteMembers(&msg);
+	UA_WriteRequest_deleteMembers(&src);
+}
+END_TEST
+
+START_TEST(UA_DecodeStream_shallFreePartiallyDecodedValue) {
+	// given
+	UA_WriteRequest src;
+	buildWriteRequest(&src);
+	UA_ByteString msg;
+	UA_ByteString_newMembers(&msg, UA_WriteRequest_calcSizeBinary(&src));
+	size_t pos = 0;
+	UA_WriteRequest_encodeBinary(&src, &msg, &pos);
+	UA_WriteRequest dst;
+	UA_DecodeStream stream;
+	UA_DecodeStream_init(&stream, &dst, &UA_TYPES[UA_TYPES_WRITEREQUEST], msg.length);
+	// when
+	UA_ByteString chunk = {.length = msg.length / 2 + 3, .data = msg.data};
+	size_t offset = 0;
+	UA_Boolean finished;
+	UA_StatusCode retval = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+	ck_assert(!finished);
+	ck_assert_int_eq(offset, chunk.length);
+	// finally
+	UA_DecodeStream_deleteMembers(&stream);
+	UA_ByteString_deleteMembers(&msg);
+	UA_WriteRequest_deleteMembers(&src);
+}
+END_TEST
+
+START_TEST(UA_DecodeStream_shallRejectStringLongerThanMessage) {
+	// given
+	UA_Byte data[] = {0xFF, 0xFF, 0xFF, 0x7F, 'a', 'b'}; // length INT32_MAX
+	UA_ByteString chunk = {.length = sizeof(data), .data = data};
+	UA_String dst;
+	UA_DecodeStream stream;
+	UA_DecodeStream_init(&stream, &dst, &UA_TYPES[UA_TYPES_STRING], 1024);
+	// when
+	size_t offset = 0;
+	UA_Boolean finished;
+	UA_StatusCode retval = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_BADDECODINGERROR);
+	ck_assert_ptr_eq(dst.data, UA_NULL);
+	// finally
+	UA_DecodeStream_deleteMembers(&stream);
+}
+END_TEST
+
+START_TEST(UA_DecodeStream_shallRejectMalformedValueAtMessageEnd) {
+	// given
+	UA_Byte data[8];
+	UA_memset(data, 0x3F, sizeof(data)); // not a nodeid encoding
+	UA_ByteString chunk = {.length = sizeof(data), .data = data};
+	UA_NodeId dst;
+	UA_DecodeStream stream;
+	UA_DecodeStream_init(&stream, &dst, &UA_TYPES[UA_TYPES_NODEID], 16);
+	// when
+	size_t offset = 0;
+	UA_Boolean finished;
+	UA_StatusCode first = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+	offset = 0;
+	UA_StatusCode second = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+	// then
+	ck_assert_int_eq(first, UA_STATUSCODE_GOOD); // the message may continue
+	ck_assert_int_eq(second, UA_STATUSCODE_BADDECODINGERROR); // the message is complete
+	// finally
+	UA_DecodeStream_deleteMembers(&stream);
+}
+END_TEST
+
+START_TEST(UA_DecodeStream_shallRejectMessageAboveMaxSize) {
+	// given
+	UA_Byte data[4] = {0x08, 0x00, 0x00, 0x00}; // a string of 8 bytes
+	UA_Byte content[4] = {'a', 'b', 'c', 'd'};
+	UA_ByteString chunk = {.length = sizeof(data), .data = data};
+	UA_ByteString chunk2 = {.length = sizeof(content), .data = content};
+	UA_String dst;
+	UA_DecodeStream stream;
+	UA_DecodeStream_init(&stream, &dst, &UA_TYPES[UA_TYPES_STRING], 10);
+	// when
+	size_t offset = 0;
+	UA_Boolean finished;
+	UA_StatusCode retval = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_BADDECODINGERROR);
+	// when
+	UA_DecodeStream_deleteMembers(&stream);
+	UA_DecodeStream_init(&stream, &dst, &UA_TYPES[UA_TYPES_STRING], 12);
+	offset = 0;
+	UA_StatusCode first = UA_DecodeStream_decode(&stream, &chunk, &offset, &finished);
+	offset = 0;
+	UA_StatusCode second = UA_DecodeStream_decode(&stream, &chunk2, &offset, &finished);
+	// then
+	ck_assert_int_eq(first, UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(second, UA_STATUSCODE_GOOD);
+	ck_assert(!finished);
+	// finally
+	UA_DecodeStream_deleteMembers(&stream);
+}
+END_TEST
+
+START_TEST(UA_Array_encodeNumericArrayShallFailIfBufferTooSmall) {
+	// given
+	UA_Double src[2] = { 1.0, 2.0 };
+	UA_Byte data[4 + 2 * 8 - 1];
+	UA_ByteString buf = { sizeof(data), data };
+	size_t pos = 0;
+	// when
+	UA_StatusCode retval = UA_Array_encodeBinary(src, 2, &UA_TYPES[UA_TYPES_DOUBLE], &buf, &pos);
+	// then
+	ck_assert_int_eq(retval, UA_STATUSCODE_BADENCODINGERROR);
+}
+END_TEST
+
 START_TEST(UA_DataValue_encodeShallWorkOnExampleWithVariant) {
 	// given
 	UA_DataValue src;
@@ -1695,6 +2100,8 @@ static Suite *testSuite_builtin(void) {
 	tcase_add_test(tc_decode, UA_NodeId_decodeTwoByteShallReadTwoBytesAndSetNamespaceToZero);
 	tcase_add_test(tc_decode, UA_NodeId_decodeFourByteShallReadFourBytesAndRespectNamespace);
 	tcase_add_test(tc_decode, UA_NodeId_decodeStringShallAllocateMemory);
+	tcase_add_test(tc_decode, UA_NodeId_decodeBorrowedStringShallPointIntoSource);
+	tcase_add_test(tc_decode, UA_ReadValueId_copyOfBorrowedDecodeShallOutliveSource);
 	tcase_add_test(tc_decode, UA_Variant_decodeWithOutArrayFlagSetShallSetVTAndAllocateMemoryForArray);
 	tcase_add_test(tc_decode, UA_Variant_decodeWithArrayFlagSetShallSetVTAndAllocateMemoryForArray);
 	tcase_add_test(tc_decode, UA_Variant_decodeWithOutDeleteMembersShallFailInCheckMem);
@@ -1716,6 +2123,18 @@ static Suite *testSuite_builtin(void) {
 	tcase_add_test(tc_encode, UA_String_encodeShallWorkOnExample);
 	tcase_add_test(tc_encode, UA_DataValue_encodeShallWorkOnExampleWithoutVariant);
 	tcase_add_test(tc_encode, UA_DataValue_encodeShallWorkOnExampleWithVariant);
+	tcase_add_test(tc_encode, UA_Variant_encodeNumericArrayShallEncodeLittleEndianAndDecode);
+	tcase_add_test(tc_encode, UA_Array_encodeNumericArrayShallFailIfBufferTooSmall);
+	tcase_add_test(tc_encode, UA_DecodeStream_shallDecodeAcrossBufferBoundaries);
+	tcase_add_test(tc_encode, UA_DecodeStream_shallFreePartiallyDecodedValue);
+	tcase_add_test(tc_encode, UA_DecodeStream_shallRejectStringLongerThanMessage);
+	tcase_add_test(tc_encode, UA_DecodeStream_shallRejectMalformedValueAtMessageEnd);
+	tcase_add_test(tc_encode, UA_DecodeStream_shallRejectMessageAboveMaxSize);
+	tcase_add_test(tc_encode, UA_encodeBinaryGrowingShallMoveToHeapAndEncodeOnce);
+	tcase_add_test(tc_encode, UA_encodeBinaryShallNotGrowOutsideTheGrowingMode);
+	tcase_add_test(tc_encode, UA_Variant_decodeShallDecodeKnownStructureIntoTypedValue);
+	tcase_add_test(tc_encode, UA_Variant_decodeShallKeepUnknownExtensionObject);
+	tcase_add_test(tc_encode, UA_findDataTypeByBinaryEncodingIdShallFindRegisteredTypes);
 	tcase_add_test(tc_encode, UA_ExtensionObject_encodeDecodeShallWorkOnExtensionObject);
 	suite_add_tcase(s, tc_encode);
 
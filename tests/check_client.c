@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_client.h"
+#include "ua_types_encoding_binary.h"
+#include "ua_transport_generated.h"
+#include "ua_nodeids.h"
+#include "ua_statuscodes.h"
+#include "ua_util.h"
+#include "check.h"
+
+#define MAXMESSAGE 4096
+#define CHANNELID 7
+#define TOKENID 8
+#define TIMEOUT 100 // ms
+
+/* The stub networklayer plays the server. It answers the messages of the
+   connection setup and the session services right away. Responses to the
+   other requests are written by the tests. */
+static struct {
+	UA_Byte pending[MAXMESSAGE]; // returned with the next receive
+	size_t pendingLength;
+	UA_Byte received[MAXMESSAGE];
+	UA_StatusCode receiveStatus; // returned by receive instead of data
+	UA_UInt32 sequenceNumber;
+	UA_UInt32 sentIds[16]; // the requestIds of the other requests
+	size_t sentIdsSize;
+} stub;
+
+static void patchMessageSize(UA_Byte *data, size_t length) {
+	UA_ByteString buf = {.length = 8, .data = data};
+	size_t pos = 4;
+	UA_UInt32 size = (UA_UInt32)length;
+	UA_UInt32_encodeBinary(&size, &buf, &pos);
+}
+
+/* Frames a response as a MSG on the SecureChannel */
+static size_t encodeMSG(UA_Byte *data, UA_UInt32 requestId, const void *response,
+						const UA_DataType *responseType) {
+	UA_ByteString buf = {.length = MAXMESSAGE, .data = data};
+	size_t pos = 0;
+	UA_SecureConversationMessageHeader header = {
+		.messageHeader = {.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_MSGF, .messageSize = 0},
+		.secureChannelId = CHANNELID};
+	UA_UInt32 tokenId = TOKENID;
+	UA_SequenceHeader seqHeader = {.sequenceNumber = ++stub.sequenceNumber, .requestId = requestId};
+	UA_NodeId typeId = responseType->typeId;
+	typeId.identifier.numeric += UA_ENCODINGOFFSET_BINARY;
+	UA_SecureConversationMessageHeader_encodeBinary(&header, &buf, &pos);
+	UA_UInt32_encodeBinary(&tokenId, &buf, &pos);
+	UA_SequenceHeader_encodeBinary(&seqHeader, &buf, &pos);
+	UA_NodeId_encodeBinary(&typeId, &buf, &pos);
+	ck_assert_int_eq(UA_encodeBinary(response, responseType, &buf, &pos), UA_STATUSCODE_GOOD);
+	patchMessageSize(data, pos);
+	return pos;
+}
+
+static void respond(UA_UInt32 requestId, const void *response, const UA_DataType *responseType) {
+	stub.pendingLength += encodeMSG(&stub.pending[stub.pendingLength], requestId, response, responseType);
+}
+
+static void respondACK(void) {
+	UA_ByteString buf = {.length = MAXMESSAGE - stub.pendingLength, .data = &stub.pending[stub.pendingLength]};
+	size_t pos = 0;
+	UA_TcpMessageHeader header = {.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_ACKF, .messageSize = 0};
+	UA_TcpAcknowledgeMessage ack = {.protocolVersion = 0, .receiveBufferSize = 65536,
+									.sendBufferSize = 65536, .maxMessageSize = 65536, .maxChunkCount = 1};
+	UA_TcpMessageHeader_encodeBinary(&header, &buf, &pos);
+	UA_TcpAcknowledgeMessage_encodeBinary(&ack, &buf, &pos);
+	patchMessageSize(buf.data, pos);
+	stub.pendingLength += pos;
+}
+
+static void respondOPN(UA_UInt32 requestId) {
+	UA_ByteString buf = {.length = MAXMESSAGE - stub.pendingLength, .data = &stub.pending[stub.pendingLength]};
+	size_t pos = 0;
+	UA_SecureConversationMessageHeader header = {
+		.messageHeader = {.messageTypeAndFinal = UA_MESSAGETYPEANDFINAL_OPNF, .messageSize = 0},
+		.secureChannelId = CHANNELID};
+	UA_AsymmetricAlgorithmSecurityHeader asymHeader;
+	UA_AsymmetricAlgorithmSecurityHeader_init(&asymHeader);
+	UA_SequenceHeader seqHeader = {.sequenceNumber = ++stub.sequenceNumber, .requestId = requestId};
+	UA_NodeId typeId = UA_NODEID_STATIC(0, UA_NS0ID_OPENSECURECHANNELRESPONSE + UA_ENCODINGOFFSET_BINARY);
+	UA_OpenSecureChannelResponse response;
+	UA_OpenSecureChannelResponse_init(&response);
+	response.securityToken.channelId = CHANNELID;
+	response.securityToken.tokenId = TOKENID;
+	UA_SecureConversationMessageHeader_encodeBinary(&header, &buf, &pos);
+	UA_AsymmetricAlgorithmSecurityHeader_encodeBinary(&asymHeader, &buf, &pos);
+	UA_SequenceHeader_encodeBinary(&seqHeader, &buf, &pos);
+	UA_NodeId_encodeBinary(&typeId, &buf, &pos);
+	UA_OpenSecureChannelResponse_encodeBinary(&response, &buf, &pos);
+	patchMessageSize(buf.data, pos);
+	stub.pendingLength += pos;
+}
+
+static UA_Boolean isRequest(const UA_NodeId *typeId, UA_UInt16 type) {
+	return typeId->identifier.numeric == UA_TYPES[type].typeId.identifier.numeric + UA_ENCODINGOFFSET_BINARY;
+}
+
+static UA_StatusCode stubConnect(void *handle, const char *endpointUrl) {
+	return UA_STATUSCODE_GOOD;
+}
+
+static void stubDisconnect(void *handle) {
+}
+
+static UA_StatusCode stubSend(void *handle, UA_ByteStringArray gather_buf) {
+	const UA_ByteString *msg = &gather_buf.strings[0];
+	size_t pos = 0;
+	UA_TcpMessageHeader header;
+	UA_TcpMessageHeader_decodeBinary(msg, &pos, &header);
+	if(header.messageTypeAndFinal == UA_MESSAGETYPEANDFINAL_HELF) {
+		respondACK();
+		return UA_STATUSCODE_GOOD;
+	}
+	if(header.messageTypeAndFinal == UA_MESSAGETYPEANDFINAL_OPNF) {
+		UA_UInt32 channelId;
+		UA_AsymmetricAlgorithmSecurityHeader asymHeader;
+		UA_SequenceHeader seqHeader;
+		UA_UInt32_decodeBinary(msg, &pos, &channelId);
+		UA_AsymmetricAlgorithmSecurityHeader_decodeBinary(msg, &pos, &asymHeader);
+		UA_AsymmetricAlgorithmSecurityHeader_deleteMembers(&asymHeader);
+		UA_SequenceHeader_decodeBinary(msg, &pos, &seqHeader);
+		respondOPN(seqHeader.requestId);
+		return UA_STATUSCODE_GOOD;
+	}
+	if(header.messageTypeAndFinal != UA_MESSAGETYPEANDFINAL_MSGF)
+		return UA_STATUSCODE_GOOD; // CLO
+
+	UA_UInt32 channelId, tokenId;
+	UA_SequenceHeader seqHeader;
+	UA_NodeId typeId;
+	UA_UInt32_decodeBinary(msg, &pos, &channelId);
+	UA_UInt32_decodeBinary(msg, &pos, &tokenId);
+	UA_SequenceHeader_decodeBinary(msg, &pos, &seqHeader);
+	UA_NodeId_decodeBinary(msg, &pos, &typeId);
+	ck_assert_int_eq(channelId, CHANNELID);
+	ck_assert_int_eq(tokenId, TOKENID);
+	if(isRequest(&typeId, UA_TYPES_CREATESESSIONREQUEST)) {
+		UA_CreateSessionResponse response;
+		UA_CreateSessionResponse_init(&response);
+		response.authenticationToken = UA_NODEID_STATIC(1, 1);
+		respond(seqHeader.requestId, &response, &UA_TYPES[UA_TYPES_CREATESESSIONRESPONSE]);
+	} else if(isRequest(&typeId, UA_TYPES_ACTIVATESESSIONREQUEST)) {
+		UA_ActivateSessionResponse response;
+		UA_ActivateSessionResponse_init(&response);
+		respond(seqHeader.requestId, &response, &UA_TYPES[UA_TYPES_ACTIVATESESSIONRESPONSE]);
+	} else if(isRequest(&typeId, UA_TYPES_CLOSESESSIONREQUEST)) {
+		UA_CloseSessionResponse response;
+		UA_CloseSessionResponse_init(&response);
+		respond(seqHeader.requestId, &response, &UA_TYPES[UA_TYPES_CLOSESESSIONRESPONSE]);
+	} else
+		stub.sentIds[stub.sentIdsSize++] = seqHeader.requestId;
+	return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode stubReceive(void *handle, UA_ByteString *buf, UA_UInt32 timeout) {
+	if(stub.receiveStatus != UA_STATUSCODE_GOOD)
+		return stub.receiveStatus;
+	if(stub.pendingLength == 0)
+		return UA_STATUSCODE_BADTIMEOUT;
+	memcpy(stub.received, stub.pending, stub.pendingLength);
+	buf->data = stub.received;
+	buf->length = (UA_Int32)stub.pendingLength;
+	stub.pendingLength = 0;
+	return UA_STATUSCODE_GOOD;
+}
+
+static void stubFree(void *handle) {
+}
+
+static UA_Client * connectClient(void) {
+	memset(&stub, 0, sizeof(stub));
+	UA_ClientNetworkLayer nl = {.nlHandle = &stub, .connect = stubConnect, .disconnect = stubDisconnect,
+								.send = stubSend, .receive = stubReceive, .free = stubFree};
+	UA_ClientConfig config = UA_ClientConfig_standard;
+	config.timeout = TIMEOUT;
+	UA_Client *client = UA_Client_new(config, nl);
+	ck_assert_int_eq(UA_Client_connect(client, "opc.tcp://stub"), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(stub.sentIdsSize, 0);
+	return client;
+}
+
+/* The callbacks are recorded in the order of their calls */
+static struct {
+	UA_UInt32 requestId;
+	UA_StatusCode serviceResult;
+	UA_Int32 value; // of the first result. -1 if there is none
+} calls[16];
+static size_t callsSize;
+
+static void readCallback(UA_Client *client, void *userdata, UA_UInt32 requestId,
+						 void *response, const UA_DataType *responseType) {
+	ck_assert_ptr_eq(responseType, &UA_TYPES[UA_TYPES_READRESPONSE]);
+	const UA_ReadResponse *rr = response;
+	calls[callsSize].requestId = requestId;
+	calls[callsSize].serviceResult = rr->responseHeader.serviceResult;
+	calls[callsSize].value = -1;
+	if(rr->resultsSize > 0 && rr->results[0].hasVariant)
+		calls[callsSize].value = *(UA_Int32*)rr->results[0].value.dataPtr;
+	callsSize++;
+}
+
+static UA_UInt32 sendRead(UA_Client *client) {
+	UA_ReadRequest request;
+	UA_ReadRequest_init(&request);
+	UA_ReadValueId rvi;
+	UA_ReadValueId_init(&rvi);
+	rvi.nodeId = UA_NODEID_STATIC(0, UA_NS0ID_SERVER_SERVERSTATUS_STATE);
+	rvi.attributeId = 13; // value
+	request.nodesToRead = &rvi;
+	request.nodesToReadSize = 1;
+	UA_UInt32 requestId = 0;
+	ck_assert_int_eq(UA_Client_read_async(client, &request, readCallback, UA_NULL, &requestId),
+					 UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(stub.sentIds[stub.sentIdsSize - 1], requestId);
+	return requestId;
+}
+
+/* A read response with one Int32 value */
+static size_t encodeReadResponse(UA_Byte *data, UA_UInt32 requestId, UA_Int32 value) {
+	UA_ReadResponse response;
+	UA_ReadResponse_init(&response);
+	UA_DataValue result;
+	UA_DataValue_init(&result);
+	result.hasVariant = UA_TRUE;
+	UA_Variant_setValue(&result.value, &value, &UA_TYPES[UA_TYPES_INT32]);
+	result.value.storageType = UA_VARIANT_DATA_NODELETE;
+	response.results = &result;
+	response.resultsSize = 1;
+	return encodeMSG(data, requestId, &response, &UA_TYPES[UA_TYPES_READRESPONSE]);
+}
+
+static void processBytes(UA_Client *client, UA_Byte *data, size_t length) {
+	UA_ByteString msg = {.length = (UA_Int32)length, .data = data};
+	ck_assert_int_eq(UA_Client_processBinaryMessage(client, &msg), UA_STATUSCODE_GOOD);
+}
+
+START_TEST(responsesAreMatchedByRequestId) {
+	UA_Client *client = connectClient();
+	UA_UInt32 ids[3];
+	for(int i = 0; i < 3; i++)
+		ids[i] = sendRead(client);
+	ck_assert_int_eq(UA_Client_getRequestsInFlight(client), 3);
+
+	// the responses arrive in reverse order in one buffer
+	callsSize = 0;
+	UA_Byte data[MAXMESSAGE];
+	size_t length = 0;
+	for(int i = 2; i >= 0; i--)
+		length += encodeReadResponse(&data[length], ids[i], 100 + i);
+	processBytes(client, data, length);
+
+	ck_assert_int_eq(callsSize, 3);
+	for(int i = 0; i < 3; i++) {
+		ck_assert_int_eq(calls[i].requestId, ids[2 - i]);
+		ck_assert_int_eq(calls[i].serviceResult, UA_STATUSCODE_GOOD);
+		ck_assert_int_eq(calls[i].value, 100 + 2 - i);
+	}
+	ck_assert_int_eq(UA_Client_getRequestsInFlight(client), 0);
+	UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(splitMessagesAreReassembled) {
+	UA_Client *client = connectClient();
+	UA_UInt32 first = sendRead(client);
+	UA_UInt32 second = sendRead(client);
+
+	UA_Byte data[MAXMESSAGE];
+	size_t firstLength = encodeReadResponse(data, first, 1);
+	size_t length = firstLength + encodeReadResponse(&data[firstLength], second, 2);
+
+	// less than the message header, then up to the middle of the first message
+	callsSize = 0;
+	processBytes(client, data, 5);
+	processBytes(client, &data[5], firstLength / 2 - 5);
+	ck_assert_int_eq(callsSize, 0);
+
+	// the rest of the first message and the start of the second
+	processBytes(client, &data[firstLength / 2], firstLength + 3 - firstLength / 2);
+	ck_assert_int_eq(callsSize, 1);
+	ck_assert_int_eq(calls[0].requestId, first);
+	ck_assert_int_eq(calls[0].value, 1);
+
+	// the second message byte by byte
+	for(size_t i = firstLength + 3; i < length; i++)
+		processBytes(client, &data[i], 1);
+	ck_assert_int_eq(callsSize, 2);
+	ck_assert_int_eq(calls[1].requestId, second);
+	ck_assert_int_eq(calls[1].value, 2);
+	ck_assert_int_eq(UA_Client_getRequestsInFlight(client), 0);
+	UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(serviceFaultIsDecoded) {
+	UA_Client *client = connectClient();
+	UA_UInt32 id = sendRead(client);
+
+	UA_ServiceFault fault;
+	UA_ServiceFault_init(&fault);
+	fault.responseHeader.serviceResult = UA_STATUSCODE_BADSESSIONIDINVALID;
+	UA_Byte data[MAXMESSAGE];
+	size_t length = encodeMSG(data, id, &fault, &UA_TYPES[UA_TYPES_SERVICEFAULT]);
+	callsSize = 0;
+	processBytes(client, data, length);
+
+	// the callback receives a read response with the result of the fault
+	ck_assert_int_eq(callsSize, 1);
+	ck_assert_int_eq(calls[0].requestId, id);
+	ck_assert_int_eq(calls[0].serviceResult, UA_STATUSCODE_BADSESSIONIDINVALID);
+	ck_assert_int_eq(calls[0].value, -1);
+	UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(requestsTimeOut) {
+	UA_Client *client = connectClient();
+	UA_UInt32 late = sendRead(client);
+	UA_DateTime sent = UA_DateTime_now();
+	UA_UInt32 answered = sendRead(client);
+
+	// one response arrives in time
+	callsSize = 0;
+	UA_Byte data[MAXMESSAGE];
+	size_t length = encodeReadResponse(data, answered, 1);
+	memcpy(stub.pending, data, length);
+	stub.pendingLength = length;
+	ck_assert_int_eq(UA_Client_processResponses(client, 0), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(callsSize, 1);
+	ck_assert_int_eq(calls[0].requestId, answered);
+
+	// the other request fails when the timeout has passed
+	while(UA_DateTime_now() <= sent + (UA_DateTime)TIMEOUT * 10000) {}
+	ck_assert_int_eq(UA_Client_processResponses(client, 0), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(callsSize, 2);
+	ck_assert_int_eq(calls[1].requestId, late);
+	ck_assert_int_eq(calls[1].serviceResult, UA_STATUSCODE_BADTIMEOUT);
+	ck_assert_int_eq(UA_Client_getRequestsInFlight(client), 0);
+
+	// the late response is dropped
+	length = encodeReadResponse(data, late, 2);
+	processBytes(client, data, length);
+	ck_assert_int_eq(callsSize, 2);
+	UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(lostConnectionCancelsRequests) {
+	UA_Client *client = connectClient();
+	UA_UInt32 first = sendRead(client);
+	UA_UInt32 second = sendRead(client);
+
+	callsSize = 0;
+	stub.receiveStatus = UA_STATUSCODE_BADCONNECTIONCLOSED;
+	ck_assert_int_eq(UA_Client_processResponses(client, 0), UA_STATUSCODE_BADCONNECTIONCLOSED);
+	ck_assert_int_eq(callsSize, 2);
+	ck_assert_int_eq(calls[0].requestId, first);
+	ck_assert_int_eq(calls[1].requestId, second);
+	ck_assert_int_eq(calls[0].serviceResult, UA_STATUSCODE_BADCONNECTIONCLOSED);
+	ck_assert_int_eq(calls[1].serviceResult, UA_STATUSCODE_BADCONNECTIONCLOSED);
+	ck_assert_int_eq(UA_Client_getRequestsInFlight(client), 0);
+
+	// no further requests until the client connects again
+	UA_ReadRequest request;
+	UA_ReadRequest_init(&request);
+	ck_assert_int_eq(UA_Client_read_async(client, &request, readCallback, UA_NULL, UA_NULL),
+					 UA_STATUSCODE_BADSERVERNOTCONNECTED);
+	UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(disconnectCancelsRequests) {
+	UA_Client *client = connectClient();
+	UA_UInt32 id = sendRead(client);
+
+	// the session is closed first. the read is still unanswered.
+	callsSize = 0;
+	ck_assert_int_eq(UA_Client_disconnect(client), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(callsSize, 1);
+	ck_assert_int_eq(calls[0].requestId, id);
+	ck_assert_int_eq(calls[0].serviceResult, UA_STATUSCODE_BADSHUTDOWN);
+	ck_assert_int_eq(UA_Client_getRequestsInFlight(client), 0);
+	UA_Client_delete(client);
+}
+END_TEST
+
+static Suite * testSuite_client(void) {
+	Suite *s = suite_create("Client");
+	TCase *tc_receive = tcase_create("Receive");
+	tcase_add_test(tc_receive, responsesAreMatchedByRequestId);
+	tcase_add_test(tc_receive, splitMessagesAreReassembled);
+	tcase_add_test(tc_receive, serviceFaultIsDecoded);
+	suite_add_tcase(s, tc_receive);
+	TCase *tc_fail = tcase_create("FailedRequests");
+	tcase_add_test(tc_fail, requestsTimeOut);
+	tcase_add_test(tc_fail, lostConnectionCancelsRequests);
+	tcase_add_test(tc_fail, disconnectCancelsRequests);
+	suite_add_tcase(s, tc_fail);
+	return s;
+}
+
+int main(void) {
+	int number_failed = 0;
+	Suite *s = testSuite_client();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed += srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_types.h"
+#include "server/ua_services.h"
+#include "server/ua_server_internal.h"
+#include "ua_statuscodes.h"
+#include "check.h"
+
+/* Reads the value of a diagnostics variable, e.g. "Diagnostics.Read.RequestCount" */
+static UA_StatusCode readDiagnostics(UA_Server *server, const char *name, UA_Variant *value) {
+	UA_ReadRequest request;
+	UA_ReadRequest_init(&request);
+	request.nodesToRead = UA_Array_new(&UA_TYPES[UA_TYPES_READVALUEID], 1);
+	request.nodesToReadSize = 1;
+	request.nodesToRead[0].nodeId.namespaceIndex = 1;
+	request.nodesToRead[0].nodeId.identifierType = UA_NODEIDTYPE_STRING;
+	UA_String_copycstring(name, &request.nodesToRead[0].nodeId.identifier.string);
+	request.nodesToRead[0].attributeId = UA_ATTRIBUTEID_VALUE;
+
+	UA_ReadResponse response;
+	UA_ReadResponse_init(&response);
+	Service_Read(server, &adminSession, &request, &response);
+	UA_StatusCode retval = response.resultsSize == 1 ? response.results[0].status : UA_STATUSCODE_BADINTERNALERROR;
+	if(retval == UA_STATUSCODE_GOOD)
+		UA_Variant_copy(&response.results[0].value, value);
+	UA_ReadResponse_deleteMembers(&response);
+	UA_ReadRequest_deleteMembers(&request);
+	return retval;
+}
+
+START_TEST(timesAreSortedIntoPowerOfTwoBuckets) {
+	UA_UInt64 histogram[UA_DIAGNOSTICS_BUCKETS];
+	UA_memset(histogram, 0, sizeof(histogram));
+	UA_Diagnostics_addTime(histogram, 500); // below 1us
+	UA_Diagnostics_addTime(histogram, 1500); // 1us
+	UA_Diagnostics_addTime(histogram, 3000); // 3us
+	UA_Diagnostics_addTime(histogram, 4000); // 4us
+	UA_Diagnostics_addTime(histogram, (UA_UInt64)1 << 60);
+	ck_assert_int_eq(histogram[0], 1);
+	ck_assert_int_eq(histogram[1], 1);
+	ck_assert_int_eq(histogram[2], 1);
+	ck_assert_int_eq(histogram[3], 1);
+	ck_assert_int_eq(histogram[UA_DIAGNOSTICS_BUCKETS - 1], 1);
+}
+END_TEST
+
+START_TEST(countersAreExposedAsVariables) {
+	UA_Server *server = UA_Server_new();
+	UA_DIAGNOSTICS_ENTER(server);
+	UA_UInt32 index = server->services[UA_TYPES_READREQUEST].diagnosticsIndex;
+	UA_localCounters->services[index].requests = 5;
+	UA_localCounters->services[index].serviceTime[3] = 7;
+
+	UA_Variant value;
+	ck_assert_int_eq(readDiagnostics(server, "Diagnostics.Read.RequestCount", &value), UA_STATUSCODE_GOOD);
+	ck_assert_ptr_eq(value.type, &UA_TYPES[UA_TYPES_UINT64]);
+	ck_assert_int_eq(*(UA_UInt64*)value.dataPtr, 5);
+	UA_Variant_deleteMembers(&value);
+
+	ck_assert_int_eq(readDiagnostics(server, "Diagnostics.Read.ServiceTime", &value), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(value.arrayLength, UA_DIAGNOSTICS_BUCKETS);
+	ck_assert_int_eq(((UA_UInt64*)value.dataPtr)[3], 7);
+	UA_Variant_deleteMembers(&value);
+
+	// the lookups of the reads above are counted
+	ck_assert_int_eq(readDiagnostics(server, "Diagnostics.NodeStoreHits", &value), UA_STATUSCODE_GOOD);
+	ck_assert(*(UA_UInt64*)value.dataPtr >= 2);
+	UA_Variant_deleteMembers(&value);
+
+	UA_Server_delete(server);
+	ck_assert_ptr_eq(UA_localCounters, UA_NULL);
+}
+END_TEST
+
+static void dummyService(UA_Server *server, UA_SecureChannel *channel, UA_Session *session,
+                         const void *request, void *response) {}
+
+START_TEST(servicesAddedLaterGetVariables) {
+	UA_Server *server = UA_Server_new();
+	UA_Server_addService(server, &UA_TYPES[UA_TYPES_CALLREQUEST], &UA_TYPES[UA_TYPES_CALLRESPONSE],
+	                     dummyService, 0);
+	char name[64];
+	snprintf(name, sizeof(name), "Diagnostics.Service_0_%u.RequestCount",
+	         UA_TYPES[UA_TYPES_CALLREQUEST].typeId.identifier.numeric);
+	UA_Variant value;
+	ck_assert_int_eq(readDiagnostics(server, name, &value), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(*(UA_UInt64*)value.dataPtr, 0);
+	UA_Variant_deleteMembers(&value);
+	UA_Server_delete(server);
+}
+END_TEST
+
+static Suite * testSuite_diagnostics(void) {
+	Suite *s = suite_create("diagnostics");
+	TCase *tc = tcase_create("Counters");
+	tcase_add_test(tc, timesAreSortedIntoPowerOfTwoBuckets);
+	tcase_add_test(tc, countersAreExposedAsVariables);
+	tcase_add_test(tc, servicesAddedLaterGetVariables);
+	suite_add_tcase(s, tc);
+	return s;
+}
+
+int main(void) {
+	int number_failed = 0;
+	Suite *s = testSuite_diagnostics();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed += srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,9 +1,11 @@
 #define _XOPEN_SOURCE 500
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "ua_types.h"
 #include "ua_types_generated.h"
+#include "ua_transport_generated.h"
 #include "ua_types_encoding_binary.h"
 #include "ua_util.h"
 #include "check.h"
@@ -174,6 +176,102 @@ START_TEST(decodeComplexTypeFromRandomBufferShallSurvive) {
 }
 END_TEST
 
+/************************************/
+/* Performance Profiling Test Cases */
+/************************************/
+
+START_TEST(profileEncodeDecodePrimitives) {
+#define ROUNDS 1000
+#define VALUES 10000
+	UA_ByteString buf;
+	UA_ByteString_newMembers(&buf, VALUES * (4 + 8 + 8));
+	UA_UInt32 u32 = 0;
+	UA_UInt64 u64 = 0;
+	UA_Double d = 0;
+	clock_t begin = clock();
+	for(UA_Int32 r = 0; r < ROUNDS; r++) {
+		size_t pos = 0;
+		for(UA_Int32 i = 0; i < VALUES; i++) {
+			u32 = i; u64 = (UA_UInt64)i << 32; d = i * 0.5;
+			UA_UInt32_encodeBinary(&u32, &buf, &pos);
+			UA_UInt64_encodeBinary(&u64, &buf, &pos);
+			UA_Double_encodeBinary(&d, &buf, &pos);
+		}
+	}
+	clock_t end = clock();
+	printf("Time for %d encodings of UInt32, UInt64 and Double: %fs.\n", ROUNDS * VALUES,
+	       (double)(end - begin) / CLOCKS_PER_SEC);
+	begin = clock();
+	for(UA_Int32 r = 0; r < ROUNDS; r++) {
+		size_t pos = 0;
+		for(UA_Int32 i = 0; i < VALUES; i++) {
+			UA_UInt32_decodeBinary(&buf, &pos, &u32);
+			UA_UInt64_decodeBinary(&buf, &pos, &u64);
+			UA_Double_decodeBinary(&buf, &pos, &d);
+		}
+	}
+	end = clock();
+	printf("Time for %d decodings of UInt32, UInt64 and Double: %fs.\n", ROUNDS * VALUES,
+	       (double)(end - begin) / CLOCKS_PER_SEC);
+	ck_assert_int_eq(u32, VALUES - 1);
+	UA_ByteString_deleteMembers(&buf);
+}
+END_TEST
+
+START_TEST(profileEncodeDecodeFixedSizeStructures) {
+	UA_SequenceHeader header = {.sequenceNumber = 0, .requestId = 0};
+	UA_ByteString buf;
+	UA_ByteString_newMembers(&buf, VALUES * 8);
+	clock_t begin = clock();
+	for(UA_Int32 r = 0; r < ROUNDS; r++) {
+		size_t pos = 0;
+		for(UA_Int32 i = 0; i < VALUES; i++) {
+			header.sequenceNumber = i;
+			UA_SequenceHeader_encodeBinary(&header, &buf, &pos);
+		}
+		pos = 0;
+		for(UA_Int32 i = 0; i < VALUES; i++)
+			UA_SequenceHeader_decodeBinary(&buf, &pos, &header);
+	}
+	clock_t end = clock();
+	printf("Time for %d encodings and decodings of a SequenceHeader: %fs.\n", ROUNDS * VALUES,
+	       (double)(end - begin) / CLOCKS_PER_SEC);
+	ck_assert_int_eq(header.sequenceNumber, VALUES - 1);
+	UA_ByteString_deleteMembers(&buf);
+}
+END_TEST
+
+START_TEST(profileEncodeDecodeNumericVariantArrays) {
+#define SAMPLES 1000000
+	UA_Variant v;
+	UA_Variant_init(&v);
+	v.type = &UA_TYPES[UA_TYPES_DOUBLE];
+	v.arrayLength = SAMPLES;
+	v.dataPtr = UA_Array_new(&UA_TYPES[UA_TYPES_DOUBLE], SAMPLES);
+	for(UA_Int32 i = 0; i < SAMPLES; i++)
+		((UA_Double*)v.dataPtr)[i] = i * 0.25;
+	UA_ByteString buf;
+	UA_ByteString_newMembers(&buf, UA_Variant_calcSizeBinary(&v));
+	UA_Variant dst;
+	clock_t begin = clock();
+	for(UA_Int32 r = 0; r < 100; r++) {
+		size_t pos = 0;
+		UA_Variant_encodeBinary(&v, &buf, &pos);
+		pos = 0;
+		UA_Variant_decodeBinary(&buf, &pos, &dst);
+		if(r < 99)
+			UA_Variant_deleteMembers(&dst);
+	}
+	clock_t end = clock();
+	printf("Time for 100 encodings and decodings of a Variant with %d Doubles: %fs.\n", SAMPLES,
+	       (double)(end - begin) / CLOCKS_PER_SEC);
+	ck_assert(((UA_Double*)dst.dataPtr)[SAMPLES - 1] == (SAMPLES - 1) * 0.25);
+	UA_Variant_deleteMembers(&dst);
+	UA_Variant_deleteMembers(&v);
+	UA_ByteString_deleteMembers(&buf);
+}
+END_TEST
+
 int main(void) {
 	int number_failed = 0;
 	SRunner *sr;
@@ -193,6 +291,12 @@ int main(void) {
 	tcase_add_loop_test(tc, decodeComplexTypeFromRandomBufferShallSurvive, UA_TYPES_NODEID, UA_TYPES_EVENTNOTIFICATIONLIST);
 	suite_add_tcase(s, tc);
 
+	/* tc = tcase_create("Profile"); */
+	/* tcase_add_test(tc, profileEncodeDecodePrimitives); */
+	/* tcase_add_test(tc, profileEncodeDecodeFixedSizeStructures); */
+	/* tcase_add_test(tc, profileEncodeDecodeNumericVariantArrays); */
+	/* suite_add_tcase(s, tc); */
+
 	sr = srunner_create(s);
 	srunner_set_fork_status(sr, CK_NOFORK);
 	srunner_run_all (sr, CK_NORMAL);
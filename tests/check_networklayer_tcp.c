@@ -0,0 +1,184 @@
+/* the send queue is internal to the networklayer */
+#include "../examples/networklayer_tcp.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include "check.h"
+
+#define MESSAGESIZE 8192
+#define MESSAGES 32
+
+static UA_ServerNetworkLayer nl;
+static NetworkLayerTCP *layer;
+static TCPConnection *connection;
+static int peer;
+
+/* The connection writes into one end of a socketpair with a small send buffer.
+   The test reads from the other end. */
+static void setupConnection(UA_UInt32 maxQueueSize, TCPSendQueuePolicy policy) {
+	nl = ServerNetworkLayerTCP_new(UA_ConnectionConfig_standard, 0);
+	layer = nl.nlHandle;
+	ServerNetworkLayerTCP_setSendQueue(&nl, maxQueueSize, policy);
+	int sv[2];
+	ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+	int bufsize = 4096;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+	setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	setNonBlocking(sv[1]);
+	ck_assert_int_eq(NetworkLayerTCP_add(layer, sv[0]), UA_STATUSCODE_GOOD);
+	connection = layer->conLinks[0].connection;
+	peer = sv[1];
+}
+
+static void teardownConnection(void) {
+	UA_WorkItem *work;
+	UA_Int32 workSize = nl.stop(layer, &work);
+	for(UA_Int32 i = 0; i < workSize; i++)
+		work[i].work.methodCall.method(NULL, work[i].work.methodCall.data);
+	free(work);
+	nl.free(layer);
+	CLOSESOCKET(peer);
+}
+
+/* Message i consists of MESSAGESIZE bytes of value i */
+static void writeMessages(void) {
+	static UA_Byte data[MESSAGESIZE];
+	for(int i = 0; i < MESSAGES; i++) {
+		memset(data, i, MESSAGESIZE);
+		UA_ByteString buf = {.length = MESSAGESIZE, .data = data};
+		UA_ByteStringArray gather = {.strings = &buf, .stringsSize = 1};
+		connection->connection.write(connection, gather);
+	}
+}
+
+/* Reads from the peer and flushes the queue until nothing arrives anymore.
+   Returns the number of bytes read into received. */
+static size_t drain(UA_Byte *received, size_t maxLength) {
+	size_t length = 0;
+	for(int idle = 0; idle < 100;) {
+		ssize_t n = read(peer, &received[length], maxLength - length);
+		if(n > 0) {
+			length += n;
+			idle = 0;
+		} else
+			idle++;
+		if(connection->connection.state != UA_CONNECTION_CLOSING)
+			flushSendQueue(connection);
+		if(n == 0)
+			break; // closed
+	}
+	return length;
+}
+
+/* The received messages are complete and in increasing order */
+static UA_Int32 checkMessages(const UA_Byte *received, size_t length) {
+	ck_assert_int_eq(length % MESSAGESIZE, 0);
+	UA_Int32 last = -1;
+	for(size_t m = 0; m < length / MESSAGESIZE; m++) {
+		UA_Byte value = received[m * MESSAGESIZE];
+		ck_assert_int_gt(value, last);
+		for(size_t i = 1; i < MESSAGESIZE; i++)
+			ck_assert_int_eq(received[m * MESSAGESIZE + i], value);
+		last = value;
+	}
+	return (UA_Int32)(length / MESSAGESIZE);
+}
+
+START_TEST(queuedMessagesAreDeliveredInOrder) {
+	setupConnection(MESSAGES * MESSAGESIZE, TCP_SENDQUEUE_STOPREADING);
+	writeMessages();
+
+	TCPSendQueueStatistics stats;
+	TCPConnection_getSendQueueStatistics(&connection->connection, &stats);
+	ck_assert(stats.messagesQueued > 0); // the socket blocked
+	ck_assert_int_eq(stats.bytesSent + stats.bytesQueued, MESSAGES * MESSAGESIZE);
+	ck_assert_int_eq(stats.overflows, 0);
+
+	static UA_Byte received[MESSAGES * MESSAGESIZE];
+	size_t length = drain(received, sizeof(received));
+	ck_assert_int_eq(checkMessages(received, length), MESSAGES);
+
+	TCPConnection_getSendQueueStatistics(&connection->connection, &stats);
+	ck_assert_int_eq(stats.bytesSent, MESSAGES * MESSAGESIZE);
+	ck_assert_int_eq(stats.bytesQueued, 0);
+	ck_assert_ptr_eq(connection->sendQueueFirst, NULL);
+	teardownConnection();
+}
+END_TEST
+
+START_TEST(dropPolicyDropsWholeMessages) {
+	setupConnection(2 * MESSAGESIZE, TCP_SENDQUEUE_DROP);
+	writeMessages();
+
+	TCPSendQueueStatistics stats;
+	TCPConnection_getSendQueueStatistics(&connection->connection, &stats);
+	ck_assert(stats.messagesDropped > 0);
+	ck_assert_int_eq(stats.overflows, stats.messagesDropped);
+	ck_assert(stats.bytesQueued <= 3 * MESSAGESIZE); // the partially written message is not counted
+	ck_assert_int_eq(connection->readingPaused, UA_FALSE);
+
+	static UA_Byte received[MESSAGES * MESSAGESIZE];
+	size_t length = drain(received, sizeof(received));
+	ck_assert_int_eq(checkMessages(received, length), MESSAGES - stats.messagesDropped);
+	teardownConnection();
+}
+END_TEST
+
+START_TEST(closePolicyClosesConnection) {
+	setupConnection(2 * MESSAGESIZE, TCP_SENDQUEUE_CLOSE);
+	writeMessages();
+
+	TCPSendQueueStatistics stats;
+	TCPConnection_getSendQueueStatistics(&connection->connection, &stats);
+	ck_assert_int_eq(stats.overflows, 1);
+	ck_assert_int_eq(stats.messagesDropped, 0);
+	ck_assert_int_eq(connection->connection.state, UA_CONNECTION_CLOSING);
+
+	// the peer sees the end of the stream
+	static UA_Byte received[MESSAGES * MESSAGESIZE];
+	drain(received, sizeof(received));
+	ck_assert_int_eq(read(peer, received, 1), 0);
+	teardownConnection();
+}
+END_TEST
+
+START_TEST(stopReadingPolicyPausesUntilFlushed) {
+	setupConnection(2 * MESSAGESIZE, TCP_SENDQUEUE_STOPREADING);
+	writeMessages();
+
+	TCPSendQueueStatistics stats;
+	TCPConnection_getSendQueueStatistics(&connection->connection, &stats);
+	ck_assert(stats.overflows > 0);
+	ck_assert_int_eq(stats.messagesDropped, 0);
+	ck_assert_int_eq(connection->readingPaused, UA_TRUE);
+
+	// nothing is lost and reading resumes when the queue is empty
+	static UA_Byte received[MESSAGES * MESSAGESIZE];
+	size_t length = drain(received, sizeof(received));
+	ck_assert_int_eq(checkMessages(received, length), MESSAGES);
+	ck_assert_int_eq(connection->readingPaused, UA_FALSE);
+	teardownConnection();
+}
+END_TEST
+
+static Suite * testSuite_networklayer_tcp(void) {
+	Suite *s = suite_create("networklayer_tcp");
+	TCase *tc = tcase_create("SendQueue");
+	tcase_add_test(tc, queuedMessagesAreDeliveredInOrder);
+	tcase_add_test(tc, dropPolicyDropsWholeMessages);
+	tcase_add_test(tc, closePolicyClosesConnection);
+	tcase_add_test(tc, stopReadingPolicyPausesUntilFlushed);
+	suite_add_tcase(s, tc);
+	return s;
+}
+
+int main(void) {
+	int number_failed = 0;
+	Suite *s = testSuite_networklayer_tcp();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed += srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
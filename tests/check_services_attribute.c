@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_types.h"
+#include "server/ua_services.h"
+#include "server/ua_server_internal.h"
+#include "ua_statuscodes.h"
+#include "check.h"
+
+static UA_Int32 readCount = 0;
+static UA_Int32 asyncReadCount = 0;
+static UA_DataSourceReadCallback asyncCallback = UA_NULL;
+static void *asyncReadHandle = UA_NULL;
+
+static UA_StatusCode readInt32(const void *handle, UA_DataValue *value) {
+	readCount++;
+	UA_Int32 *i = UA_Int32_new();
+	*i = 42;
+	UA_Variant_setValue(&value->value, i, &UA_TYPES[UA_TYPES_INT32]);
+	value->hasVariant = UA_TRUE;
+	return UA_STATUSCODE_GOOD;
+}
+
+static void releaseInt32(const void *handle, UA_DataValue *value) {
+	UA_DataValue_deleteMembers(value);
+}
+
+static UA_StatusCode writeInt32(const void *handle, const UA_Variant *data) {
+	return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode readInt32Async(const void *handle, UA_Server *server,
+                                    UA_DataSourceReadCallback callback, void *readHandle) {
+	asyncReadCount++;
+	asyncCallback = callback;
+	asyncReadHandle = readHandle;
+	return UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY;
+}
+
+static UA_Int32 finishedCount = 0;
+static void readFinished(UA_Server *server, UA_AsyncRead *read) {
+	finishedCount++;
+}
+
+static UA_Server * makeTestServer(void) {
+	UA_Server *server = UA_Server_new();
+	UA_DataSource ds = (UA_DataSource) {.handle = UA_NULL, .read = readInt32, .release = releaseInt32,
+	                                    .write = UA_NULL, .readAsync = readInt32Async};
+	UA_QualifiedName name;
+	UA_QUALIFIEDNAME_ASSIGN(name, "async");
+	UA_Server_addDataSourceVariableNode(server, ds, &UA_NODEID_STATIC(1, 1000), &name,
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER),
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_ORGANIZES));
+	UA_Server_addDataSourceVariableNode(server, ds, &UA_NODEID_STATIC(1, 1001), &name,
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER),
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_ORGANIZES));
+	return server;
+}
+
+static void initReadRequest(UA_ReadRequest *request, UA_Int32 size) {
+	UA_ReadRequest_init(request);
+	request->nodesToRead = UA_Array_new(&UA_TYPES[UA_TYPES_READVALUEID], size);
+	request->nodesToReadSize = size;
+	for(UA_Int32 i = 0; i < size; i++) {
+		request->nodesToRead[i].nodeId = UA_NODEID_STATIC(1, 1000 + (i % 2));
+		request->nodesToRead[i].attributeId = UA_ATTRIBUTEID_VALUE;
+	}
+}
+
+START_TEST(asyncReadIsCoalescedAndFinishesOnCallback) {
+	UA_Server *server = makeTestServer();
+	asyncReadCount = 0;
+	finishedCount = 0;
+
+	UA_AsyncRead read;
+	initReadRequest(&read.request, 4);
+	UA_ReadResponse_init(&read.response);
+	read.finished = readFinished;
+
+	UA_StatusCode retval = Service_ReadAsync(server, &adminSession, &read);
+	ck_assert_int_eq(retval, UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY);
+	ck_assert_int_eq(asyncReadCount, 1);
+	ck_assert_int_eq(finishedCount, 0);
+
+	UA_Int32 value = 23;
+	UA_DataValue dv;
+	UA_DataValue_init(&dv);
+	UA_Variant_setValue(&dv.value, &value, &UA_TYPES[UA_TYPES_INT32]);
+	dv.hasVariant = UA_TRUE;
+	asyncCallback(server, asyncReadHandle, UA_STATUSCODE_GOOD, &dv);
+
+	ck_assert_int_eq(finishedCount, 1);
+	ck_assert_int_eq(read.response.resultsSize, 4);
+	for(UA_Int32 i = 0; i < 4; i++) {
+		ck_assert_int_eq(read.response.results[i].hasVariant, UA_TRUE);
+		ck_assert_int_eq(*(UA_Int32*)read.response.results[i].value.dataPtr, 23);
+	}
+
+	UA_ReadRequest_deleteMembers(&read.request);
+	UA_ReadResponse_deleteMembers(&read.response);
+	UA_Server_delete(server);
+}
+END_TEST
+
+static void readWithAsyncStatus(UA_StatusCode status, UA_StatusCode expected) {
+	UA_Server *server = makeTestServer();
+	UA_AsyncRead read;
+	initReadRequest(&read.request, 2);
+	UA_ReadResponse_init(&read.response);
+	read.finished = readFinished;
+	ck_assert_int_eq(Service_ReadAsync(server, &adminSession, &read), UA_STATUSCODE_GOODCOMPLETESASYNCHRONOUSLY);
+	asyncCallback(server, asyncReadHandle, status, UA_NULL);
+	ck_assert_int_eq(read.response.resultsSize, 2);
+	for(UA_Int32 i = 0; i < 2; i++) {
+		ck_assert_int_eq(read.response.results[i].hasStatus, UA_TRUE);
+		ck_assert_int_eq(read.response.results[i].status, expected);
+	}
+	UA_ReadRequest_deleteMembers(&read.request);
+	UA_ReadResponse_deleteMembers(&read.response);
+	UA_Server_delete(server);
+}
+
+START_TEST(asyncReadReportsDataSourceStatus) {
+	readWithAsyncStatus(UA_STATUSCODE_BADTIMEOUT, UA_STATUSCODE_BADTIMEOUT);
+	readWithAsyncStatus(UA_STATUSCODE_BADCOMMUNICATIONERROR, UA_STATUSCODE_BADCOMMUNICATIONERROR);
+	// good, but without a value
+	readWithAsyncStatus(UA_STATUSCODE_GOOD, UA_STATUSCODE_BADNOTREADABLE);
+}
+END_TEST
+
+START_TEST(syncReadUsesReadCallback) {
+	UA_Server *server = makeTestServer();
+	readCount = 0;
+	asyncReadCount = 0;
+
+	UA_ReadRequest request;
+	initReadRequest(&request, 2);
+	UA_ReadResponse response;
+	UA_ReadResponse_init(&response);
+	Service_Read(server, &adminSession, &request, &response);
+
+	ck_assert_int_eq(asyncReadCount, 0);
+	ck_assert_int_eq(readCount, 2);
+	ck_assert_int_eq(*(UA_Int32*)response.results[0].value.dataPtr, 42);
+
+	UA_ReadRequest_deleteMembers(&request);
+	UA_ReadResponse_deleteMembers(&response);
+	UA_Server_delete(server);
+}
+END_TEST
+
+static UA_Int32 batchCount = 0;
+static UA_UInt32 lastBatchSize = 0;
+static UA_StatusCode readInt32Batch(const void *handle, const UA_ReadValueId *readValueIds,
+                                    const UA_UInt32 *indices, UA_UInt32 indicesSize, UA_DataValue *values) {
+	batchCount++;
+	lastBatchSize = indicesSize;
+	for(UA_UInt32 i = 0; i < indicesSize; i++) {
+		UA_Int32 *v = UA_Int32_new();
+		*v = readValueIds[indices[i]].nodeId.identifier.numeric;
+		UA_Variant_setValue(&values[indices[i]].value, v, &UA_TYPES[UA_TYPES_INT32]);
+		values[indices[i]].hasVariant = UA_TRUE;
+	}
+	return UA_STATUSCODE_GOOD;
+}
+
+START_TEST(batchReadGroupsByDataSource) {
+	UA_Server *server = makeTestServer();
+	UA_DataSource ds = (UA_DataSource) {.handle = UA_NULL, .read = readInt32, .release = releaseInt32,
+	                                    .write = UA_NULL, .readBatch = readInt32Batch};
+	UA_QualifiedName name;
+	UA_QUALIFIEDNAME_ASSIGN(name, "batch");
+	for(UA_UInt32 i = 2000; i < 2003; i++)
+		UA_Server_addDataSourceVariableNode(server, ds, &UA_NODEID_STATIC(1, i), &name,
+		                                    &UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER),
+		                                    &UA_NODEID_STATIC(0, UA_NS0ID_ORGANIZES));
+	batchCount = 0;
+	readCount = 0;
+
+	UA_ReadRequest request;
+	initReadRequest(&request, 4);
+	request.nodesToRead[0].nodeId = UA_NODEID_STATIC(1, 2000);
+	request.nodesToRead[1].nodeId = UA_NODEID_STATIC(1, 1000);
+	request.nodesToRead[2].nodeId = UA_NODEID_STATIC(1, 2001);
+	request.nodesToRead[3].nodeId = UA_NODEID_STATIC(1, 2002);
+	UA_ReadResponse response;
+	UA_ReadResponse_init(&response);
+	Service_Read(server, &adminSession, &request, &response);
+
+	ck_assert_int_eq(batchCount, 1);
+	ck_assert_int_eq(lastBatchSize, 3);
+	ck_assert_int_eq(readCount, 1);
+	ck_assert_int_eq(*(UA_Int32*)response.results[0].value.dataPtr, 2000);
+	ck_assert_int_eq(*(UA_Int32*)response.results[1].value.dataPtr, 42);
+	ck_assert_int_eq(*(UA_Int32*)response.results[3].value.dataPtr, 2002);
+
+	UA_ReadRequest_deleteMembers(&request);
+	UA_ReadResponse_deleteMembers(&response);
+	UA_Server_delete(server);
+}
+END_TEST
+
+START_TEST(cachedValueIsReusedWithinMaxAge) {
+	UA_Server *server = makeTestServer();
+	UA_DataSource ds = (UA_DataSource) {.handle = UA_NULL, .read = readInt32, .release = releaseInt32,
+	                                    .write = UA_NULL, .maxAge = 60000};
+	UA_QualifiedName name;
+	UA_QUALIFIEDNAME_ASSIGN(name, "cached");
+	UA_Server_addDataSourceVariableNode(server, ds, &UA_NODEID_STATIC(1, 3000), &name,
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER),
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_ORGANIZES));
+	readCount = 0;
+
+	UA_ReadRequest request;
+	initReadRequest(&request, 1);
+	request.nodesToRead[0].nodeId = UA_NODEID_STATIC(1, 3000);
+	request.maxAge = 10000;
+	for(UA_Int32 i = 0; i < 3; i++) {
+		UA_ReadResponse response;
+		UA_ReadResponse_init(&response);
+		Service_Read(server, &adminSession, &request, &response);
+		ck_assert_int_eq(*(UA_Int32*)response.results[0].value.dataPtr, 42);
+		UA_ReadResponse_deleteMembers(&response);
+	}
+	ck_assert_int_eq(readCount, 1);
+
+	// maxAge 0 requires a fresh value
+	request.maxAge = 0;
+	UA_ReadResponse response;
+	UA_ReadResponse_init(&response);
+	Service_Read(server, &adminSession, &request, &response);
+	UA_ReadResponse_deleteMembers(&response);
+	ck_assert_int_eq(readCount, 2);
+
+	UA_ReadRequest_deleteMembers(&request);
+	UA_Server_delete(server);
+}
+END_TEST
+
+START_TEST(writeInvalidatesCachedValue) {
+	UA_Server *server = makeTestServer();
+	UA_DataSource ds = (UA_DataSource) {.handle = UA_NULL, .read = readInt32, .release = releaseInt32,
+	                                    .write = writeInt32, .maxAge = 60000};
+	UA_QualifiedName name;
+	UA_QUALIFIEDNAME_ASSIGN(name, "cached");
+	UA_Server_addDataSourceVariableNode(server, ds, &UA_NODEID_STATIC(1, 3000), &name,
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER),
+	                                    &UA_NODEID_STATIC(0, UA_NS0ID_ORGANIZES));
+	readCount = 0;
+
+	UA_ReadRequest request;
+	initReadRequest(&request, 1);
+	request.nodesToRead[0].nodeId = UA_NODEID_STATIC(1, 3000);
+	request.maxAge = 10000;
+	UA_ReadResponse response;
+	UA_ReadResponse_init(&response);
+	Service_Read(server, &adminSession, &request, &response);
+	UA_ReadResponse_deleteMembers(&response);
+	ck_assert_int_eq(readCount, 1);
+
+	UA_WriteRequest wRequest;
+	UA_WriteRequest_init(&wRequest);
+	wRequest.nodesToWrite = UA_Array_new(&UA_TYPES[UA_TYPES_WRITEVALUE], 1);
+	wRequest.nodesToWriteSize = 1;
+	wRequest.nodesToWrite[0].nodeId = UA_NODEID_STATIC(1, 3000);
+	wRequest.nodesToWrite[0].attributeId = UA_ATTRIBUTEID_VALUE;
+	wRequest.nodesToWrite[0].value.hasVariant = UA_TRUE;
+	UA_Int32 *i = UA_Int32_new();
+	*i = 7;
+	UA_Variant_setValue(&wRequest.nodesToWrite[0].value.value, i, &UA_TYPES[UA_TYPES_INT32]);
+	UA_WriteResponse wResponse;
+	UA_WriteResponse_init(&wResponse);
+	Service_Write(server, &adminSession, &wRequest, &wResponse);
+	ck_assert_int_eq(wResponse.results[0], UA_STATUSCODE_GOOD);
+	UA_WriteResponse_deleteMembers(&wResponse);
+	UA_WriteRequest_deleteMembers(&wRequest);
+
+	// the cached value is outdated
+	UA_ReadResponse_init(&response);
+	Service_Read(server, &adminSession, &request, &response);
+	UA_ReadResponse_deleteMembers(&response);
+	ck_assert_int_eq(readCount, 2);
+
+	UA_ReadRequest_deleteMembers(&request);
+	UA_Server_delete(server);
+}
+END_TEST
+
+static Suite * testSuite_services_attribute(void) {
+	Suite *s = suite_create("services_attribute");
+	TCase *tc_read = tcase_create("Read");
+	tcase_add_test(tc_read, asyncReadIsCoalescedAndFinishesOnCallback);
+	tcase_add_test(tc_read, asyncReadReportsDataSourceStatus);
+	tcase_add_test(tc_read, syncReadUsesReadCallback);
+	tcase_add_test(tc_read, batchReadGroupsByDataSource);
+	tcase_add_test(tc_read, cachedValueIsReusedWithinMaxAge);
+	tcase_add_test(tc_read, writeInvalidatesCachedValue);
+	suite_add_tcase(s, tc_read);
+	return s;
+}
+
+int main(void) {
+	int number_failed = 0;
+	Suite *s = testSuite_services_attribute();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed += srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
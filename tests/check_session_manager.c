@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_types.h"
+#include "server/ua_session_manager.h"
+#include "ua_util.h"
+#include "check.h"
+
+START_TEST(cleanupRemovesOnlyTimedOutSessions) {
+	UA_SessionManager sm;
+	UA_SessionManager_init(&sm, 10, 10000, 1, UA_NULL);
+	UA_Session *s1, *s2;
+	UA_SessionManager_createSession(&sm, UA_NULL, 0, &s1);
+	UA_SessionManager_createSession(&sm, UA_NULL, 0, &s2);
+
+	s1->timeout = 0;
+	UA_SessionManager_updateSessionLifetime(&sm, s1);
+
+	UA_UInt32 removed = UA_SessionManager_cleanupTimedOut(&sm, UA_DateTime_now() + 1, 10);
+	ck_assert_int_eq(removed, 1);
+	ck_assert_int_eq(sm.currentSessionCount, 1);
+
+	UA_Session *found;
+	UA_NodeId s2Id = s2->sessionId;
+	ck_assert_int_eq(UA_SessionManager_getSessionById(&sm, &s2Id, &found), UA_STATUSCODE_GOOD);
+	ck_assert_ptr_eq(found, s2);
+
+	UA_SessionManager_deleteMembers(&sm);
+}
+END_TEST
+
+START_TEST(cleanupRespectsBudget) {
+	UA_SessionManager sm;
+	UA_SessionManager_init(&sm, 10, 10000, 1, UA_NULL);
+	UA_Session *s;
+	for(int i = 0; i < 5; i++)
+		UA_SessionManager_createSession(&sm, UA_NULL, 0, &s);
+
+	UA_DateTime future = UA_DateTime_now() + (UA_DateTime)3600 * 1000 * 10000 * 2;
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, future, 2), 2);
+	ck_assert_int_eq(sm.currentSessionCount, 3);
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, future, 2), 2);
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, future, 2), 1);
+	ck_assert_int_eq(sm.currentSessionCount, 0);
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, future, 2), 0);
+
+	UA_SessionManager_deleteMembers(&sm);
+}
+END_TEST
+
+START_TEST(removeSessionFreesSlot) {
+	UA_SessionManager sm;
+	UA_SessionManager_init(&sm, 1, 10000, 1, UA_NULL);
+	UA_Session *s;
+	ck_assert_int_eq(UA_SessionManager_createSession(&sm, UA_NULL, 0, &s), UA_STATUSCODE_GOOD);
+	UA_NodeId sId = s->sessionId;
+	ck_assert_int_eq(UA_SessionManager_removeSession(&sm, &sId), UA_STATUSCODE_GOOD);
+	ck_assert_int_eq(UA_SessionManager_createSession(&sm, UA_NULL, 0, &s), UA_STATUSCODE_GOOD);
+	UA_SessionManager_deleteMembers(&sm);
+}
+END_TEST
+
+START_TEST(requestedTimeoutIsRevised) {
+	UA_SessionManager sm;
+	UA_SessionManager_init(&sm, 10, 10000, 1, UA_NULL);
+	UA_Session *s;
+	UA_SessionManager_createSession(&sm, UA_NULL, 5000, &s);
+	ck_assert_int_eq(s->timeout, 5000);
+	UA_SessionManager_createSession(&sm, UA_NULL, 20000, &s);
+	ck_assert_int_eq(s->timeout, 10000);
+	UA_SessionManager_createSession(&sm, UA_NULL, 0, &s);
+	ck_assert_int_eq(s->timeout, 10000);
+	UA_SessionManager_deleteMembers(&sm);
+}
+END_TEST
+
+START_TEST(cleanupCountsActiveSessionsAgainstBudget) {
+	UA_SessionManager sm;
+	UA_SessionManager_init(&sm, 10, 10000, 1, UA_NULL);
+	UA_Session *sessions[5];
+	for(int i = 0; i < 5; i++)
+		UA_SessionManager_createSession(&sm, UA_NULL, 0, &sessions[i]);
+
+	// the first three sessions were active since they were sorted in
+	UA_DateTime later = UA_DateTime_now() + (UA_DateTime)20000 * 10000;
+	for(int i = 0; i < 3; i++)
+		sessions[i]->validTill = later + 1;
+
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, later, 2), 0);
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, later, 2), 1);
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, later, 2), 1);
+	ck_assert_int_eq(UA_SessionManager_cleanupTimedOut(&sm, later, 2), 0);
+	ck_assert_int_eq(sm.currentSessionCount, 3);
+	UA_SessionManager_deleteMembers(&sm);
+}
+END_TEST
+
+static Suite * testSuite_SessionManager(void) {
+	Suite *s = suite_create("UA_SessionManager");
+	TCase *tc_expiry = tcase_create("Expiry");
+	tcase_add_test(tc_expiry, cleanupRemovesOnlyTimedOutSessions);
+	tcase_add_test(tc_expiry, cleanupRespectsBudget);
+	tcase_add_test(tc_expiry, removeSessionFreesSlot);
+	tcase_add_test(tc_expiry, requestedTimeoutIsRevised);
+	tcase_add_test(tc_expiry, cleanupCountsActiveSessionsAgainstBudget);
+	suite_add_tcase(s, tc_expiry);
+	return s;
+}
+
+int main(void) {
+	int number_failed = 0;
+	Suite *s = testSuite_SessionManager();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	number_failed += srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,369 @@
+/*
+ * Microbenchmarks for the binary encoding, the nodestore and the services.
+ * Every result is printed as a JSON object on its own line, so the output can
+ * be collected for comparisons between builds.
+ *
+ * microbenchmark [-quick] [-large] [filter]
+ *   -quick   small sizes and short runs (used as a smoke test)
+ *   -large   include the nodestore with 10M nodes (needs several GB)
+ *   filter   only run the benchmarks whose group starts with the filter
+ *
+ * The nodestore variant (single-threaded or concurrent) is selected at compile
+ * time with UA_MULTITHREADING and is reported in the first line.
+ */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ua_types.h"
+#include "ua_types_encoding_binary.h"
+#include "ua_nodeids.h"
+#include "ua_statuscodes.h"
+#include "server/ua_nodestore.h"
+#include "server/ua_services.h"
+#include "server/ua_server_internal.h"
+
+#ifdef UA_MULTITHREADING
+#include <urcu.h>
+#define NODESTORE_VARIANT "concurrent"
+#else
+#define NODESTORE_VARIANT "single-threaded"
+#endif
+
+#define STRIDE 7919 // prime, so that the nodes are visited in a scattered order
+
+static UA_Double minTime = 0.5; // seconds per benchmark
+
+static UA_Double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *group, const char *name, UA_Int32 size, UA_UInt64 ops, UA_Double seconds) {
+    printf("{\"group\":\"%s\",\"name\":\"%s\",\"size\":%d,\"ops\":%llu,\"seconds\":%.6f,"
+           "\"ns_per_op\":%.1f,\"ops_per_s\":%.0f}\n", group, name, size, (unsigned long long)ops,
+           seconds, 1e9 * seconds / ops, ops / seconds);
+    fflush(stdout);
+}
+
+/* Repeats the operation until minTime has passed and reports the average */
+typedef void (*BenchmarkOp)(void *ctx);
+
+static void runTimed(const char *group, const char *name, UA_Int32 size, BenchmarkOp op, void *ctx) {
+    op(ctx); // warm the caches and the allocator
+    UA_UInt64 ops = 0;
+    UA_UInt64 rounds = 1;
+    UA_Double start = now();
+    UA_Double elapsed;
+    do {
+        for(UA_UInt64 i = 0; i < rounds; i++)
+            op(ctx);
+        ops += rounds;
+        rounds *= 2;
+        elapsed = now() - start;
+    } while(elapsed < minTime);
+    report(group, name, size, ops, elapsed);
+}
+
+/************/
+/* Encoding */
+/************/
+
+typedef struct {
+    const void *msg;
+    const UA_DataType *type;
+    UA_ByteString buf;
+    size_t length;
+} CodecContext;
+
+static void opCalcSize(void *c) {
+    CodecContext *ctx = c;
+    ctx->length = UA_calcSizeBinary(ctx->msg, ctx->type);
+}
+
+static void opEncode(void *c) {
+    CodecContext *ctx = c;
+    size_t offset = 0;
+    UA_encodeBinary(ctx->msg, ctx->type, &ctx->buf, &offset);
+}
+
+static void opDecode(void *c) {
+    CodecContext *ctx = c;
+    void *dst = UA_alloca(ctx->type->memSize);
+    size_t offset = 0;
+    UA_decodeBinary(&ctx->buf, &offset, dst, ctx->type);
+    UA_deleteMembers(dst, ctx->type);
+}
+
+static void benchmarkCodec(const char *name, UA_Int32 size, const void *msg, const UA_DataType *type) {
+    CodecContext ctx = {.msg = msg, .type = type};
+    ctx.length = UA_calcSizeBinary(msg, type);
+    UA_ByteString_newMembers(&ctx.buf, ctx.length);
+    char fullName[128];
+    snprintf(fullName, sizeof(fullName), "%s.calcSize", name);
+    runTimed("encoding", fullName, size, opCalcSize, &ctx);
+    snprintf(fullName, sizeof(fullName), "%s.encode", name);
+    runTimed("encoding", fullName, size, opEncode, &ctx);
+    snprintf(fullName, sizeof(fullName), "%s.decode", name);
+    runTimed("encoding", fullName, size, opDecode, &ctx);
+    UA_ByteString_deleteMembers(&ctx.buf);
+}
+
+static void benchmarkEncoding(UA_Int32 size) {
+    /* Read request with numeric nodeids */
+    UA_ReadRequest readRequest;
+    UA_ReadRequest_init(&readRequest);
+    readRequest.nodesToRead = UA_Array_new(&UA_TYPES[UA_TYPES_READVALUEID], size);
+    readRequest.nodesToReadSize = size;
+    for(UA_Int32 i = 0; i < size; i++) {
+        readRequest.nodesToRead[i].nodeId = UA_NODEID_STATIC(1, 1000 + i);
+        readRequest.nodesToRead[i].attributeId = UA_ATTRIBUTEID_VALUE;
+    }
+    benchmarkCodec("ReadRequest", size, &readRequest, &UA_TYPES[UA_TYPES_READREQUEST]);
+    UA_ReadRequest_deleteMembers(&readRequest);
+
+    /* Read response with scalar doubles and source timestamps */
+    UA_ReadResponse readResponse;
+    UA_ReadResponse_init(&readResponse);
+    readResponse.results = UA_Array_new(&UA_TYPES[UA_TYPES_DATAVALUE], size);
+    readResponse.resultsSize = size;
+    for(UA_Int32 i = 0; i < size; i++) {
+        UA_Double *d = UA_Double_new();
+        *d = i * 0.5;
+        UA_Variant_setValue(&readResponse.results[i].value, d, &UA_TYPES[UA_TYPES_DOUBLE]);
+        readResponse.results[i].hasVariant = UA_TRUE;
+        readResponse.results[i].sourceTimestamp = UA_DateTime_now();
+        readResponse.results[i].hasSourceTimestamp = UA_TRUE;
+    }
+    benchmarkCodec("ReadResponse", size, &readResponse, &UA_TYPES[UA_TYPES_READRESPONSE]);
+    UA_ReadResponse_deleteMembers(&readResponse);
+
+    /* Browse response with string nodeids and names */
+    UA_BrowseResponse browseResponse;
+    UA_BrowseResponse_init(&browseResponse);
+    browseResponse.results = UA_Array_new(&UA_TYPES[UA_TYPES_BROWSERESULT], 1);
+    browseResponse.resultsSize = 1;
+    UA_BrowseResult *br = &browseResponse.results[0];
+    br->references = UA_Array_new(&UA_TYPES[UA_TYPES_REFERENCEDESCRIPTION], size);
+    br->referencesSize = size;
+    for(UA_Int32 i = 0; i < size; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Variable %d", i);
+        UA_ReferenceDescription *rd = &br->references[i];
+        rd->referenceTypeId = UA_NODEID_STATIC(0, UA_NS0ID_HASCOMPONENT);
+        rd->isForward = UA_TRUE;
+        rd->nodeId.nodeId.namespaceIndex = 1;
+        rd->nodeId.nodeId.identifierType = UA_NODEIDTYPE_STRING;
+        UA_String_copycstring(name, &rd->nodeId.nodeId.identifier.string);
+        UA_String_copycstring(name, &rd->browseName.name);
+        UA_String_copycstring(name, &rd->displayName.text);
+        rd->nodeClass = UA_NODECLASS_VARIABLE;
+        rd->typeDefinition.nodeId = UA_NODEID_STATIC(0, UA_NS0ID_BASEDATAVARIABLETYPE);
+    }
+    benchmarkCodec("BrowseResponse", size, &browseResponse, &UA_TYPES[UA_TYPES_BROWSERESPONSE]);
+    UA_BrowseResponse_deleteMembers(&browseResponse);
+
+    /* Variant with an array of doubles */
+    UA_Variant variant;
+    UA_Variant_init(&variant);
+    UA_Double *array = UA_Array_new(&UA_TYPES[UA_TYPES_DOUBLE], size * 10);
+    for(UA_Int32 i = 0; i < size * 10; i++)
+        array[i] = i;
+    UA_Variant_setArray(&variant, array, size * 10, &UA_TYPES[UA_TYPES_DOUBLE]);
+    benchmarkCodec("VariantDoubleArray", size * 10, &variant, &UA_TYPES[UA_TYPES_VARIANT]);
+    UA_Variant_deleteMembers(&variant);
+}
+
+/*************/
+/* Nodestore */
+/*************/
+
+static UA_Node * createNode(UA_UInt32 id) {
+    UA_VariableNode *p = UA_VariableNode_new();
+    p->nodeId = UA_NODEID_STATIC(1, id);
+    p->nodeClass = UA_NODECLASS_VARIABLE;
+    return (UA_Node*)p;
+}
+
+static void benchmarkNodestore(UA_Int32 size) {
+    UA_NodeStore *ns = UA_NodeStore_new();
+
+    UA_Double start = now();
+    for(UA_Int32 i = 0; i < size; i++)
+        UA_NodeStore_insert(ns, createNode(i + 1), UA_NULL);
+    report("nodestore", "insert." NODESTORE_VARIANT, size, size, now() - start);
+
+    /* The lookups and replacements are scattered over the nodestore */
+    UA_NodeId id = UA_NODEID_STATIC(1, 0);
+    UA_UInt64 ops = 0;
+    UA_Double elapsed;
+    start = now();
+    do {
+        for(UA_Int32 i = 0; i < size; i++) {
+            id.identifier.numeric = (UA_UInt32)(((UA_UInt64)i * STRIDE) % size) + 1;
+            UA_NodeStore_release(UA_NodeStore_get(ns, &id));
+        }
+        ops += size;
+        elapsed = now() - start;
+    } while(elapsed < minTime);
+    report("nodestore", "get." NODESTORE_VARIANT, size, ops, elapsed);
+
+    // includes the allocation of the new node
+    start = now();
+    for(UA_Int32 i = 0; i < size; i++) {
+        UA_UInt32 n = (UA_UInt32)(((UA_UInt64)i * STRIDE) % size) + 1;
+        id.identifier.numeric = n;
+        const UA_Node *old = UA_NodeStore_get(ns, &id);
+        UA_Node *node = createNode(n);
+        if(UA_NodeStore_replace(ns, old, node, UA_NULL) != UA_STATUSCODE_GOOD)
+            UA_VariableNode_delete((UA_VariableNode*)node);
+        UA_NodeStore_release(old);
+    }
+    report("nodestore", "replace." NODESTORE_VARIANT, size, size, now() - start);
+
+    start = now();
+    UA_NodeStore_delete(ns);
+    report("nodestore", "delete." NODESTORE_VARIANT, size, size, now() - start);
+}
+
+/************/
+/* Services */
+/************/
+
+static UA_UInt32 serviceNodes = 10000;
+
+typedef struct {
+    UA_Server *server;
+    const void *request;
+} ServiceContext;
+
+static void opRead(void *c) {
+    ServiceContext *ctx = c;
+    UA_ReadResponse response;
+    UA_ReadResponse_init(&response);
+    Service_Read(ctx->server, &adminSession, ctx->request, &response);
+    UA_ReadResponse_deleteMembers(&response);
+}
+
+static void opBrowse(void *c) {
+    ServiceContext *ctx = c;
+    UA_BrowseResponse response;
+    UA_BrowseResponse_init(&response);
+    Service_Browse(ctx->server, &adminSession, ctx->request, &response);
+    UA_BrowseResponse_deleteMembers(&response);
+}
+
+static UA_Server * makeServiceServer(void) {
+    UA_Server *server = UA_Server_new();
+    UA_QualifiedName name;
+    UA_QUALIFIEDNAME_ASSIGN(name, "variable");
+    for(UA_UInt32 i = 0; i < serviceNodes; i++) {
+        UA_Variant *value = UA_Variant_new();
+        UA_Int32 *data = UA_Int32_new();
+        *data = (UA_Int32)i;
+        UA_Variant_setValue(value, data, &UA_TYPES[UA_TYPES_INT32]);
+        UA_NodeId id = UA_NODEID_STATIC(1, 100000 + i);
+        // the variables form a chain. so the parents do not accumulate
+        // references that are copied with every insert. (the variable type
+        // still does for the inverse HasTypeDefinition references.)
+        UA_NodeId parent = i == 0 ? UA_NODEID_STATIC(0, UA_NS0ID_OBJECTSFOLDER) : UA_NODEID_STATIC(1, 100000 + i - 1);
+        UA_Server_addVariableNode(server, value, &id, &name, &parent,
+                                  &UA_NODEID_STATIC(0, UA_NS0ID_HASCOMPONENT));
+    }
+    return server;
+}
+
+static void benchmarkServices(UA_Server *server, UA_Int32 size) {
+    ServiceContext ctx = {.server = server};
+    char name[64];
+
+    UA_ReadRequest readRequest;
+    UA_ReadRequest_init(&readRequest);
+    readRequest.nodesToRead = UA_Array_new(&UA_TYPES[UA_TYPES_READVALUEID], size);
+    readRequest.nodesToReadSize = size;
+    for(UA_Int32 i = 0; i < size; i++) {
+        readRequest.nodesToRead[i].nodeId = UA_NODEID_STATIC(1, 100000 + ((i * STRIDE) % serviceNodes));
+        readRequest.nodesToRead[i].attributeId = UA_ATTRIBUTEID_VALUE;
+    }
+    ctx.request = &readRequest;
+    snprintf(name, sizeof(name), "Read.value");
+    runTimed("services", name, size, opRead, &ctx);
+    for(UA_Int32 i = 0; i < size; i++)
+        readRequest.nodesToRead[i].attributeId = UA_ATTRIBUTEID_BROWSENAME;
+    snprintf(name, sizeof(name), "Read.browseName");
+    runTimed("services", name, size, opRead, &ctx);
+    UA_ReadRequest_deleteMembers(&readRequest);
+
+    UA_BrowseRequest browseRequest;
+    UA_BrowseRequest_init(&browseRequest);
+    browseRequest.nodesToBrowse = UA_Array_new(&UA_TYPES[UA_TYPES_BROWSEDESCRIPTION], size);
+    browseRequest.nodesToBrowseSize = size;
+    for(UA_Int32 i = 0; i < size; i++) {
+        UA_BrowseDescription *bd = &browseRequest.nodesToBrowse[i];
+        bd->nodeId = UA_NODEID_STATIC(1, 100000 + ((i * STRIDE) % serviceNodes));
+        bd->browseDirection = UA_BROWSEDIRECTION_BOTH;
+        bd->resultMask = UA_BROWSERESULTMASK_ALL;
+    }
+    ctx.request = &browseRequest;
+    runTimed("services", "Browse.variable", size, opBrowse, &ctx);
+    UA_BrowseRequest_deleteMembers(&browseRequest);
+}
+
+int main(int argc, char **argv) {
+    UA_Boolean quick = UA_FALSE, large = UA_FALSE;
+    const char *filter = "";
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-quick") == 0)
+            quick = UA_TRUE;
+        else if(strcmp(argv[i], "-large") == 0)
+            large = UA_TRUE;
+        else
+            filter = argv[i];
+    }
+    if(quick) {
+        minTime = 0.01;
+        serviceNodes = 1000;
+    }
+
+#ifdef UA_MULTITHREADING
+    rcu_register_thread();
+#endif
+
+    printf("{\"nodestore\":\"%s\",\"quick\":%s}\n", NODESTORE_VARIANT, quick ? "true" : "false");
+
+    if(strncmp("encoding", filter, strlen(filter)) == 0) {
+        benchmarkEncoding(1);
+        benchmarkEncoding(100);
+        if(!quick)
+            benchmarkEncoding(1000);
+    }
+
+    if(strncmp("nodestore", filter, strlen(filter)) == 0) {
+        benchmarkNodestore(10000);
+        if(!quick) {
+            benchmarkNodestore(100000);
+            benchmarkNodestore(1000000);
+        }
+        if(large)
+            benchmarkNodestore(10000000);
+    }
+
+    if(strncmp("services", filter, strlen(filter)) == 0) {
+        UA_Server *server = makeServiceServer();
+        benchmarkServices(server, 10);
+        if(!quick)
+            benchmarkServices(server, 1000);
+        UA_Server_delete(server);
+    }
+
+#ifdef UA_MULTITHREADING
+    rcu_unregister_thread();
+#endif
+    return EXIT_SUCCESS;
+}